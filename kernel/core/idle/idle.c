@@ -0,0 +1,23 @@
+#include "idle.h"
+#include "machine/pmap/pmap_pfa.h"
+#include "machine/routines/routines.h"
+
+bool
+idle_step(void) {
+    return pmap_pfa_idle();
+}
+
+void
+idle_loop(void) {
+    while (true) {
+        /* 
+        Each unit of work is small, so we go back around (and would notice any
+        pending events) after every one
+        */
+        if (idle_step()) {
+            continue;
+        }
+
+        routines_wait_for_event();
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef IDLE_H
+#define IDLE_H
+#include "lib/debug.h"
+#include "lib/types.h"
+
+/**
+ * Performs one small unit of background maintenance (such as zeroing a few free
+ * pages). Returns true if there may be more to do, or false if every subsystem
+ * is idle.
+ */
+bool
+idle_step(void);
+
+/**
+ * The idle loop for a core. While any subsystem has background maintenance to
+ * do, the core performs it in small chunks with idle_step. Otherwise, the core
+ * waits for events in a low-power state.
+ */
+void
+idle_loop(void) NO_RETURN;
+
+#endif /* IDLE_H */
@@ -0,0 +1,33 @@
+#ifndef CORE_START_BOOTSTRAP_H
+#define CORE_START_BOOTSTRAP_H
+
+/*
+The layout of the bootstrap region which start.S carves out of the memory
+directly after the kernel image (__kernel_map_end). This header is shared
+between assembly and C and so must only contain macros.
+
+[0x00000, 0x01000) : Boot CPU exception stack (SP_EL1)
+[0x01000, 0x02000) : Boot CPU kernel stack (SP_EL0)
+[0x02000, 0x03000) : P=V L1 (TTBR0) -- see vm_bootstrap.S
+[0x03000, 0x06000) : KVA L1, L2, L3 (TTBR1) -- see vm_bootstrap.S
+
+The boot stacks and the KVA tables are reclaimed by pmap_init.c once the kernel
+is running on pmap_kernel and the boot stacks have been migrated. The P=V table
+stays live, and TTBR0 keeps pointing at it, because the device register macros
+in machine/io/gpio.h are physical addresses which are dereferenced directly.
+Every access to the mini UART console (and the GPIO pins it is muxed onto), the
+VideoCore mailbox and the PM (reset and shutdown) goes through its first 1GB
+device block. pmap_kernel's physmap maps the same registers, so the table can
+be freed (after clearing TTBR0 and invalidating the TLB) once those drivers use
+the physmap instead.
+*/
+
+#define BOOTSTRAP_STACK_SIZE                (0x1000)
+#define BOOTSTRAP_EXCEPTION_STACK_OFFSET    (0x00000)
+#define BOOTSTRAP_KERNEL_STACK_OFFSET       (0x01000)
+#define BOOTSTRAP_PV_TABLE_OFFSET           (0x02000)
+#define BOOTSTRAP_KVA_TABLES_OFFSET         (0x03000)
+#define BOOTSTRAP_KVA_TABLES_SIZE           (0x03000)
+#define BOOTSTRAP_REGION_SIZE               (0x06000)
+
+#endif /* CORE_START_BOOTSTRAP_H */
@@ -8,16 +8,20 @@
 #include "machine/pmap/pmap_init.h"
 #include "machine/pmap/pmap_pfa.h"
 #include "machine/platform_registers.h"
+#include "core/vm/slab.h"
+#include "core/vm/kmalloc.h"
+#include "core/idle/idle.h"
 #ifdef CONFIG_TESTING
 #include "testing/runner.h"
 #endif
 
-extern void pmap_pfa_dump_state(void);
 extern void pmap_pfa_get_state(size_t *level_buffer, size_t count);
 
 extern uint8_t __bss_start;
 extern uint8_t __bss_end;
 
+static void main_bootstrapped(void) NO_RETURN;
+
 /**
  * @brief The first C function invoked on boot. Executed once by the primary CPU
  * Virtual memory is active with both a P=V map and a KVA map. VM, however, is 
@@ -32,8 +36,8 @@ extern uint8_t __bss_end;
  * 
  * @param bootstrap_pa_reserved The maximum physical address which is reserved
  * until the kernel has migrated off of bootstrap. [0, reserved) contains the
- * bootstrap page tables and the bootstrap stacks. Once the kernel ends its
- * bootstrap phase, this memory may be reclaimed.
+ * bootstrap page tables and the bootstrap stacks (see bootstrap.h). Once the
+ * kernel ends its bootstrap phase, this memory is reclaimed.
  */
 void 
 main(phys_addr_t kernel_base, phys_addr_t bootstrap_pa_reserved) {
@@ -76,7 +80,19 @@ main(phys_addr_t kernel_base, phys_addr_t bootstrap_pa_reserved) {
         arm_ram_base, arm_ram_size, 
         bootstrap_pa_reserved
     );
+    slab_init();
+    kmalloc_init();
+
+    /* Get off the bootstrap stacks so that the bootstrap region can be freed */
+    pmap_vm_leave_bootstrap_stacks(main_bootstrapped);
+}
 
+/**
+ * Continues boot once the kernel is running on pmap_kernel and its stacks have
+ * been moved out of the bootstrap region
+ */
+static void
+main_bootstrapped(void) {
 #ifdef CONFIG_TESTING
     /*
     If this is a test kernel, run the tests. This will trigger a shutdown after
@@ -88,10 +104,20 @@ main(phys_addr_t kernel_base, phys_addr_t bootstrap_pa_reserved) {
     If this is not a test kernel, continue with regular boot
     */
 
+ #ifdef CONFIG_IDLE_AFTER_BOOT
+    /*
+    There is nothing to run yet, so the boot core becomes an idle core and
+    spends its time on background maintenance (the secondary cores are still
+    parked in start.S)
+    */
+    printf("[*] Boot complete\n");
+    idle_loop();
+ #else
     printf("[*] Shutting down...\n");
     pmc_shutdown();
     routines_adp_application_exit(0);
     routines_core_idle();
+ #endif /* CONFIG_IDLE_AFTER_BOOT */
     /* NO RETURN */
  #endif /* CONFIG_TESTING */
 }
@@ -0,0 +1,204 @@
+#include "kmalloc.h"
+#include "slab.h"
+#include "machine/pmap/pmap_pfa.h"
+#include "lib/assert.h"
+#include "lib/ctype.h"
+#include "lib/string.h"
+#include "lib/stdio.h"
+
+/*
+~* KMALLOC *~
+kmalloc serves variable sized requests from a fixed set of slab caches, one per
+size class. The classes are the powers of two from 16 to KMALLOC_SLAB_MAX plus
+the midpoint between each pair from 48 on (48, 96, 192, ...), so that no request
+of more than 32 bytes wastes more than a third of its object. A request is
+mapped to its class through a table indexed by its size in KMALLOC_ALIGN units,
+so the lookup is constant time.
+
+Larger requests go straight to the PFA as whole pages. The number of pages is
+kept in the owner tag of the first page (see pmap_pfa_mds_owner_set), marked
+with KMALLOC_LARGE_TAG so that a stray pointer to some other kernel page is
+caught rather than freed.
+
+kfree needs no size. A pointer into a PMAP_PAGE_TYPE_SLAB page belongs to the
+slab cache the MDS names (see slab_cache_for_object), and any other pointer must
+be the start of a large allocation.
+*/
+
+/** Marks the owner tag of the first page of a large allocation */
+#define KMALLOC_LARGE_TAG       (0x80000000U)
+/** The number of entries in kmalloc_state.class_for_size */
+#define KMALLOC_SIZE_SLOTS      (KMALLOC_SLAB_MAX / KMALLOC_ALIGN + 1)
+
+/** The size of each class, in increasing order */
+static const size_t kmalloc_class_sizes[] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072,
+    4096,
+};
+
+_Static_assert(
+    sizeof(kmalloc_class_sizes) / sizeof(kmalloc_class_sizes[0]) < UINT8_MAX,
+    "Class indices must fit in class_for_size"
+);
+
+static struct {
+    /** The cache of each class in kmalloc_class_sizes */
+    struct slab_cache *caches[COUNT_OF(kmalloc_class_sizes)];
+
+    /**
+     * The class of each size, indexed by the size rounded up to KMALLOC_ALIGN
+     * and divided by KMALLOC_ALIGN
+     */
+    uint8_t class_for_size[KMALLOC_SIZE_SLOTS];
+
+    /** The cache names, which slab_cache_create copies */
+    char names[COUNT_OF(kmalloc_class_sizes)][SLAB_NAME_MAX];
+} kmalloc_state;
+
+void
+kmalloc_init(void) {
+    unsigned int class_i = 0;
+
+    REQUIRE(kmalloc_class_sizes[COUNT_OF(kmalloc_class_sizes) - 1]
+            == KMALLOC_SLAB_MAX);
+    REQUIRE(KMALLOC_SLAB_MAX <= SLAB_OBJECT_MAX);
+
+    for (unsigned int i = 0; i < COUNT_OF(kmalloc_class_sizes); i++) {
+        size_t size = kmalloc_class_sizes[i];
+
+        snprintf(
+            kmalloc_state.names[i], sizeof(kmalloc_state.names[i]),
+            "kmalloc-%zu", size
+        );
+
+        /*
+        Powers of two pack by cache line. Midpoints can't be aligned to their
+        size, so they only get the alignment every allocation is promised.
+        */
+        kmalloc_state.caches[i] = slab_cache_create(
+            kmalloc_state.names[i], size,
+            size & (size - 1) ? KMALLOC_ALIGN : 0
+        );
+        if (!kmalloc_state.caches[i]) {
+            panic("Failed to create cache %s", kmalloc_state.names[i]);
+        }
+    }
+
+    for (unsigned int slot = 0; slot < KMALLOC_SIZE_SLOTS; slot++) {
+        while (kmalloc_class_sizes[class_i] < slot * KMALLOC_ALIGN) {
+            class_i++;
+        }
+        kmalloc_state.class_for_size[slot] = class_i;
+    }
+}
+
+/**
+ * Allocates SIZE bytes, which is more than KMALLOC_SLAB_MAX, from the PFA with
+ * FLAGS
+ */
+static void *
+kmalloc_large(size_t size, pmap_pfa_alloc_flags_t flags) {
+    pmap_page_metadata_s m;
+    size_t pages = ROUND_UP(size, PAGE_SIZE) / PAGE_SIZE;
+    phys_addr_t pa = PHYS_ADDR_INVALID;
+
+    if (pages >= KMALLOC_LARGE_TAG) {
+        return NULL;
+    }
+
+    memset(&m, 0x00, sizeof(m));
+    m.page_type = PMAP_PAGE_TYPE_KERNEL_DATA;
+    pa = pmap_pfa_alloc_contig_flags(pages * PAGE_SIZE, &m, flags);
+    if (pa == PHYS_ADDR_INVALID) {
+        return NULL;
+    }
+
+    pmap_pfa_mds_owner_set(pa >> PAGE_SHIFT, KMALLOC_LARGE_TAG | pages);
+    return (void *)pmap_pa_to_kva(pa);
+}
+
+/**
+ * Get the number of pages in the large allocation at PTR, panicking if PTR is
+ * not the start of one
+ */
+static size_t
+kmalloc_large_pages(const void *ptr) {
+    phys_addr_t pa = pmap_physmap_kva_to_pa((vm_addr_t)ptr);
+    uint32_t owner = pmap_pfa_mds_owner_get(pa >> PAGE_SHIFT);
+
+    if (pa % PAGE_SIZE || !(owner & KMALLOC_LARGE_TAG)) {
+        panic("%p was not allocated by kmalloc", ptr);
+    }
+
+    return owner & ~KMALLOC_LARGE_TAG;
+}
+
+/** Get the cache of the size class for SIZE, which must not exceed the max */
+static inline struct slab_cache *
+kmalloc_cache_for_size(size_t size) {
+    size_t slot = (size + KMALLOC_ALIGN - 1) / KMALLOC_ALIGN;
+
+    return kmalloc_state.caches[kmalloc_state.class_for_size[slot]];
+}
+
+void *
+kmalloc(size_t size) {
+    if (!size) {
+        return NULL;
+    }
+
+    if (size > KMALLOC_SLAB_MAX) {
+        return kmalloc_large(size, PMAP_PFA_ALLOC_NONE);
+    }
+
+    return slab_alloc(kmalloc_cache_for_size(size));
+}
+
+void *
+kzalloc(size_t size) {
+    void *ptr = NULL;
+
+    if (!size) {
+        return NULL;
+    }
+
+    if (size > KMALLOC_SLAB_MAX) {
+        /* The PFA zeroes whole pages itself */
+        return kmalloc_large(size, PMAP_PFA_ALLOC_ZERO);
+    }
+
+    if ((ptr = slab_alloc(kmalloc_cache_for_size(size)))) {
+        memset(ptr, 0x00, size);
+    }
+
+    return ptr;
+}
+
+void
+kfree(void *ptr) {
+    struct slab_cache *cache = NULL;
+    phys_addr_t pa = 0;
+
+    if (!ptr) {
+        return;
+    }
+
+    if ((cache = slab_cache_for_object(ptr))) {
+        slab_free(cache, ptr);
+        return;
+    }
+
+    pa = pmap_physmap_kva_to_pa((vm_addr_t)ptr);
+    pmap_pfa_free_contig(pa, kmalloc_large_pages(ptr) * PAGE_SIZE);
+}
+
+size_t
+ksize(const void *ptr) {
+    struct slab_cache *cache = NULL;
+
+    if ((cache = slab_cache_for_object(ptr))) {
+        return slab_cache_object_size(cache);
+    }
+
+    return kmalloc_large_pages(ptr) * PAGE_SIZE;
+}
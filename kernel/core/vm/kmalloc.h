@@ -0,0 +1,56 @@
+#ifndef KMALLOC_H
+#define KMALLOC_H
+#include "lib/types.h"
+#include "vm.h"
+
+/*
+~* KMALLOC *~
+General purpose allocations of any size. Small requests are rounded up to a size
+class and served from that class's slab cache, and large requests take whole
+pages from the PFA. See kmalloc.c.
+*/
+
+/** Every allocation is aligned to at least this many bytes */
+#define KMALLOC_ALIGN           (16)
+/** The largest request served from a slab cache */
+#define KMALLOC_SLAB_MAX        (4096)
+
+/**
+ * Initializes the size class caches. This must be called once, after
+ * slab_init and before the first kmalloc.
+ */
+void
+kmalloc_init(void);
+
+/**
+ * Allocates SIZE bytes aligned to KMALLOC_ALIGN. Returns NULL if SIZE is zero
+ * or the system is out of memory.
+ *
+ * Requests of up to KMALLOC_SLAB_MAX bytes are rounded up to the next size
+ * class (the powers of two from 16 and the midpoints between them from 48) and
+ * served from that class's slab cache, so they usually take no lock. Larger
+ * requests are rounded up to whole pages and allocated from the PFA, and are
+ * then page aligned.
+ */
+void *
+kmalloc(size_t size);
+
+/** Identical to kmalloc but the allocation is zero filled */
+void *
+kzalloc(size_t size);
+
+/**
+ * Frees PTR, which must have been returned by kmalloc or kzalloc. The size of
+ * the allocation is found from the MDS. Does nothing if PTR is NULL.
+ */
+void
+kfree(void *ptr);
+
+/**
+ * Get the number of usable bytes at PTR, which must have been returned by
+ * kmalloc or kzalloc. This is at least the size requested.
+ */
+size_t
+ksize(const void *ptr);
+
+#endif /* KMALLOC_H */
@@ -0,0 +1,690 @@
+#include "slab.h"
+#include "machine/pmap/pmap_pfa.h"
+#include "machine/synchronization/synchs.h"
+#include "machine/smp/smp.h"
+#include "machine/routines/routines.h"
+#include "lib/assert.h"
+#include "lib/ctype.h"
+#include "lib/string.h"
+#include "lib/list.h"
+#include "lib/stdio.h"
+
+/*
+~* SLAB *~
+Most kernel structures (list nodes, threads, pmap objects) are far smaller than
+a page, so allocating each one from the PFA would waste most of a page and take
+an arena lock. The slab allocator [1] instead groups objects of one type into a
+cache, which takes naturally aligned blocks of 2^order pages (slabs) from the
+PFA and carves them into equally sized objects.
+
+Each slab begins with a header (struct slab) followed by its objects. Objects
+are aligned to the cache's alignment relative to the physical address of the
+slab, and by default the alignment is chosen so that no object straddles two
+cache lines. Free objects are linked through their first word. A new slab's
+objects are only linked as they are first handed out (see `carved`), so creating
+a slab touches nothing but its header.
+
+A cache keeps its slabs on three lists: partial (some objects free), full (no
+objects free) and empty (no objects allocated). Objects are taken from partial
+slabs before empty ones, so that memory is concentrated in as few slabs as
+possible and empty slabs can be returned to the PFA. Up to SLAB_EMPTY_MAX empty
+slabs are kept to absorb a workload which repeatedly frees and reallocates the
+last object of a slab, and the rest are freed immediately. Kept empty slabs are
+given back by a PFA shrinker when memory runs short.
+
+Every slab page is typed PMAP_PAGE_TYPE_SLAB in the MDS and its owner tag holds
+the page number of the slab's first page. This lets slab_cache_for_object find
+the header (and so the cache) of any object without knowing its size.
+
+The cache lists are protected by a per-cache lock. As in the PFA, each core
+keeps a magazine (a small stack) of free objects for each cache, and allocations
+and frees are serviced from it without any lock. A magazine which runs dry is
+refilled with SLAB_MAGAZINE_SIZE / 2 objects under a single lock hold, and a
+magazine which fills up drains the same number of its coldest objects. A core
+therefore takes a cache lock at most once per SLAB_MAGAZINE_SIZE / 2 operations.
+
+The cache lock is never held while allocating from the PFA. An allocation which
+is short of memory calls the shrinkers, and the slab shrinker takes cache locks.
+
+The caches themselves are objects of the cache of caches, which is the only
+cache that is not dynamically allocated.
+
+[1] Bonwick, "The Slab Allocator: An Object-Caching Kernel Memory Allocator"
+*/
+
+/** A slab tries to hold at least this many objects, see slab_pick_order */
+#define SLAB_MIN_OBJECTS        (8)
+/** The number of objects moved per magazine refill or drain */
+#define SLAB_MAGAZINE_BATCH     (SLAB_MAGAZINE_SIZE / 2)
+
+_Static_assert(
+    SLAB_MAX_ORDER >= 1, "A SLAB_OBJECT_MAX object must fit after the header"
+);
+
+#define CACHE_LOCK(cache)       (synchs_lock_acquire(&(cache)->lock))
+#define CACHE_UNLOCK(cache)     (synchs_lock_release(&(cache)->lock))
+#define CACHES_LOCK()           (synchs_lock_acquire(&slab_state.lock))
+#define CACHES_UNLOCK()         (synchs_lock_release(&slab_state.lock))
+
+/**
+ * A per-CPU stack of free objects for a single cache. Only the owning core may
+ * touch its magazine (except while the cache is destroyed).
+ */
+struct slab_magazine {
+    /** The number of objects in `objects` */
+    size_t count;
+
+    /** The cached objects. The top of the stack is hot. */
+    void *objects[SLAB_MAGAZINE_SIZE];
+
+    /** Statistics for this core, see struct slab_cache_stats */
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t refills;
+    uint64_t drains;
+} __attribute__((aligned(SMP_CACHE_LINE_SIZE)));
+
+struct slab_cache {
+    struct slab_magazine magazines[SMP_MAX_CPUS];
+
+    /** Protects the slab lists and the fields below */
+    struct synchs_lock lock;
+
+    /** The slabs with both free and allocated objects */
+    struct list partial;
+    /** The slabs with no free objects */
+    struct list full;
+    /** The slabs with no allocated objects */
+    struct list empty;
+
+    /** The number of slabs on each list */
+    size_t partial_count;
+    size_t full_count;
+    size_t empty_count;
+
+    /** The number of objects taken from slabs, including those in magazines */
+    size_t slab_objects;
+
+    uint64_t slabs_created;
+    uint64_t slabs_destroyed;
+
+    /** The bytes taken by each object. A multiple of `align`. */
+    size_t object_size;
+
+    /** The alignment of each object */
+    size_t align;
+
+    /** The offset of the first object from the start of its slab */
+    size_t first_offset;
+
+    /** The number of objects each slab holds */
+    size_t objects_per_slab;
+
+    /** The block order of each slab */
+    unsigned int order;
+
+    /** The entry on slab_state.caches */
+    struct list_elem elem;
+
+    char name[SLAB_NAME_MAX];
+} __attribute__((aligned(SMP_CACHE_LINE_SIZE)));
+
+/** The header at the start of every slab */
+struct slab {
+    /** The entry on one of the cache's slab lists */
+    struct list_elem elem;
+
+    /** The cache this slab belongs to */
+    struct slab_cache *cache;
+
+    /** The free objects which have been handed out before */
+    void *free;
+
+    /**
+     * The number of objects which have ever been handed out. Objects from this
+     * index on have never been used and are not on `free`.
+     */
+    size_t carved;
+
+    /** The number of allocated objects */
+    size_t in_use;
+};
+
+static struct {
+    /** Protects `caches` */
+    struct synchs_lock lock;
+
+    /** Every cache, including cache_cache */
+    struct list caches;
+
+    /** The cache which slab_cache_create allocates caches from */
+    struct slab_cache cache_cache;
+} slab_state;
+
+static size_t
+slab_shrinker_shrink(size_t pages, void *context);
+
+static const struct pmap_pfa_shrinker slab_shrinker = {
+    .shrink = slab_shrinker_shrink,
+    .context = NULL,
+};
+
+/** Get the size in bytes of each of CACHE's slabs */
+static inline size_t
+slab_size(struct slab_cache *cache) {
+    return PAGE_SIZE << cache->order;
+}
+
+/** Get the slab which OBJECT, an object of CACHE, lies in */
+static inline struct slab *
+slab_for_object(struct slab_cache *cache, const void *object) {
+    phys_addr_t pa = pmap_physmap_kva_to_pa((vm_addr_t)object);
+
+    /*
+    Slabs are naturally aligned in physical memory, but the physmap need not be
+    aligned to the size of a slab
+    */
+    return (struct slab *)pmap_pa_to_kva(ROUND_DOWN(pa, slab_size(cache)));
+}
+
+/**
+ * Get the smallest slab order which holds at least SLAB_MIN_OBJECTS objects of
+ * OBJECT_SIZE bytes after a header of HEADER_SIZE bytes and wastes no more than
+ * an eighth of the slab, or SLAB_MAX_ORDER if no order does
+ */
+static unsigned int
+slab_pick_order(size_t header_size, size_t object_size) {
+    for (unsigned int order = 0; order < SLAB_MAX_ORDER; order++) {
+        size_t size = PAGE_SIZE << order;
+        size_t count = 0;
+        size_t waste = 0;
+
+        if (size <= header_size) {
+            continue;
+        }
+
+        count = (size - header_size) / object_size;
+        waste = size - header_size - count * object_size;
+        if (count >= SLAB_MIN_OBJECTS && waste <= size / 8) {
+            return order;
+        }
+    }
+
+    return SLAB_MAX_ORDER;
+}
+
+/** Initializes CACHE, which must be zeroed. See slab_cache_create. */
+static void
+slab_cache_init(struct slab_cache *cache, const char *name, size_t size,
+                size_t align) {
+    REQUIRE(size && size <= SLAB_OBJECT_MAX);
+    REQUIRE(!(align & (align - 1)) && align <= PAGE_SIZE);
+
+    if (!align) {
+        /* Pack objects without letting any of them straddle a cache line */
+        align = SMP_CACHE_LINE_SIZE;
+        while (align / 2 >= size && align / 2 >= sizeof(void *)) {
+            align /= 2;
+        }
+    }
+    /* Free objects hold a pointer in their first word */
+    align = MAX(align, sizeof(void *));
+
+    strlcpy(cache->name, name, sizeof(cache->name));
+    synchs_lock_init(&cache->lock);
+    list_init(&cache->partial);
+    list_init(&cache->full);
+    list_init(&cache->empty);
+
+    cache->align = align;
+    cache->object_size = ROUND_UP(MAX(size, sizeof(void *)), align);
+    cache->first_offset = ROUND_UP(sizeof(struct slab), align);
+    cache->order = slab_pick_order(cache->first_offset, cache->object_size);
+    cache->objects_per_slab =
+        (slab_size(cache) - cache->first_offset) / cache->object_size;
+    REQUIRE(cache->objects_per_slab);
+
+    CACHES_LOCK();
+    list_push_back(&slab_state.caches, &cache->elem);
+    CACHES_UNLOCK();
+}
+
+/**
+ * Takes a new slab for CACHE from the PFA. Returns NULL if the system is out of
+ * memory. The slab is not on any list.
+ */
+static struct slab *
+slab_create(struct slab_cache *cache) {
+    pmap_page_metadata_s m;
+    phys_addr_t pa = PHYS_ADDR_INVALID;
+    page_id_t page = 0;
+    struct slab *slab = NULL;
+
+    memset(&m, 0x00, sizeof(m));
+    m.page_type = PMAP_PAGE_TYPE_SLAB;
+    pa = pmap_pfa_alloc_order(cache->order, &m);
+    if (pa == PHYS_ADDR_INVALID) {
+        return NULL;
+    }
+
+    /* Point every page at the header so any object can find its slab */
+    page = pa >> PAGE_SHIFT;
+    for (page_id_t i = 0; i < (1U << cache->order); i++) {
+        pmap_pfa_mds_owner_set(page + i, page);
+    }
+
+    slab = (struct slab *)pmap_pa_to_kva(pa);
+    slab->cache = cache;
+    slab->free = NULL;
+    slab->carved = 0;
+    slab->in_use = 0;
+
+    return slab;
+}
+
+/** Returns SLAB, which must be on no list, to the PFA */
+static void
+slab_destroy(struct slab_cache *cache, struct slab *slab) {
+    ASSERT(!slab->in_use);
+    pmap_pfa_free_contig(
+        pmap_physmap_kva_to_pa((vm_addr_t)slab), slab_size(cache)
+    );
+}
+
+/** Takes a free object from SLAB, which must not be full */
+static inline void *
+slab_take_object(struct slab_cache *cache, struct slab *slab) {
+    void *object = slab->free;
+
+    ASSERT(slab->in_use < cache->objects_per_slab);
+
+    if (object) {
+        slab->free = *(void **)object;
+    } else {
+        object = (uint8_t *)slab + cache->first_offset
+            + slab->carved * cache->object_size;
+        slab->carved++;
+    }
+    slab->in_use++;
+
+    return object;
+}
+
+/**
+ * Takes up to COUNT objects from CACHE's partial and then empty slabs and
+ * writes them to OBJECTS. Returns the number of objects taken.
+ */
+static size_t
+cache_take_locked(struct slab_cache *cache, void **objects, size_t count) {
+    size_t taken = 0;
+
+    while (taken < count) {
+        struct slab *slab = NULL;
+
+        if (!list_empty(&cache->partial)) {
+            slab = list_entry(list_front(&cache->partial), struct slab, elem);
+        } else if (!list_empty(&cache->empty)) {
+            slab = list_entry(
+                list_pop_front(&cache->empty), struct slab, elem
+            );
+            cache->empty_count--;
+            list_push_front(&cache->partial, &slab->elem);
+            cache->partial_count++;
+        } else {
+            break;
+        }
+
+        while (taken < count && slab->in_use < cache->objects_per_slab) {
+            objects[taken++] = slab_take_object(cache, slab);
+        }
+
+        if (slab->in_use == cache->objects_per_slab) {
+            list_remove(&slab->elem);
+            cache->partial_count--;
+            list_push_front(&cache->full, &slab->elem);
+            cache->full_count++;
+        }
+    }
+    cache->slab_objects += taken;
+
+    return taken;
+}
+
+/**
+ * Returns the COUNT objects in OBJECTS to their slabs. Empty slabs beyond
+ * SLAB_EMPTY_MAX are moved to RELEASE for the caller to destroy once the lock
+ * is dropped.
+ */
+static void
+cache_put_locked(struct slab_cache *cache, void **objects, size_t count,
+                 struct list *release) {
+    for (size_t i = 0; i < count; i++) {
+        struct slab *slab = slab_for_object(cache, objects[i]);
+
+        ASSERT(slab->cache == cache);
+        ASSERT(slab->in_use);
+
+        *(void **)objects[i] = slab->free;
+        slab->free = objects[i];
+
+        if (slab->in_use-- == cache->objects_per_slab) {
+            list_remove(&slab->elem);
+            cache->full_count--;
+            list_push_front(&cache->partial, &slab->elem);
+            cache->partial_count++;
+        }
+
+        if (!slab->in_use) {
+            list_remove(&slab->elem);
+            cache->partial_count--;
+            if (cache->empty_count < SLAB_EMPTY_MAX) {
+                list_push_front(&cache->empty, &slab->elem);
+                cache->empty_count++;
+            } else {
+                list_push_back(release, &slab->elem);
+                cache->slabs_destroyed++;
+            }
+        }
+    }
+    cache->slab_objects -= count;
+}
+
+/** Destroys every slab on RELEASE */
+static void
+release_slabs(struct slab_cache *cache, struct list *release) {
+    while (!list_empty(release)) {
+        slab_destroy(
+            cache, list_entry(list_pop_front(release), struct slab, elem)
+        );
+    }
+}
+
+/**
+ * Refills MAGAZINE, which must be empty, with up to SLAB_MAGAZINE_BATCH objects
+ * from CACHE. Returns false only if the system is out of memory.
+ */
+static bool
+magazine_refill(struct slab_cache *cache, struct slab_magazine *magazine) {
+    struct slab *slab = NULL;
+
+    ASSERT(!magazine->count);
+
+    CACHE_LOCK(cache);
+    magazine->count =
+        cache_take_locked(cache, magazine->objects, SLAB_MAGAZINE_BATCH);
+    CACHE_UNLOCK(cache);
+
+    if (!magazine->count) {
+        /* The PFA may call the shrinker, so we can't hold the lock here */
+        if (!(slab = slab_create(cache))) {
+            return false;
+        }
+
+        /*
+        Fill up from the new slab before publishing it. Once it is on a list,
+        other cores could empty it before we retake the lock.
+        */
+        while (magazine->count < SLAB_MAGAZINE_BATCH
+                && slab->in_use < cache->objects_per_slab) {
+            magazine->objects[magazine->count++] =
+                slab_take_object(cache, slab);
+        }
+
+        CACHE_LOCK(cache);
+        if (slab->in_use == cache->objects_per_slab) {
+            list_push_front(&cache->full, &slab->elem);
+            cache->full_count++;
+        } else {
+            list_push_front(&cache->partial, &slab->elem);
+            cache->partial_count++;
+        }
+        cache->slabs_created++;
+        cache->slab_objects += magazine->count;
+        CACHE_UNLOCK(cache);
+    }
+
+    magazine->refills++;
+    return magazine->count;
+}
+
+/** Returns the COUNT coldest objects in MAGAZINE to CACHE's slabs */
+static void
+magazine_drain(struct slab_cache *cache, struct slab_magazine *magazine,
+               size_t count) {
+    struct list release;
+
+    ASSERT(count <= magazine->count);
+
+    list_init(&release);
+    CACHE_LOCK(cache);
+    cache_put_locked(cache, magazine->objects, count, &release);
+    CACHE_UNLOCK(cache);
+    release_slabs(cache, &release);
+
+    /* The coldest objects are at the bottom of the stack */
+    memmove(
+        magazine->objects, magazine->objects + count,
+        (magazine->count - count) * sizeof(magazine->objects[0])
+    );
+    magazine->count -= count;
+    magazine->drains++;
+}
+
+void
+slab_init(void) {
+    synchs_lock_init(&slab_state.lock);
+    list_init(&slab_state.caches);
+
+    memset(&slab_state.cache_cache, 0x00, sizeof(slab_state.cache_cache));
+    slab_cache_init(
+        &slab_state.cache_cache, "slab_cache", sizeof(struct slab_cache), 0
+    );
+
+    pmap_pfa_register_shrinker(&slab_shrinker);
+}
+
+struct slab_cache *
+slab_cache_create(const char *name, size_t size, size_t align) {
+    struct slab_cache *cache = slab_alloc(&slab_state.cache_cache);
+
+    if (!cache) {
+        return NULL;
+    }
+
+    memset(cache, 0x00, sizeof(*cache));
+    slab_cache_init(cache, name, size, align);
+
+    return cache;
+}
+
+void
+slab_cache_destroy(struct slab_cache *cache) {
+    struct list release;
+
+    REQUIRE(cache && cache != &slab_state.cache_cache);
+
+    CACHES_LOCK();
+    list_remove(&cache->elem);
+    CACHES_UNLOCK();
+
+    /* The caller guarantees no other core is using the cache */
+    for (unsigned int cpu_i = 0; cpu_i < SMP_MAX_CPUS; cpu_i++) {
+        struct slab_magazine *magazine = &cache->magazines[cpu_i];
+
+        if (magazine->count) {
+            magazine_drain(cache, magazine, magazine->count);
+        }
+    }
+
+    if (cache->partial_count || cache->full_count) {
+        panic(
+            "Slab cache %s destroyed with %zu objects allocated",
+            cache->name, cache->slab_objects
+        );
+    }
+
+    list_init(&release);
+    while (!list_empty(&cache->empty)) {
+        list_push_back(&release, list_pop_front(&cache->empty));
+    }
+    release_slabs(cache, &release);
+
+    slab_free(&slab_state.cache_cache, cache);
+}
+
+void *
+slab_alloc(struct slab_cache *cache) {
+    struct slab_magazine *magazine = &cache->magazines[smp_get_cpu_id()];
+
+    ASSERT(!routines_irqs_masked());
+    if (!magazine->count && !magazine_refill(cache, magazine)) {
+        return NULL;
+    }
+
+    magazine->allocs++;
+    return magazine->objects[--magazine->count];
+}
+
+void
+slab_free(struct slab_cache *cache, void *object) {
+    struct slab_magazine *magazine = &cache->magazines[smp_get_cpu_id()];
+
+    ASSERT(!routines_irqs_masked());
+    ASSERT(object);
+    ASSERT(slab_for_object(cache, object)->cache == cache);
+
+    if (magazine->count == SLAB_MAGAZINE_SIZE) {
+        magazine_drain(cache, magazine, SLAB_MAGAZINE_BATCH);
+    }
+
+    magazine->frees++;
+    magazine->objects[magazine->count++] = object;
+}
+
+struct slab_cache *
+slab_cache_for_object(const void *object) {
+    page_id_t page = pmap_physmap_kva_to_pa((vm_addr_t)object) >> PAGE_SHIFT;
+    pmap_page_metadata_s m;
+    struct slab *slab = NULL;
+
+    pmap_pfa_mds_get_metadata(page, &m);
+    if (m.page_type != PMAP_PAGE_TYPE_SLAB) {
+        return NULL;
+    }
+
+    slab = (struct slab *)pmap_pa_to_kva(
+        (phys_addr_t)pmap_pfa_mds_owner_get(page) << PAGE_SHIFT
+    );
+    return slab->cache;
+}
+
+size_t
+slab_cache_object_size(struct slab_cache *cache) {
+    return cache->object_size;
+}
+
+void
+slab_drain_caches(void) {
+    CACHES_LOCK();
+    for (struct list_elem *e = list_begin(&slab_state.caches);
+            e != list_end(&slab_state.caches);
+            e = list_next(e)) {
+        struct slab_cache *cache = list_entry(e, struct slab_cache, elem);
+        struct slab_magazine *magazine = &cache->magazines[smp_get_cpu_id()];
+
+        if (magazine->count) {
+            magazine_drain(cache, magazine, magazine->count);
+        }
+    }
+    CACHES_UNLOCK();
+}
+
+size_t
+slab_shrink(size_t pages) {
+    size_t freed = 0;
+
+    CACHES_LOCK();
+    for (struct list_elem *e = list_begin(&slab_state.caches);
+            e != list_end(&slab_state.caches) && freed < pages;
+            e = list_next(e)) {
+        struct slab_cache *cache = list_entry(e, struct slab_cache, elem);
+        struct list release;
+
+        list_init(&release);
+        CACHE_LOCK(cache);
+        while (!list_empty(&cache->empty) && freed < pages) {
+            list_push_back(&release, list_pop_front(&cache->empty));
+            cache->empty_count--;
+            cache->slabs_destroyed++;
+            freed += 1U << cache->order;
+        }
+        CACHE_UNLOCK(cache);
+
+        /* Freeing to the PFA never calls back into the shrinkers */
+        release_slabs(cache, &release);
+    }
+    CACHES_UNLOCK();
+
+    return freed;
+}
+
+static size_t
+slab_shrinker_shrink(size_t pages, void *context) {
+    return slab_shrink(pages);
+}
+
+void
+slab_cache_get_stats(struct slab_cache *cache, struct slab_cache_stats *stats) {
+    memset(stats, 0x00, sizeof(*stats));
+    stats->object_size = cache->object_size;
+    stats->objects_per_slab = cache->objects_per_slab;
+    stats->order = cache->order;
+
+    for (unsigned int cpu_i = 0; cpu_i < SMP_MAX_CPUS; cpu_i++) {
+        struct slab_magazine *magazine = &cache->magazines[cpu_i];
+
+        stats->magazine_objects +=
+            __atomic_load_n(&magazine->count, __ATOMIC_RELAXED);
+        stats->allocs += __atomic_load_n(&magazine->allocs, __ATOMIC_RELAXED);
+        stats->frees += __atomic_load_n(&magazine->frees, __ATOMIC_RELAXED);
+        stats->refills +=
+            __atomic_load_n(&magazine->refills, __ATOMIC_RELAXED);
+        stats->drains += __atomic_load_n(&magazine->drains, __ATOMIC_RELAXED);
+    }
+
+    CACHE_LOCK(cache);
+    stats->partial_slabs = cache->partial_count;
+    stats->full_slabs = cache->full_count;
+    stats->empty_slabs = cache->empty_count;
+    stats->slab_objects = cache->slab_objects;
+    stats->slabs_created = cache->slabs_created;
+    stats->slabs_destroyed = cache->slabs_destroyed;
+    CACHE_UNLOCK(cache);
+}
+
+void
+slab_dump(void) {
+    CACHES_LOCK();
+    for (struct list_elem *e = list_begin(&slab_state.caches);
+            e != list_end(&slab_state.caches);
+            e = list_next(e)) {
+        struct slab_cache *cache = list_entry(e, struct slab_cache, elem);
+        struct slab_cache_stats stats;
+
+        slab_cache_get_stats(cache, &stats);
+        printf(
+            "Slab cache %s -- object size = %zu, objects/slab = %zu, "
+            "order = %u\n"
+            "\tslabs = %zu/%zu/%zu (partial/full/empty), objects = %zu, "
+            "in magazines = %zu\n"
+            "\tallocs = %llu, frees = %llu, refills = %llu, drains = %llu, "
+            "slabs created = %llu, destroyed = %llu\n",
+            cache->name, stats.object_size, stats.objects_per_slab,
+            stats.order, stats.partial_slabs, stats.full_slabs,
+            stats.empty_slabs, stats.slab_objects, stats.magazine_objects,
+            stats.allocs, stats.frees, stats.refills, stats.drains,
+            stats.slabs_created, stats.slabs_destroyed
+        );
+    }
+    CACHES_UNLOCK();
+}
@@ -0,0 +1,161 @@
+#ifndef SLAB_H
+#define SLAB_H
+#include "lib/types.h"
+#include "vm.h"
+#include "machine/pmap/pmap_pfa.h"
+#include "lib/ctype.h"
+
+/*
+~* SLAB *~
+The slab allocator hands out small fixed size objects from named caches. Each
+cache carves naturally aligned blocks of pages from the PFA (slabs, typed
+PMAP_PAGE_TYPE_SLAB in the MDS) into equally sized objects. See slab.c.
+*/
+
+/** The longest cache name, including the terminator. Longer names are cut. */
+#define SLAB_NAME_MAX           (32)
+/** The largest slab, as a block order. The PFA may not have blocks this big. */
+#define SLAB_MAX_ORDER          (MIN(3, PMAP_PFA_MAX_ORDER))
+/**
+ * The largest object a cache may be created for. A slab of two pages holds one
+ * after its header, so this doesn't shrink with SLAB_MAX_ORDER.
+ */
+#define SLAB_OBJECT_MAX         (PAGE_SIZE)
+/** The number of objects each core's magazine for a cache holds */
+#define SLAB_MAGAZINE_SIZE      (32)
+/** The most empty slabs a cache keeps before it returns them to the PFA */
+#define SLAB_EMPTY_MAX          (1)
+
+struct slab_cache;
+
+struct slab_cache_stats {
+    /** The bytes taken by each object, after rounding to its alignment */
+    size_t object_size;
+
+    /** The number of objects each slab holds */
+    size_t objects_per_slab;
+
+    /** The block order of each slab */
+    unsigned int order;
+
+    /** The number of slabs with both free and allocated objects */
+    size_t partial_slabs;
+
+    /** The number of slabs with no free objects */
+    size_t full_slabs;
+
+    /** The number of slabs with no allocated objects */
+    size_t empty_slabs;
+
+    /**
+     * The number of objects taken from slabs. This includes objects cached in
+     * the per-CPU magazines.
+     */
+    size_t slab_objects;
+
+    /** The number of objects cached in the per-CPU magazines */
+    size_t magazine_objects;
+
+    /** The number of objects allocated from and freed to the cache */
+    uint64_t allocs;
+    uint64_t frees;
+
+    /** The number of times a magazine was refilled from or drained to slabs */
+    uint64_t refills;
+    uint64_t drains;
+
+    /** The number of slabs taken from and returned to the PFA */
+    uint64_t slabs_created;
+    uint64_t slabs_destroyed;
+};
+
+/**
+ * Initializes the slab allocator. This must be called once, after the PFA is
+ * initialized and before any cache is created.
+ */
+void
+slab_init(void);
+
+/**
+ * Creates a cache of objects of SIZE bytes aligned to ALIGN, which must be zero
+ * or a power of two. An ALIGN of zero packs objects by cache line: objects of
+ * more than half a cache line begin on a cache line and smaller objects are
+ * aligned to their size rounded up to a power of two, so no object ever
+ * straddles two cache lines. SIZE must not exceed SLAB_OBJECT_MAX. NAME is only
+ * used for diagnostics and is copied.
+ *
+ * Returns NULL if the system is out of memory.
+ */
+struct slab_cache *
+slab_cache_create(const char *name, size_t size, size_t align);
+
+/**
+ * Destroys CACHE and returns its slabs to the PFA. Every object must have been
+ * freed and no other core may be using the cache, since the objects cached in
+ * every core's magazine are drained. Panics if any object is still allocated.
+ */
+void
+slab_cache_destroy(struct slab_cache *cache);
+
+/**
+ * Allocates an object from CACHE. Returns NULL if the system is out of memory.
+ *
+ * Allocations are serviced from the calling core's magazine without any lock.
+ * When it runs dry, the magazine is refilled in one batch under the cache lock,
+ * first from partially used slabs and then from a new slab. The magazine is
+ * not interrupt safe, so this must not be called from an interrupt handler or
+ * with IRQs masked, which debug builds assert.
+ */
+void *
+slab_alloc(struct slab_cache *cache);
+
+/**
+ * Frees OBJECT back to CACHE, which it must have been allocated from. Frees are
+ * cached in the calling core's magazine without any lock, and once it is full
+ * half of it is drained back to the slabs in one batch under the cache lock.
+ * As with slab_alloc, this must not be called from interrupt context.
+ */
+void
+slab_free(struct slab_cache *cache, void *object);
+
+/**
+ * Get the cache that OBJECT was allocated from, or NULL if OBJECT does not lie
+ * in a slab. This is answered from the MDS and so takes no lock.
+ */
+struct slab_cache *
+slab_cache_for_object(const void *object);
+
+/**
+ * Get the bytes taken by each object of CACHE, which is at least the size it
+ * was created with
+ */
+size_t
+slab_cache_object_size(struct slab_cache *cache);
+
+/**
+ * Returns the objects cached in the calling core's magazines to their caches'
+ * slabs
+ */
+void
+slab_drain_caches(void);
+
+/**
+ * Returns empty slabs of every cache to the PFA until at least PAGES pages have
+ * been freed or no empty slabs remain. Returns the number of pages freed. This
+ * is registered as a PFA shrinker by slab_init.
+ */
+size_t
+slab_shrink(size_t pages);
+
+/**
+ * Get the statistics for CACHE. The magazine counters are read without
+ * stopping other cores and so may be slightly inconsistent.
+ */
+void
+slab_cache_get_stats(struct slab_cache *cache, struct slab_cache_stats *stats);
+
+/** Prints the statistics of every cache to the console */
+void
+slab_dump(void);
+
+#endif /* SLAB_H */
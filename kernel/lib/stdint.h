@@ -37,6 +37,9 @@ typedef long long int64_t;
 typedef unsigned int uint32_t;
 typedef int int32_t;
 
+typedef unsigned short uint16_t;
+typedef short int16_t;
+
 typedef unsigned char uint8_t;
 typedef char int8_t;
 
@@ -44,6 +47,8 @@ STATIC_ASSERT(sizeof(uint64_t) == 8);
 STATIC_ASSERT(sizeof(int64_t) == 8);
 STATIC_ASSERT(sizeof(uint32_t) == 4);
 STATIC_ASSERT(sizeof(int32_t) == 4);
+STATIC_ASSERT(sizeof(uint16_t) == 2);
+STATIC_ASSERT(sizeof(int16_t) == 2);
 STATIC_ASSERT(sizeof(uint8_t) == 1);
 STATIC_ASSERT(sizeof(int8_t) == 1);
 
@@ -11,6 +11,8 @@
 #include "lib/stdio.h"
 #include "lib/ctype.h"
 #include "lib/string.h"
+#include "core/start/bootstrap.h"
+#include "machine/routines/routines.h"
 
 /*
 pmap_init.c // January 15, 2022
@@ -168,6 +170,27 @@ extern char __kernel_rw_data_end;
 /** Switch the kernel from the bootstrap tables onto the pmap_kernel pmap */
 extern void vm_bootstrap_switch_to_pmap_kernel(phys_addr_t page_table_base);
 
+/** The physical base of the bootstrap region, see bootstrap.h */
+static phys_addr_t bootstrap_base = PHYS_ADDR_INVALID;
+/** One bit per page of the bootstrap region which has not been reclaimed */
+static uint8_t bootstrap_live_pages = 0;
+STATIC_ASSERT(BOOTSTRAP_REGION_SIZE >> PAGE_SHIFT <= 8);
+/** Where pmap_vm_leave_bootstrap_stacks continues, once on the new stacks */
+static void (*bootstrap_continuation)(void) = NULL;
+
+/**
+ * Returns the bootstrap region's pages in [OFFSET, OFFSET + SIZE) to the PFA.
+ * The pages must still be live.
+ */
+static void
+bootstrap_reclaim(vm_addr_t offset, size_t size) {
+    uint8_t mask = ((1U << (size >> PAGE_SHIFT)) - 1) << (offset >> PAGE_SHIFT);
+
+    ASSERT((bootstrap_live_pages & mask) == mask);
+    bootstrap_live_pages &= ~mask;
+    pmap_pfa_free_contig(bootstrap_base + offset, size);
+}
+
 #define KERNEL_SECTION_PA_BASE_OFFSET(s)   \
     ((phys_addr_t)(&(s ## _start) - &__kernel_map_start))
 #define KERNEL_SECTION_PA_BASE(s)   \
@@ -268,4 +291,61 @@ void pmap_vm_init(phys_addr_t kernel_base,
             + KERNEL_SECTION_SIZE(__kernel_rw_data),
         allocation_ptr
    );
+
+    /*
+    Nothing references the KVA bootstrap tables now that TTBR1 points at
+    pmap_kernel, so they can go back to the PFA. The boot stacks follow once
+    we're off them, and the P=V table stays live (see bootstrap.h).
+
+    Page tables were carved upwards from bootstrap_pa_reserved and the PFA's
+    own structures directly after them, so there's no unused tail to return.
+    */
+    bootstrap_base = bootstrap_pa_reserved - BOOTSTRAP_REGION_SIZE;
+    bootstrap_live_pages = (1U << (BOOTSTRAP_REGION_SIZE >> PAGE_SHIFT)) - 1;
+    bootstrap_reclaim(BOOTSTRAP_KVA_TABLES_OFFSET, BOOTSTRAP_KVA_TABLES_SIZE);
+}
+
+/** Runs on the new stacks, see pmap_vm_leave_bootstrap_stacks */
+static void NO_RETURN
+bootstrap_stacks_left(void) {
+    bootstrap_reclaim(BOOTSTRAP_EXCEPTION_STACK_OFFSET, BOOTSTRAP_STACK_SIZE);
+    bootstrap_reclaim(BOOTSTRAP_KERNEL_STACK_OFFSET, BOOTSTRAP_STACK_SIZE);
+
+    /* Every page of the region which isn't the P=V table must be back */
+    ASSERT(bootstrap_live_pages 
+           == 1U << (BOOTSTRAP_PV_TABLE_OFFSET >> PAGE_SHIFT));
+    printf(
+        "[*] pmap_init: Reclaimed bootstrap region (live pages = 0x%02x)\n",
+        bootstrap_live_pages
+    );
+
+    bootstrap_continuation();
+    panic("Bootstrap continuation must not return");
+}
+
+void
+pmap_vm_leave_bootstrap_stacks(void (*continuation)(void)) {
+    pmap_page_metadata_s m;
+    phys_addr_t kernel_stack = PHYS_ADDR_INVALID;
+    phys_addr_t exception_stack = PHYS_ADDR_INVALID;
+
+    ASSERT(bootstrap_base != PHYS_ADDR_INVALID);
+
+    /* Stacks are hot, so keep them out of each other's L2 sets */
+    STATIC_ASSERT(BOOTSTRAP_STACK_SIZE == PAGE_SIZE);
+    memset(&m, 0x00, sizeof(m));
+    m.page_type = PMAP_PAGE_TYPE_KERNEL_DATA;
+    kernel_stack = pmap_pfa_alloc_colored(PMAP_PFA_COLOR_NEXT, &m);
+    exception_stack = pmap_pfa_alloc_colored(PMAP_PFA_COLOR_NEXT, &m);
+    if (kernel_stack == PHYS_ADDR_INVALID 
+        || exception_stack == PHYS_ADDR_INVALID) {
+        panic("Failed to allocate the boot CPU stacks");
+    }
+
+    bootstrap_continuation = continuation;
+    routines_switch_stacks(
+        pmap_pa_to_kva(kernel_stack) + BOOTSTRAP_STACK_SIZE,
+        pmap_pa_to_kva(exception_stack) + BOOTSTRAP_STACK_SIZE,
+        bootstrap_stacks_left
+    );
 }
@@ -2,6 +2,7 @@
 #define PMAP_INIT_H
 #include "pmap.h"
 #include "lib/types.h"
+#include "lib/debug.h"
 #include "core/vm/vm.h"
 
 void pmap_vm_init(
@@ -10,4 +11,12 @@ void pmap_vm_init(
     phys_addr_t ram_size,
     phys_addr_t bootstrap_pa_reserved);
 
+/**
+ * Moves the boot CPU off of the stacks in the bootstrap region and onto stacks
+ * allocated from the PFA, reclaims the old stacks, and then calls CONTINUATION.
+ * Must be called after pmap_vm_init. Everything on the current stack is lost,
+ * so this never returns.
+ */
+void pmap_vm_leave_bootstrap_stacks(void (*continuation)(void)) NO_RETURN;
+
 #endif /* PMAP_INIT_H */
\ No newline at end of file
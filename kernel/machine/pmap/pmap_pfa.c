@@ -1,5 +1,8 @@
 #include "pmap_pfa.h"
 #include "machine/synchronization/synchs.h"
+#include "machine/smp/smp.h"
+#include "machine/io/gpio.h"
+#include "machine/routines/routines.h"
 #include "lib/ctype.h"
 #include "lib/string.h"
 #include "lib/list.h"
@@ -19,12 +22,121 @@ give you one.
 
 The PFA is implemented as a buddy allocator [1] with `BUDDY_LEVELS` levels. The
 PFA has two data structures which work together to make allocations possible.
-The buddy_lists field of the PFA holds a series of linked lists of all free
+The buddy_lists field of each zone holds a series of linked lists of all free
 pages on a given level. The buddy_bitmaps field of the PFA holds a series of
 bitmaps which indicate the free state of any given managed physical page. These
 two structures allow for constant time allocation of any chunk size less than or
 equal to PAGE_SIZE<<(BUDDY_LEVELS - 1).
 
+The number of levels is a build option (PFA_MAX_ORDER). The default top level is
+order 9 (2MB) so that the PFA can hand out naturally aligned blocks which back
+L2 block mappings, and it may be raised to order 18 (1GB) for L1 block mappings.
+Every level costs one bitmap and one list head, and the bitmaps shrink by half
+per level, so high orders are nearly free in memory. Managed RAM must begin on a
+top level boundary.
+
+Allocations larger than the top level are serviced by scanning the top level
+buddy bitmap for a run of adjacent free blocks. Since each bit in the top level
+bitmap covers an entire top level block, this scan touches a single uint64_t
+for every 64 top level blocks rather than walking the free lists.
+
+Since each buddy allocator is protected by a lock, the PFA keeps a small
+per-CPU cache (a "magazine") of free 4K and 8K blocks for each core. Single and
+double page allocations and frees are serviced from the calling core's magazine
+without taking any arena lock. Magazines refill from and drain to the buddy
+lists in bulk (one lock hold per refill/drain) as they cross their low and high
+watermarks. Each core's magazines also have a lock of their own, which is only
+ever contended when another core drains every magazine because it is out of
+memory, so that memory cached by one core is never out of reach of another.
+
+Freeing a block normally merges it with its buddy as far up as possible, and a
+workload which frees and reallocates the same order then splits it straight back
+down. To avoid that churn the buddy lists coalesce lazily. While a zone holds
+fewer free blocks of a level than that level's slack, a block freed at that
+level goes onto its list as is, even if its buddy is free. Both buddies are then
+marked free on their own level, so the bitmaps still describe exactly the blocks
+on the lists. Once the slack is used up frees merge as usual, and when a request
+finds nothing large enough (before it steals from another class or compacts), a
+pass over the zone's bitmaps merges every free pair from the bottom up.
+
+Most consumers zero their pages immediately after allocating them. To keep that
+4K write off the critical path, the PFA also keeps a pool of free pages which
+were zeroed ahead of time by idle cores (see pmap_pfa_idle). Single page
+PMAP_PFA_ALLOC_ZERO requests are serviced from this pool when it is not empty.
+
+The L2 is physically indexed, so pages whose addresses agree modulo the size of
+an L2 way (a "color") compete for the same sets no matter how they are mapped.
+Hot kernel structures can ask for a page of a particular color, or for each of
+the colors in turn, with pmap_pfa_alloc_colored. These requests are serviced
+from free pages partitioned by color. A color which runs dry is refilled by
+splitting the smallest block holding a page of every color across all of the
+color lists.
+
+Memory is split into zones by what can address it. The DMA zone is a small
+range at the bottom of RAM which the VideoCore and its DMA engines can address,
+and the normal zone is everything above it. Between the two sits the CMA zone,
+which is set aside for large contiguous device buffers (see below). Each zone
+has its own buddy lists
+while the bitmaps remain shared (since they are indexed by page). Zone
+boundaries are aligned to the top level so no buddy block ever spans two zones,
+and so freeing a page only needs its address to find the zone's lists. Requests
+try their preferred zone first and then fall back through `zone_fallbacks`.
+Normal requests only dip into the DMA zone once normal memory is exhausted,
+which keeps the DMA zone available for device buffers.
+
+Even with the magazines, a single lock over all of memory serializes every
+refill, drain and multi-page request on every core. Memory is therefore also
+split into arenas: power of two sized, top level aligned slices of RAM, each of
+which is a complete buddy allocator with its own lock, bitmaps, share of each
+zone and color cache. Each core has a home arena, which it tries first, and only
+moves on to the other arenas in turn (never holding two arena locks) once its
+home can't satisfy a request. Every arena's share of a zone is tried before
+falling back to the next zone, so the zone rules above hold across arenas. Since
+arenas are a power of two pages, a free finds the arena which owns its pages
+with a single shift of the address. The little state shared by all arenas (the
+zero pool and the pressure state) has its own lock or is atomic, and the rare
+settings the buddy allocators read are written with every arena lock held.
+
+Within a zone, free blocks are further split by mobility class (unmovable,
+reclaimable, movable) so that long lived, pinned allocations don't end up
+scattered across memory where each would keep an entire top level block from
+ever coalescing. Every top level block (a "pageblock") is assigned a class in
+`pageblock_mobility`, and its free blocks live on that class's lists. When a
+class runs dry, it steals the largest free block available from another class
+(see `mobility_fallbacks`). If that block is at least half a pageblock, the
+stealer claims the whole pageblock so that subsequent allocations of its class
+land there too.
+
+Grouping alone can't help once movable pages are scattered, so the PFA can also
+compact memory. Owners of movable pages register a mover which knows how to fix
+up their mappings, and tag their pages with it in the MDS. When a request of
+two or more pages fails, compaction picks the aligned window in a movable
+pageblock which needs the fewest migrations, pulls the window's free blocks off
+the lists, copies each allocated page elsewhere and asks its mover to switch
+over, and then frees the whole window at once. Idle cores can optionally do
+the same in the background. Since free pages have no MDS state, freeing a page
+clears its entry so that compaction never mistakes a free page for a movable
+one.
+
+Large device buffers such as the framebuffer need megabytes of physically
+contiguous memory, which a long running system can rarely find. The CMA zone
+reserves it at init. Left idle, the reservation would be wasted, so movable
+pages which name a mover may also be allocated from it (before the DMA zone,
+and only once their preferred zone is exhausted). Nothing else is ever
+allocated there, so a claim (see pmap_pfa_cma_claim) can always empty the range
+it picks by migrating those pages out to the other zones. Migration targets may
+be in any arena and are taken before the claim's arena is locked, since two
+arena locks are never held at once.
+
+Rather than leaving callers to find out about a shortage when an allocation
+fails, the PFA watches free memory against three watermarks. Caches and pools
+register shrinkers, which give back some of their memory when asked. When an
+allocation leaves free memory below the low watermark, idle cores start asking
+the shrinkers in turn until it is back above the high watermark. An allocation
+which finds free memory below the min watermark (or which would otherwise fail)
+can't wait for that and asks every shrinker itself. Shrinkers free pages, so
+they are always called without any arena lock held.
+
 ** The Metadata Store **
 One of the kernels goals is to provide strong memory corruption. A key part of
 achieving this is through detailed accounting of what data is held where so as
@@ -34,14 +146,93 @@ using for holding program text, page tables, etc.) as well as page state (is the
 page currently being paged out?). It is implemented as a large contiguous array
 of metadata entries. 
 
+The single byte entries are what policy checks scan, so rarely used per-page
+state doesn't go in them. Reference counts, mapping counts and an owner tag are
+instead kept in parallel arrays (one per field, indexed the same way as the
+MDS) and accessed atomically. A scan of page types never pulls them into the
+cache, and the byte array stays cheap to memset. All fields are zero for free
+pages.
+
+Policy checks read the MDS far more often than it changes, so reads don't take
+any lock. Instead, each pageblock has a sequence count which writers bump
+around every MDS update, and readers retry if the count moved while they read
+(a seqlock). Not every writer holds an arena lock (pages in magazines and the
+zero pool are written by the core which owns them), so the count can't simply
+be odd while a write is in flight. Its low bits count the writers currently
+inside the pageblock and its high bits count completed writes. A snapshot is
+valid if no writer was active when it began and the count didn't change by the
+time it ended.
+
+** Statistics **
+The PFA always keeps counters of how often blocks are split and merged (and how
+deep each split or merge went) as well as log2 histograms of allocation and free
+latency and of how long the arena locks are waited on and held, all measured
+with the generic timer (CNTVCT). Each core records into its own cache line
+aligned copy so that collecting them costs a couple of timer reads and
+increments on lines the core already owns. See pmap_pfa_get_stats and
+pmap_pfa_dump.
+
 [1] https://en.wikipedia.org/wiki/Buddy_memory_allocation
 
 */
 
-#define BUDDY_LEVELS    (6)     /* Max level: 4K<<{BUDDY_LEVELS - 1}, or 128K */
+/* Max level: 4K<<{BUDDY_LEVELS - 1}, or 2MB by default */
+#define BUDDY_LEVELS    (PMAP_PFA_BUDDY_LEVELS)
+#define PCP_ORDERS      (2)     /* Per-CPU magazines cache 4K and 8K blocks */
+/* Default per-CPU magazine watermarks, in blocks */
+#define PCP_ORDER0_LOW  (16)
+#define PCP_ORDER0_HIGH (64)
+#define PCP_ORDER1_LOW  (8)
+#define PCP_ORDER1_HIGH (32)
+#define PCP_REFILL_CHUNK (16)   /* Blocks refilled per batch allocator call */
+#define ZERO_POOL_TARGET (64)   /* Default number of pre-zeroed pages */
+#define ZERO_POOL_REFILL_CHUNK (8)  /* Max pages zeroed per idle call */
+/* Default lazy slack of order 0, in blocks. Each order above gets half. */
+#define LAZY_SLACK_ORDER0 (32)
+/* Free pages held per color for colored requests, beyond which they're freed */
+#define COLOR_CACHE_MAX (16)
+/* The DMA zone size, rounded up to the top level */
+#define DMA_ZONE_SIZE   (16 * 1024 * 1024)
+/* Times a claim takes more migration targets before giving up on an arena */
+#define CMA_CLAIM_ATTEMPTS      (3)
+/* Stealing a block of at least this level claims its whole pageblock */
+#define PAGEBLOCK_CLAIM_LEVEL   (BUDDY_LEVELS - 2)
+/* The default min watermark is managed pages >> this, low and high are above */
+#define PRESSURE_MIN_SHIFT      (8)
+/* Pages an idle core asks a single shrinker for at a time */
+#define PRESSURE_RECLAIM_BATCH  (32)
+/* Requests smaller than this level never trigger compaction */
+#define COMPACTION_MIN_LEVEL    (1)
+/* MDS sequence count layout: active writers below, write generation above */
+#define MDS_SEQ_WRITERS_MASK    (0xFFu)
+#define MDS_SEQ_GENERATION      (0x100u)
+
+#define ARENA_LOCK(arena)       (arena_lock(arena))
+#define ARENA_UNLOCK(arena)     (arena_unlock(arena))
+#define PRESSURE_LOCK(pfa)      (synchs_lock_acquire(&pfa->pressure.lock))
+#define PRESSURE_UNLOCK(pfa)    (synchs_lock_release(&pfa->pressure.lock))
+#define ZERO_POOL_LOCK(pfa)     (synchs_lock_acquire(&pfa->zero_pool.lock))
+#define ZERO_POOL_UNLOCK(pfa)   (synchs_lock_release(&pfa->zero_pool.lock))
+#define CMA_LOCK(pfa)           (synchs_lock_acquire(&pfa->cma.lock))
+#define CMA_UNLOCK(pfa)         (synchs_lock_release(&pfa->cma.lock))
+#define PCP_LOCK(pcp)           (synchs_lock_acquire(&(pcp)->lock))
+#define PCP_UNLOCK(pcp)         (synchs_lock_release(&(pcp)->lock))
 
-#define PFA_LOCK(pfa)   (synchs_lock_acquire(&pfa->lock))
-#define PFA_UNLOCK(pfa)   (synchs_lock_release(&pfa->lock))
+/*
+Every allocation and free entry point checks that it wasn't called from an
+interrupt handler (or with IRQs masked, which is how a handler runs). The
+magazines and the PFA's locks don't mask interrupts, so an interrupt which
+called in could corrupt a magazine or spin on a lock its own core holds.
+*/
+#define ASSERT_NOT_IRQ()        ASSERT(!routines_irqs_masked())
+
+/**
+ * A vector of MDS entries. The compiler lowers operations on these to NEON, so
+ * range checks handle 16 pages per instruction.
+ */
+typedef uint8_t mds_vector_t 
+    __attribute__((vector_size(16), aligned(16), may_alias));
+#define MDS_VECTOR_PAGES    (sizeof(mds_vector_t))
 
 /**
  * In the buddy_bitmap, indicates that a given page is allocated (not free)
@@ -53,38 +244,345 @@ of metadata entries.
  */
 #define BUDDY_BIT_FREE      (0x1)
 
-struct pmap_pfa {
-    struct synchs_lock lock;
+/**
+ * A per-CPU cache of free blocks of a single order. Blocks held by a magazine
+ * are marked allocated in the buddy bitmaps and so are invisible to the buddy
+ * allocator until they are drained.
+ */
+struct pmap_pfa_pcp_magazine {
+    /** The cached blocks, linked through their free entries. Front is hot. */
+    struct list blocks;
+
+    /** The number of blocks in `blocks` */
+    size_t count;
 
     /** 
-     * The page ID of the first managed page is the base. All MDS entries
-     * are indexed relative to this base at zero
+     * When the magazine is empty, it is refilled up to this many blocks. When
+     * it crosses the high watermark, it is drained back down to this many.
+     * A low watermark of zero disables allocation caching.
      */
-    page_id_t page_base;
+    size_t low;
 
     /**
-     * The number of pages managed by the PFA and its MDS.
+     * The maximum number of blocks the magazine may hold before draining.
+     * A high watermark of zero disables free caching.
+     */
+    size_t high;
+};
+
+/**
+ * A pool of free pages which have already been zeroed, typically by idle cores.
+ * Pages in the pool are marked allocated in the buddy bitmaps. 
+ */
+struct pmap_pfa_zero_pool {
+    /** Protects the pool. Never held at the same time as an arena lock. */
+    struct synchs_lock lock;
+
+    /** The zeroed pages, linked through their (otherwise zero) free entries */
+    struct list pages;
+
+    /** The number of pages in `pages` */
+    size_t count;
+
+    /** The number of pages background zeroing tries to keep in the pool */
+    size_t target;
+
+    /** The number of zeroed single page requests serviced by the pool */
+    uint64_t hits;
+
+    /** The number of zeroed single page requests which found the pool empty */
+    uint64_t misses;
+};
+
+/**
+ * Free single pages partitioned by cache color for colored allocations. Pages
+ * held here are marked allocated in the buddy bitmaps. Protected by the lock of
+ * the arena they came from.
+ */
+struct pmap_pfa_color_cache {
+    /** The free pages of each color, linked through their free entries */
+    struct list pages[PMAP_PFA_COLORS];
+
+    /** The number of pages in each of `pages` */
+    size_t counts[PMAP_PFA_COLORS];
+
+    /** The number of colored requests serviced from `pages` */
+    uint64_t hits;
+
+    /** The number of blocks split across `pages` */
+    uint64_t refills;
+
+    /** The number of colored requests which got a page of another color */
+    uint64_t misses;
+};
+
+/**
+ * The per-CPU page caches for a single core. Only the owning core adds blocks
+ * to its magazines, which lets the common single page paths skip the arena
+ * locks.
+ */
+struct pmap_pfa_pcp {
+    /**
+     * Protects the magazines. Other cores only take it to drain them, so the
+     * owning core almost always finds it free. Taken before any arena lock.
      */
+    struct synchs_lock lock;
+
+    struct pmap_pfa_pcp_magazine magazines[PCP_ORDERS];
+
+    /** The color the next PMAP_PFA_COLOR_NEXT request on this core gets */
+    unsigned int next_color;
+
+    /** True while this core runs a mover's callback, see migrate_page_locked */
+    bool in_mover;
+
+    /** True while this core runs a shrinker, see pressure_shrink */
+    bool in_reclaim;
+} __attribute__((aligned(SMP_CACHE_LINE_SIZE)));
+
+struct pmap_pfa_arena;
+
+/**
+ * An arena's share of a range of physical memory, with its own buddy lists.
+ * Zones are protected by their arena's lock.
+ */
+struct pmap_pfa_zone {
+    /** The arena the zone belongs to */
+    struct pmap_pfa_arena *arena;
+
+    /** The first page in the zone. Aligned to the top buddy level. */
+    page_id_t page_base;
+
+    /** The number of pages in the zone, which may be zero */
     page_id_t page_count;
 
     /**
-     * The buddy lists for each level. Index 0 holds level 0 which contains 
-     * page ranges of size 4K. Each level up doubles the range size.
+     * The buddy lists for each mobility class and level. Index 0 holds level 0
+     * which contains page ranges of size 4K. Each level up doubles the range
+     * size. A free block is on the lists of its pageblock's class.
+     */
+    struct list buddy_lists[PMAP_PFA_MOBILITY_COUNT][BUDDY_LEVELS];
+
+    /** The number of pages on the buddy lists */
+    size_t free_pages;
+
+    /**
+     * The number of blocks on each level's lists, summed over the classes.
+     * Also read without the lock by pmap_pfa_get_free_summary.
      */
-    struct list buddy_lists[BUDDY_LEVELS];
+    size_t free_blocks[BUDDY_LEVELS];
+
+    /** A mask of the levels where lazy frees left free buddies unmerged */
+    uint32_t uncoalesced;
+
+    /** See struct pmap_pfa_zone_stats */
+    uint64_t allocations;
+    uint64_t fallbacks;
+    uint64_t failures;
+    uint64_t steals;
+    uint64_t claims;
+};
+
+/**
+ * Compaction movers and settings. These are written with every arena lock held,
+ * so holding any one of them is enough to read them.
+ */
+struct pmap_pfa_compaction {
+    /** The registered movers, indexed by ID. Index 0 (no mover) is unused. */
+    const struct pmap_pfa_mover *movers[PMAP_PFA_MOVER_MAX + 1];
+
+    /** The number of registered movers */
+    unsigned int mover_count;
+
+    /** If true, idle cores compact zones lacking a block of background_order */
+    bool background;
+    unsigned int background_order;
+};
+
+/** Lazy coalescing settings, written with every arena lock held */
+struct pmap_pfa_lazy {
+    /** If false, frees always merge */
+    bool enabled;
+
+    /** Frees of a level merge once their zone has this many blocks of it */
+    size_t slack[BUDDY_LEVELS];
+};
+
+/** 
+ * Memory pressure state. The watermarks, the shrinker count and the reclaiming
+ * and kick flags are also read without the lock (and the flags and the crossing
+ * count are updated with an arena lock held instead), so they are only written
+ * with atomics.
+ */
+struct pmap_pfa_pressure {
+    /** Protects the rest. Never held at the same time as an arena lock. */
+    struct synchs_lock lock;
+
+    /** The registered shrinkers, the first shrinker_count of which are valid */
+    const struct pmap_pfa_shrinker *shrinkers[PMAP_PFA_SHRINKER_MAX];
+    unsigned int shrinker_count;
+
+    /** The watermarks, in free pages. See pmap_pfa_pressure_set_watermarks. */
+    size_t min;
+    size_t low;
+    size_t high;
+
+    /** If true, idle cores reclaim until free memory reaches `high` */
+    bool reclaiming;
+    /** If true, the next allocation to return starts reclaim (pressure_kick) */
+    bool kick;
+
+    /** The shrinker idle cores ask next */
+    unsigned int next_shrinker;
+
+    /** See struct pmap_pfa_pressure_stats */
+    uint64_t low_crossings;
+    uint64_t async_runs;
+    uint64_t direct_runs;
+    uint64_t pages_reclaimed;
+    uint64_t direct_ticks;
+};
+
+/** CMA claim statistics */
+struct pmap_pfa_cma {
+    /** Protects the rest. Never held at the same time as an arena lock. */
+    struct synchs_lock lock;
+
+    /** See struct pmap_pfa_cma_stats */
+    size_t claimed_pages;
+    uint64_t claims;
+    uint64_t failures;
+    uint64_t releases;
+    uint64_t pages_migrated;
+    uint64_t claim_ticks;
+    uint64_t claim_max_ticks;
+    uint64_t release_ticks;
+    uint64_t release_max_ticks;
+};
+
+/** A core's share of the allocator statistics, see pmap_pfa_get_stats */
+struct pmap_pfa_cpu_stats {
+    struct pmap_pfa_stats stats;
+} __attribute__((aligned(SMP_CACHE_LINE_SIZE)));
+
+/**
+ * A slice of physical memory with its own lock and buddy allocator. Everything
+ * in an arena, as well as the classes of its pageblocks, is protected by its
+ * lock.
+ */
+struct pmap_pfa_arena {
+    struct synchs_lock lock;
+
+    /** The CNTVCT value when the lock was last acquired, protected by it */
+    uint64_t lock_acquired;
+
+    /** The first page in the arena. Aligned to the top buddy level. */
+    page_id_t page_base;
+
+    /** The number of pages in the arena */
+    page_id_t page_count;
+
+    /** The arena's share of each zone, in ascending address order */
+    struct pmap_pfa_zone zones[PMAP_PFA_ZONE_COUNT];
 
     /**
-     * Sidecar data structure to support the PFA's buddy list data structure.
-     * If a page is 1 in this bitmap, it is free.
+     * Sidecar data structure to support the buddy lists, indexed relative to
+     * the arena's page base. If a page is 1 in this bitmap, it is free.
      */
     uint64_t *buddy_bitmaps[BUDDY_LEVELS];
 
+    /** Free pages held for colored requests from cores at home here */
+    struct pmap_pfa_color_cache colors;
+
+    /** See struct pmap_pfa_compaction_stats */
+    struct pmap_pfa_compaction_stats compaction;
+
+    /** See struct pmap_pfa_lazy_stats */
+    uint64_t deferrals;
+    uint64_t coalesces;
+    uint64_t coalesced;
+
+    /** See struct pmap_pfa_arena_stats */
+    uint64_t remote_allocations;
+} __attribute__((aligned(SMP_CACHE_LINE_SIZE)));
+
+struct pmap_pfa {
+    /** The number of ticks pmap_pfa_init spent building the free lists */
+    uint64_t init_ticks;
+
+    /** 
+     * The page ID of the first managed page is the base. All MDS entries
+     * are indexed relative to this base at zero
+     */
+    page_id_t page_base;
+
+    /**
+     * The number of pages managed by the PFA and its MDS.
+     */
+    page_id_t page_count;
+
+    /** The arenas, in ascending address order */
+    struct pmap_pfa_arena arenas[PMAP_PFA_ARENAS];
+
+    /** The number of arenas in use */
+    unsigned int arena_count;
+
+    /** Every arena but the last holds exactly 2^arena_shift pages */
+    unsigned int arena_shift;
+
     /** 
      * Each page has a single metadata struct allocated for it.
      * This data structure, referred to as ``MDS'' is used to enforce page
      * policy.
      */
     struct pmap_page_metadata *metadata;
+
+    /**
+     * The MDS sequence count of each top level block, indexed like
+     * `pageblock_mobility`. See mds_write_begin and pmap_pfa_mds_read_begin.
+     */
+    uint32_t *mds_seq;
+
+    /**
+     * The extended MDS, parallel to `metadata`. Each field is only accessed
+     * with atomics. See the pmap_pfa_mds_* accessors.
+     */
+    uint32_t *mds_owner;
+    uint16_t *mds_refcount;
+    uint16_t *mds_mapcount;
+
+    /**
+     * The mobility class (pmap_pfa_mobility_e) of each top level block, indexed
+     * relative to the page base
+     */
+    uint8_t *pageblock_mobility;
+
+    /** Per-CPU page caches, indexed by CPU ID */
+    struct pmap_pfa_pcp pcp[SMP_MAX_CPUS];
+
+    /** Pages zeroed ahead of time for PMAP_PFA_ALLOC_ZERO requests */
+    struct pmap_pfa_zero_pool zero_pool;
+
+    /** 
+     * If false, colored requests are serviced like any other single page.
+     * Written with every arena lock held.
+     */
+    bool colors_enabled;
+
+    /** Compaction movers and settings */
+    struct pmap_pfa_compaction compaction;
+
+    /** Lazy coalescing settings */
+    struct pmap_pfa_lazy lazy;
+
+    /** Free memory watermarks, shrinkers and reclaim stats */
+    struct pmap_pfa_pressure pressure;
+
+    /** CMA claim statistics */
+    struct pmap_pfa_cma cma;
+
+    /** Allocator statistics, indexed by CPU ID */
+    struct pmap_pfa_cpu_stats stats[SMP_MAX_CPUS];
 };
 
 /**
@@ -93,8 +591,8 @@ struct pmap_pfa {
  */
 typedef struct pmap_pfa_free_entry {
     /** 
-     * The list element for this page. This will be one of the lists in
-     * `pfa->buddy_lists`
+     * The list element for this page. This will be one of the buddy lists of
+     * the page's zone (or a magazine/zero pool list)
      */
     struct list_elem elem;
 } * pmap_pfa_free_entry_t;
@@ -102,6 +600,244 @@ typedef struct pmap_pfa_free_entry {
 /** The singleton PFA for the kernel */
 static struct pmap_pfa *pfa = NULL;
 
+/** Get the calling core's statistics */
+static inline struct pmap_pfa_stats *
+stats_get_local(void) {
+    return &pfa->stats[smp_get_cpu_id()].stats;
+}
+
+/** Adds a sample of TICKS to HISTOGRAM */
+static inline void
+stats_histogram_record(struct pmap_pfa_histogram *histogram, uint64_t ticks) {
+    unsigned int bucket = 0;
+
+    if (ticks) {
+        bucket = MIN(
+            63 - __builtin_clzll(ticks), PMAP_PFA_HISTOGRAM_BUCKETS - 1
+        );
+    }
+
+    histogram->buckets[bucket]++;
+}
+
+/** Records the latency of an allocation which began at CNTVCT value START */
+static inline void
+stats_record_alloc(uint64_t start) {
+    stats_histogram_record(
+        &stats_get_local()->alloc_ticks, routines_read_cntvct() - start
+    );
+}
+
+/** Records the latency of a free which began at CNTVCT value START */
+static inline void
+stats_record_free(uint64_t start) {
+    stats_histogram_record(
+        &stats_get_local()->free_ticks, routines_read_cntvct() - start
+    );
+}
+
+/** Records that a block was taken off the free lists and split DEPTH times */
+static inline void
+stats_record_split(unsigned int depth) {
+    struct pmap_pfa_stats *stats = stats_get_local();
+
+    stats->splits += depth;
+    stats->split_depth[depth]++;
+}
+
+/** Records that a freed block was merged DEPTH times */
+static inline void
+stats_record_merge(unsigned int depth) {
+    struct pmap_pfa_stats *stats = stats_get_local();
+
+    stats->merges += depth;
+    stats->merge_depth[depth]++;
+}
+
+/** Records LIST_OPS buddy list updates and BITMAP_OPS buddy bitmap accesses */
+static inline void
+stats_record_buddy_ops(unsigned int list_ops, unsigned int bitmap_ops) {
+    struct pmap_pfa_stats *stats = stats_get_local();
+
+    stats->list_ops += list_ops;
+    stats->bitmap_ops += bitmap_ops;
+}
+
+/** Acquires the lock of ARENA, recording how long we waited for it */
+static inline void
+arena_lock(struct pmap_pfa_arena *arena) {
+    uint64_t start = routines_read_cntvct();
+
+    /* A mover calling back into us would otherwise spin on its own lock */
+    ASSERT(!pfa->pcp[smp_get_cpu_id()].in_mover);
+
+    synchs_lock_acquire(&arena->lock);
+    arena->lock_acquired = routines_read_cntvct();
+    stats_histogram_record(
+        &stats_get_local()->lock_wait_ticks, arena->lock_acquired - start
+    );
+}
+
+/** Releases the lock of ARENA, recording how long it was held */
+static inline void
+arena_unlock(struct pmap_pfa_arena *arena) {
+    uint64_t held = routines_read_cntvct() - arena->lock_acquired;
+
+    synchs_lock_release(&arena->lock);
+    stats_histogram_record(&stats_get_local()->lock_hold_ticks, held);
+}
+
+/**
+ * Acquires every arena lock, in ascending order, for writing the settings which
+ * the arenas share. Arena locks are otherwise never held two at a time, so this
+ * can't deadlock.
+ */
+static void
+arenas_lock_all(void) {
+    for (unsigned int arena_i = 0; arena_i < pfa->arena_count; arena_i++) {
+        ARENA_LOCK(&pfa->arenas[arena_i]);
+    }
+}
+
+/** Releases every arena lock acquired by arenas_lock_all */
+static void
+arenas_unlock_all(void) {
+    for (unsigned int arena_i = pfa->arena_count; arena_i-- > 0;) {
+        ARENA_UNLOCK(&pfa->arenas[arena_i]);
+    }
+}
+
+/** Get the arena which owns PAGE */
+static inline struct pmap_pfa_arena *
+arena_for_page(page_id_t page) {
+    ASSERT(page - pfa->page_base < pfa->page_count);
+
+    /* Arenas are a power of two pages, so there is nothing to search */
+    return &pfa->arenas[(page - pfa->page_base) >> pfa->arena_shift];
+}
+
+/** Get the index of the calling core's home arena */
+static inline unsigned int
+arena_home_index(void) {
+    return smp_get_cpu_id() % pfa->arena_count;
+}
+
+/**
+ * Get the arena a request from a core whose home arena is index HOME tries
+ * I-th, starting from the home arena and moving on up through the others
+ */
+static inline struct pmap_pfa_arena *
+arena_nth(unsigned int home, unsigned int i) {
+    return &pfa->arenas[(home + i) % pfa->arena_count];
+}
+
+/**
+ * Makes sure the lock of the arena which owns PAGE is held, given that the lock
+ * of HELD (which may be NULL) is, and returns that arena. This is for freeing a
+ * list of pages which usually, but not always, share an arena.
+ */
+static inline struct pmap_pfa_arena *
+arena_lock_switch(struct pmap_pfa_arena *held, page_id_t page) {
+    struct pmap_pfa_arena *arena = arena_for_page(page);
+
+    if (arena != held) {
+        if (held) {
+            ARENA_UNLOCK(held);
+        }
+        ARENA_LOCK(arena);
+    }
+
+    return arena;
+}
+
+/**
+ * The order in which zones are tried for a request preferring a given zone,
+ * terminated by PMAP_PFA_ZONE_COUNT
+ */
+static const pmap_pfa_zone_e 
+zone_fallbacks[PMAP_PFA_ZONE_COUNT][PMAP_PFA_ZONE_COUNT] = {
+    /* DMA memory is only useful if it actually came from the DMA zone */
+    [PMAP_PFA_ZONE_DMA] = { PMAP_PFA_ZONE_DMA, PMAP_PFA_ZONE_COUNT },
+    /* Only claims are made from the CMA zone */
+    [PMAP_PFA_ZONE_CMA] = { PMAP_PFA_ZONE_CMA, PMAP_PFA_ZONE_COUNT },
+    /* Normal requests use DMA memory only once normal memory runs out */
+    [PMAP_PFA_ZONE_NORMAL] = { 
+        PMAP_PFA_ZONE_NORMAL, PMAP_PFA_ZONE_DMA, PMAP_PFA_ZONE_COUNT 
+    },
+};
+
+/**
+ * As zone_fallbacks, but for pages a claim can migrate out of the CMA zone.
+ * These borrow the reservation before the DMA zone, which can't be emptied.
+ */
+static const pmap_pfa_zone_e 
+zone_fallbacks_migratable[PMAP_PFA_ZONE_COUNT][PMAP_PFA_ZONE_COUNT] = {
+    [PMAP_PFA_ZONE_DMA] = { 
+        PMAP_PFA_ZONE_DMA, PMAP_PFA_ZONE_CMA, PMAP_PFA_ZONE_COUNT 
+    },
+    [PMAP_PFA_ZONE_CMA] = { PMAP_PFA_ZONE_CMA, PMAP_PFA_ZONE_COUNT },
+    [PMAP_PFA_ZONE_NORMAL] = { 
+        PMAP_PFA_ZONE_NORMAL, PMAP_PFA_ZONE_CMA, PMAP_PFA_ZONE_DMA 
+    },
+};
+
+/**
+ * Get the order in which zones are tried for a request preferring PREFERRED
+ * whose pages will carry METADATA
+ */
+static inline const pmap_pfa_zone_e *
+zone_fallbacks_for(pmap_pfa_zone_e preferred, 
+                   const pmap_page_metadata_s *metadata) {
+    if (metadata->mobility == PMAP_PFA_MOBILITY_MOVABLE 
+            && metadata->mover != PMAP_PFA_MOVER_NONE) {
+        return zone_fallbacks_migratable[preferred];
+    }
+
+    return zone_fallbacks[preferred];
+}
+
+/**
+ * The order in which other mobility classes are stolen from when a class has no
+ * free blocks left. Movable allocations steal from reclaimable pageblocks first
+ * since those can at least be emptied by reclaim.
+ */
+static const pmap_pfa_mobility_e
+mobility_fallbacks[PMAP_PFA_MOBILITY_COUNT][PMAP_PFA_MOBILITY_COUNT - 1] = {
+    [PMAP_PFA_MOBILITY_UNMOVABLE] = { 
+        PMAP_PFA_MOBILITY_RECLAIMABLE, PMAP_PFA_MOBILITY_MOVABLE 
+    },
+    [PMAP_PFA_MOBILITY_RECLAIMABLE] = { 
+        PMAP_PFA_MOBILITY_UNMOVABLE, PMAP_PFA_MOBILITY_MOVABLE 
+    },
+    [PMAP_PFA_MOBILITY_MOVABLE] = { 
+        PMAP_PFA_MOBILITY_RECLAIMABLE, PMAP_PFA_MOBILITY_UNMOVABLE 
+    },
+};
+
+/** 
+ * If false, all allocations are treated as unmovable. This exists so that the
+ * benefit of grouping can be measured.
+ */
+static bool mobility_grouping = true;
+
+/**
+ * If false, pmap_pfa_init builds the free lists one block at a time rather than
+ * in bulk. This exists so that the two can be compared.
+ */
+static bool bulk_init = true;
+
+/**
+ * The number of arenas the next pmap_pfa_init splits memory into, if there is
+ * enough memory. See pmap_pfa_set_arena_count.
+ */
+static unsigned int arena_count_next = PMAP_PFA_ARENAS;
+
+/**
+ * The size of the reservation the next pmap_pfa_init sets aside for the CMA
+ * zone. See pmap_pfa_set_cma_size.
+ */
+static size_t cma_size_next = PMAP_PFA_CMA_SIZE;
+
 /** Get the number of pages in an entry at a buddy level */
 static inline unsigned int
 buddy_level_page_count(unsigned int level) {
@@ -114,6 +850,12 @@ pa_to_page_id(phys_addr_t page) {
     return page >> PAGE_SHIFT;
 }
 
+/** Get the physical address for a page number */
+static inline phys_addr_t
+page_id_to_pa(page_id_t page) {
+    return (phys_addr_t)page << PAGE_SHIFT;
+}
+
 /** Get the minimum number of pages to represent SIZE bytes */
 static inline page_id_t
 size_to_page_count(size_t size) {
@@ -142,20 +884,14 @@ max_buddy_level_for_page_alignment(page_id_t page_id) {
  */
 static inline unsigned int
 min_buddy_level_for_size_no_overflow(size_t size) {
-    unsigned int level = 0;
-    size_t value = PAGE_SIZE;
+    /* Only whole pages count, so this is just log2 of the page count */
+    uint64_t page_count = size >> PAGE_SHIFT;
 
-    while (level < BUDDY_LEVELS - 1 && value < size) {
-        level++;
-        value <<= 1;
-    }
-    
-    if (level > 0 && value > size) {
-        /* we overflowed, get rid of the extra level */
-        level -= 1;
+    if (page_count <= 1) {
+        return 0;
     }
 
-    return level; 
+    return MIN(BUDDY_LEVELS - 1, 63 - __builtin_clzll(page_count));
 }
 /** Get the lowest buddy level which contains entries of at least size bytes */
 static inline unsigned int
@@ -183,13 +919,7 @@ static inline pmap_pfa_free_entry_t
 get_pfa_free_entry_for_page(page_id_t page) {
     ASSERT(page - pfa->page_base < pfa->page_count);
 
-    return (pmap_pfa_free_entry_t)(pmap_pa_to_kva(page << PAGE_SHIFT));
-}
-
-static inline void
-mds_get_metadata_locked(page_id_t page, pmap_page_metadata_s *metadata) {
-    ASSERT(page - pfa->page_base < pfa->page_count);
-    *metadata = pfa->metadata[page];
+    return (pmap_pfa_free_entry_t)(pmap_pa_to_kva(page_id_to_pa(page)));
 }
 
 static inline page_id_t
@@ -232,8 +962,9 @@ buddy_bitmap_required_bytes(page_id_t page_count) {
 }
 
 static inline size_t
-buddy_bitmap_page_index(page_id_t page, unsigned int level) {
-    page_id_t debased_page = page - pfa->page_base;
+buddy_bitmap_page_index(struct pmap_pfa_arena *arena, page_id_t page, 
+                        unsigned int level) {
+    page_id_t debased_page = page - arena->page_base;
     /* 
     Each bin is 64 bits, log2(64) = 6, so to get the bin we shift by 
     6 + level 
@@ -242,8 +973,9 @@ buddy_bitmap_page_index(page_id_t page, unsigned int level) {
 }
 
 static inline size_t
-buddy_bitmap_page_offset(page_id_t page, unsigned int level) {
-    page_id_t debased_page = page - pfa->page_base;
+buddy_bitmap_page_offset(struct pmap_pfa_arena *arena, page_id_t page, 
+                         unsigned int level) {
+    page_id_t debased_page = page - arena->page_base;
     /*
     Each bin is 64 bits, log2(64) = 6, so get the 6 bit index
     */
@@ -251,27 +983,143 @@ buddy_bitmap_page_offset(page_id_t page, unsigned int level) {
 }
 
 static inline void
-buddy_bitmap_set_bit_locked(page_id_t page, unsigned int level, uint8_t value) {
-    size_t idx = buddy_bitmap_page_index(page, level);
-    size_t offset = buddy_bitmap_page_offset(page, level);
+buddy_bitmap_set_bit_locked(struct pmap_pfa_arena *arena, page_id_t page, 
+                            unsigned int level, uint8_t value) {
+    size_t idx = buddy_bitmap_page_index(arena, page, level);
+    size_t offset = buddy_bitmap_page_offset(arena, page, level);
     
-    uint64_t bin_value = pfa->buddy_bitmaps[level][idx];
+    uint64_t bin_value = arena->buddy_bitmaps[level][idx];
     bin_value &= ~(1LLU << offset);
     bin_value |= ((uint64_t)value << offset);
-    pfa->buddy_bitmaps[level][idx] = bin_value;
+    arena->buddy_bitmaps[level][idx] = bin_value;
 }
 
 static inline uint8_t
-buddy_bitmap_get_bit_locked(page_id_t page, unsigned int level) {
-    size_t idx = buddy_bitmap_page_index(page, level);
-    size_t offset = buddy_bitmap_page_offset(page, level);
-    uint64_t bin_value = pfa->buddy_bitmaps[level][idx];
+buddy_bitmap_get_bit_locked(struct pmap_pfa_arena *arena, page_id_t page, 
+                            unsigned int level) {
+    size_t idx = buddy_bitmap_page_index(arena, page, level);
+    size_t offset = buddy_bitmap_page_offset(arena, page, level);
+    uint64_t bin_value = arena->buddy_bitmaps[level][idx];
 
     return (bin_value >> offset) & 1;
 }
 
-/** Apply METADATA to all page IDs in range [base, base + page_count) */
-static void
+/** Get the zone which contains PAGE, within the arena which owns it */
+static inline struct pmap_pfa_zone *
+zone_for_page(page_id_t page) {
+    struct pmap_pfa_arena *arena = arena_for_page(page);
+
+    /* Zones are contiguous and ascending, so this is just a bounds check */
+    if (page >= arena->zones[PMAP_PFA_ZONE_NORMAL].page_base) {
+        return &arena->zones[PMAP_PFA_ZONE_NORMAL];
+    } else if (page >= arena->zones[PMAP_PFA_ZONE_CMA].page_base) {
+        return &arena->zones[PMAP_PFA_ZONE_CMA];
+    }
+
+    return &arena->zones[PMAP_PFA_ZONE_DMA];
+}
+
+/** Get the index of the pageblock (top level block) which contains PAGE */
+static inline size_t
+pageblock_index(page_id_t page) {
+    return (page - pfa->page_base) >> (BUDDY_LEVELS - 1);
+}
+
+/** Get the mobility class of the pageblock which contains PAGE */
+static inline pmap_pfa_mobility_e
+pageblock_mobility(page_id_t page) {
+    return pfa->pageblock_mobility[pageblock_index(page)];
+}
+
+/**
+ * Marks the block of 2^LEVEL pages starting at PAGE as free and inserts it into
+ * its zone's free list for its pageblock's class. This does not merge.
+ */
+static inline void
+buddy_block_insert_locked(page_id_t page, unsigned int level) {
+    struct pmap_pfa_zone *zone = zone_for_page(page);
+    pmap_pfa_free_entry_t fe = get_pfa_free_entry_for_page(page);
+
+    list_push_front(
+        &zone->buddy_lists[pageblock_mobility(page)][level], &fe->elem
+    );
+    zone->free_pages += buddy_level_page_count(level);
+    zone->free_blocks[level]++;
+    buddy_bitmap_set_bit_locked(zone->arena, page, level, BUDDY_BIT_FREE);
+    stats_record_buddy_ops(1, 1);
+}
+
+/**
+ * Removes the free block of 2^LEVEL pages starting at PAGE from its zone's free
+ * list and marks it as allocated
+ */
+static inline void
+buddy_block_remove_locked(page_id_t page, unsigned int level) {
+    struct pmap_pfa_zone *zone = zone_for_page(page);
+    pmap_pfa_free_entry_t fe = get_pfa_free_entry_for_page(page);
+
+    list_remove(&fe->elem);
+    zone->free_pages -= buddy_level_page_count(level);
+    zone->free_blocks[level]--;
+    buddy_bitmap_set_bit_locked(zone->arena, page, level, BUDDY_BIT_ALLCOATED);
+    stats_record_buddy_ops(1, 1);
+}
+
+/** Get the page ID of the first block on the free list LIST */
+static inline page_id_t
+buddy_list_front_page(struct list *list) {
+    pmap_pfa_free_entry_t fe = list_entry(
+        list_front(list), struct pmap_pfa_free_entry, elem
+    );
+
+    return pa_to_page_id(pmap_physmap_kva_to_pa((vm_addr_t)fe));
+}
+
+/**
+ * Announces a write to the MDS entries of [base, base + page_count) to lockless
+ * readers. Must be paired with mds_write_end. An empty range touches nothing.
+ */
+static inline void
+mds_write_begin(page_id_t base, size_t page_count) {
+    size_t last = 0;
+
+    if (!page_count) {
+        return;
+    }
+
+    /* Each core writes at most one range at a time */
+    STATIC_ASSERT(SMP_MAX_CPUS < MDS_SEQ_WRITERS_MASK);
+    last = pageblock_index(base + page_count - 1);
+    for (size_t block_i = pageblock_index(base); block_i <= last; block_i++) {
+        __atomic_fetch_add(&pfa->mds_seq[block_i], 1, __ATOMIC_RELAXED);
+    }
+
+    /* Readers which see any of our writes must also see the count change */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Completes a write started by mds_write_begin, retiring the writer and moving
+ * each pageblock on to its next generation
+ */
+static inline void
+mds_write_end(page_id_t base, size_t page_count) {
+    size_t last = 0;
+
+    if (!page_count) {
+        return;
+    }
+
+    last = pageblock_index(base + page_count - 1);
+    for (size_t block_i = pageblock_index(base); block_i <= last; block_i++) {
+        __atomic_fetch_add(
+            &pfa->mds_seq[block_i], MDS_SEQ_GENERATION - 1, __ATOMIC_RELEASE
+        );
+    }
+}
+
+/** Apply METADATA to all page IDs in range [base, base + page_count) */
+static void
 apply_metadata_range_locked(page_id_t base, size_t page_count, 
                         pmap_page_metadata_s *metadata) {
     /* When the size is 1, we can just use memset */
@@ -281,7 +1129,58 @@ apply_metadata_range_locked(page_id_t base, size_t page_count,
 
     uint8_t m8;
     memcpy(&m8, metadata, sizeof(*metadata)); 
+    mds_write_begin(base, page_count);
     memset(pfa->metadata + base - pfa->page_base, m8, page_count);
+    mds_write_end(base, page_count);
+}
+
+/**
+ * Clears the metadata and extended metadata of all page IDs in range 
+ * [base, base + page_count) as they are freed. Free pages have no meaningful
+ * metadata, but compaction relies on them not naming a mover and the extended
+ * fields must start out at zero for the next owner.
+ */
+static inline void
+mds_clear_range_locked(page_id_t base, size_t page_count) {
+    page_id_t index = base - pfa->page_base;
+
+    ASSERT(index + page_count <= pfa->page_count);
+    mds_write_begin(base, page_count);
+    memset(pfa->metadata + index, 0x00, page_count);
+    memset(pfa->mds_owner + index, 0x00, 
+           page_count * sizeof(*pfa->mds_owner));
+    memset(pfa->mds_refcount + index, 0x00, 
+           page_count * sizeof(*pfa->mds_refcount));
+    memset(pfa->mds_mapcount + index, 0x00, 
+           page_count * sizeof(*pfa->mds_mapcount));
+    mds_write_end(base, page_count);
+}
+
+/**
+ * Get the level of the largest naturally aligned block which starts at PAGE and
+ * does not extend past LIMIT. Walking [base, limit) with this decomposes the
+ * range into the minimal set of maximal aligned blocks.
+ */
+static inline unsigned int
+max_buddy_level_for_range(page_id_t page, page_id_t limit) {
+    /*
+    The only two issues we need to consider are 1) what is the alignment of the
+    page and 2) if we take the max level'd alignment (i.e. 256K after the given
+    page), is that still in bounds?
+    In the expression below, we take the largest possible contiguous chunk but
+    cap it by the amount of remaining memory so we don't have chunks extending
+    out off into memory we don't manage
+    */
+    unsigned int level = MIN(
+        max_buddy_level_for_page_alignment(page),
+        min_buddy_level_for_size_no_overflow(
+            (size_t)(limit - page) << PAGE_SHIFT
+        )
+    );
+
+    ASSERT(level < BUDDY_LEVELS);
+    ASSERT(buddy_level_page_count(level) <= limit - page);
+    return level;
 }
 
 /**
@@ -289,41 +1188,140 @@ apply_metadata_range_locked(page_id_t base, size_t page_count,
  * buddy bitmaps. Note: this function DOES NOT merge and MUST NOT be used for
  * freeing pages.
  */
-static pmap_pfa_free_entry_t
+static void
 buddy_insert_range_freed_locked(page_id_t base, page_id_t page_count) {
     page_id_t free_i;
     page_id_t limit;
-    pmap_pfa_free_entry_t fe = NULL;
 
     limit = base + page_count;
     for (free_i = base; free_i < limit;) {
-        unsigned int level = 0;
-
         /*
-        Calculate the largest valid level for a given page
-        We're able to do this in a bit of a faster, hacky way because we know
-        that the entire contiguous range is free. Thus, the only two issues we 
-        need to consider are 1) what is the alignment of the page and 2) if we
-        take the max level'd alignment (i.e. 256K after the given page), is that
-        still in bounds?
-        In the expression below, we take the largest possible contiguous chunk
-        but cap it by the amount of remaining memory so we don't have chunks
-        extending out off into memory we don't manage
+        Since we know that the entire contiguous range is free and that nothing
+        around it can be joined, each maximal block goes straight onto its list.
+        The range may span zones and arenas, but a naturally aligned block
+        never does.
         */
-        level = MIN(
-            max_buddy_level_for_page_alignment(free_i),
-            min_buddy_level_for_size_no_overflow((limit - free_i) << PAGE_SHIFT)
-        );
+        unsigned int level = max_buddy_level_for_range(free_i, limit);
 
-        ASSERT(level >= 0 && level < BUDDY_LEVELS);
-        ASSERT(1 << level <= limit - free_i);
-        fe = (void *)pmap_pa_to_kva(free_i << PAGE_SHIFT);
-        list_push_front(&pfa->buddy_lists[level], &fe->elem);
-        buddy_bitmap_set_bit_locked(free_i, level, BUDDY_BIT_FREE);
+        buddy_block_insert_locked(free_i, level);
 
         free_i += buddy_level_page_count(level);
     }
-    return fe;
+}
+
+/**
+ * Inserts free pages in range [BASE, LIMIT), which lies within ARENA, into the
+ * free lists and buddy bitmaps at init. See buddy_init_range_freed_locked.
+ */
+static void
+arena_init_range_freed_locked(struct pmap_pfa_arena *arena, page_id_t base, 
+                              page_id_t limit) {
+    unsigned int top_level = BUDDY_LEVELS - 1;
+    page_id_t top_pages = buddy_level_page_count(top_level);
+    /* The arena base is top level aligned, so these are too (see init) */
+    page_id_t run_base = ROUND_UP(base, top_pages);
+    page_id_t run_limit = limit & ~(top_pages - 1);
+    uint64_t *bitmap = arena->buddy_bitmaps[top_level];
+    size_t bit_limit = 0;
+    vm_addr_t run_kva = 0;
+
+    if (run_base >= run_limit) {
+        buddy_insert_range_freed_locked(base, limit - base);
+        return;
+    }
+
+    buddy_insert_range_freed_locked(base, run_base - base);
+
+    /* Mark the run free, masking only the partial words at either end */
+    STATIC_ASSERT(BUDDY_BIT_FREE == 1);
+    bit_limit = (run_limit - arena->page_base) >> top_level;
+    for (size_t bit_i = (run_base - arena->page_base) >> top_level; 
+            bit_i < bit_limit;) {
+        size_t offset = bit_i % 64;
+        size_t bits = MIN(64 - offset, bit_limit - bit_i);
+        uint64_t mask = bits == 64 ? ~0ULL : ((1ULL << bits) - 1) << offset;
+
+        bitmap[bit_i / 64] |= mask;
+        bit_i += bits;
+    }
+
+    /* 
+    Link the blocks in ascending order, pushing to the front as 
+    buddy_block_insert_locked does so that the lists come out identical. The
+    physmap is linear, so the free entries are a fixed stride apart.
+    */
+    run_kva = pmap_pa_to_kva(page_id_to_pa(run_base));
+    for (page_id_t page_i = run_base; page_i < run_limit; 
+            page_i += top_pages) {
+        struct pmap_pfa_zone *zone = zone_for_page(page_i);
+        pmap_pfa_free_entry_t fe = (pmap_pfa_free_entry_t)(
+            run_kva + page_id_to_pa(page_i - run_base)
+        );
+
+        list_push_front(
+            &zone->buddy_lists[pageblock_mobility(page_i)][top_level], 
+            &fe->elem
+        );
+        zone->free_blocks[top_level]++;
+    }
+
+    for (unsigned int zone_i = 0; zone_i < PMAP_PFA_ZONE_COUNT; zone_i++) {
+        struct pmap_pfa_zone *zone = &arena->zones[zone_i];
+        page_id_t zone_base = MAX(run_base, zone->page_base);
+        page_id_t zone_limit = MIN(
+            run_limit, zone->page_base + zone->page_count
+        );
+
+        if (zone_base < zone_limit) {
+            zone->free_pages += zone_limit - zone_base;
+        }
+    }
+
+    buddy_insert_range_freed_locked(run_limit, limit - run_limit);
+}
+
+/**
+ * Inserts free pages in range [BASE, BASE+PAGE_COUNT) into the free lists and
+ * buddy bitmaps at init. This has the same result as
+ * buddy_insert_range_freed_locked, but it is much cheaper for large ranges.
+ * 
+ * At init, nearly all of RAM is one free range, and all of each arena's share
+ * of it but the head and tail is a run of top level blocks. The run's bits are
+ * written into the top level bitmap a word at a time and its blocks are linked
+ * into the free lists in a single sequential pass, so only the head and tail
+ * are decomposed block by block.
+ */
+static void
+buddy_init_range_freed_locked(page_id_t base, page_id_t page_count) {
+    page_id_t limit = base + page_count;
+
+    for (unsigned int arena_i = 0; arena_i < pfa->arena_count; arena_i++) {
+        struct pmap_pfa_arena *arena = &pfa->arenas[arena_i];
+        page_id_t arena_base = MAX(base, arena->page_base);
+        page_id_t arena_limit = MIN(
+            limit, arena->page_base + arena->page_count
+        );
+
+        if (arena_base < arena_limit) {
+            arena_init_range_freed_locked(arena, arena_base, arena_limit);
+        }
+    }
+}
+
+/**
+ * Get the log2 of the number of pages in each arena when PAGE_COUNT pages are
+ * split into at most COUNT arenas. Every arena is at least a top level block.
+ */
+static unsigned int
+arena_shift_for_pages(page_id_t page_count, unsigned int count) {
+    uint64_t arena_pages = ROUND_UP((uint64_t)page_count, count) / count;
+    unsigned int shift = BUDDY_LEVELS - 1;
+
+    while (((uint64_t)1 << shift) < arena_pages) {
+        shift++;
+    }
+
+    return shift;
 }
 
 void
@@ -336,16 +1334,60 @@ pmap_pfa_init(phys_addr_t ram_base,
               phys_addr_t bootstrap_pa_reserved) {
     page_id_t page_base = ram_base >> PAGE_SHIFT;
     page_id_t page_count = size_to_page_count(ram_size - ram_base);
+    page_id_t top_block_pages = buddy_level_page_count(BUDDY_LEVELS - 1);
+    page_id_t dma_limit = 0;
+    page_id_t cma_limit = 0;
+    page_id_t cma_pages = 0;
+    uint64_t init_start = 0;
+    /*
+    The large allocator converts top level bitmap indices directly back into
+    page IDs, which is only valid if the base is aligned to the top level
+    */
+    ASSERT(page_base % buddy_level_page_count(BUDDY_LEVELS - 1) == 0);
+    /* 
+    Arenas are a power of two pages, so rounding up may leave fewer of them
+    than we asked for
+    */
+    unsigned int arena_shift = arena_shift_for_pages(
+        page_count, arena_count_next
+    );
+    unsigned int arena_count = 
+        ((uint64_t)page_count + (1ULL << arena_shift) - 1) >> arena_shift;
     /* The size of the primary PFA structure, uint64_t aligned */
     size_t pfa_size = ROUND_UP(sizeof(struct pmap_pfa), sizeof(uint64_t));
-    /* The size of the buddy bitmap, uint64_t aligned */
-    size_t bitmap_size = buddy_bitmap_required_bytes(page_count);
+    /* The size of the arenas' buddy bitmaps, uint64_t aligned */
+    size_t bitmap_size = 0;
     /* Metadata store structure, byte aligned */
     size_t mds_size = sizeof(struct pmap_page_metadata) * page_count;
+    /* 
+    Extended metadata store arrays. They come between the bitmap and the MDS in
+    descending order of alignment so that none of them need padding.
+    */
+    size_t owner_size = sizeof(*pfa->mds_owner) * page_count;
+    size_t refcount_size = sizeof(*pfa->mds_refcount) * page_count;
+    size_t mapcount_size = sizeof(*pfa->mds_mapcount) * page_count;
+    size_t ext_mds_size = owner_size + refcount_size + mapcount_size;
+    /* One mobility class byte per (possibly partial) pageblock */
+    size_t pageblock_count = ROUND_UP(page_count, top_block_pages) 
+                                / top_block_pages;
+    /* One MDS sequence count per pageblock, placed before the owner array */
+    size_t seq_size = sizeof(*pfa->mds_seq) * pageblock_count;
+
+    size_t required_bytes = 0;
+
+    ASSERT(arena_count <= arena_count_next);
+    for (unsigned int arena_i = 0; arena_i < arena_count; arena_i++) {
+        page_id_t arena_base = (page_id_t)arena_i << arena_shift;
+
+        bitmap_size += buddy_bitmap_required_bytes(
+            MIN(page_count - arena_base, 1ULL << arena_shift)
+        );
+    }
 
     /* Calculate the number of pages for the structure and metadata array */
-    size_t required_bytes = ROUND_UP(
-        pfa_size + bitmap_size + mds_size,
+    required_bytes = ROUND_UP(
+        pfa_size + bitmap_size + seq_size + ext_mds_size + mds_size 
+            + pageblock_count,
         PAGE_SIZE
     );
 
@@ -353,32 +1395,175 @@ pmap_pfa_init(phys_addr_t ram_base,
     bootstrap_pa_reserved += required_bytes;
 
     /* Init the PFA */
-    synchs_lock_init(&pfa->lock);
     pfa->page_base = page_base;
     pfa->page_count = page_count;
+    pfa->arena_count = arena_count;
+    pfa->arena_shift = arena_shift;
 
     /* 
     The metadata and bitmap are allocated after the PFA in memory, calculate
     their locations and store them for simplicity
     */  
-    pfa->metadata = 
-        (struct pmap_page_metadata *)((vm_addr_t)(pfa) + bitmap_size);
+    pfa->mds_seq = (uint32_t *)((vm_addr_t)(pfa) + pfa_size + bitmap_size);
+    pfa->mds_owner = (uint32_t *)((vm_addr_t)pfa->mds_seq + seq_size);
+    pfa->mds_refcount = (uint16_t *)((vm_addr_t)pfa->mds_owner + owner_size);
+    pfa->mds_mapcount = (uint16_t *)(
+        (vm_addr_t)pfa->mds_refcount + refcount_size
+    );
+    pfa->metadata = (struct pmap_page_metadata *)(
+        (vm_addr_t)pfa->mds_mapcount + mapcount_size
+    );
+    pfa->pageblock_mobility = (uint8_t *)(pfa->metadata) + mds_size;
+
+    /*
+    Everything starts out movable and unmovable allocations claim pageblocks as
+    they need them, except for the pageblocks holding the kernel and the
+    bootstrap region which are pinned from the start.
+    */
+    STATIC_ASSERT(sizeof(*pfa->pageblock_mobility) == 1);
+    memset(pfa->pageblock_mobility, PMAP_PFA_MOBILITY_MOVABLE, pageblock_count);
+    memset(
+        pfa->pageblock_mobility, PMAP_PFA_MOBILITY_UNMOVABLE,
+        pageblock_index(pa_to_page_id(bootstrap_pa_reserved - 1)) + 1
+    );
+
+    /* 
+    There is no "free" state in the metadata and it is only meaningful for
+    allocated pages. We still zero it so that free pages never claim a mover
+    (see mds_clear_range_locked).
+    */
+    STATIC_ASSERT(PMAP_PFA_MOVER_NONE == 0);
+    memset(pfa->metadata, 0x00, mds_size);
+    memset(pfa->mds_owner, 0x00, ext_mds_size);
+    memset(pfa->mds_seq, 0x00, seq_size);
 
     /* 
-    We don't init the metadata as there is no "free" state. It is only valid for
-    allocated pages
+    Carve the zones. The DMA zone is the bottom of RAM, rounded up to the top
+    level so that buddies never span zones, and capped by both the end of RAM
+    and the highest address the VideoCore can reach. The CMA zone comes next,
+    under the same cap so that device buffers claimed from it are reachable,
+    but never takes more than half of what's left. The normal zone takes the
+    rest and either may be empty on small configurations.
     */
+    dma_limit = MIN(
+        page_base + ROUND_UP(size_to_page_count(DMA_ZONE_SIZE), 
+                             top_block_pages),
+        page_base + page_count
+    );
+    dma_limit = MIN(dma_limit, pa_to_page_id(VC_DMA_LIMIT));
+    ASSERT(dma_limit % top_block_pages == 0 
+            || dma_limit == page_base + page_count);
+
+    cma_pages = MIN(
+        ROUND_UP(size_to_page_count(cma_size_next), top_block_pages),
+        ROUND_DOWN((page_base + page_count - dma_limit) / 2, top_block_pages)
+    );
+    cma_limit = MIN(dma_limit + cma_pages, pa_to_page_id(VC_DMA_LIMIT));
 
-    /* Init buddy infrastructure */
+    /*
+    Carve the arenas, each of which takes its share of every zone, and lay out
+    their bitmaps one after another. The colored pages are split off as colors
+    are requested.
+    */
     vm_addr_t bitmap_addr = (vm_addr_t)(pfa) + pfa_size;
-    for (unsigned int level_i = 0; level_i < BUDDY_LEVELS; level_i++) {
-        list_init(&pfa->buddy_lists[level_i]);
-        pfa->buddy_bitmaps[level_i] = (uint64_t *)(bitmap_addr);
+    for (unsigned int arena_i = 0; arena_i < arena_count; arena_i++) {
+        struct pmap_pfa_arena *arena = &pfa->arenas[arena_i];
+        page_id_t arena_base = page_base + ((page_id_t)arena_i << arena_shift);
+        page_id_t arena_limit = MIN(
+            page_base + page_count, 
+            arena_base + ((uint64_t)1 << arena_shift)
+        );
+        page_id_t arena_dma_limit = MIN(MAX(dma_limit, arena_base), 
+                                        arena_limit);
+        page_id_t arena_cma_limit = MIN(MAX(cma_limit, arena_base), 
+                                        arena_limit);
+
+        memset(arena, 0x00, sizeof(*arena));
+        synchs_lock_init(&arena->lock);
+        arena->page_base = arena_base;
+        arena->page_count = arena_limit - arena_base;
+
+        arena->zones[PMAP_PFA_ZONE_DMA].page_base = arena_base;
+        arena->zones[PMAP_PFA_ZONE_DMA].page_count = 
+            arena_dma_limit - arena_base;
+        arena->zones[PMAP_PFA_ZONE_CMA].page_base = arena_dma_limit;
+        arena->zones[PMAP_PFA_ZONE_CMA].page_count = 
+            arena_cma_limit - arena_dma_limit;
+        arena->zones[PMAP_PFA_ZONE_NORMAL].page_base = arena_cma_limit;
+        arena->zones[PMAP_PFA_ZONE_NORMAL].page_count = 
+            arena_limit - arena_cma_limit;
+
+        for (unsigned int zone_i = 0; zone_i < PMAP_PFA_ZONE_COUNT; zone_i++) {
+            struct pmap_pfa_zone *zone = &arena->zones[zone_i];
+
+            zone->arena = arena;
+            for (unsigned int class_i = 0; class_i < PMAP_PFA_MOBILITY_COUNT; 
+                    class_i++) {
+                for (unsigned int level_i = 0; level_i < BUDDY_LEVELS; 
+                        level_i++) {
+                    list_init(&zone->buddy_lists[class_i][level_i]);
+                }
+            }
+        }
+
+        for (unsigned int level_i = 0; level_i < BUDDY_LEVELS; level_i++) {
+            arena->buddy_bitmaps[level_i] = (uint64_t *)(bitmap_addr);
+
+            bitmap_addr += buddy_bitmap_required_bytes_for_level(
+                arena->page_count, level_i
+            );
+        }
+
+        for (unsigned int color = 0; color < PMAP_PFA_COLORS; color++) {
+            list_init(&arena->colors.pages[color]);
+        }
+    }
 
-        bitmap_addr += buddy_bitmap_required_bytes_for_level(page_count, 
-                                                             level_i);
+    /* Init the per-CPU magazines (empty, with default watermarks) */
+    for (unsigned int cpu_i = 0; cpu_i < SMP_MAX_CPUS; cpu_i++) {
+        synchs_lock_init(&pfa->pcp[cpu_i].lock);
+        for (unsigned int order = 0; order < PCP_ORDERS; order++) {
+            list_init(&pfa->pcp[cpu_i].magazines[order].blocks);
+            pfa->pcp[cpu_i].magazines[order].count = 0;
+        }
+        pfa->pcp[cpu_i].next_color = 0;
+    }
+    pmap_pfa_pcp_set_watermarks(0, PCP_ORDER0_LOW, PCP_ORDER0_HIGH);
+    pmap_pfa_pcp_set_watermarks(1, PCP_ORDER1_LOW, PCP_ORDER1_HIGH);
+
+    /* Init the zero pool. It is filled lazily by idle cores. */
+    synchs_lock_init(&pfa->zero_pool.lock);
+    list_init(&pfa->zero_pool.pages);
+    pfa->zero_pool.count = 0;
+    pfa->zero_pool.target = ZERO_POOL_TARGET;
+    pfa->zero_pool.hits = 0;
+    pfa->zero_pool.misses = 0;
+
+    pfa->colors_enabled = true;
+
+    /* Compaction only runs on demand until background compaction is enabled */
+    memset(&pfa->compaction, 0x00, sizeof(pfa->compaction));
+    pfa->compaction.background_order = BUDDY_LEVELS - 1;
+
+    /* The top level never merges, so it never needs any slack */
+    memset(&pfa->lazy, 0x00, sizeof(pfa->lazy));
+    pfa->lazy.enabled = true;
+    for (unsigned int level_i = 0; level_i < BUDDY_LEVELS - 1; level_i++) {
+        pfa->lazy.slack[level_i] = LAZY_SLACK_ORDER0 >> level_i;
     }
 
+    /* Nothing can be reclaimed until the rest of the kernel registers */
+    memset(&pfa->pressure, 0x00, sizeof(pfa->pressure));
+    synchs_lock_init(&pfa->pressure.lock);
+    pfa->pressure.min = page_count >> PRESSURE_MIN_SHIFT;
+    pfa->pressure.low = pfa->pressure.min + pfa->pressure.min / 4;
+    pfa->pressure.high = pfa->pressure.min + pfa->pressure.min / 2;
+
+    memset(&pfa->cma, 0x00, sizeof(pfa->cma));
+    synchs_lock_init(&pfa->cma.lock);
+
+    memset(pfa->stats, 0x00, sizeof(pfa->stats));
+
     /* 
     We initially 0 fill the entire bitmap to mark everything as allocated.
     We will later free real free regions. This catches weird edge cases of extra
@@ -386,15 +1571,24 @@ pmap_pfa_init(phys_addr_t ram_base,
     now and never make them available.
     */
     STATIC_ASSERT(BUDDY_BIT_ALLCOATED == 0);
-    memset(pfa->buddy_bitmaps[0], 0, bitmap_size);
+    memset(pfa->arenas[0].buddy_bitmaps[0], 0, bitmap_size);
 
     /* 
     Construct the buddy lists for all unreserved memory
     */
-    buddy_insert_range_freed_locked(
-        pa_to_page_id(bootstrap_pa_reserved),
-        size_to_page_count(ram_size - ram_base - bootstrap_pa_reserved)
-    );
+    init_start = routines_read_cntvct();
+    if (bulk_init) {
+        buddy_init_range_freed_locked(
+            pa_to_page_id(bootstrap_pa_reserved),
+            size_to_page_count(ram_size - ram_base - bootstrap_pa_reserved)
+        );
+    } else {
+        buddy_insert_range_freed_locked(
+            pa_to_page_id(bootstrap_pa_reserved),
+            size_to_page_count(ram_size - ram_base - bootstrap_pa_reserved)
+        );
+    }
+    pfa->init_ticks = routines_read_cntvct() - init_start;
 
     pmap_page_metadata_s m;
     memset(&m, 0x00, sizeof(m));
@@ -403,7 +1597,7 @@ pmap_pfa_init(phys_addr_t ram_base,
     m.page_type = PMAP_PAGE_TYPE_KERNEL_DATA;
     /* reserved data */
     apply_metadata_range_locked(
-        /* base page */ ram_base, 
+        /* base page */ page_base, 
         size_to_page_count(bootstrap_pa_reserved - ram_base), 
         &m
     );
@@ -424,27 +1618,218 @@ pmap_pfa_init(phys_addr_t ram_base,
     );
 
     printf(
-        "[*] pmap_pfa: Created PFA (used %zu pages, bitmap=%zu, MDS=%zu)\n", 
-        required_bytes >> PAGE_SHIFT, bitmap_size, mds_size
+        "[*] pmap_pfa: Created PFA (used %zu pages, bitmap=%zu, MDS=%zu, "
+        "extended MDS=%zu)\n", 
+        required_bytes >> PAGE_SHIFT, bitmap_size, mds_size, ext_mds_size
+    );
+    printf(
+        "[*] pmap_pfa: DMA zone = 0x%08llx -> 0x%08llx, "
+        "CMA zone = 0x%08llx -> 0x%08llx, "
+        "normal zone = 0x%08llx -> 0x%08llx\n",
+        page_id_to_pa(page_base), page_id_to_pa(dma_limit),
+        page_id_to_pa(dma_limit), page_id_to_pa(cma_limit),
+        page_id_to_pa(cma_limit), page_id_to_pa(page_base + page_count)
+    );
+    printf(
+        "[*] pmap_pfa: %u arenas of up to %llu pages\n", 
+        arena_count, 1ULL << arena_shift
+    );
+    printf(
+        "[*] pmap_pfa: Built free lists in %llu ticks (%s)\n",
+        pfa->init_ticks, bulk_init ? "bulk" : "per-block"
     );
+}
+
+/**
+ * Get the level of the free block which starts at PAGE, or BUDDY_LEVELS if no
+ * free block starts there
+ */
+static inline unsigned int
+buddy_free_block_level_locked(page_id_t page) {
+    struct pmap_pfa_arena *arena = arena_for_page(page);
+    unsigned int level_i = max_buddy_level_for_page_alignment(page) + 1;
+
+    while (level_i-- > 0) {
+        if (buddy_bitmap_get_bit_locked(arena, page, level_i) 
+                == BUDDY_BIT_FREE) {
+            return level_i;
+        }
+    }
 
+    return BUDDY_LEVELS;
 }
 
 /**
- * Attempts to allocate SIZE bytes of contiguous pages.
- * If no valid allocation can be made, returns PHYS_ADDR_INVALID.
+ * Changes the mobility class of the pageblock containing PAGE to MOBILITY and
+ * moves all of its free blocks onto the new class's lists. This walks the
+ * pageblock and so costs O(pageblock pages) in the worst case, but it only
+ * happens when a class runs out of memory.
+ */
+static void
+pageblock_claim_locked(page_id_t page, pmap_pfa_mobility_e mobility) {
+    struct pmap_pfa_zone *zone = zone_for_page(page);
+    page_id_t top_pages = buddy_level_page_count(BUDDY_LEVELS - 1);
+    page_id_t base = page & ~(top_pages - 1);
+    page_id_t limit = MIN(base + top_pages, pfa->page_base + pfa->page_count);
+
+    if (pageblock_mobility(page) == mobility) {
+        return;
+    }
+
+    pfa->pageblock_mobility[pageblock_index(page)] = mobility;
+    zone->claims++;
+
+    for (page_id_t page_i = base; page_i < limit;) {
+        unsigned int level = buddy_free_block_level_locked(page_i);
+        pmap_pfa_free_entry_t fe = NULL;
+
+        if (level == BUDDY_LEVELS) {
+            page_i++;
+            continue;
+        }
+
+        fe = get_pfa_free_entry_for_page(page_i);
+        list_remove(&fe->elem);
+        list_push_front(&zone->buddy_lists[mobility][level], &fe->elem);
+        page_i += buddy_level_page_count(level);
+    }
+}
+
+/**
+ * Merges every pair of free buddies in ZONE which lazy frees left unmerged,
+ * working up from the bottom level so that merged blocks go on to merge with
+ * their own buddies. Returns true if anything was merged.
+ * 
+ * Pairs are found a bitmap word at a time, so a pass costs O(zone page_count /
+ * 64) word reads plus the list updates of the merges themselves. Only levels
+ * where a lazy free left a pair, or where this pass merged blocks into, are
+ * scanned.
+ */
+static bool
+buddy_coalesce_locked(struct pmap_pfa_zone *zone) {
+    struct pmap_pfa_arena *arena = zone->arena;
+    page_id_t zone_limit = zone->page_base + zone->page_count;
+    uint32_t levels = zone->uncoalesced;
+    uint64_t merged = 0;
+    unsigned int word_reads = 0;
+
+    STATIC_ASSERT(BUDDY_LEVELS <= 32);
+    if (!levels) {
+        return false;
+    }
+    zone->uncoalesced = 0;
+
+    for (unsigned int level_i = 0; level_i < BUDDY_LEVELS - 1; level_i++) {
+        uint64_t *bitmap = arena->buddy_bitmaps[level_i];
+        size_t word_i = 0;
+        size_t word_limit = 0;
+
+        if (!(levels & (1U << level_i)) || zone->free_blocks[level_i] < 2) {
+            /* There's no pair to find */
+            continue;
+        }
+
+        word_i = buddy_bitmap_page_index(arena, zone->page_base, level_i);
+        word_limit = buddy_bitmap_page_index(
+            arena, zone_limit - 1, level_i
+        ) + 1;
+        for (; word_i < word_limit; word_i++) {
+            /* Arena bases are top level aligned, so roots are the even bits */
+            uint64_t pairs = bitmap[word_i] & (bitmap[word_i] >> 1) 
+                                & 0x5555555555555555ULL;
+
+            word_reads++;
+            while (pairs) {
+                unsigned int bit = __builtin_ctzll(pairs);
+                page_id_t page = arena->page_base
+                    + (((page_id_t)word_i * 64 + bit) << level_i);
+
+                pairs &= pairs - 1;
+                if (page < zone->page_base || page >= zone_limit) {
+                    /* The word is shared with another zone */
+                    continue;
+                }
+
+                buddy_block_remove_locked(page, level_i);
+                buddy_block_remove_locked(
+                    page + buddy_level_page_count(level_i), level_i
+                );
+                buddy_block_insert_locked(page, level_i + 1);
+                levels |= 1U << (level_i + 1);
+                merged++;
+            }
+        }
+    }
+
+    stats_record_buddy_ops(0, word_reads);
+    if (merged) {
+        arena->coalesces++;
+        arena->coalesced += merged;
+    }
+
+    return merged != 0;
+}
+
+/** Runs buddy_coalesce_locked over every zone of ARENA */
+static void
+arena_coalesce_locked(struct pmap_pfa_arena *arena) {
+    for (unsigned int zone_i = 0; zone_i < PMAP_PFA_ZONE_COUNT; zone_i++) {
+        buddy_coalesce_locked(&arena->zones[zone_i]);
+    }
+}
+
+/**
+ * Finds a free block of at least MIN_LEVEL in ZONE on the lists of a mobility
+ * class other than MOBILITY. Returns the page ID of the block and writes its
+ * level to LEVEL_OUT, or returns PAGE_ID_INVALID if there is none. The block is
+ * not removed from its list.
+ * 
+ * The largest block available is taken so that a steal is more likely to claim
+ * an entire pageblock (see pageblock_claim_locked) rather than leaving pages
+ * of MOBILITY scattered across pageblocks of other classes.
+ */
+static page_id_t
+buddy_steal_locked(struct pmap_pfa_zone *zone, unsigned int min_level,
+                   pmap_pfa_mobility_e mobility, unsigned int *level_out) {
+    for (unsigned int i = 0; i < PMAP_PFA_MOBILITY_COUNT - 1; i++) {
+        pmap_pfa_mobility_e from = mobility_fallbacks[mobility][i];
+
+        for (unsigned int level_i = BUDDY_LEVELS; level_i-- > min_level;) {
+            struct list *buddy_list = &zone->buddy_lists[from][level_i];
+            page_id_t page = 0;
+
+            if (list_empty(buddy_list)) {
+                continue;
+            }
+
+            page = buddy_list_front_page(buddy_list);
+            zone->steals++;
+            if (level_i >= PAGEBLOCK_CLAIM_LEVEL) {
+                pageblock_claim_locked(page, mobility);
+            }
+
+            *level_out = level_i;
+            return page;
+        }
+    }
+
+    return PAGE_ID_INVALID;
+}
+
+/**
+ * Removes SIZE bytes of contiguous pages of class MOBILITY from ZONE without
+ * applying any metadata. Returns the first page ID of the allocation or
+ * PAGE_ID_INVALID if no valid allocation can be made.
  * Returns in constant time wrt size, linear wrt the number of buddy levels.
  * 
  * NOTE: This function CANNOT service requests of 
- * SIZE > PAGE_SIZE << (BUDDY_LEVELS - 1). It is INVALID and UNDEFINED to 
- * TODO: Support larger allocations via another function
+ * SIZE > PAGE_SIZE << (BUDDY_LEVELS - 1). Use the large allocator instead.
  */ 
-static phys_addr_t
-pmap_pfa_alloc_contig_small_locked(size_t size, 
-                                     pmap_page_metadata_s *metadata) {
-    phys_addr_t allocated_element = PHYS_ADDR_INVALID;
+static page_id_t
+buddy_alloc_small_locked(struct pmap_pfa_zone *zone, size_t size,
+                         pmap_pfa_mobility_e mobility) {
+    page_id_t allocated_page = PAGE_ID_INVALID;
     unsigned int level_i = 0;
-    pmap_pfa_free_entry_t allocated_entry = NULL;
     page_id_t page_count = 0;
     
     page_count = size_to_page_count(size);
@@ -463,7 +1848,7 @@ pmap_pfa_alloc_contig_small_locked(size_t size,
             level_i++) {
             struct list *buddy_list = NULL;
 
-            buddy_list = pfa->buddy_lists + level_i;
+            buddy_list = &zone->buddy_lists[mobility][level_i];
         
             if (list_empty(buddy_list)) {
                 /* If the list is empty, it cannot satisfy the request */
@@ -474,32 +1859,32 @@ pmap_pfa_alloc_contig_small_locked(size_t size,
             We found a list with at least one element on it, grab the first free
             chunk off the buddy list.
             */
-            allocated_entry = list_entry(
-                list_front(buddy_list), 
-                struct pmap_pfa_free_entry, 
-                elem
-            );
-
-            allocated_element = pmap_physmap_kva_to_pa(
-                (vm_addr_t)allocated_entry
-            );
+            allocated_page = buddy_list_front_page(buddy_list);
             break;
     }
 
-    if (!allocated_entry) {
+    if (allocated_page == PAGE_ID_INVALID && buddy_coalesce_locked(zone)) {
+        /* Merges we deferred may have left us a large enough block */
+        return buddy_alloc_small_locked(zone, size, mobility);
+    }
+
+    if (allocated_page == PAGE_ID_INVALID) {
+        /* Our class is out of memory, borrow from another class */
+        allocated_page = buddy_steal_locked(
+            zone, min_buddy_level_for_size(size), mobility, &level_i
+        );
+    }
+
+    if (allocated_page == PAGE_ID_INVALID) {
         /* We do not have the requested memory, OOM event */
-        return PHYS_ADDR_INVALID;
+        return PAGE_ID_INVALID;
     }
 
     /* level_i holds the level we allocated from */
 
     /* Remove it from whatever free list it's on, allocate it in the bitmap */
-    list_remove(&allocated_entry->elem);
-    buddy_bitmap_set_bit_locked(
-        /* page ID */ pa_to_page_id(allocated_element), 
-        /* level   */ level_i, 
-        /* bit     */ BUDDY_BIT_ALLCOATED
-    );
+    buddy_block_remove_locked(allocated_page, level_i);
+    stats_record_split(level_i - min_buddy_level_for_size(size));
 
     /* 
     Free any space of this block that we aren't using 
@@ -508,172 +1893,3084 @@ pmap_pfa_alloc_contig_small_locked(size_t size,
     would have already been joined before).
     */
     buddy_insert_range_freed_locked(
-        pa_to_page_id(allocated_element) + page_count,
+        allocated_page + page_count,
         buddy_level_page_count(level_i) - page_count
     );
 
-    apply_metadata_range_locked(
-        /* base */ pa_to_page_id(allocated_element),
-        /* page_count */ page_count,
-        metadata
-    );
-
-    return allocated_element;
+    return allocated_page;
 }
 
-phys_addr_t
-pmap_pfa_alloc_contig(size_t size, pmap_page_metadata_s *metadata) {
-    phys_addr_t allocation = PHYS_ADDR_INVALID;
-    if (size > (PAGE_SIZE << (BUDDY_LEVELS - 1))) {
+/**
+ * Removes up to COUNT independent blocks of 2^ORDER pages from ZONE and writes
+ * their addresses to BLOCKS without applying metadata. Returns the number of
+ * blocks allocated, which is only less than COUNT if the zone is out of memory.
+ * 
+ * Rather than allocating and splitting once per block, each free block taken
+ * from the lists is carved directly into as many batch entries as it can hold.
+ * Only the unused remainder of the final block is returned to the lists.
+ */
+static size_t
+buddy_alloc_batch_zone_locked(struct pmap_pfa_zone *zone, unsigned int order,
+                              phys_addr_t *blocks, size_t count,
+                              pmap_pfa_mobility_e mobility) {
+    page_id_t block_pages = buddy_level_page_count(order);
+    unsigned int level_i = order;
+    size_t allocated = 0;
+
+    /*
+    Remainders are only inserted once the batch is full, so lower levels never
+    refill while we're working and we can walk up the levels monotonically.
+    */
+    while (allocated < count) {
+        struct list *buddy_list = &zone->buddy_lists[mobility][level_i];
+        page_id_t page = 0;
+        unsigned int level = level_i;
+        page_id_t split_count = 0;
+        page_id_t take_count = 0;
+
+        if (level_i < BUDDY_LEVELS - 1 && list_empty(buddy_list)) {
+            level_i++;
+            continue;
+        }
+
+        if (!list_empty(buddy_list)) {
+            page = buddy_list_front_page(buddy_list);
+        } else if (buddy_coalesce_locked(zone)) {
+            /* Deferred merges may have made blocks of our class, start over */
+            level_i = order;
+            continue;
+        } else {
+            /* 
+            Our class is out of memory, borrow from another. A claim may have
+            moved small blocks onto our lists so start over from the bottom.
+            */
+            page = buddy_steal_locked(zone, order, mobility, &level);
+            if (page == PAGE_ID_INVALID) {
+                break;
+            }
+            level_i = order;
+        }
+
+        buddy_block_remove_locked(page, level);
+        stats_record_split(level - order);
+
+        /* Split the block into the batch */
+        split_count = buddy_level_page_count(level - order);
+        take_count = MIN(split_count, count - allocated);
+        for (page_id_t i = 0; i < take_count; i++) {
+            blocks[allocated++] = page_id_to_pa(page + i * block_pages);
+        }
+
+        /* Return anything the batch didn't need */
+        buddy_insert_range_freed_locked(
+            page + take_count * block_pages,
+            (split_count - take_count) * block_pages
+        );
+    }
+
+    return allocated;
+}
+
+/**
+ * Get the number of pages free in the buddy allocator of every zone of every
+ * arena. This is read without any lock, so it is only a snapshot.
+ */
+static inline size_t
+pressure_free_pages(void) {
+    size_t free_pages = 0;
+
+    for (unsigned int arena_i = 0; arena_i < pfa->arena_count; arena_i++) {
+        struct pmap_pfa_arena *arena = &pfa->arenas[arena_i];
+
+        for (unsigned int zone_i = 0; zone_i < PMAP_PFA_ZONE_COUNT; zone_i++) {
+            free_pages += __atomic_load_n(
+                &arena->zones[zone_i].free_pages, __ATOMIC_RELAXED
+            );
+        }
+    }
+
+    return free_pages;
+}
+
+/** 
+ * Starts background reclaim if we've fallen below the low watermark. This may
+ * be called with or without an arena lock held, so the first step is left to
+ * pressure_kick.
+ */
+static inline void
+pressure_check(void) {
+    if (!__atomic_load_n(&pfa->pressure.reclaiming, __ATOMIC_RELAXED)
+            && pressure_free_pages() 
+                < __atomic_load_n(&pfa->pressure.low, __ATOMIC_RELAXED)
+            && !__atomic_exchange_n(
+                &pfa->pressure.reclaiming, true, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&pfa->pressure.low_crossings, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&pfa->pressure.kick, true, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Asks SHRINKER for up to PAGES pages and returns the number it freed. Its
+ * frees bypass this core's magazines, so what it reclaims is free in the buddy
+ * allocator straight away and no cache has to be drained to find it.
+ */
+static size_t
+pressure_shrink(const struct pmap_pfa_shrinker *shrinker, size_t pages) {
+    struct pmap_pfa_pcp *pcp = &pfa->pcp[smp_get_cpu_id()];
+    bool nested = pcp->in_reclaim;
+    size_t freed = 0;
+
+    pcp->in_reclaim = true;
+    freed = shrinker->shrink(pages, shrinker->context);
+    pcp->in_reclaim = nested;
+
+    return freed;
+}
+
+/**
+ * Asks the next shrinker in turn for some memory if free memory fell below the
+ * low watermark and hasn't yet recovered to the high watermark. A shrinker with
+ * nothing to give passes its turn on, so every shrinker is asked at most once.
+ * Returns true if any pages were reclaimed.
+ */
+static bool
+pressure_background_step(void) {
+    const struct pmap_pfa_shrinker *shrinker = NULL;
+    unsigned int count = 0;
+    size_t wanted = 0;
+    size_t freed = 0;
+
+    PRESSURE_LOCK(pfa);
+    if (__atomic_load_n(&pfa->pressure.reclaiming, __ATOMIC_RELAXED)) {
+        size_t free_pages = pressure_free_pages();
+
+        if (free_pages >= pfa->pressure.high) {
+            __atomic_store_n(
+                &pfa->pressure.reclaiming, false, __ATOMIC_RELAXED
+            );
+        } else if ((count = pfa->pressure.shrinker_count)) {
+            shrinker = pfa->pressure.shrinkers[
+                pfa->pressure.next_shrinker++ % count
+            ];
+            wanted = MIN(
+                pfa->pressure.high - free_pages, PRESSURE_RECLAIM_BATCH
+            );
+            pfa->pressure.async_runs++;
+        }
+    }
+    PRESSURE_UNLOCK(pfa);
+
+    if (!shrinker) {
+        return false;
+    }
+
+    for (unsigned int tried = 1;
+            !(freed = pressure_shrink(shrinker, wanted)); tried++) {
+        if (tried == count) {
+            return false;
+        }
+
+        PRESSURE_LOCK(pfa);
+        shrinker = pfa->pressure.shrinkers[
+            pfa->pressure.next_shrinker++ % pfa->pressure.shrinker_count
+        ];
+        pfa->pressure.async_runs++;
+        PRESSURE_UNLOCK(pfa);
+    }
+
+    PRESSURE_LOCK(pfa);
+    pfa->pressure.pages_reclaimed += freed;
+    PRESSURE_UNLOCK(pfa);
+
+    return true;
+}
+
+/**
+ * Takes the first step of background reclaim on the calling core if free memory
+ * just fell below the low watermark. Idle cores take the rest, but this way
+ * reclaim starts even if no core is idle. This is called by every allocation
+ * entry point once it holds no locks.
+ */
+static void
+pressure_kick(void) {
+    if (__atomic_load_n(&pfa->pressure.kick, __ATOMIC_RELAXED)
+            && __atomic_exchange_n(&pfa->pressure.kick, false, 
+                                   __ATOMIC_RELAXED)) {
+        pressure_background_step();
+    }
+}
+
+/**
+ * Records that a request preferring zone PREFERRED, made by a core whose home
+ * arena is index HOME, was serviced by zone SERVED of ARENA (or failed, if
+ * SERVED is PMAP_PFA_ZONE_COUNT)
+ */
+static inline void
+zone_account_locked(struct pmap_pfa_arena *arena, unsigned int home,
+                    pmap_pfa_zone_e preferred, pmap_pfa_zone_e served) {
+    if (served == PMAP_PFA_ZONE_COUNT) {
+        arena->zones[preferred].failures++;
+        return;
+    }
+
+    arena->zones[served].allocations++;
+    if (served != preferred) {
+        arena->zones[served].fallbacks++;
+    }
+    if (arena != &pfa->arenas[home]) {
+        arena->remote_allocations++;
+    }
+}
+
+/** Records that a request preferring PREFERRED failed in every arena */
+static void
+zone_account_failure(unsigned int home, pmap_pfa_zone_e preferred) {
+    struct pmap_pfa_arena *arena = &pfa->arenas[home];
+
+    ARENA_LOCK(arena);
+    zone_account_locked(arena, home, preferred, PMAP_PFA_ZONE_COUNT);
+    ARENA_UNLOCK(arena);
+}
+
+/**
+ * Removes up to COUNT independent blocks of 2^ORDER pages from the buddy
+ * allocators and writes their addresses to BLOCKS without applying metadata.
+ * Zones are tried in the fallback order for PREFERRED, each in every arena
+ * starting from the calling core's home, and the blocks are of class MOBILITY.
+ * Returns the number of blocks allocated, which is only less than COUNT if the
+ * system is out of memory.
+ * 
+ * Each arena's lock is taken in turn, and only if the arenas before it could
+ * not fill the batch.
+ */
+static size_t
+buddy_alloc_batch(unsigned int order, phys_addr_t *blocks, size_t count, 
+                  pmap_pfa_zone_e preferred, pmap_pfa_mobility_e mobility) {
+    unsigned int home = arena_home_index();
+    size_t allocated = 0;
+
+    for (unsigned int i = 0; i < PMAP_PFA_ZONE_COUNT && allocated < count; i++) {
+        pmap_pfa_zone_e zone_i = zone_fallbacks[preferred][i];
+
+        if (zone_i == PMAP_PFA_ZONE_COUNT) {
+            break;
+        }
+
+        for (unsigned int arena_i = 0; 
+                arena_i < pfa->arena_count && allocated < count; arena_i++) {
+            struct pmap_pfa_arena *arena = arena_nth(home, arena_i);
+            size_t got = 0;
+
+            if (!arena->zones[zone_i].page_count) {
+                continue;
+            }
+
+            ARENA_LOCK(arena);
+            got = buddy_alloc_batch_zone_locked(
+                &arena->zones[zone_i], order, blocks + allocated, 
+                count - allocated, mobility
+            );
+            if (got) {
+                zone_account_locked(arena, home, preferred, zone_i);
+            }
+            ARENA_UNLOCK(arena);
+
+            allocated += got;
+        }
+    }
+
+    if (allocated < count) {
+        zone_account_failure(home, preferred);
+    }
+
+    pressure_check();
+    return allocated;
+}
+
+/**
+ * Finds the first run of COUNT adjacent free blocks on buddy level LEVEL which
+ * lies entirely within ZONE and begins on a multiple of ALIGN blocks by
+ * scanning the level's bitmap. Returns the page ID of the first block in the
+ * run or PAGE_ID_INVALID if no such run exists.
+ * 
+ * Runs in O(zone page_count / (64 << LEVEL)) bitmap word reads. Words which are
+ * entirely free or entirely allocated are consumed in a single step, and mixed
+ * words are consumed one run of bits at a time.
+ */
+static page_id_t
+buddy_bitmap_find_free_run_locked(struct pmap_pfa_zone *zone, 
+                                  unsigned int level, page_id_t count,
+                                  page_id_t align) {
+    struct pmap_pfa_arena *arena = zone->arena;
+    uint64_t *bitmap = arena->buddy_bitmaps[level];
+    /* Alignment is physical, and the arena base is aligned to the top level */
+    size_t base_bits = arena->page_base >> level;
+    size_t bit_i = 0;
+    size_t bit_limit = 0;
+    size_t run_start = 0;
+    size_t run_length = 0;
+    size_t aligned_start = 0;
+
+    /* Bits are indexed relative to the arena, not the zone */
+    bit_i = (zone->page_base - arena->page_base) >> level;
+    bit_limit = (zone->page_base + zone->page_count - arena->page_base 
+                    + buddy_level_page_count(level) - 1) >> level;
+
+    while (bit_i < bit_limit) {
+        unsigned int shift = bit_i % 64;
+        unsigned int avail = MIN(64 - shift, bit_limit - bit_i);
+        uint64_t rest = bitmap[bit_i / 64] >> shift;
+        unsigned int span = 0;
+
+        if (avail < 64) {
+            /* Mask off anything past the end of the zone */
+            rest &= (1LLU << avail) - 1;
+        }
+
+        if (rest & BUDDY_BIT_FREE) {
+            /* 
+            Count the free bits. The shift and mask fill the top with zeroes, so
+            ~rest always has a set bit unless the whole word is free.
+            */
+            span = ~rest ? __builtin_ctzll(~rest) : 64;
+            if (!run_length) {
+                run_start = bit_i;
+            }
+            run_length += span;
+
+            /* The allocation begins on the first aligned block in the run */
+            aligned_start = ROUND_UP(base_bits + run_start, align) - base_bits;
+            if (run_start + run_length >= aligned_start + count) {
+                return arena->page_base + (aligned_start << level);
+            }
+        } else {
+            /* 
+            Count the allocated bits, these end any run. An empty word is 
+            consumed in one step.
+            */
+            span = rest ? __builtin_ctzll(rest) : avail;
+            run_length = 0;
+        }
+
+        bit_i += span;
+    }
+
+    return PAGE_ID_INVALID;
+}
+
+/**
+ * Attempts to allocate SIZE bytes of contiguous pages from ZONE where SIZE (or
+ * the alignment ALIGN_PAGES) is larger than the top buddy level, without
+ * applying metadata. The allocation is built out of a run of adjacent, free top
+ * level blocks of any class which begins on a multiple of ALIGN_PAGES, and they
+ * all become pageblocks of class MOBILITY. Any unused tail of the final block
+ * is returned to the buddy lists.
+ * If no valid allocation can be made, returns PAGE_ID_INVALID.
+ * 
+ * Worst case cost is one top level bitmap scan (see 
+ * buddy_bitmap_find_free_run_locked) plus one list removal per top level block
+ * in the allocation.
+ */
+static page_id_t
+buddy_alloc_large_locked(struct pmap_pfa_zone *zone, size_t size,
+                         page_id_t align_pages, pmap_pfa_mobility_e mobility) {
+    unsigned int top_level = BUDDY_LEVELS - 1;
+    page_id_t block_pages = buddy_level_page_count(top_level);
+    page_id_t page_count = 0;
+    page_id_t block_count = 0;
+    page_id_t base = 0;
+
+    page_count = size_to_page_count(size);
+    block_count = ROUND_UP(page_count, block_pages) / block_pages;
+
+    /* Top level blocks are already aligned to anything smaller than them */
+    base = buddy_bitmap_find_free_run_locked(
+        zone, top_level, block_count, MAX(1, align_pages / block_pages)
+    );
+    if (base == PAGE_ID_INVALID && buddy_coalesce_locked(zone)) {
+        /* Merges we deferred may complete a run */
+        base = buddy_bitmap_find_free_run_locked(
+            zone, top_level, block_count, MAX(1, align_pages / block_pages)
+        );
+    }
+    if (base == PAGE_ID_INVALID) {
+        /* No run is long enough, OOM (or too fragmented) event */
+        return PAGE_ID_INVALID;
+    }
+
+    /* Pull every block in the run off the top level list */
+    for (page_id_t block_i = 0; block_i < block_count; block_i++) {
+        page_id_t page_i = base + block_i * block_pages;
+
+        buddy_block_remove_locked(page_i, top_level);
+        pfa->pageblock_mobility[pageblock_index(page_i)] = mobility;
+    }
+
+    /* 
+    Free the unused tail of the last block. As in the small allocator, there is
+    nothing to join since the rest of this block is allocated.
+    */
+    buddy_insert_range_freed_locked(
+        base + page_count,
+        block_count * block_pages - page_count
+    );
+
+    return base;
+}
+
+/**
+ * Attempts to allocate SIZE bytes from ZONE which begin on a multiple of
+ * 2^ALIGN_LEVEL pages, where the size fits within the top buddy level, without
+ * applying metadata. Returns the first page ID of the allocation or
+ * PAGE_ID_INVALID if no valid allocation can be made.
+ * 
+ * If the alignment also fits within the top level, any block of the larger of
+ * the two levels is suitably aligned, so we first try to take one off the lists
+ * in constant time. Failing that (which is likely only when memory is
+ * fragmented), or if the alignment is above the top level, we scan the bitmap
+ * of every level from the size's up to just below the alignment's (or up to the
+ * top), smallest first, for a free block which happens to be aligned. Whatever
+ * block we take, the pages before and after the allocation go back onto the
+ * lists.
+ */
+static page_id_t
+buddy_alloc_aligned_small_locked(struct pmap_pfa_zone *zone, size_t size,
+                                 unsigned int align_level,
+                                 pmap_pfa_mobility_e mobility) {
+    unsigned int size_level = min_buddy_level_for_size(size);
+    unsigned int level = MAX(size_level, align_level);
+    page_id_t page_count = size_to_page_count(size);
+    page_id_t block = PAGE_ID_INVALID;
+    page_id_t page = PAGE_ID_INVALID;
+    page_id_t block_end = 0;
+
+    ASSERT(size_level < BUDDY_LEVELS);
+
+    if (level < BUDDY_LEVELS) {
+        block = buddy_alloc_small_locked(
+            zone, (size_t)PAGE_SIZE << level, mobility
+        );
+    }
+    if (block != PAGE_ID_INVALID) {
+        /* This already gave back everything past the aligned level's block */
+        block_end = block + buddy_level_page_count(level);
+    }
+
+    for (level = size_level; block == PAGE_ID_INVALID 
+            && level < MIN(align_level, BUDDY_LEVELS); level++) {
+        /* A block of this level is aligned if it starts on the alignment */
+        block = buddy_bitmap_find_free_run_locked(
+            zone, level, 1, (page_id_t)1 << (align_level - level)
+        );
+
+        if (block != PAGE_ID_INVALID) {
+            buddy_block_remove_locked(block, level);
+            block_end = block + buddy_level_page_count(level);
+        }
+    }
+
+    if (block == PAGE_ID_INVALID) {
+        return PAGE_ID_INVALID;
+    }
+
+    /* 
+    The allocation begins at the first aligned page in the block. Trim the head
+    and the tail, as in buddy_alloc_small_locked.
+    */
+    page = ROUND_UP(block, (page_id_t)1 << align_level);
+    ASSERT(page + page_count <= block_end);
+    buddy_insert_range_freed_locked(block, page - block);
+    buddy_insert_range_freed_locked(
+        page + page_count, block_end - page - page_count
+    );
+
+    return page;
+}
+
+/**
+ * Attempts to allocate SIZE bytes of contiguous pages of class MOBILITY from
+ * ZONE which begin on a multiple of ALIGN_PAGES (a power of two), without
+ * applying metadata. Returns the first page ID of the allocation or
+ * PAGE_ID_INVALID if no valid allocation can be made.
+ */
+static page_id_t
+zone_alloc_locked(struct pmap_pfa_zone *zone, size_t size, 
+                  page_id_t align_pages, pmap_pfa_mobility_e mobility) {
+    unsigned int align_level = __builtin_ctz(align_pages);
+    page_id_t base = PAGE_ID_INVALID;
+
+    if (size > (PAGE_SIZE << (BUDDY_LEVELS - 1))) {
+        return buddy_alloc_large_locked(zone, size, align_pages, mobility);
+    } else if (align_level > BUDDY_LEVELS - 1) {
+        /* 
+        A whole top level block is quickest, but a smaller one may be free at
+        an aligned address when no top level block there is
+        */
+        base = buddy_alloc_large_locked(zone, size, align_pages, mobility);
+        if (base == PAGE_ID_INVALID) {
+            base = buddy_alloc_aligned_small_locked(
+                zone, size, align_level, mobility
+            );
+        }
+        return base;
+    } else if (align_level > min_buddy_level_for_size(size)) {
+        return buddy_alloc_aligned_small_locked(
+            zone, size, align_level, mobility
+        );
+    }
+
+    /* Blocks are naturally aligned to at least the alignment */
+    return buddy_alloc_small_locked(zone, size, mobility);
+}
+
+/**
+ * Attempts the allocation described by pmap_pfa_alloc_contig_arenas from zone
+ * ZONE_I of ARENA, whose lock must be held, and applies METADATA. HOME is the
+ * index of the calling core's home arena. Returns the first page ID of the
+ * allocation or PAGE_ID_INVALID if no valid allocation can be made.
+ */
+static page_id_t
+arena_alloc_locked(struct pmap_pfa_arena *arena, unsigned int home,
+                   pmap_pfa_zone_e zone_i, size_t size, page_id_t align_pages,
+                   pmap_page_metadata_s *metadata, pmap_pfa_zone_e preferred,
+                   pmap_pfa_mobility_e mobility) {
+    page_id_t base = zone_alloc_locked(
+        &arena->zones[zone_i], size, align_pages, mobility
+    );
+
+    if (base != PAGE_ID_INVALID) {
+        zone_account_locked(arena, home, preferred, zone_i);
+        apply_metadata_range_locked(base, size_to_page_count(size), metadata);
+    }
+
+    return base;
+}
+
+/**
+ * Attempts to allocate SIZE bytes of contiguous pages of class MOBILITY which
+ * begin on a multiple of ALIGN_PAGES (a power of two) and applies METADATA.
+ * Zones are tried in the fallback order for PREFERRED and METADATA, and each
+ * zone is tried in every arena (starting from the calling core's home arena)
+ * before falling back to the next. Each arena's lock is taken in turn.
+ * If no valid allocation can be made, returns PHYS_ADDR_INVALID.
+ */ 
+static phys_addr_t
+pmap_pfa_alloc_contig_arenas(size_t size, page_id_t align_pages,
+                             pmap_page_metadata_s *metadata,
+                             pmap_pfa_zone_e preferred,
+                             pmap_pfa_mobility_e mobility) {
+    const pmap_pfa_zone_e *fallbacks = zone_fallbacks_for(preferred, metadata);
+    unsigned int home = arena_home_index();
+    page_id_t base = PAGE_ID_INVALID;
+
+    ASSERT(align_pages && !(align_pages & (align_pages - 1)));
+
+    for (unsigned int i = 0; i < PMAP_PFA_ZONE_COUNT; i++) {
+        pmap_pfa_zone_e zone_i = fallbacks[i];
+
+        if (zone_i == PMAP_PFA_ZONE_COUNT) {
+            break;
+        }
+
+        for (unsigned int arena_i = 0; arena_i < pfa->arena_count; arena_i++) {
+            struct pmap_pfa_arena *arena = arena_nth(home, arena_i);
+
+            if (!arena->zones[zone_i].page_count) {
+                continue;
+            }
+
+            ARENA_LOCK(arena);
+            base = arena_alloc_locked(
+                arena, home, zone_i, size, align_pages, metadata, preferred,
+                mobility
+            );
+            ARENA_UNLOCK(arena);
+
+            if (base != PAGE_ID_INVALID) {
+                pressure_check();
+                return page_id_to_pa(base);
+            }
+        }
+    }
+
+    zone_account_failure(home, preferred);
+    pressure_check();
+    return PHYS_ADDR_INVALID;
+}
+
+uint32_t
+pmap_pfa_mds_read_begin(page_id_t page) {
+    uint32_t *seq = NULL;
+    uint32_t count = 0;
+
+    ASSERT(page - pfa->page_base < pfa->page_count);
+    seq = &pfa->mds_seq[pageblock_index(page)];
+
+    /* Writes are a memset at most, so just wait them out */
+    while ((count = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) 
+            & MDS_SEQ_WRITERS_MASK) {}
+
+    return count;
+}
+
+bool
+pmap_pfa_mds_read_retry(page_id_t page, uint32_t seq) {
+    ASSERT(page - pfa->page_base < pfa->page_count);
+
+    /* Order the caller's reads before the count check */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(
+        &pfa->mds_seq[pageblock_index(page)], __ATOMIC_RELAXED
+    ) != seq;
+}
+
+void
+pmap_pfa_mds_get_metadata(page_id_t page, pmap_page_metadata_s *metadata) {
+    uint32_t seq = 0;
+    uint8_t m8 = 0;
+
+    STATIC_ASSERT(sizeof(*metadata) == sizeof(m8));
+    do {
+        seq = pmap_pfa_mds_read_begin(page);
+        m8 = __atomic_load_n(
+            (uint8_t *)&pfa->metadata[page - pfa->page_base], __ATOMIC_RELAXED
+        );
+    } while (pmap_pfa_mds_read_retry(page, seq));
+
+    memcpy(metadata, &m8, sizeof(*metadata));
+}
+
+/** Get the index of PAGE in the MDS and extended MDS arrays */
+static inline page_id_t
+mds_index(page_id_t page) {
+    ASSERT(page - pfa->page_base < pfa->page_count);
+    return page - pfa->page_base;
+}
+
+uint16_t
+pmap_pfa_mds_refcount_get(page_id_t page) {
+    return __atomic_load_n(&pfa->mds_refcount[mds_index(page)], 
+                           __ATOMIC_ACQUIRE);
+}
+
+uint16_t
+pmap_pfa_mds_refcount_inc(page_id_t page) {
+    uint16_t count = __atomic_add_fetch(
+        &pfa->mds_refcount[mds_index(page)], 1, __ATOMIC_ACQ_REL
+    );
+
+    ASSERT(count != 0);
+    return count;
+}
+
+uint16_t
+pmap_pfa_mds_refcount_dec(page_id_t page) {
+    uint16_t count = __atomic_sub_fetch(
+        &pfa->mds_refcount[mds_index(page)], 1, __ATOMIC_ACQ_REL
+    );
+
+    ASSERT(count != UINT16_MAX);
+    return count;
+}
+
+uint16_t
+pmap_pfa_mds_mapcount_get(page_id_t page) {
+    return __atomic_load_n(&pfa->mds_mapcount[mds_index(page)], 
+                           __ATOMIC_ACQUIRE);
+}
+
+uint16_t
+pmap_pfa_mds_mapcount_inc(page_id_t page) {
+    uint16_t count = __atomic_add_fetch(
+        &pfa->mds_mapcount[mds_index(page)], 1, __ATOMIC_ACQ_REL
+    );
+
+    ASSERT(count != 0);
+    return count;
+}
+
+uint16_t
+pmap_pfa_mds_mapcount_dec(page_id_t page) {
+    uint16_t count = __atomic_sub_fetch(
+        &pfa->mds_mapcount[mds_index(page)], 1, __ATOMIC_ACQ_REL
+    );
+
+    ASSERT(count != UINT16_MAX);
+    return count;
+}
+
+uint32_t
+pmap_pfa_mds_owner_get(page_id_t page) {
+    return __atomic_load_n(&pfa->mds_owner[mds_index(page)], __ATOMIC_ACQUIRE);
+}
+
+void
+pmap_pfa_mds_owner_set(page_id_t page, uint32_t owner) {
+    __atomic_store_n(&pfa->mds_owner[mds_index(page)], owner, __ATOMIC_RELEASE);
+}
+
+bool
+pmap_pfa_mds_owner_cmpxchg(page_id_t page, uint32_t expected, 
+                           uint32_t owner) {
+    return __atomic_compare_exchange_n(
+        &pfa->mds_owner[mds_index(page)], &expected, owner, false,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE
+    );
+}
+
+/** Returns true if every lane of VECTOR is 0xFF */
+static inline bool
+mds_vector_all_set(mds_vector_t vector) {
+    uint64_t halves[2];
+
+    memcpy(halves, &vector, sizeof(halves));
+    return (halves[0] & halves[1]) == UINT64_MAX;
+}
+
+page_id_t
+pmap_pfa_mds_find_type_mismatch(page_id_t page, page_id_t count,
+                                pmap_page_type_e type) {
+    const uint8_t *mds = NULL;
+    pmap_page_metadata_s m;
+    uint8_t type_mask = 0;
+    uint8_t type_value = 0;
+    mds_vector_t mask_vector;
+    mds_vector_t type_vector;
+    page_id_t i = 0;
+
+    REQUIRE(page - pfa->page_base <= pfa->page_count);
+    REQUIRE(count <= pfa->page_count - (page - pfa->page_base));
+
+    /* Build the byte patterns without assuming how the bitfield is laid out */
+    memset(&m, 0x00, sizeof(m));
+    /* Wraps to all ones, whatever the field's width */
+    m.page_type--;
+    memcpy(&type_mask, &m, sizeof(m));
+    m.page_type = type;
+    memcpy(&type_value, &m, sizeof(m));
+    mask_vector = (mds_vector_t){ 0 } + type_mask;
+    type_vector = (mds_vector_t){ 0 } + type_value;
+
+    /*
+    No lock is taken. Every entry is a single byte so we never see a torn entry,
+    and the caller owns the pages so their types can't be changing under us.
+    */
+    mds = (const uint8_t *)pfa->metadata + (page - pfa->page_base);
+
+    /* Walk up to a vector boundary, since we can't make unaligned accesses */
+    for (; i < count && (vm_addr_t)(mds + i) % MDS_VECTOR_PAGES; i++) {
+        if ((mds[i] & type_mask) != type_value) {
+            return page + i;
+        }
+    }
+
+    /* Check two vectors (32 pages) per iteration */
+    for (; i + 2 * MDS_VECTOR_PAGES <= count; i += 2 * MDS_VECTOR_PAGES) {
+        mds_vector_t lo = *(const mds_vector_t *)(mds + i);
+        mds_vector_t hi = *(const mds_vector_t *)(mds + i + MDS_VECTOR_PAGES);
+        mds_vector_t match = (mds_vector_t)((lo & mask_vector) == type_vector)
+                           & (mds_vector_t)((hi & mask_vector) == type_vector);
+
+        if (!mds_vector_all_set(match)) {
+            /* The scalar loop below finds the first offender in this chunk */
+            break;
+        }
+    }
+
+    for (; i < count; i++) {
+        if ((mds[i] & type_mask) != type_value) {
+            return page + i;
+        }
+    }
+
+    return PAGE_ID_INVALID;
+}
+
+void
+pmap_pfa_mds_require_range_type(page_id_t page, page_id_t count,
+                                pmap_page_type_e type) {
+    page_id_t bad_page = pmap_pfa_mds_find_type_mismatch(page, count, type);
+
+    if (bad_page != PAGE_ID_INVALID) {
+        pmap_page_metadata_s metadata;
+
+        metadata = pfa->metadata[bad_page - pfa->page_base];
+        panic(
+            "Incorrect page type on page %u (was %d but expected %d)",
+            bad_page, metadata.page_type, type
+        );
+    }
+}
+
+/**
+ * Frees the naturally aligned block of 2^LEVEL pages starting at PAGE by both
+ * modifying the free lists and the buddy bitmaps. The block is merged with its
+ * buddies as far up as possible, so this costs O(BUDDY_LEVELS - LEVEL), unless
+ * the level still has lazy slack in which case it isn't merged at all.
+ */
+static void
+buddy_free_block_locked(page_id_t page, unsigned int level) {
+    struct pmap_pfa_zone *zone = zone_for_page(page);
+    unsigned int level_i = level;
+    page_id_t page_i = page;
+    unsigned int bitmap_reads = 0;
+
+    ASSERT(page % buddy_level_page_count(level) == 0);
+
+    if (pfa->lazy.enabled 
+            && zone->free_blocks[level] < pfa->lazy.slack[level]) {
+        page_id_t buddy = get_buddy_page_id_for_page(page, level);
+
+        /* Leave any merge for buddy_coalesce_locked, if we ever run short */
+        if (level < BUDDY_LEVELS - 1
+                && buddy - pfa->page_base < pfa->page_count
+                && buddy_bitmap_get_bit_locked(zone->arena, buddy, level) 
+                    == BUDDY_BIT_FREE) {
+            zone->uncoalesced |= 1U << level;
+        }
+
+        buddy_block_insert_locked(page, level);
+        zone->arena->deferrals++;
+        stats_record_merge(0);
+        stats_record_buddy_ops(0, 1);
+        return;
+    }
+
+    /* merge up, -1 since we never merge on top level */
+    for (; level_i < BUDDY_LEVELS - 1; level_i++) {
+        page_id_t buddy_i = 0;
+
+        buddy_i = get_buddy_page_id_for_page(page_i, level_i);
+        bitmap_reads++;
+        if (buddy_i - pfa->page_base >= pfa->page_count
+            || buddy_bitmap_get_bit_locked(zone->arena, buddy_i, level_i)
+                == BUDDY_BIT_ALLCOATED) {
+            /* Our buddy is not free (or not real). Our journey ends here. */
+            break;
+        }
+
+        /* 
+        Our buddy is free! 
+        Since we have not marked ourselves as free yet, we only need to
+        free our buddy before continuing (since we are implicitly free).
+        Buddies always share a zone, so this never crosses zones or arenas.
+        */
+        buddy_block_remove_locked(buddy_i, level_i);
+
+        /* continue with the root */
+        page_i = get_root_buddy_page_id_for_page(page_i, level_i);
+    }
+
+    /*
+    Finalize our free.
+    level_i holds the level we bailed on and is thus where we should insert
+    the free record for page_i
+    */
+    buddy_block_insert_locked(page_i, level_i);
+    stats_record_merge(level_i - level);
+    stats_record_buddy_ops(0, bitmap_reads);
+}
+
+/**
+ * Frees pages in range [BASE, BASE+PAGE_COUNT), which must lie within a single
+ * arena, by both modifying the free list and the buddy bitmaps. This performs
+ * all necessary merging.
+ * 
+ * The range is decomposed into maximal naturally aligned blocks, each of which
+ * is freed and merged starting from its own level. Freeing a block of 2^k pages
+ * thus costs O(BUDDY_LEVELS) rather than O(2^k * BUDDY_LEVELS).
+ */
+static void
+buddy_free_pages_locked(page_id_t base, page_id_t page_count) {
+    page_id_t limit = base + page_count;
+
+    mds_clear_range_locked(base, page_count);
+
+    /*
+    Blocks are freed in ascending address order, so when a block's buddy also
+    lies inside the range, the first of the two has already been placed by the
+    time the second is freed and the merge continues through it.
+    */
+    for (page_id_t free_i = base; free_i < limit;) {
+        unsigned int level = max_buddy_level_for_range(free_i, limit);
+
+        buddy_free_block_locked(free_i, level);
+        free_i += buddy_level_page_count(level);
+    }
+}
+
+/**
+ * Frees pages in range [BASE, BASE+PAGE_COUNT) as buddy_free_pages_locked does,
+ * taking the lock of the arena which owns them. Allocations never span arenas,
+ * but ranges reserved at init may, in which case each arena's share is freed
+ * under its own lock.
+ */
+static void
+buddy_free_pages(page_id_t base, page_id_t page_count) {
+    page_id_t limit = base + page_count;
+
+    for (page_id_t free_i = base; free_i < limit;) {
+        struct pmap_pfa_arena *arena = arena_for_page(free_i);
+        page_id_t arena_limit = MIN(
+            limit, arena->page_base + arena->page_count
+        );
+
+        ARENA_LOCK(arena);
+        buddy_free_pages_locked(free_i, arena_limit - free_i);
+        ARENA_UNLOCK(arena);
+
+        free_i = arena_limit;
+    }
+}
+
+/** Returns true if ZONE has a free block of at least LEVEL in any class */
+static bool
+zone_has_free_block_locked(struct pmap_pfa_zone *zone, unsigned int level) {
+    for (unsigned int class_i = 0; class_i < PMAP_PFA_MOBILITY_COUNT; 
+            class_i++) {
+        for (unsigned int level_i = level; level_i < BUDDY_LEVELS; level_i++) {
+            if (!list_empty(&zone->buddy_lists[class_i][level_i])) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Get the number of pages which must be migrated to empty the PAGE_COUNT pages
+ * at BASE, or PAGE_ID_INVALID if the window holds an allocated page which
+ * cannot be migrated. A page can be migrated if it is movable and names a
+ * mover. BASE must be aligned to the top level or to the smallest block which
+ * covers the window, so that no free block straddles it.
+ */
+static page_id_t
+compaction_window_cost_locked(page_id_t base, page_id_t page_count) {
+    page_id_t limit = base + page_count;
+    page_id_t cost = 0;
+
+    for (page_id_t page_i = base; page_i < limit;) {
+        unsigned int level = buddy_free_block_level_locked(page_i);
+        pmap_page_metadata_s m = pfa->metadata[page_i - pfa->page_base];
+
+        if (level != BUDDY_LEVELS) {
+            /* Free blocks are aligned, so this never lands mid-block */
+            page_i += buddy_level_page_count(level);
+            continue;
+        }
+
+        if (m.mobility != PMAP_PFA_MOBILITY_MOVABLE 
+                || m.mover == PMAP_PFA_MOVER_NONE) {
+            return PAGE_ID_INVALID;
+        }
+
+        cost++;
+        page_i++;
+    }
+
+    return cost;
+}
+
+/**
+ * Finds the window of 2^ORDER pages in the movable pageblocks of ZONE which is
+ * cheapest to empty. Returns the first page of the window or PAGE_ID_INVALID if
+ * no window can be emptied.
+ */
+static page_id_t
+compaction_find_window_locked(struct pmap_pfa_zone *zone, unsigned int order) {
+    page_id_t top_pages = buddy_level_page_count(BUDDY_LEVELS - 1);
+    page_id_t window_pages = buddy_level_page_count(order);
+    page_id_t zone_limit = zone->page_base + zone->page_count;
+    page_id_t best = PAGE_ID_INVALID;
+    page_id_t best_cost = PAGE_ID_INVALID;
+
+    for (page_id_t block_i = zone->page_base; block_i < zone_limit; 
+            block_i += top_pages) {
+        if (pageblock_mobility(block_i) != PMAP_PFA_MOBILITY_MOVABLE) {
+            /* Other classes are full of pages we can't move */
+            continue;
+        }
+
+        for (page_id_t window_i = block_i; 
+                window_i < block_i + top_pages 
+                    && window_i + window_pages <= zone_limit;
+                window_i += window_pages) {
+            page_id_t cost = compaction_window_cost_locked(
+                window_i, window_pages
+            );
+
+            /* A zero cost window is already free and needs no help */
+            if (cost == 0 || cost >= best_cost) {
+                continue;
+            }
+
+            best = window_i;
+            best_cost = cost;
+            if (cost == 1) {
+                /* We can't do any better */
+                return best;
+            }
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Copies the movable page PAGE to NEW_PAGE, which the caller has allocated, and
+ * asks its mover to switch over. On success, the old page is left allocated
+ * with its metadata cleared. Returns false if the mover refused, in which case
+ * NEW_PAGE is still allocated and belongs to the caller.
+ * 
+ * The mover runs under the arena lock, since a page we had stopped guarding
+ * could be freed into the window being emptied. Movers must not call back into
+ * the PFA (see struct pmap_pfa_mover), which in_mover catches.
+ */
+static bool
+migrate_page_locked(page_id_t page, page_id_t new_page) {
+    pmap_page_metadata_s m = pfa->metadata[page - pfa->page_base];
+    struct pmap_pfa_pcp *pcp = &pfa->pcp[smp_get_cpu_id()];
+    const struct pmap_pfa_mover *mover = NULL;
+    bool moved = false;
+
+    ASSERT(m.mover <= pfa->compaction.mover_count);
+    mover = pfa->compaction.movers[m.mover];
+
+    memcpy(
+        (void *)pmap_pa_to_kva(page_id_to_pa(new_page)),
+        (void *)pmap_pa_to_kva(page_id_to_pa(page)),
+        PAGE_SIZE
+    );
+    apply_metadata_range_locked(new_page, 1, &m);
+    pfa->mds_owner[new_page - pfa->page_base] = 
+        pfa->mds_owner[page - pfa->page_base];
+    pfa->mds_refcount[new_page - pfa->page_base] = 
+        pfa->mds_refcount[page - pfa->page_base];
+    pfa->mds_mapcount[new_page - pfa->page_base] = 
+        pfa->mds_mapcount[page - pfa->page_base];
+
+    pcp->in_mover = true;
+    moved = mover->migrate(
+        page_id_to_pa(page), page_id_to_pa(new_page), mover->context
+    );
+    pcp->in_mover = false;
+
+    if (!moved) {
+        return false;
+    }
+
+    mds_clear_range_locked(page, 1);
+    return true;
+}
+
+/**
+ * Migrates the movable page PAGE to a new page in its own zone, as
+ * migrate_page_locked does. Returns false if there was no free page or the
+ * mover refused.
+ */
+static bool
+compaction_migrate_page_locked(page_id_t page) {
+    /* The new page comes from the same zone, and so the same arena */
+    page_id_t new_page = buddy_alloc_small_locked(
+        zone_for_page(page), PAGE_SIZE, PMAP_PFA_MOBILITY_MOVABLE
+    );
+
+    if (new_page == PAGE_ID_INVALID) {
+        return false;
+    }
+
+    if (!migrate_page_locked(page, new_page)) {
+        buddy_free_pages_locked(new_page, 1);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Frees every page in [BASE, LIMIT) which doesn't name a mover, leaving the
+ * rest in place. After a failed migration, every such page in a window is
+ * either an isolated free page or a page we've already migrated away from, and
+ * so it's ours to free.
+ */
+static void
+compaction_release_window_locked(page_id_t base, page_id_t limit) {
+    for (page_id_t page_i = base; page_i < limit;) {
+        page_id_t run_start = page_i;
+
+        while (page_i < limit && pfa->metadata[page_i - pfa->page_base].mover
+                                    == PMAP_PFA_MOVER_NONE) {
+            page_i++;
+        }
+
+        if (page_i > run_start) {
+            buddy_free_pages_locked(run_start, page_i - run_start);
+        }
+
+        /* Skip the page we couldn't free */
+        page_i++;
+    }
+}
+
+/**
+ * Empties the naturally aligned window of 2^ORDER pages at BASE by migrating
+ * every allocated page in it and then frees the window as a single block. The
+ * number of pages migrated is added to MIGRATED. Returns false if a migration
+ * failed, in which case the pages which could not be moved stay where they are
+ * and everything else in the window is freed.
+ * 
+ * The window must have been vetted by compaction_window_cost_locked under the
+ * same lock hold.
+ */
+static bool
+compaction_compact_window_locked(page_id_t base, unsigned int order, 
+                                 uint64_t *migrated) {
+    page_id_t limit = base + buddy_level_page_count(order);
+
+    /* 
+    Isolate the window's free blocks so that none of our migration targets
+    land inside the window
+    */
+    for (page_id_t page_i = base; page_i < limit;) {
+        unsigned int level = buddy_free_block_level_locked(page_i);
+
+        if (level == BUDDY_LEVELS) {
+            page_i++;
+            continue;
+        }
+
+        buddy_block_remove_locked(page_i, level);
+        page_i += buddy_level_page_count(level);
+    }
+
+    for (page_id_t page_i = base; page_i < limit; page_i++) {
+        if (pfa->metadata[page_i - pfa->page_base].mover 
+                == PMAP_PFA_MOVER_NONE) {
+            /* Isolated free page */
+            continue;
+        }
+
+        if (!compaction_migrate_page_locked(page_i)) {
+            goto abort;
+        }
+        (*migrated)++;
+    }
+
+    buddy_free_pages_locked(base, buddy_level_page_count(order));
+    return true;
+
+abort:
+    compaction_release_window_locked(base, limit);
+    return false;
+}
+
+/**
+ * Tries to create a free block of 2^ORDER pages in ZONE by migrating movable
+ * pages out of a window. Returns true if a block was created.
+ */
+static bool
+compaction_run_locked(struct pmap_pfa_zone *zone, unsigned int order) {
+    struct pmap_pfa_compaction_stats *stats = &zone->arena->compaction;
+    uint64_t start = 0;
+    page_id_t window = PAGE_ID_INVALID;
+    bool success = false;
+
+    ASSERT(order < BUDDY_LEVELS);
+
+    /*
+    Each page migrated out of the window needs a free page outside of it, which
+    works out to needing at least a window's worth of free pages in the zone
+    */
+    if (!pfa->compaction.mover_count 
+            || zone->free_pages < buddy_level_page_count(order)) {
+        return false;
+    }
+
+    /* Merging what lazy frees left behind is far cheaper than migrating */
+    if (buddy_coalesce_locked(zone) 
+            && zone_has_free_block_locked(zone, order)) {
+        return true;
+    }
+
+    start = routines_read_cntvct();
+    stats->runs++;
+
+    window = compaction_find_window_locked(zone, order);
+    if (window != PAGE_ID_INVALID) {
+        success = compaction_compact_window_locked(
+            window, order, &stats->pages_migrated
+        );
+    }
+
+    if (success) {
+        stats->successes++;
+    }
+    stats->ticks += routines_read_cntvct() - start;
+
+    return success;
+}
+
+/**
+ * Compacts a single zone which lacks a free block of the background order, if
+ * background compaction is enabled. Arenas are visited starting from the
+ * calling core's home. Returns true if a block was created.
+ */
+static bool
+compaction_background_step(void) {
+    unsigned int home = arena_home_index();
+    bool progress = false;
+
+    for (unsigned int arena_i = 0; 
+            arena_i < pfa->arena_count && !progress; arena_i++) {
+        struct pmap_pfa_arena *arena = arena_nth(home, arena_i);
+        unsigned int order = 0;
+
+        ARENA_LOCK(arena);
+        if (!pfa->compaction.background) {
+            ARENA_UNLOCK(arena);
+            break;
+        }
+
+        order = pfa->compaction.background_order;
+        for (unsigned int zone_i = 0; zone_i < PMAP_PFA_ZONE_COUNT; zone_i++) {
+            struct pmap_pfa_zone *zone = &arena->zones[zone_i];
+
+            if (!zone->page_count || zone_has_free_block_locked(zone, order)) {
+                continue;
+            }
+
+            if (compaction_run_locked(zone, order)) {
+                progress = true;
+                break;
+            }
+        }
+        ARENA_UNLOCK(arena);
+    }
+
+    return progress;
+}
+
+/**
+ * Finds the PAGE_COUNT pages in ZONE beginning on a multiple of ALIGN_PAGES
+ * which are cheapest to empty for a claim. Returns the first page and writes
+ * the number of migrations needed to COST, or returns PAGE_ID_INVALID if no
+ * such range can be emptied.
+ */
+static page_id_t
+cma_find_range_locked(struct pmap_pfa_zone *zone, page_id_t page_count,
+                      page_id_t align_pages, page_id_t *cost) {
+    page_id_t zone_limit = zone->page_base + zone->page_count;
+    page_id_t best = PAGE_ID_INVALID;
+
+    /* Zones begin on the top level, so every base we try is aligned */
+    *cost = PAGE_ID_INVALID;
+    for (page_id_t base_i = zone->page_base; 
+            base_i + page_count <= zone_limit; base_i += align_pages) {
+        page_id_t base_cost = compaction_window_cost_locked(
+            base_i, page_count
+        );
+
+        if (base_cost >= *cost) {
+            continue;
+        }
+
+        best = base_i;
+        *cost = base_cost;
+        if (base_cost == 0) {
+            /* Free, but not yet merged into a block large enough */
+            break;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Empties the PAGE_COUNT pages at BASE for a claim by isolating their free
+ * blocks and migrating every allocated page to a page taken from TARGETS, which
+ * holds TARGET_COUNT pages. The range is left allocated and the number of pages
+ * migrated is added to MIGRATED. Returns false if a mover refused, in which
+ * case everything but the pages which could not be moved is freed again.
+ * 
+ * The range must have been vetted by compaction_window_cost_locked under the
+ * same lock hold, and TARGETS must hold at least as many pages as it cost.
+ */
+static bool
+cma_empty_range_locked(page_id_t base, page_id_t page_count, 
+                       struct list *targets, size_t *target_count,
+                       uint64_t *migrated) {
+    page_id_t limit = base + page_count;
+    page_id_t isolated_limit = limit;
+
+    for (page_id_t page_i = base; page_i < limit;) {
+        unsigned int level = buddy_free_block_level_locked(page_i);
+
+        if (level == BUDDY_LEVELS) {
+            page_i++;
+            continue;
+        }
+
+        buddy_block_remove_locked(page_i, level);
+        page_i += buddy_level_page_count(level);
+        /* The last block may run past the range, that part is given back */
+        isolated_limit = MAX(isolated_limit, page_i);
+    }
+
+    for (page_id_t page_i = base; page_i < limit; page_i++) {
+        pmap_pfa_free_entry_t fe = NULL;
+        page_id_t target = PAGE_ID_INVALID;
+
+        if (pfa->metadata[page_i - pfa->page_base].mover 
+                == PMAP_PFA_MOVER_NONE) {
+            /* Isolated free page */
+            continue;
+        }
+
+        ASSERT(*target_count);
+        fe = list_entry(
+            list_pop_front(targets), struct pmap_pfa_free_entry, elem
+        );
+        target = pa_to_page_id(pmap_physmap_kva_to_pa((vm_addr_t)fe));
+        (*target_count)--;
+
+        if (!migrate_page_locked(page_i, target)) {
+            list_push_front(targets, &fe->elem);
+            (*target_count)++;
+            compaction_release_window_locked(base, isolated_limit);
+            return false;
+        }
+        (*migrated)++;
+    }
+
+    if (isolated_limit > limit) {
+        buddy_free_pages_locked(limit, isolated_limit - limit);
+    }
+
+    return true;
+}
+
+/**
+ * Claims PAGE_COUNT pages beginning on a multiple of ALIGN_PAGES from ZONE,
+ * whose arena's lock must be held, and applies METADATA. Allocated pages in the
+ * way are migrated to pages from TARGETS as cma_empty_range_locked does.
+ * Returns the first page of the claim or PAGE_ID_INVALID. If the cheapest range
+ * needs more targets than TARGETS holds, NEEDED is set to the number it needs
+ * and otherwise it is set to zero.
+ */
+static page_id_t
+cma_claim_zone_locked(struct pmap_pfa_zone *zone, page_id_t page_count,
+                      page_id_t align_pages, pmap_page_metadata_s *metadata,
+                      struct list *targets, size_t *target_count,
+                      uint64_t *migrated, page_id_t *needed) {
+    page_id_t base = PAGE_ID_INVALID;
+    page_id_t cost = 0;
+
+    *needed = 0;
+
+    /* Nothing needs to move if the range is already free */
+    base = zone_alloc_locked(
+        zone, (size_t)page_count << PAGE_SHIFT, align_pages, 
+        PMAP_PFA_MOBILITY_MOVABLE
+    );
+
+    if (base == PAGE_ID_INVALID) {
+        base = cma_find_range_locked(zone, page_count, align_pages, &cost);
+        if (base == PAGE_ID_INVALID) {
+            return PAGE_ID_INVALID;
+        }
+
+        if (cost > *target_count) {
+            *needed = cost;
+            return PAGE_ID_INVALID;
+        }
+
+        if (!cma_empty_range_locked(
+                base, page_count, targets, target_count, migrated)) {
+            return PAGE_ID_INVALID;
+        }
+    }
+
+    apply_metadata_range_locked(base, page_count, metadata);
+    return base;
+}
+
+/**
+ * Allocates movable pages outside of the CMA zone onto TARGETS, which holds
+ * TARGET_COUNT pages, until it holds COUNT. Returns false if memory ran out.
+ */
+static bool
+cma_take_targets(struct list *targets, size_t *target_count, size_t count) {
+    phys_addr_t pages[PCP_REFILL_CHUNK];
+
+    while (*target_count < count) {
+        size_t want = MIN(count - *target_count, COUNT_OF(pages));
+        /* The plain fallback order never borrows the CMA zone */
+        size_t got = buddy_alloc_batch(
+            0, pages, want, PMAP_PFA_ZONE_NORMAL, PMAP_PFA_MOBILITY_MOVABLE
+        );
+
+        for (size_t i = 0; i < got; i++) {
+            pmap_pfa_free_entry_t fe = 
+                (pmap_pfa_free_entry_t)pmap_pa_to_kva(pages[i]);
+            list_push_back(targets, &fe->elem);
+        }
+        *target_count += got;
+
+        if (got < want) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/** Frees the migration targets left on TARGETS */
+static void
+cma_free_targets(struct list *targets) {
+    struct pmap_pfa_arena *arena = NULL;
+
+    while (!list_empty(targets)) {
+        pmap_pfa_free_entry_t fe = list_entry(
+            list_pop_front(targets), struct pmap_pfa_free_entry, elem
+        );
+        page_id_t page = pa_to_page_id(pmap_physmap_kva_to_pa((vm_addr_t)fe));
+
+        arena = arena_lock_switch(arena, page);
+        buddy_free_pages_locked(page, 1);
+    }
+
+    if (arena) {
+        ARENA_UNLOCK(arena);
+    }
+}
+
+/**
+ * Claims PAGE_COUNT pages beginning on a multiple of ALIGN_PAGES from ARENA's
+ * share of the CMA zone and applies METADATA. The number of pages migrated out
+ * of the way is added to MIGRATED. Returns the first page of the claim or
+ * PAGE_ID_INVALID.
+ */
+static page_id_t
+cma_claim_arena(struct pmap_pfa_arena *arena, page_id_t page_count,
+                page_id_t align_pages, pmap_page_metadata_s *metadata,
+                uint64_t *migrated) {
+    struct pmap_pfa_zone *zone = &arena->zones[PMAP_PFA_ZONE_CMA];
+    page_id_t base = PAGE_ID_INVALID;
+    size_t target_count = 0;
+    struct list targets;
+
+    list_init(&targets);
+    for (unsigned int attempt_i = 0; attempt_i < CMA_CLAIM_ATTEMPTS; 
+            attempt_i++) {
+        page_id_t needed = 0;
+
+        ARENA_LOCK(arena);
+        base = cma_claim_zone_locked(
+            zone, page_count, align_pages, metadata, &targets, &target_count, 
+            migrated, &needed
+        );
+        ARENA_UNLOCK(arena);
+
+        /*
+        Targets may come from any arena, so they can only be taken without this
+        one's lock. Others may allocate in the range while we're away, which is
+        why the range is picked and costed again each time.
+        */
+        if (!needed || !cma_take_targets(&targets, &target_count, needed)) {
+            break;
+        }
+    }
+
+    cma_free_targets(&targets);
+    return base;
+}
+
+/** Get the per-CPU page caches of the calling core */
+static inline struct pmap_pfa_pcp *
+pcp_get_local(void) {
+    return &pfa->pcp[smp_get_cpu_id()];
+}
+
+/**
+ * Get the magazine order a request for PAGE_COUNT pages starting at BASE would
+ * be serviced by, or -1 if the request cannot be cached
+ */
+static inline int
+pcp_order_for_pages(page_id_t base, page_id_t page_count) {
+    for (unsigned int order = 0; order < PCP_ORDERS; order++) {
+        if (page_count == buddy_level_page_count(order)) {
+            /* Blocks on the magazine must be naturally aligned */
+            if (base % page_count) {
+                return -1;
+            }
+
+            return order;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Refills MAGAZINE with blocks of 2^ORDER pages up to its low watermark. Unless
+ * the home arena runs dry, its lock is taken once per PCP_REFILL_CHUNK blocks.
+ * The lock of the magazine's core must be held.
+ */
+static void
+pcp_refill(struct pmap_pfa_pcp_magazine *magazine, unsigned int order) {
+    phys_addr_t blocks[PCP_REFILL_CHUNK];
+
+    while (magazine->count < magazine->low) {
+        size_t want = MIN(magazine->low - magazine->count, COUNT_OF(blocks));
+        size_t got = buddy_alloc_batch(
+            order, blocks, want, 
+            PMAP_PFA_ZONE_NORMAL, PMAP_PFA_MOBILITY_UNMOVABLE
+        );
+
+        for (size_t i = 0; i < got; i++) {
+            pmap_pfa_free_entry_t fe = 
+                (pmap_pfa_free_entry_t)pmap_pa_to_kva(blocks[i]);
+            list_push_back(&magazine->blocks, &fe->elem);
+        }
+        magazine->count += got;
+
+        if (got < want) {
+            /* Out of memory, settle for whatever we already got */
+            break;
+        }
+    }
+}
+
+/**
+ * Returns the COUNT coldest blocks on MAGAZINE to the buddy allocators. Each
+ * arena lock is taken once per run of blocks from that arena, so once in
+ * total when the blocks all came from the home arena. The lock of the
+ * magazine's core must be held.
+ */
+static void
+pcp_drain(struct pmap_pfa_pcp_magazine *magazine, unsigned int order,
+          size_t count) {
+    struct pmap_pfa_arena *arena = NULL;
+
+    ASSERT(count <= magazine->count);
+
+    for (size_t i = 0; i < count; i++) {
+        struct list_elem *e = list_pop_back(&magazine->blocks);
+        pmap_pfa_free_entry_t fe = list_entry(
+            e, struct pmap_pfa_free_entry, elem
+        );
+        page_id_t page = pa_to_page_id(pmap_physmap_kva_to_pa((vm_addr_t)fe));
+
+        arena = arena_lock_switch(arena, page);
+        buddy_free_pages_locked(page, buddy_level_page_count(order));
+    }
+    magazine->count -= count;
+
+    if (arena) {
+        ARENA_UNLOCK(arena);
+    }
+}
+
+/**
+ * Allocates a block of 2^ORDER pages from the calling core's magazine, 
+ * refilling it if needed. Returns PHYS_ADDR_INVALID if the magazine is
+ * disabled or the system is out of memory.
+ */
+static phys_addr_t
+pcp_alloc(unsigned int order, pmap_page_metadata_s *metadata) {
+    struct pmap_pfa_pcp *pcp = pcp_get_local();
+    struct pmap_pfa_pcp_magazine *magazine = &pcp->magazines[order];
+    pmap_pfa_free_entry_t fe = NULL;
+    page_id_t page = 0;
+
+    if (!magazine->low) {
+        /* Caching is disabled for this order */
+        return PHYS_ADDR_INVALID;
+    }
+
+    PCP_LOCK(pcp);
+    if (list_empty(&magazine->blocks)) {
+        pcp_refill(magazine, order);
+
+        if (list_empty(&magazine->blocks)) {
+            PCP_UNLOCK(pcp);
+            return PHYS_ADDR_INVALID;
+        }
+    }
+
+    fe = list_entry(
+        list_pop_front(&magazine->blocks), struct pmap_pfa_free_entry, elem
+    );
+    magazine->count--;
+    PCP_UNLOCK(pcp);
+
+    /* 
+    The block belongs exclusively to this core now, so no one else can be
+    writing its MDS entries and we don't need an arena lock to update them.
+    */
+    page = pa_to_page_id(pmap_physmap_kva_to_pa((vm_addr_t)fe));
+    apply_metadata_range_locked(page, buddy_level_page_count(order), metadata);
+
+    return page_id_to_pa(page);
+}
+
+/**
+ * Returns a block of 2^ORDER pages starting at PAGE to the calling core's 
+ * magazine, draining the magazine to its low watermark if it crosses its high
+ * watermark. Returns false if the magazine is disabled or the block is not in
+ * an unmovable pageblock of the normal zone.
+ */
+static bool
+pcp_free(unsigned int order, page_id_t page) {
+    struct pmap_pfa_pcp *pcp = pcp_get_local();
+    struct pmap_pfa_pcp_magazine *magazine = &pcp->magazines[order];
+    struct pmap_pfa_zone *zone = zone_for_page(page);
+    pmap_pfa_free_entry_t fe = NULL;
+
+    if (!magazine->high) {
+        /* Caching is disabled for this order */
+        return false;
+    }
+
+    if (pcp->in_reclaim) {
+        /* Reclaimed pages must be free for whoever is short of memory */
+        return false;
+    }
+
+    if (zone != &zone->arena->zones[PMAP_PFA_ZONE_NORMAL]) {
+        /* 
+        Magazines serve normal requests, which must not be handed DMA memory
+        while there is normal memory left
+        */
+        return false;
+    }
+
+    if (pageblock_mobility(page) != PMAP_PFA_MOBILITY_UNMOVABLE) {
+        /* 
+        Magazines hand their blocks out to unmovable requests, which must not
+        end up in other classes' pageblocks. This read is racy, but a stale
+        class only affects how well we group and never correctness.
+        */
+        return false;
+    }
+
+    /* As in pcp_alloc, we own the block so we can clear its MDS unlocked */
+    mds_clear_range_locked(page, buddy_level_page_count(order));
+
+    /* Push to the front as this block is likely still hot in cache */
+    fe = get_pfa_free_entry_for_page(page);
+    PCP_LOCK(pcp);
+    list_push_front(&magazine->blocks, &fe->elem);
+    magazine->count++;
+
+    if (magazine->count > magazine->high) {
+        pcp_drain(magazine, order, magazine->count - magazine->low);
+    }
+    PCP_UNLOCK(pcp);
+
+    return true;
+}
+
+void
+pmap_pfa_pcp_set_watermarks(unsigned int order, size_t low, size_t high) {
+    REQUIRE(order < PCP_ORDERS);
+    REQUIRE(low <= high);
+
+    for (unsigned int cpu_i = 0; cpu_i < SMP_MAX_CPUS; cpu_i++) {
+        struct pmap_pfa_pcp_magazine *magazine = 
+            &pfa->pcp[cpu_i].magazines[order];
+
         /*
-        We don't currently support large allocations, this would require
-        scanning the top level buddy and is sort of a pain to implement. 
-        Under the decree of "YAGNI", large allocations are not supported yet.
-        XXX: This is also necessary (at all levels) to support non-aligned
-        but contiguous allocations 
-        TODO: Add large allocation support
+        Watermarks are written without synchronizing with the owning core. This
+        is fine since the magazines tolerate any watermark value and will
+        converge on the new ones on their next refill or drain.
         */
+        magazine->low = low;
+        magazine->high = high;
+    }
+}
+
+/**
+ * Takes a pre-zeroed page from the zero pool and applies METADATA to it with
+ * its mobility set to MOBILITY. Returns PHYS_ADDR_INVALID if the pool is empty.
+ */
+static phys_addr_t
+zero_pool_alloc(pmap_page_metadata_s *metadata, pmap_pfa_mobility_e mobility) {
+    pmap_pfa_free_entry_t fe = NULL;
+    pmap_page_metadata_s m = *metadata;
+    page_id_t page = 0;
+
+    m.mobility = mobility;
+    if (mobility != PMAP_PFA_MOBILITY_MOVABLE) {
+        m.mover = PMAP_PFA_MOVER_NONE;
+    }
+
+    ZERO_POOL_LOCK(pfa);
+    if (list_empty(&pfa->zero_pool.pages)) {
+        pfa->zero_pool.misses++;
+        ZERO_POOL_UNLOCK(pfa);
         return PHYS_ADDR_INVALID;
     }
 
+    fe = list_entry(
+        list_pop_front(&pfa->zero_pool.pages), struct pmap_pfa_free_entry, elem
+    );
+    pfa->zero_pool.count--;
+    pfa->zero_pool.hits++;
+    ZERO_POOL_UNLOCK(pfa);
+
+    /* 
+    The free entry was the only non-zero part of the page, clear it. As with
+    the magazines, we own the page so we can write its MDS entry unlocked.
+    */
+    memset(fe, 0x00, sizeof(*fe));
+    page = pa_to_page_id(pmap_physmap_kva_to_pa((vm_addr_t)fe));
+    apply_metadata_range_locked(page, 1, &m);
+
+    return page_id_to_pa(page);
+}
+
+/**
+ * Zeroes up to BUDGET free pages and adds them to the zero pool, stopping
+ * early if the pool reaches its target. The pages are zeroed without holding
+ * any locks. Returns the number of pages added.
+ */
+static size_t
+zero_pool_refill(size_t budget) {
+    phys_addr_t pages[ZERO_POOL_REFILL_CHUNK];
+    size_t want = 0;
+    size_t got = 0;
+
+    ZERO_POOL_LOCK(pfa);
+    if (pfa->zero_pool.count < pfa->zero_pool.target) {
+        want = pfa->zero_pool.target - pfa->zero_pool.count;
+    }
+    ZERO_POOL_UNLOCK(pfa);
+
+    want = MIN(want, MIN(budget, COUNT_OF(pages)));
+    if (!want) {
+        return 0;
+    }
+
+    got = buddy_alloc_batch(
+        0, pages, want, PMAP_PFA_ZONE_NORMAL, PMAP_PFA_MOBILITY_UNMOVABLE
+    );
+
+    for (size_t i = 0; i < got; i++) {
+        memset((void *)pmap_pa_to_kva(pages[i]), 0x00, PAGE_SIZE);
+    }
+
+    /* 
+    We may overshoot the target if someone else refilled concurrently, but only
+    by one chunk. 
+    */
+    ZERO_POOL_LOCK(pfa);
+    for (size_t i = 0; i < got; i++) {
+        pmap_pfa_free_entry_t fe = 
+            (pmap_pfa_free_entry_t)pmap_pa_to_kva(pages[i]);
+        list_push_back(&pfa->zero_pool.pages, &fe->elem);
+    }
+    pfa->zero_pool.count += got;
+    ZERO_POOL_UNLOCK(pfa);
+
+    return got;
+}
+
+/** Returns every page in the zero pool to the buddy allocator */
+static void
+zero_pool_drain(void) {
+    struct pmap_pfa_arena *arena = NULL;
+    struct list pages;
+
+    list_init(&pages);
+
+    /* Steal the entire pool so that we never hold both locks */
+    ZERO_POOL_LOCK(pfa);
+    while (!list_empty(&pfa->zero_pool.pages)) {
+        list_push_back(&pages, list_pop_front(&pfa->zero_pool.pages));
+    }
+    pfa->zero_pool.count = 0;
+    ZERO_POOL_UNLOCK(pfa);
+
+    while (!list_empty(&pages)) {
+        pmap_pfa_free_entry_t fe = list_entry(
+            list_pop_front(&pages), struct pmap_pfa_free_entry, elem
+        );
+        page_id_t page = pa_to_page_id(pmap_physmap_kva_to_pa((vm_addr_t)fe));
+
+        arena = arena_lock_switch(arena, page);
+        buddy_free_pages_locked(page, 1);
+    }
+
+    if (arena) {
+        ARENA_UNLOCK(arena);
+    }
+}
+
+void
+pmap_pfa_zone_get_stats(pmap_pfa_zone_e zone, 
+                        struct pmap_pfa_zone_stats *stats) {
+    page_id_t base = PAGE_ID_INVALID;
+
+    REQUIRE(zone < PMAP_PFA_ZONE_COUNT);
+
+    memset(stats, 0x00, sizeof(*stats));
+    for (unsigned int arena_i = 0; arena_i < pfa->arena_count; arena_i++) {
+        struct pmap_pfa_arena *arena = &pfa->arenas[arena_i];
+        struct pmap_pfa_zone *z = &arena->zones[zone];
+
+        ARENA_LOCK(arena);
+        /* The zone starts in the first arena which has a share of it */
+        if (base == PAGE_ID_INVALID && z->page_count) {
+            base = z->page_base;
+        }
+        stats->size += (size_t)z->page_count << PAGE_SHIFT;
+        stats->free_pages += z->free_pages;
+        stats->allocations += z->allocations;
+        stats->fallbacks += z->fallbacks;
+        stats->failures += z->failures;
+        stats->steals += z->steals;
+        stats->claims += z->claims;
+        ARENA_UNLOCK(arena);
+    }
+
+    if (base == PAGE_ID_INVALID) {
+        base = pfa->arenas[pfa->arena_count - 1].zones[zone].page_base;
+    }
+    stats->base = page_id_to_pa(base);
+}
+
+void
+pmap_pfa_zero_pool_set_target(size_t target) {
+    ZERO_POOL_LOCK(pfa);
+    pfa->zero_pool.target = target;
+    ZERO_POOL_UNLOCK(pfa);
+}
+
+void
+pmap_pfa_zero_pool_get_stats(struct pmap_pfa_zero_pool_stats *stats) {
+    ZERO_POOL_LOCK(pfa);
+    stats->count = pfa->zero_pool.count;
+    stats->target = pfa->zero_pool.target;
+    stats->hits = pfa->zero_pool.hits;
+    stats->misses = pfa->zero_pool.misses;
+    ZERO_POOL_UNLOCK(pfa);
+}
+
+unsigned int
+pmap_pfa_register_mover(const struct pmap_pfa_mover *mover) {
+    unsigned int id = 0;
+
+    REQUIRE(mover && mover->migrate);
+
+    arenas_lock_all();
+    REQUIRE(pfa->compaction.mover_count < PMAP_PFA_MOVER_MAX);
+    id = ++pfa->compaction.mover_count;
+    pfa->compaction.movers[id] = mover;
+    arenas_unlock_all();
+
+    return id;
+}
+
+bool
+pmap_pfa_compact(pmap_pfa_zone_e zone, unsigned int order) {
+    unsigned int home = arena_home_index();
+    bool success = false;
+
+    REQUIRE(zone < PMAP_PFA_ZONE_COUNT);
+    REQUIRE(order <= PMAP_PFA_MAX_ORDER);
+
+    for (unsigned int arena_i = 0; 
+            arena_i < pfa->arena_count && !success; arena_i++) {
+        struct pmap_pfa_arena *arena = arena_nth(home, arena_i);
+
+        if (!arena->zones[zone].page_count) {
+            continue;
+        }
+
+        ARENA_LOCK(arena);
+        success = compaction_run_locked(&arena->zones[zone], order);
+        ARENA_UNLOCK(arena);
+    }
+
+    return success;
+}
+
+void
+pmap_pfa_compaction_set_background(bool enabled, unsigned int order) {
+    REQUIRE(order <= PMAP_PFA_MAX_ORDER);
+
+    arenas_lock_all();
+    pfa->compaction.background = enabled;
+    pfa->compaction.background_order = order;
+    arenas_unlock_all();
+}
+
+void
+pmap_pfa_compaction_get_stats(struct pmap_pfa_compaction_stats *stats) {
+    memset(stats, 0x00, sizeof(*stats));
+    for (unsigned int arena_i = 0; arena_i < pfa->arena_count; arena_i++) {
+        struct pmap_pfa_arena *arena = &pfa->arenas[arena_i];
+
+        ARENA_LOCK(arena);
+        stats->runs += arena->compaction.runs;
+        stats->successes += arena->compaction.successes;
+        stats->pages_migrated += arena->compaction.pages_migrated;
+        stats->ticks += arena->compaction.ticks;
+        ARENA_UNLOCK(arena);
+    }
+}
+
+phys_addr_t
+pmap_pfa_cma_claim(size_t size, pmap_page_metadata_s *metadata) {
+    page_id_t page_count = size_to_page_count(size);
+    page_id_t align_pages = buddy_level_page_count(BUDDY_LEVELS - 1);
+    pmap_page_metadata_s m = *metadata;
+    page_id_t base = PAGE_ID_INVALID;
+    uint64_t migrated = 0;
+    uint64_t start = routines_read_cntvct();
+    uint64_t ticks = 0;
+
+    ASSERT_NOT_IRQ();
+    REQUIRE(size && (size >> PAGE_SHIFT) < PAGE_ID_INVALID);
+
+    /* Claims up to the top level are aligned like a block of their size */
+    if (page_count < align_pages) {
+        align_pages = buddy_level_page_count(min_buddy_level_for_size(size));
+    }
+
+    /* Device buffers stay put until they're released */
+    m.mobility = PMAP_PFA_MOBILITY_UNMOVABLE;
+    m.mover = PMAP_PFA_MOVER_NONE;
+
+    for (unsigned int arena_i = 0; 
+            arena_i < pfa->arena_count && base == PAGE_ID_INVALID; arena_i++) {
+        struct pmap_pfa_arena *arena = &pfa->arenas[arena_i];
+
+        if (arena->zones[PMAP_PFA_ZONE_CMA].page_count >= page_count) {
+            base = cma_claim_arena(
+                arena, page_count, align_pages, &m, &migrated
+            );
+        }
+    }
+    ticks = routines_read_cntvct() - start;
+
+    CMA_LOCK(pfa);
+    if (base != PAGE_ID_INVALID) {
+        pfa->cma.claims++;
+        pfa->cma.claimed_pages += page_count;
+    } else {
+        pfa->cma.failures++;
+    }
+    pfa->cma.pages_migrated += migrated;
+    pfa->cma.claim_ticks += ticks;
+    pfa->cma.claim_max_ticks = MAX(pfa->cma.claim_max_ticks, ticks);
+    CMA_UNLOCK(pfa);
+
+    pressure_check();
+    pressure_kick();
+    return base == PAGE_ID_INVALID ? PHYS_ADDR_INVALID : page_id_to_pa(base);
+}
+
+void
+pmap_pfa_cma_release(phys_addr_t addr, size_t size) {
+    page_id_t base = pa_to_page_id(addr);
+    page_id_t page_count = size_to_page_count(size);
+    struct pmap_pfa_arena *arena = NULL;
+    struct pmap_pfa_zone *zone = NULL;
+    uint64_t start = routines_read_cntvct();
+    uint64_t ticks = 0;
+
+    ASSERT_NOT_IRQ();
+    REQUIRE(addr % PAGE_SIZE == 0 && page_count);
+    REQUIRE(base - pfa->page_base < pfa->page_count);
+    arena = arena_for_page(base);
+    zone = &arena->zones[PMAP_PFA_ZONE_CMA];
+    REQUIRE(base >= zone->page_base 
+            && base + page_count <= zone->page_base + zone->page_count);
+
+    ARENA_LOCK(arena);
+    buddy_free_pages_locked(base, page_count);
+    ARENA_UNLOCK(arena);
+    ticks = routines_read_cntvct() - start;
+
+    CMA_LOCK(pfa);
+    ASSERT(pfa->cma.claimed_pages >= page_count);
+    pfa->cma.claimed_pages -= page_count;
+    pfa->cma.releases++;
+    pfa->cma.release_ticks += ticks;
+    pfa->cma.release_max_ticks = MAX(pfa->cma.release_max_ticks, ticks);
+    CMA_UNLOCK(pfa);
+}
+
+void
+pmap_pfa_cma_get_stats(struct pmap_pfa_cma_stats *stats) {
+    struct pmap_pfa_zone_stats zone;
+
+    pmap_pfa_zone_get_stats(PMAP_PFA_ZONE_CMA, &zone);
+
+    memset(stats, 0x00, sizeof(*stats));
+    stats->base = zone.base;
+    stats->size = zone.size;
+
+    CMA_LOCK(pfa);
+    stats->claimed_pages = pfa->cma.claimed_pages;
+    stats->claims = pfa->cma.claims;
+    stats->failures = pfa->cma.failures;
+    stats->releases = pfa->cma.releases;
+    stats->pages_migrated = pfa->cma.pages_migrated;
+    stats->claim_ticks = pfa->cma.claim_ticks;
+    stats->claim_max_ticks = pfa->cma.claim_max_ticks;
+    stats->release_ticks = pfa->cma.release_ticks;
+    stats->release_max_ticks = pfa->cma.release_max_ticks;
+    CMA_UNLOCK(pfa);
+}
+
+/**
+ * Asks each shrinker in turn for memory until PAGES pages have been reclaimed
+ * on behalf of an allocation which is short of memory. The reclaimed pages go
+ * straight to the buddy allocator, see pressure_shrink. Returns the number of
+ * pages reclaimed.
+ */
+static size_t
+pressure_direct_reclaim(size_t pages) {
+    unsigned int count = __atomic_load_n(
+        &pfa->pressure.shrinker_count, __ATOMIC_ACQUIRE
+    );
+    uint64_t start = routines_read_cntvct();
+    unsigned int shrinker_i = 0;
+    size_t freed = 0;
+
+    if (!count) {
+        return 0;
+    }
+
+    for (; shrinker_i < count && freed < pages; shrinker_i++) {
+        const struct pmap_pfa_shrinker *shrinker = 
+            pfa->pressure.shrinkers[shrinker_i];
+
+        freed += pressure_shrink(shrinker, pages - freed);
+    }
+
+    PRESSURE_LOCK(pfa);
+    pfa->pressure.direct_runs += shrinker_i;
+    pfa->pressure.pages_reclaimed += freed;
+    pfa->pressure.direct_ticks += routines_read_cntvct() - start;
+    PRESSURE_UNLOCK(pfa);
+
+    return freed;
+}
+
+void
+pmap_pfa_register_shrinker(const struct pmap_pfa_shrinker *shrinker) {
+    REQUIRE(shrinker && shrinker->shrink);
+
+    PRESSURE_LOCK(pfa);
+    REQUIRE(pfa->pressure.shrinker_count < PMAP_PFA_SHRINKER_MAX);
+    pfa->pressure.shrinkers[pfa->pressure.shrinker_count] = shrinker;
+    /* Direct reclaim reads the count without the lock */
+    __atomic_store_n(
+        &pfa->pressure.shrinker_count, pfa->pressure.shrinker_count + 1,
+        __ATOMIC_RELEASE
+    );
+    PRESSURE_UNLOCK(pfa);
+}
+
+void
+pmap_pfa_pressure_set_watermarks(size_t min, size_t low, size_t high) {
+    REQUIRE(min <= low && low <= high);
+
+    PRESSURE_LOCK(pfa);
+    __atomic_store_n(&pfa->pressure.min, min, __ATOMIC_RELAXED);
+    __atomic_store_n(&pfa->pressure.low, low, __ATOMIC_RELAXED);
+    __atomic_store_n(&pfa->pressure.high, high, __ATOMIC_RELAXED);
+    PRESSURE_UNLOCK(pfa);
+
+    pressure_check();
+}
+
+pmap_pfa_pressure_e
+pmap_pfa_get_pressure(void) {
+    size_t free_pages = pressure_free_pages();
+
+    if (free_pages < __atomic_load_n(&pfa->pressure.min, __ATOMIC_RELAXED)) {
+        return PMAP_PFA_PRESSURE_MIN;
+    } else if (free_pages 
+                < __atomic_load_n(&pfa->pressure.low, __ATOMIC_RELAXED)) {
+        return PMAP_PFA_PRESSURE_LOW;
+    }
+
+    return PMAP_PFA_PRESSURE_NONE;
+}
+
+void
+pmap_pfa_pressure_get_stats(struct pmap_pfa_pressure_stats *stats) {
+    stats->level = pmap_pfa_get_pressure();
+
+    PRESSURE_LOCK(pfa);
+    stats->free_pages = pressure_free_pages();
+    stats->min = pfa->pressure.min;
+    stats->low = pfa->pressure.low;
+    stats->high = pfa->pressure.high;
+    stats->shrinkers = pfa->pressure.shrinker_count;
+    stats->low_crossings = __atomic_load_n(
+        &pfa->pressure.low_crossings, __ATOMIC_RELAXED
+    );
+    stats->async_runs = pfa->pressure.async_runs;
+    stats->direct_runs = pfa->pressure.direct_runs;
+    stats->pages_reclaimed = pfa->pressure.pages_reclaimed;
+    stats->direct_ticks = pfa->pressure.direct_ticks;
+    PRESSURE_UNLOCK(pfa);
+}
+
+void
+pmap_pfa_get_free_summary(unsigned int order, 
+                          struct pmap_pfa_free_summary *summary) {
+    size_t usable = 0;
+
+    REQUIRE(order <= PMAP_PFA_MAX_ORDER);
+
+    memset(summary, 0x00, sizeof(*summary));
+    for (unsigned int arena_i = 0; arena_i < pfa->arena_count; arena_i++) {
+        struct pmap_pfa_arena *arena = &pfa->arenas[arena_i];
+
+        for (unsigned int zone_i = 0; zone_i < PMAP_PFA_ZONE_COUNT; zone_i++) {
+            struct pmap_pfa_zone *zone = &arena->zones[zone_i];
+
+            for (unsigned int level_i = 0; level_i < BUDDY_LEVELS; level_i++) {
+                summary->free_blocks[level_i] += __atomic_load_n(
+                    &zone->free_blocks[level_i], __ATOMIC_RELAXED
+                );
+            }
+        }
+    }
+
+    /* Derive the page count from the blocks so that the two always agree */
+    summary->largest_order = -1;
+    for (unsigned int level_i = 0; level_i < BUDDY_LEVELS; level_i++) {
+        size_t pages = summary->free_blocks[level_i] 
+            * buddy_level_page_count(level_i);
+
+        summary->free_pages += pages;
+        if (level_i >= order) {
+            usable += pages;
+        }
+        if (summary->free_blocks[level_i]) {
+            summary->largest_order = level_i;
+        }
+    }
+
+    if (summary->free_pages) {
+        summary->fragmentation = (summary->free_pages - usable) 
+            * PMAP_PFA_FRAGMENTATION_SCALE / summary->free_pages;
+    }
+}
+
+bool
+pmap_pfa_idle(void) {
+    /* Give memory back first, if we're short of it */
+    if (pressure_background_step()) {
+        return true;
+    }
+
+    /* Top up the zero pool a small chunk at a time, unless memory is short */
+    if (!__atomic_load_n(&pfa->pressure.reclaiming, __ATOMIC_RELAXED)
+            && zero_pool_refill(ZERO_POOL_REFILL_CHUNK) > 0) {
+        return true;
+    }
+
+    /* Then put movable pages back in order, one window at a time */
+    return compaction_background_step();
+}
+
+/**
+ * Splits a run of PMAP_PFA_COLORS pages, which holds a page of every color,
+ * across ARENA's color lists, freeing any pages whose color already holds
+ * COLOR_CACHE_MAX pages. The run comes from ARENA alone, so that its cache only
+ * ever holds its own pages. Returns false if there is no such run.
+ */
+static bool
+color_refill_locked(struct pmap_pfa_arena *arena) {
+    unsigned int home = arena - pfa->arenas;
+    page_id_t base = PAGE_ID_INVALID;
+
+    STATIC_ASSERT((PMAP_PFA_COLORS & (PMAP_PFA_COLORS - 1)) == 0);
+    for (unsigned int i = 0; 
+            i < PMAP_PFA_ZONE_COUNT && base == PAGE_ID_INVALID; i++) {
+        pmap_pfa_zone_e zone_i = zone_fallbacks[PMAP_PFA_ZONE_NORMAL][i];
+
+        if (zone_i == PMAP_PFA_ZONE_COUNT) {
+            break;
+        }
+
+        /* 
+        With fewer levels than colors this spans several top level blocks,
+        since a single one would only ever hold some of the colors
+        */
+        base = zone_alloc_locked(
+            &arena->zones[zone_i], PMAP_PFA_COLORS * PAGE_SIZE, 1,
+            PMAP_PFA_MOBILITY_UNMOVABLE
+        );
+        if (base != PAGE_ID_INVALID) {
+            zone_account_locked(arena, home, PMAP_PFA_ZONE_NORMAL, zone_i);
+        }
+    }
+
+    if (base == PAGE_ID_INVALID) {
+        return false;
+    }
+
+    for (page_id_t page = base; page < base + PMAP_PFA_COLORS; page++) {
+        unsigned int color = pmap_pfa_page_color(page_id_to_pa(page));
+        pmap_pfa_free_entry_t fe = NULL;
+
+        if (arena->colors.counts[color] >= COLOR_CACHE_MAX) {
+            buddy_free_pages_locked(page, 1);
+            continue;
+        }
+
+        fe = get_pfa_free_entry_for_page(page);
+        list_push_back(&arena->colors.pages[color], &fe->elem);
+        arena->colors.counts[color]++;
+    }
+    arena->colors.refills++;
+
+    return true;
+}
+
+/**
+ * Takes a free page of COLOR off ARENA's color lists, refilling them if needed.
+ * Returns PAGE_ID_INVALID if no page of COLOR could be found.
+ */
+static page_id_t
+color_alloc_locked(struct pmap_pfa_arena *arena, unsigned int color) {
+    pmap_pfa_free_entry_t fe = NULL;
+
+    if (list_empty(&arena->colors.pages[color])
+            && !color_refill_locked(arena)) {
+        return PAGE_ID_INVALID;
+    }
+
+    fe = list_entry(
+        list_pop_front(&arena->colors.pages[color]), 
+        struct pmap_pfa_free_entry, elem
+    );
+    arena->colors.counts[color]--;
+
+    return pa_to_page_id(pmap_physmap_kva_to_pa((vm_addr_t)fe));
+}
+
+/** Returns every page held for colored requests to the buddy allocators */
+static void
+color_drain(void) {
+    for (unsigned int arena_i = 0; arena_i < pfa->arena_count; arena_i++) {
+        struct pmap_pfa_arena *arena = &pfa->arenas[arena_i];
+
+        ARENA_LOCK(arena);
+        for (unsigned int color = 0; color < PMAP_PFA_COLORS; color++) {
+            while (!list_empty(&arena->colors.pages[color])) {
+                pmap_pfa_free_entry_t fe = list_entry(
+                    list_pop_front(&arena->colors.pages[color]), 
+                    struct pmap_pfa_free_entry, elem
+                );
+
+                buddy_free_pages_locked(
+                    pa_to_page_id(pmap_physmap_kva_to_pa((vm_addr_t)fe)), 1
+                );
+            }
+            arena->colors.counts[color] = 0;
+        }
+        ARENA_UNLOCK(arena);
+    }
+}
+
+void
+pmap_pfa_drain_caches(void) {
+    /* 
+    Every core's magazines, not just ours. A core which is out of memory can't
+    use what another core has cached, and that core may not free or allocate
+    again for a long time.
+    */
+    for (unsigned int cpu_i = 0; cpu_i < SMP_MAX_CPUS; cpu_i++) {
+        struct pmap_pfa_pcp *pcp = &pfa->pcp[cpu_i];
+
+        PCP_LOCK(pcp);
+        for (unsigned int order = 0; order < PCP_ORDERS; order++) {
+            struct pmap_pfa_pcp_magazine *magazine = &pcp->magazines[order];
+            if (magazine->count) {
+                pcp_drain(magazine, order, magazine->count);
+            }
+        }
+        PCP_UNLOCK(pcp);
+    }
+
+    zero_pool_drain();
+    color_drain();
+}
+
+void
+pmap_pfa_coalesce(void) {
+    for (unsigned int arena_i = 0; arena_i < pfa->arena_count; arena_i++) {
+        struct pmap_pfa_arena *arena = &pfa->arenas[arena_i];
+
+        ARENA_LOCK(arena);
+        arena_coalesce_locked(arena);
+        ARENA_UNLOCK(arena);
+    }
+}
+
+void
+pmap_pfa_lazy_set_enabled(bool enabled) {
+    arenas_lock_all();
+    pfa->lazy.enabled = enabled;
+    if (!enabled) {
+        for (unsigned int arena_i = 0; arena_i < pfa->arena_count; arena_i++) {
+            arena_coalesce_locked(&pfa->arenas[arena_i]);
+        }
+    }
+    arenas_unlock_all();
+}
+
+void
+pmap_pfa_lazy_set_slack(unsigned int order, size_t blocks) {
+    REQUIRE(order <= PMAP_PFA_MAX_ORDER);
+
+    arenas_lock_all();
+    pfa->lazy.slack[order] = blocks;
+    arenas_unlock_all();
+}
+
+void
+pmap_pfa_lazy_get_stats(struct pmap_pfa_lazy_stats *stats) {
+    memset(stats, 0x00, sizeof(*stats));
+    for (unsigned int arena_i = 0; arena_i < pfa->arena_count; arena_i++) {
+        struct pmap_pfa_arena *arena = &pfa->arenas[arena_i];
+
+        ARENA_LOCK(arena);
+        if (!arena_i) {
+            stats->enabled = pfa->lazy.enabled;
+            for (unsigned int level_i = 0; level_i < BUDDY_LEVELS; level_i++) {
+                stats->slack[level_i] = pfa->lazy.slack[level_i];
+            }
+        }
+        stats->deferrals += arena->deferrals;
+        stats->coalesces += arena->coalesces;
+        stats->coalesced += arena->coalesced;
+        ARENA_UNLOCK(arena);
+    }
+}
+
+phys_addr_t
+pmap_pfa_alloc_colored(unsigned int color, pmap_page_metadata_s *metadata) {
+    struct pmap_pfa_pcp *pcp = &pfa->pcp[smp_get_cpu_id()];
+    struct pmap_pfa_arena *arena = &pfa->arenas[arena_home_index()];
+    pmap_page_metadata_s m = *metadata;
+    page_id_t page = PAGE_ID_INVALID;
+    uint64_t start = routines_read_cntvct();
+
+    ASSERT_NOT_IRQ();
+    REQUIRE(color < PMAP_PFA_COLORS || color == PMAP_PFA_COLOR_NEXT);
+    if (color == PMAP_PFA_COLOR_NEXT) {
+        color = pcp->next_color;
+        pcp->next_color = (color + 1) % PMAP_PFA_COLORS;
+    }
+
+    /* Colored pages come from unmovable pageblocks, as magazine pages do */
+    m.mobility = PMAP_PFA_MOBILITY_UNMOVABLE;
+    m.mover = PMAP_PFA_MOVER_NONE;
+
+    /* Each arena keeps its own colors, so we only look in our home arena's */
+    ARENA_LOCK(arena);
+    if (pfa->colors_enabled) {
+        bool cached = !list_empty(&arena->colors.pages[color]);
+
+        page = color_alloc_locked(arena, color);
+        if (page == PAGE_ID_INVALID) {
+            arena->colors.misses++;
+        } else if (cached) {
+            arena->colors.hits++;
+        }
+    }
+
+    if (page != PAGE_ID_INVALID) {
+        apply_metadata_range_locked(page, 1, &m);
+    }
+    ARENA_UNLOCK(arena);
+
+    if (page == PAGE_ID_INVALID) {
+        /* Any color will do */
+        return pmap_pfa_alloc_contig(PAGE_SIZE, metadata);
+    }
+
+    pressure_check();
+    pressure_kick();
+    stats_record_alloc(start);
+    return page_id_to_pa(page);
+}
 
-    PFA_LOCK(pfa);
-    allocation = pmap_pfa_alloc_contig_small_locked(size, metadata);
-    PFA_UNLOCK(pfa);
+void
+pmap_pfa_color_set_enabled(bool enabled) {
+    arenas_lock_all();
+    pfa->colors_enabled = enabled;
+    arenas_unlock_all();
 
-    return allocation;
+    if (!enabled) {
+        color_drain();
+    }
 }
 
 void
-pmap_pfa_mds_get_metadata(page_id_t page, pmap_page_metadata_s *metadata) {
-    PFA_LOCK(pfa);
-    mds_get_metadata_locked(page, metadata);
-    PFA_UNLOCK(pfa);
+pmap_pfa_color_get_stats(struct pmap_pfa_color_stats *stats) {
+    memset(stats, 0x00, sizeof(*stats));
+    stats->enabled = __atomic_load_n(&pfa->colors_enabled, __ATOMIC_RELAXED);
+    for (unsigned int arena_i = 0; arena_i < pfa->arena_count; arena_i++) {
+        struct pmap_pfa_arena *arena = &pfa->arenas[arena_i];
+
+        ARENA_LOCK(arena);
+        for (unsigned int color = 0; color < PMAP_PFA_COLORS; color++) {
+            stats->cached[color] += arena->colors.counts[color];
+        }
+        stats->hits += arena->colors.hits;
+        stats->refills += arena->colors.refills;
+        stats->misses += arena->colors.misses;
+        ARENA_UNLOCK(arena);
+    }
 }
 
-void
-pmap_pfa_mds_require_range_type(page_id_t page, page_id_t count,
-                                pmap_page_type_e type) {
-    ASSERT(page - pfa->page_base + count < pfa->page_count);
+/** Get the zone a request with FLAGS prefers */
+static inline pmap_pfa_zone_e
+flags_to_zone(pmap_pfa_alloc_flags_t flags) {
+    if (flags & PMAP_PFA_ALLOC_DMA) {
+        return PMAP_PFA_ZONE_DMA;
+    }
 
-    PFA_LOCK(pfa);
-    for (page_id_t i = 0; i < count; i++) {
-        pmap_page_metadata_s metadata;
-        page_id_t page_i = page - pfa->page_base + i;
-        mds_get_metadata_locked(page, &metadata);
+    return PMAP_PFA_ZONE_NORMAL;
+}
 
-        if (metadata.page_type != type) {
-            panic(
-                "Incorrect page type on page %d (was %d but expected %d)",
-                page_i, metadata.page_type, type
-            );
-        }
+/** Get the mobility class of a request with FLAGS */
+static inline pmap_pfa_mobility_e
+flags_to_mobility(pmap_pfa_alloc_flags_t flags) {
+    if (!mobility_grouping) {
+        return PMAP_PFA_MOBILITY_UNMOVABLE;
+    } else if (flags & PMAP_PFA_ALLOC_MOVABLE) {
+        return PMAP_PFA_MOBILITY_MOVABLE;
+    } else if (flags & PMAP_PFA_ALLOC_RECLAIMABLE) {
+        return PMAP_PFA_MOBILITY_RECLAIMABLE;
     }
-    PFA_UNLOCK(pfa);
+
+    return PMAP_PFA_MOBILITY_UNMOVABLE;
 }
 
 /**
- * Frees pages in range [BASE, BASE+PAGE_COUNT) by both modifying the free list
- * and the buddy bitmaps. This performs all necessary merging.
+ * Allocates SIZE bytes of contiguous pages for a request with FLAGS and applies
+ * METADATA (with its mobility set from FLAGS), trying the calling core's
+ * magazines first when possible. The contents of the pages are unspecified.
  */
-static void
-buddy_free_pages_locked(page_id_t base, page_id_t page_count) {
-    page_id_t i = 0;
-    for (; i < page_count; i++) {
-        pmap_pfa_free_entry_t fe = NULL;
-        unsigned int level_i = 0;
-        page_id_t page_i = 0;
+static phys_addr_t
+pmap_pfa_alloc_contig_internal(size_t size, pmap_page_metadata_s *metadata,
+                               pmap_pfa_alloc_flags_t flags) {
+    phys_addr_t allocation = PHYS_ADDR_INVALID;
+    pmap_pfa_zone_e zone = flags_to_zone(flags);
+    pmap_pfa_mobility_e mobility = flags_to_mobility(flags);
+    pmap_page_metadata_s m = *metadata;
+    int order = -1;
+    unsigned int level = 0;
 
-        page_i = base + i;
-        /* merge up, -1 since we never merge on top level */
-        for (; level_i < BUDDY_LEVELS - 1; level_i++) {
-            page_id_t buddy_i = 0;
+    m.mobility = mobility;
+    if (mobility != PMAP_PFA_MOBILITY_MOVABLE) {
+        m.mover = PMAP_PFA_MOVER_NONE;
+    }
+    ASSERT(m.mover <= pfa->compaction.mover_count);
 
-            buddy_i = get_buddy_page_id_for_page(page_i, level_i);
-            if (buddy_bitmap_get_bit_locked(buddy_i, level_i)
-                == BUDDY_BIT_ALLCOATED) {
-                /* Our buddy is not free. Our journey ends here. */
+    if (zone == PMAP_PFA_ZONE_NORMAL 
+            && mobility == PMAP_PFA_MOBILITY_UNMOVABLE) {
+        /* 
+        Magazines only hold blocks from unmovable pageblocks of the normal zone
+        (or of the DMA zone, once a refill finds no normal memory left), so only
+        normal, unmovable requests fit
+        */
+        order = pcp_order_for_pages(0, size_to_page_count(size));
+    }
+
+    if (order >= 0) {
+        /* Try the per-CPU fast path first */
+        allocation = pcp_alloc(order, &m);
+        if (allocation != PHYS_ADDR_INVALID) {
+            return allocation;
+        }
+
+        /* 
+        Caching is disabled or the refill came back empty. Either way the
+        arenas may still serve us, and the caches are only flushed below once
+        they can't.
+        */
+    }
+
+    if (pressure_free_pages() < __atomic_load_n(&pfa->pressure.min, 
+                                                __ATOMIC_RELAXED)) {
+        /* We're into the reserve, so don't wait for idle cores to reclaim */
+        pressure_direct_reclaim(
+            MAX(size_to_page_count(size), PRESSURE_RECLAIM_BATCH)
+        );
+    }
+
+    allocation = pmap_pfa_alloc_contig_arenas(size, 1, &m, zone, mobility);
+
+    if (allocation == PHYS_ADDR_INVALID) {
+        /* 
+        The magazines and the zero pool may be hoarding memory this request
+        could have used, give it back and try once more
+        */
+        pmap_pfa_drain_caches();
+
+        allocation = pmap_pfa_alloc_contig_arenas(size, 1, &m, zone, mobility);
+    }
+
+    level = min_buddy_level_for_size(size);
+    if (allocation == PHYS_ADDR_INVALID 
+            && level >= COMPACTION_MIN_LEVEL
+            && size <= (PAGE_SIZE << (BUDDY_LEVELS - 1))) {
+        /*
+        There may be enough free memory but it's scattered between movable
+        pages. Compact a window in the first zone (and arena, starting from our
+        home) we're allowed to use which can make one, and retry under the same
+        lock hold so no one else gets it.
+        */
+        const pmap_pfa_zone_e *fallbacks = zone_fallbacks_for(zone, &m);
+        unsigned int home = arena_home_index();
+        bool compacted = false;
+
+        for (unsigned int i = 0; i < PMAP_PFA_ZONE_COUNT && !compacted; i++) {
+            pmap_pfa_zone_e zone_i = fallbacks[i];
+            if (zone_i == PMAP_PFA_ZONE_COUNT) {
                 break;
             }
-            pmap_pfa_free_entry_t buddy_fe = NULL;
-            /* 
-            Our buddy is free! 
-            Since we have not marked ourselves as free yet, we only need to
-            free our buddy before continuing (since we are implicitly free).
-            */
-            buddy_bitmap_set_bit_locked(buddy_i, level_i, BUDDY_BIT_ALLCOATED);
 
-            buddy_fe = get_pfa_free_entry_for_page(buddy_i);
-            list_remove(&buddy_fe->elem);
+            for (unsigned int arena_i = 0; 
+                    arena_i < pfa->arena_count && !compacted; arena_i++) {
+                struct pmap_pfa_arena *arena = arena_nth(home, arena_i);
+                page_id_t base = PAGE_ID_INVALID;
+
+                if (!arena->zones[zone_i].page_count) {
+                    continue;
+                }
 
-            /* continue with the root */
-            page_i = get_root_buddy_page_id_for_page(page_i, level_i);
+                ARENA_LOCK(arena);
+                compacted = compaction_run_locked(
+                    &arena->zones[zone_i], level
+                );
+                if (compacted) {
+                    base = arena_alloc_locked(
+                        arena, home, zone_i, size, 1, &m, zone, mobility
+                    );
+                }
+                ARENA_UNLOCK(arena);
+
+                if (base != PAGE_ID_INVALID) {
+                    allocation = page_id_to_pa(base);
+                }
+            }
         }
+    }
 
-        /*
-        Finalize our free for this page.
-        level_i holds the level we bailed on and is thus where we should insert
-        the free record for page_i
-        */
+    if (allocation == PHYS_ADDR_INVALID 
+            && pressure_direct_reclaim(size_to_page_count(size))) {
+        /* Last resort, the caches gave something back so try once more */
+        allocation = pmap_pfa_alloc_contig_arenas(size, 1, &m, zone, mobility);
+    }
 
-        fe = get_pfa_free_entry_for_page(page_i);
-        list_push_front(pfa->buddy_lists + level_i, &fe->elem);
-        buddy_bitmap_set_bit_locked(page_i, level_i, BUDDY_BIT_FREE);
+    return allocation;
+}
+
+phys_addr_t
+pmap_pfa_alloc_order(unsigned int order, pmap_page_metadata_s *metadata) {
+    phys_addr_t allocation = PHYS_ADDR_INVALID;
+
+    uint64_t start = routines_read_cntvct();
+
+    ASSERT_NOT_IRQ();
+    REQUIRE(order <= PMAP_PFA_MAX_ORDER);
+
+    /*
+    A request for exactly one level's worth of pages is always serviced by a
+    single buddy block of that level (or a magazine block of that order), and
+    buddy blocks are aligned to their own size since the managed range begins on
+    a top level boundary.
+    */
+    allocation = pmap_pfa_alloc_contig_internal(
+        PAGE_SIZE << order, metadata, PMAP_PFA_ALLOC_NONE
+    );
+    ASSERT(allocation == PHYS_ADDR_INVALID 
+            || allocation % (PAGE_SIZE << order) == 0);
+
+    pressure_kick();
+    stats_record_alloc(start);
+    return allocation;
+}
+
+phys_addr_t
+pmap_pfa_alloc_aligned(size_t size, size_t align, 
+                       pmap_page_metadata_s *metadata) {
+    return pmap_pfa_alloc_aligned_flags(
+        size, align, metadata, PMAP_PFA_ALLOC_NONE
+    );
+}
+
+phys_addr_t
+pmap_pfa_alloc_aligned_flags(size_t size, size_t align, 
+                             pmap_page_metadata_s *metadata,
+                             pmap_pfa_alloc_flags_t flags) {
+    phys_addr_t allocation = PHYS_ADDR_INVALID;
+    pmap_pfa_zone_e zone = flags_to_zone(flags);
+    pmap_pfa_mobility_e mobility = flags_to_mobility(flags);
+    pmap_page_metadata_s m = *metadata;
+    page_id_t align_pages = 0;
+    uint64_t start = routines_read_cntvct();
+
+    ASSERT_NOT_IRQ();
+    REQUIRE(align && !(align & (align - 1)));
+    REQUIRE((align >> PAGE_SHIFT) < PAGE_ID_INVALID);
+    align_pages = MAX(align, PAGE_SIZE) >> PAGE_SHIFT;
+
+    /* As in pmap_pfa_alloc_contig_internal */
+    m.mobility = mobility;
+    if (mobility != PMAP_PFA_MOBILITY_MOVABLE) {
+        m.mover = PMAP_PFA_MOVER_NONE;
+    }
+    ASSERT(m.mover <= pfa->compaction.mover_count);
+
+    /* Skip the magazines, whose blocks are only naturally aligned */
+    allocation = pmap_pfa_alloc_contig_arenas(
+        size, align_pages, &m, zone, mobility
+    );
+
+    if (allocation == PHYS_ADDR_INVALID) {
+        /* As in pmap_pfa_alloc_contig_internal, retry without our caches */
+        pmap_pfa_drain_caches();
+
+        allocation = pmap_pfa_alloc_contig_arenas(
+            size, align_pages, &m, zone, mobility
+        );
+    }
+
+    if (allocation == PHYS_ADDR_INVALID 
+            && pressure_direct_reclaim(size_to_page_count(size))) {
+        /* And then with whatever the shrinkers could give back */
+        allocation = pmap_pfa_alloc_contig_arenas(
+            size, align_pages, &m, zone, mobility
+        );
+    }
+
+    if ((flags & PMAP_PFA_ALLOC_ZERO) && allocation != PHYS_ADDR_INVALID) {
+        memset(
+            (void *)pmap_pa_to_kva(allocation), 0x00, 
+            (size_t)size_to_page_count(size) << PAGE_SHIFT
+        );
+    }
+
+    ASSERT(allocation == PHYS_ADDR_INVALID || allocation % align == 0);
+    pressure_kick();
+    stats_record_alloc(start);
+    return allocation;
+}
+
+phys_addr_t
+pmap_pfa_alloc_contig(size_t size, pmap_page_metadata_s *metadata) {
+    return pmap_pfa_alloc_contig_flags(size, metadata, PMAP_PFA_ALLOC_NONE);
+}
+
+phys_addr_t
+pmap_pfa_alloc_contig_flags(size_t size, pmap_page_metadata_s *metadata,
+                            pmap_pfa_alloc_flags_t flags) {
+    phys_addr_t allocation = PHYS_ADDR_INVALID;
+    page_id_t page_count = size_to_page_count(size);
+    uint64_t start = routines_read_cntvct();
+
+    ASSERT_NOT_IRQ();
+
+    if ((flags & PMAP_PFA_ALLOC_ZERO) && page_count == 1 
+            && flags_to_zone(flags) == PMAP_PFA_ZONE_NORMAL) {
+        /* Single zeroed pages come from the pool when possible */
+        allocation = zero_pool_alloc(metadata, flags_to_mobility(flags));
+        if (allocation != PHYS_ADDR_INVALID) {
+            goto out;
+        }
+    }
+
+    allocation = pmap_pfa_alloc_contig_internal(size, metadata, flags);
+
+    if ((flags & PMAP_PFA_ALLOC_ZERO) && allocation != PHYS_ADDR_INVALID) {
+        /* Pool miss (or too large for the pool), zero on the critical path */
+        memset(
+            (void *)pmap_pa_to_kva(allocation), 0x00, 
+            (size_t)page_count << PAGE_SHIFT
+        );
     }
+
+out:
+    pressure_kick();
+    stats_record_alloc(start);
+    return allocation;
 }
 
 void
 pmap_pfa_free_contig(phys_addr_t addr, size_t size) {
     page_id_t page_base = 0;
     page_id_t page_count = 0;
+    int order = 0;
+    uint64_t start = routines_read_cntvct();
+
+    ASSERT_NOT_IRQ();
 
     page_base = pa_to_page_id(addr);
     page_count = size_to_page_count(size);
 
-    PFA_LOCK(pfa);
-    
-    /* free pages */
-    buddy_free_pages_locked(page_base, page_count);
+    order = pcp_order_for_pages(page_base, page_count);
+    if (order >= 0 && pcp_free(order, page_base)) {
+        /* Cached on the fast path */
+        goto out;
+    }
 
-    /* we do not update MDS as the data is invalid when the pages are free */
+    /* free pages (this also clears their MDS entries) */
+    buddy_free_pages(page_base, page_count);
 
-    PFA_UNLOCK(pfa);
+out:
+    stats_record_free(start);
+}
+
+size_t
+pmap_pfa_alloc_batch(phys_addr_t *pages, size_t count,
+                     pmap_page_metadata_s *metadata) {
+    return pmap_pfa_alloc_batch_flags(
+        pages, count, metadata, PMAP_PFA_ALLOC_NONE
+    );
+}
+
+size_t
+pmap_pfa_alloc_batch_flags(phys_addr_t *pages, size_t count,
+                           pmap_page_metadata_s *metadata,
+                           pmap_pfa_alloc_flags_t flags) {
+    size_t allocated = 0;
+    pmap_pfa_zone_e zone = flags_to_zone(flags);
+    pmap_pfa_mobility_e mobility = flags_to_mobility(flags);
+    pmap_page_metadata_s m = *metadata;
+    uint64_t start = routines_read_cntvct();
+
+    ASSERT_NOT_IRQ();
+
+    /* As in pmap_pfa_alloc_contig_internal */
+    m.mobility = mobility;
+    if (mobility != PMAP_PFA_MOBILITY_MOVABLE) {
+        m.mover = PMAP_PFA_MOVER_NONE;
+    }
+    ASSERT(m.mover <= pfa->compaction.mover_count);
+
+    allocated = buddy_alloc_batch(0, pages, count, zone, mobility);
+    if (allocated < count) {
+        /* The magazines may be hoarding what we need, retry without them */
+        pmap_pfa_drain_caches();
+
+        allocated += buddy_alloc_batch(
+            0, pages + allocated, count - allocated, zone, mobility
+        );
+    }
+
+    for (size_t i = 0; (flags & PMAP_PFA_ALLOC_ZERO) && i < allocated; i++) {
+        memset((void *)pmap_pa_to_kva(pages[i]), 0x00, PAGE_SIZE);
+    }
+
+    /*
+    Apply metadata in a single pass over the batch. Pages split out of the same
+    block are adjacent in the batch, so we coalesce them into runs. The pages
+    are ours now, so as in pcp_alloc we don't need any arena lock for this.
+    */
+    for (size_t run_start = 0; run_start < allocated;) {
+        size_t run_end = run_start + 1;
+        while (run_end < allocated 
+                && pages[run_end] == pages[run_end - 1] + PAGE_SIZE) {
+            run_end++;
+        }
+
+        apply_metadata_range_locked(
+            pa_to_page_id(pages[run_start]), run_end - run_start, &m
+        );
+        run_start = run_end;
+    }
+
+    pressure_kick();
+    stats_record_alloc(start);
+    return allocated;
 }
 
-#if (CONFIG_DEBUG || CONFIG_TESTING)
 void
-pmap_pfa_dump_state(void) {
-    for (unsigned int level_i = 0; level_i < BUDDY_LEVELS; level_i++) {
-        struct list_elem *e = NULL;
-        struct list *buddy_list = NULL;
-        size_t size = 0;
+pmap_pfa_free_batch(phys_addr_t *pages, size_t count) {
+    struct pmap_pfa_arena *arena = NULL;
+    uint64_t start = routines_read_cntvct();
+
+    ASSERT_NOT_IRQ();
+
+    for (size_t i = 0; i < count; i++) {
+        page_id_t page = pa_to_page_id(pages[i]);
+
+        arena = arena_lock_switch(arena, page);
+        buddy_free_pages_locked(page, 1);
+    }
+
+    if (arena) {
+        ARENA_UNLOCK(arena);
+    }
+
+    stats_record_free(start);
+}
+
+/** Adds the histogram FROM into TO */
+static void
+stats_histogram_add(struct pmap_pfa_histogram *to, 
+                    const struct pmap_pfa_histogram *from) {
+    for (unsigned int i = 0; i < PMAP_PFA_HISTOGRAM_BUCKETS; i++) {
+        to->buckets[i] += from->buckets[i];
+    }
+}
+
+void
+pmap_pfa_get_stats(struct pmap_pfa_stats *stats) {
+    memset(stats, 0x00, sizeof(*stats));
+
+    for (unsigned int cpu_i = 0; cpu_i < SMP_MAX_CPUS; cpu_i++) {
+        const struct pmap_pfa_stats *cpu = &pfa->stats[cpu_i].stats;
+
+        stats->splits += cpu->splits;
+        stats->merges += cpu->merges;
+        stats->list_ops += cpu->list_ops;
+        stats->bitmap_ops += cpu->bitmap_ops;
+        for (unsigned int level_i = 0; level_i < BUDDY_LEVELS; level_i++) {
+            stats->split_depth[level_i] += cpu->split_depth[level_i];
+            stats->merge_depth[level_i] += cpu->merge_depth[level_i];
+        }
+
+        stats_histogram_add(&stats->alloc_ticks, &cpu->alloc_ticks);
+        stats_histogram_add(&stats->free_ticks, &cpu->free_ticks);
+        stats_histogram_add(&stats->lock_wait_ticks, &cpu->lock_wait_ticks);
+        stats_histogram_add(&stats->lock_hold_ticks, &cpu->lock_hold_ticks);
+    }
+}
+
+void
+pmap_pfa_reset_stats(void) {
+    /* 
+    This races with other cores recording samples, so a handful may be lost or
+    survive the reset. That's fine for statistics.
+    */
+    memset(pfa->stats, 0x00, sizeof(pfa->stats));
+}
+
+/** Prints the non-empty buckets of HISTOGRAM under the heading NAME */
+static void
+dump_histogram(const char *name, const struct pmap_pfa_histogram *histogram) {
+    uint64_t total = 0;
+
+    for (unsigned int i = 0; i < PMAP_PFA_HISTOGRAM_BUCKETS; i++) {
+        total += histogram->buckets[i];
+    }
+
+    printf("%s (ticks, %llu samples)\n", name, total);
+    for (unsigned int i = 0; i < PMAP_PFA_HISTOGRAM_BUCKETS; i++) {
+        if (histogram->buckets[i]) {
+            printf(
+                "\t< 2^%-2u : %llu\n", i + 1, histogram->buckets[i]
+            );
+        }
+    }
+}
 
-        buddy_list = pfa->buddy_lists + level_i;
-        size = list_size(buddy_list);
+void
+pmap_pfa_dump(void) {
+    struct pmap_pfa_zero_pool_stats zero_pool;
+    struct pmap_pfa_color_stats colors;
+    struct pmap_pfa_compaction_stats compaction;
+    struct pmap_pfa_cma_stats cma;
+    struct pmap_pfa_lazy_stats lazy;
+    struct pmap_pfa_pressure_stats pressure;
+    struct pmap_pfa_free_summary summary;
+    struct pmap_pfa_stats stats;
+
+    for (unsigned int arena_i = 0; arena_i < pfa->arena_count; arena_i++) {
+        struct pmap_pfa_arena *arena = &pfa->arenas[arena_i];
+
+        ARENA_LOCK(arena);
         printf(
-            "Level %d -- free count = %lu\n",
-            level_i, size
-        );
-
-        if (size < 100) {
-            for (e = list_begin(buddy_list); 
-                e != list_end (buddy_list); e = list_next(e)) {
-                pmap_pfa_free_entry_t fe = list_entry(e, 
-                    struct pmap_pfa_free_entry, elem);
-                printf(
-                    "\t%d\n", 
-                    pa_to_page_id(pmap_physmap_kva_to_pa((phys_addr_t)fe))
-                );
+            "Arena %u -- base = 0x%llx, pages = %llu, remote = %llu\n",
+            arena_i, page_id_to_pa(arena->page_base), 
+            (uint64_t)arena->page_count, arena->remote_allocations
+        );
+        for (unsigned int zone_i = 0; zone_i < PMAP_PFA_ZONE_COUNT; zone_i++) {
+            struct pmap_pfa_zone *zone = &arena->zones[zone_i];
+
+            printf(
+                "\tZone %u -- free pages = %zu, allocations = %llu, "
+                "fallbacks = %llu, failures = %llu, steals = %llu, "
+                "claims = %llu\n",
+                zone_i, zone->free_pages, zone->allocations, zone->fallbacks,
+                zone->failures, zone->steals, zone->claims
+            );
+
+            for (unsigned int level_i = 0; level_i < BUDDY_LEVELS; level_i++) {
+                if (zone->free_blocks[level_i]) {
+                    printf(
+                        "\t\tLevel %u -- free count = %zu\n",
+                        level_i, zone->free_blocks[level_i]
+                    );
+                }
             }
         }
-        
+        ARENA_UNLOCK(arena);
+    }
+
+    pmap_pfa_get_free_summary(PMAP_PFA_MAX_ORDER, &summary);
+    printf(
+        "Free -- pages = %zu, largest order = %d, fragmentation = %u/%u\n",
+        summary.free_pages, summary.largest_order, summary.fragmentation,
+        PMAP_PFA_FRAGMENTATION_SCALE
+    );
+
+    pmap_pfa_zero_pool_get_stats(&zero_pool);
+    printf(
+        "Zero pool -- count = %zu, target = %zu, hits = %llu, misses = %llu\n",
+        zero_pool.count, zero_pool.target, zero_pool.hits, zero_pool.misses
+    );
+
+    pmap_pfa_color_get_stats(&colors);
+    printf(
+        "Colors -- enabled = %d, hits = %llu, refills = %llu, misses = %llu, "
+        "cached =",
+        colors.enabled, colors.hits, colors.refills, colors.misses
+    );
+    for (unsigned int color = 0; color < PMAP_PFA_COLORS; color++) {
+        printf(" %zu", colors.cached[color]);
+    }
+    printf("\n");
+
+    pmap_pfa_compaction_get_stats(&compaction);
+    printf(
+        "Compaction -- runs = %llu, successes = %llu, migrated = %llu, "
+        "ticks = %llu\n",
+        compaction.runs, compaction.successes, compaction.pages_migrated,
+        compaction.ticks
+    );
+
+    pmap_pfa_cma_get_stats(&cma);
+    printf(
+        "CMA -- base = 0x%llx, size = %zu, claimed = %zu, claims = %llu, "
+        "failures = %llu, releases = %llu, migrated = %llu\n"
+        "\tclaim ticks = %llu (max %llu), release ticks = %llu (max %llu)\n",
+        cma.base, cma.size, cma.claimed_pages, cma.claims, cma.failures,
+        cma.releases, cma.pages_migrated, cma.claim_ticks, 
+        cma.claim_max_ticks, cma.release_ticks, cma.release_max_ticks
+    );
+
+    pmap_pfa_pressure_get_stats(&pressure);
+    printf(
+        "Pressure -- level = %d, free = %zu, min = %zu, low = %zu, "
+        "high = %zu, shrinkers = %u\n"
+        "\tlow crossings = %llu, async runs = %llu, direct runs = %llu, "
+        "reclaimed = %llu, direct ticks = %llu\n",
+        pressure.level, pressure.free_pages, pressure.min, pressure.low,
+        pressure.high, pressure.shrinkers, pressure.low_crossings,
+        pressure.async_runs, pressure.direct_runs, pressure.pages_reclaimed,
+        pressure.direct_ticks
+    );
+
+    pmap_pfa_lazy_get_stats(&lazy);
+    printf(
+        "Lazy -- enabled = %d, deferrals = %llu, coalesces = %llu, "
+        "coalesced = %llu\n",
+        lazy.enabled, lazy.deferrals, lazy.coalesces, lazy.coalesced
+    );
+
+    pmap_pfa_get_stats(&stats);
+    printf(
+        "Splits = %llu, merges = %llu, list ops = %llu, bitmap ops = %llu\n",
+        stats.splits, stats.merges, stats.list_ops, stats.bitmap_ops
+    );
+    for (unsigned int level_i = 0; level_i < BUDDY_LEVELS; level_i++) {
+        if (stats.split_depth[level_i] || stats.merge_depth[level_i]) {
+            printf(
+                "\tDepth %-2u -- split = %llu, merged = %llu\n", level_i,
+                stats.split_depth[level_i], stats.merge_depth[level_i]
+            );
+        }
+    }
+    dump_histogram("Allocation latency", &stats.alloc_ticks);
+    dump_histogram("Free latency", &stats.free_ticks);
+    dump_histogram("Lock wait", &stats.lock_wait_ticks);
+    dump_histogram("Lock hold", &stats.lock_hold_ticks);
+}
+
+#if (CONFIG_DEBUG || CONFIG_TESTING)
+void
+pmap_pfa_set_bulk_init(bool enabled) {
+    /* Only read by pmap_pfa_init, which runs before there is any locking */
+    bulk_init = enabled;
+}
+
+void
+pmap_pfa_set_arena_count(unsigned int count) {
+    REQUIRE(count >= 1 && count <= PMAP_PFA_ARENAS);
+
+    /* As with bulk_init, only read by pmap_pfa_init */
+    arena_count_next = count;
+}
+
+void
+pmap_pfa_set_cma_size(size_t size) {
+    /* As with bulk_init, only read by pmap_pfa_init */
+    cma_size_next = size;
+}
+#endif /* CONFIG_DEBUG || CONFIG_TESTING */
+
+unsigned int
+pmap_pfa_get_arena_count(void) {
+    return pfa->arena_count;
+}
+
+unsigned int
+pmap_pfa_get_home_arena(void) {
+    return arena_home_index();
+}
+
+void
+pmap_pfa_arena_get_stats(unsigned int arena_i, 
+                         struct pmap_pfa_arena_stats *stats) {
+    struct pmap_pfa_arena *arena = NULL;
+
+    REQUIRE(arena_i < pfa->arena_count);
+    arena = &pfa->arenas[arena_i];
+
+    memset(stats, 0x00, sizeof(*stats));
+    ARENA_LOCK(arena);
+    stats->base = page_id_to_pa(arena->page_base);
+    stats->size = (size_t)arena->page_count << PAGE_SHIFT;
+    for (unsigned int zone_i = 0; zone_i < PMAP_PFA_ZONE_COUNT; zone_i++) {
+        stats->free_pages += arena->zones[zone_i].free_pages;
+        stats->allocations += arena->zones[zone_i].allocations;
     }
+    stats->remote_allocations = arena->remote_allocations;
+    ARENA_UNLOCK(arena);
 }
 
+uint64_t
+pmap_pfa_get_init_ticks(void) {
+    return pfa->init_ticks;
+}
+
+#if (CONFIG_DEBUG || CONFIG_TESTING)
 pmap_pfa_free_entry_t
 pmap_pfa_contains(unsigned int level, page_id_t page) {
     struct list *buddy_list = NULL;
-    buddy_list = pfa->buddy_lists + level;
+    buddy_list = 
+        &zone_for_page(page)->buddy_lists[pageblock_mobility(page)][level];
     for (struct list_elem *e = list_begin(buddy_list);  
             e != list_end (buddy_list); e = list_next(e)) {
         pmap_pfa_free_entry_t fe1 = 
@@ -693,14 +4990,65 @@ void
 pmap_pfa_get_state(size_t *level_buffer, size_t count) {
     REQUIRE(count >= BUDDY_LEVELS);
 
-    PFA_LOCK(pfa);
     for (unsigned int level_i = 0; level_i < BUDDY_LEVELS; level_i++) {
-        struct list *buddy_list = NULL;
-        buddy_list = pfa->buddy_lists + level_i;
-        level_buffer[level_i] = list_size(buddy_list);
+        level_buffer[level_i] = 0;
+    }
+
+    for (unsigned int arena_i = 0; arena_i < pfa->arena_count; arena_i++) {
+        struct pmap_pfa_arena *arena = &pfa->arenas[arena_i];
+
+        ARENA_LOCK(arena);
+        for (unsigned int zone_i = 0; zone_i < PMAP_PFA_ZONE_COUNT; zone_i++) {
+            struct pmap_pfa_zone *zone = &arena->zones[zone_i];
+
+            for (unsigned int level_i = 0; level_i < BUDDY_LEVELS; level_i++) {
+                level_buffer[level_i] += zone->free_blocks[level_i];
+            }
+        }
+        ARENA_UNLOCK(arena);
+    }
+}
+
+void
+pmap_pfa_set_mobility_grouping(bool enabled) {
+    arenas_lock_all();
+    mobility_grouping = enabled;
+    arenas_unlock_all();
+}
+
+/**
+ * Moves up to COUNT free blocks of 2^ORDER pages into the magazine of CPU, as
+ * though that core had freed them, regardless of its watermarks. Returns the
+ * number of blocks the magazine then holds.
+ */
+size_t
+pmap_pfa_pcp_fill(unsigned int cpu, unsigned int order, size_t count) {
+    struct pmap_pfa_pcp *pcp = NULL;
+    struct pmap_pfa_pcp_magazine *magazine = NULL;
+
+    REQUIRE(cpu < SMP_MAX_CPUS);
+    REQUIRE(order < PCP_ORDERS);
+    pcp = &pfa->pcp[cpu];
+    magazine = &pcp->magazines[order];
+
+    PCP_LOCK(pcp);
+    for (size_t i = 0; i < count; i++) {
+        phys_addr_t block = PHYS_ADDR_INVALID;
+        pmap_pfa_free_entry_t fe = NULL;
+
+        if (!buddy_alloc_batch(order, &block, 1, PMAP_PFA_ZONE_NORMAL, 
+                               PMAP_PFA_MOBILITY_UNMOVABLE)) {
+            break;
+        }
+
+        fe = (pmap_pfa_free_entry_t)pmap_pa_to_kva(block);
+        list_push_front(&magazine->blocks, &fe->elem);
+        magazine->count++;
     }
+    count = magazine->count;
+    PCP_UNLOCK(pcp);
 
-    PFA_UNLOCK(pfa);
+    return count;
 }
 
 #endif /* CONFIG_DEBUG || CONFIG_TESTING */
@@ -2,9 +2,59 @@
 #define PMAP_PFA_H
 #include "lib/types.h"
 #include "pmap.h"
+#include "machine/smp/smp.h"
 
 /** Represents a page number */
 typedef uint32_t page_id_t;
+/** An invalid page number */
+#define PAGE_ID_INVALID (UINT32_MAX)
+
+#ifndef CONFIG_PFA_MAX_ORDER
+#define CONFIG_PFA_MAX_ORDER (9)
+#endif
+
+/**
+ * The largest block order (a block of PAGE_SIZE << order bytes) the PFA manages
+ * directly. Set at build time with the PFA_MAX_ORDER CMake option.
+ */
+#define PMAP_PFA_MAX_ORDER      (CONFIG_PFA_MAX_ORDER)
+/** The number of buddy levels (orders 0 through PMAP_PFA_MAX_ORDER) */
+#define PMAP_PFA_BUDDY_LEVELS   (PMAP_PFA_MAX_ORDER + 1)
+
+#ifndef CONFIG_PFA_ARENAS
+#define CONFIG_PFA_ARENAS (SMP_MAX_CPUS)
+#endif
+
+/**
+ * The most arenas (independently locked slices of physical memory, one per
+ * core by default) the PFA may be split into. Set at build time with the
+ * PFA_ARENAS CMake option.
+ */
+#define PMAP_PFA_ARENAS         (CONFIG_PFA_ARENAS)
+
+#ifndef CONFIG_PFA_CMA_MB
+#define CONFIG_PFA_CMA_MB (16)
+#endif
+
+/**
+ * The default size of the contiguous memory reservation (the CMA zone) set
+ * aside for device buffers. Set at build time with the PFA_CMA_MB CMake option.
+ */
+#define PMAP_PFA_CMA_SIZE       ((size_t)(CONFIG_PFA_CMA_MB) << 20)
+
+/** The order of a block which can back an L2 block mapping (2MB) */
+#define PMAP_PFA_ORDER_L2_BLOCK (9)
+/** The order of a block which can back an L1 block mapping (1GB) */
+#define PMAP_PFA_ORDER_L1_BLOCK (18)
+
+/**
+ * The number of page colors. Pages of the same color map to the same L2 sets,
+ * so there is one color for each page in an L2 way (8 on the BCM2837).
+ */
+#define PMAP_PFA_COLORS \
+    (SMP_L2_CACHE_SIZE / SMP_L2_CACHE_WAYS / PAGE_SIZE)
+/** Asks pmap_pfa_alloc_colored for the calling core's next color in turn */
+#define PMAP_PFA_COLOR_NEXT     (UINT32_MAX)
 
 typedef enum pmap_page_type {
     /*
@@ -14,6 +64,8 @@ typedef enum pmap_page_type {
     PMAP_PAGE_TYPE_KERNEL_DATA      = 0x00,
     PMAP_PAGE_TYPE_KERNEL_TEXT      = 0x01,
     PMAP_PAGE_TYPE_PAGE_TABLE       = 0x02,
+    /** Backs the objects of a slab cache (see core/vm/slab.h) */
+    PMAP_PAGE_TYPE_SLAB             = 0x03,
 } pmap_page_type_e;
 
 typedef struct pmap_page_metadata {
@@ -24,10 +76,336 @@ typedef struct pmap_page_metadata {
      */
     unsigned char page_type     : 2;
 
-    /** reserved bits */
-    unsigned char padding       : 6;
+    /**
+     * The mobility class the page was allocated with. Internally typed as
+     * pmap_pfa_mobility_e. This is set by the PFA from the allocation flags and
+     * any value passed in by the caller is ignored.
+     */
+    unsigned char mobility      : 2;
+
+    /**
+     * For movable pages, the ID of the mover (see pmap_pfa_register_mover)
+     * which compaction asks to migrate the page, or PMAP_PFA_MOVER_NONE if the
+     * page must stay put. The PFA clears this for all other classes.
+     */
+    unsigned char mover         : 4;
 } pmap_page_metadata_s;
 
+/** Indicates that a page has no mover and so is never migrated */
+#define PMAP_PFA_MOVER_NONE     (0)
+/** The largest mover ID, limited by the width of pmap_page_metadata.mover */
+#define PMAP_PFA_MOVER_MAX      (15)
+
+/**
+ * Called by compaction after the contents of the movable page OLD_PAGE have
+ * been copied to NEW_PAGE. The mover must redirect every mapping and reference
+ * to OLD_PAGE to NEW_PAGE and return true, or return false to leave the page
+ * where it is (in which case NEW_PAGE is discarded).
+ * 
+ * This is called with the lock of OLD_PAGE's arena held, see
+ * struct pmap_pfa_mover.
+ */
+typedef bool (* pmap_pfa_migrate_t)(phys_addr_t old_page, phys_addr_t new_page,
+                                    void *context);
+
+/**
+ * An owner of movable pages which knows how to migrate them.
+ * 
+ * The migrate callback runs with an arena lock held, so it must not allocate
+ * or free memory through the PFA (or anything built on it, such as kmalloc),
+ * and must not block on any lock which may be held while calling into the PFA
+ * (use a try-lock and return false instead). A mover whose switch over could
+ * need memory, such as a page table update which may need a new table, must
+ * allocate it ahead of time or return false. Taking an arena lock from the
+ * callback panics.
+ */
+struct pmap_pfa_mover {
+    pmap_pfa_migrate_t migrate;
+    /** Passed to migrate */
+    void *context;
+};
+
+/** The most shrinkers which may be registered */
+#define PMAP_PFA_SHRINKER_MAX   (16)
+
+/**
+ * Asks a cache to give about PAGES pages of memory back to the PFA (with
+ * pmap_pfa_free_contig or similar) and returns the number of pages it freed,
+ * which may be more or less than PAGES.
+ * 
+ * This is called without any PFA lock held, either by an idle core or by a core
+ * whose allocation is short of memory or just took free memory below the low
+ * watermark. It may free pages but must not allocate them.
+ */
+typedef size_t (* pmap_pfa_shrink_t)(size_t pages, void *context);
+
+/** A cache which can give memory back when the PFA runs short */
+struct pmap_pfa_shrinker {
+    pmap_pfa_shrink_t shrink;
+    /** Passed to shrink */
+    void *context;
+};
+
+/** How short of memory the PFA is, see pmap_pfa_get_pressure */
+typedef enum pmap_pfa_pressure_level {
+    /** Free memory is at or above the low watermark */
+    PMAP_PFA_PRESSURE_NONE  = 0,
+    /** Free memory is below the low watermark and is being reclaimed */
+    PMAP_PFA_PRESSURE_LOW   = 1,
+    /** Free memory is below the min watermark, allocations reclaim directly */
+    PMAP_PFA_PRESSURE_MIN   = 2,
+} pmap_pfa_pressure_e;
+
+/** Flags which modify the behavior of an allocation request */
+typedef uint32_t pmap_pfa_alloc_flags_t;
+
+/** No special behavior */
+#define PMAP_PFA_ALLOC_NONE     (0)
+/** The returned memory must be zero filled */
+#define PMAP_PFA_ALLOC_ZERO     (1 << 0)
+/** The returned memory must be addressable by the VideoCore and DMA engines */
+#define PMAP_PFA_ALLOC_DMA      (1 << 1)
+/** The memory can be freed on demand (such as a cache). See pmap_pfa_mobility */
+#define PMAP_PFA_ALLOC_RECLAIMABLE  (1 << 2)
+/** The memory can be migrated elsewhere. See pmap_pfa_mobility */
+#define PMAP_PFA_ALLOC_MOVABLE  (1 << 3)
+
+/**
+ * Allocations are grouped by how easily their pages can be vacated so that a
+ * single pinned page does not prevent an entire large block from being
+ * allocated. Allocations are unmovable unless their flags say otherwise.
+ */
+typedef enum pmap_pfa_mobility {
+    /** The page cannot be moved or freed on demand (e.g. page tables) */
+    PMAP_PFA_MOBILITY_UNMOVABLE     = 0,
+    /** The page can be freed on demand but cannot be moved */
+    PMAP_PFA_MOBILITY_RECLAIMABLE   = 1,
+    /** The page can be migrated to a new physical page */
+    PMAP_PFA_MOBILITY_MOVABLE       = 2,
+
+    PMAP_PFA_MOBILITY_COUNT
+} pmap_pfa_mobility_e;
+
+/** 
+ * Physical memory is split into zones by what can address it. Each zone has its
+ * own free lists, and requests fall back from their preferred zone to the ones
+ * below it (but never above it). Only migratable pages may borrow the CMA zone.
+ */
+typedef enum pmap_pfa_zone_type {
+    /** Low memory reserved for buffers shared with the VideoCore/DMA engines */
+    PMAP_PFA_ZONE_DMA       = 0,
+    /** Memory set aside for large contiguous device buffers */
+    PMAP_PFA_ZONE_CMA       = 1,
+    /** All other memory */
+    PMAP_PFA_ZONE_NORMAL    = 2,
+
+    PMAP_PFA_ZONE_COUNT
+} pmap_pfa_zone_e;
+
+/** Statistics for a single zone */
+struct pmap_pfa_zone_stats {
+    /** The first physical address in the zone */
+    phys_addr_t base;
+    /** The size of the zone in bytes. Zero if the zone is empty. */
+    size_t size;
+    /** 
+     * The number of pages free in the buddy allocator. This does not include 
+     * free pages held by the per-CPU magazines or the zero pool.
+     */
+    size_t free_pages;
+    /** The number of requests serviced by the zone */
+    uint64_t allocations;
+    /** The number of serviced requests which preferred a different zone */
+    uint64_t fallbacks;
+    /** The number of requests preferring this zone which were not fully met */
+    uint64_t failures;
+    /** The number of blocks taken from another mobility class's free lists */
+    uint64_t steals;
+    /** The number of top level blocks which changed mobility class by a steal */
+    uint64_t claims;
+};
+
+/** Statistics for a single arena */
+struct pmap_pfa_arena_stats {
+    /** The first physical address in the arena */
+    phys_addr_t base;
+    /** The size of the arena in bytes */
+    size_t size;
+    /** The number of pages free in the arena's buddy allocator */
+    size_t free_pages;
+    /** The number of requests serviced by the arena */
+    uint64_t allocations;
+    /** The number of those requests made by a core with another home arena */
+    uint64_t remote_allocations;
+};
+
+/** Statistics for the pool of pre-zeroed pages */
+struct pmap_pfa_zero_pool_stats {
+    /** The number of pages currently in the pool */
+    size_t count;
+    /** The number of pages background zeroing tries to keep in the pool */
+    size_t target;
+    /** The number of single page zeroed requests serviced by the pool */
+    uint64_t hits;
+    /** The number of single page zeroed requests which found the pool empty */
+    uint64_t misses;
+};
+
+/** Statistics for compaction */
+struct pmap_pfa_compaction_stats {
+    /** The number of times compaction tried to create a free block */
+    uint64_t runs;
+    /** The number of runs which created a free block */
+    uint64_t successes;
+    /** The number of pages moved to a new physical page */
+    uint64_t pages_migrated;
+    /** The time spent compacting, in generic timer (CNTVCT) ticks */
+    uint64_t ticks;
+};
+
+/** Statistics for the contiguous memory reservation */
+struct pmap_pfa_cma_stats {
+    /** The first physical address of the reservation */
+    phys_addr_t base;
+    /** The size of the reservation in bytes. Zero if there is none. */
+    size_t size;
+    /** The number of pages currently claimed */
+    size_t claimed_pages;
+    /** The number of claims which were met */
+    uint64_t claims;
+    /** The number of claims which could not be met */
+    uint64_t failures;
+    /** The number of claims released */
+    uint64_t releases;
+    /** The number of movable pages migrated out of the way of claims */
+    uint64_t pages_migrated;
+    /** The time spent claiming, in generic timer (CNTVCT) ticks */
+    uint64_t claim_ticks;
+    /** The longest single claim, in ticks */
+    uint64_t claim_max_ticks;
+    /** The time spent releasing, in ticks */
+    uint64_t release_ticks;
+    /** The longest single release, in ticks */
+    uint64_t release_max_ticks;
+};
+
+/** Statistics for colored allocations */
+struct pmap_pfa_color_stats {
+    /** Whether colored requests are honored, see pmap_pfa_color_set_enabled */
+    bool enabled;
+    /** The number of free pages of each color held for colored requests */
+    size_t cached[PMAP_PFA_COLORS];
+    /** The number of colored requests serviced from the held pages */
+    uint64_t hits;
+    /** The number of blocks split across the colors to refill them */
+    uint64_t refills;
+    /** The number of colored requests which got a page of another color */
+    uint64_t misses;
+};
+
+/** Statistics for lazy coalescing */
+struct pmap_pfa_lazy_stats {
+    /** Whether frees may defer merging, see pmap_pfa_lazy_set_enabled */
+    bool enabled;
+    /** The number of free blocks each level may hold before frees merge */
+    size_t slack[PMAP_PFA_BUDDY_LEVELS];
+    /** The number of freed blocks left on their own level without merging */
+    uint64_t deferrals;
+    /** The number of passes which merged deferred blocks */
+    uint64_t coalesces;
+    /** The number of buddy pairs merged by those passes */
+    uint64_t coalesced;
+};
+
+/** Statistics for memory pressure and reclaim */
+struct pmap_pfa_pressure_stats {
+    /** The number of pages free in the buddy allocator of every zone */
+    size_t free_pages;
+    /** The watermarks, in pages. See pmap_pfa_pressure_set_watermarks. */
+    size_t min;
+    size_t low;
+    size_t high;
+    /** The current pressure level */
+    pmap_pfa_pressure_e level;
+    /** The number of registered shrinkers */
+    unsigned int shrinkers;
+    /** The number of times free memory fell below the low watermark */
+    uint64_t low_crossings;
+    /**
+     * The number of shrinker calls made in the background, by idle cores or by
+     * the allocation which crossed the low watermark
+     */
+    uint64_t async_runs;
+    /** The number of shrinker calls made by allocations short of memory */
+    uint64_t direct_runs;
+    /** The number of pages shrinkers gave back */
+    uint64_t pages_reclaimed;
+    /** The time allocations spent waiting on shrinkers, in CNTVCT ticks */
+    uint64_t direct_ticks;
+};
+
+/** The fragmentation index of a struct pmap_pfa_free_summary is out of this */
+#define PMAP_PFA_FRAGMENTATION_SCALE    (1000)
+
+/** A summary of the free memory in the buddy allocators */
+struct pmap_pfa_free_summary {
+    /** 
+     * The number of pages free in the buddy allocators. As with the zone
+     * statistics, this does not include the per-CPU magazines or the zero pool.
+     */
+    size_t free_pages;
+    /** The number of free blocks of each order */
+    size_t free_blocks[PMAP_PFA_BUDDY_LEVELS];
+    /** The largest order with a free block, or -1 if nothing is free */
+    int largest_order;
+    /**
+     * The external fragmentation index for the requested order: how much of
+     * the free memory, out of PMAP_PFA_FRAGMENTATION_SCALE, is in blocks too
+     * small to serve it. Zero if every free page could, or if nothing is free.
+     */
+    unsigned int fragmentation;
+};
+
+/** The number of buckets in a struct pmap_pfa_histogram */
+#define PMAP_PFA_HISTOGRAM_BUCKETS  (32)
+
+/**
+ * A log2 histogram of generic timer (CNTVCT) tick counts. Bucket i counts the
+ * samples in [2^i, 2^(i + 1)), except that bucket zero also counts samples of
+ * zero ticks and the last bucket counts everything above it.
+ */
+struct pmap_pfa_histogram {
+    uint64_t buckets[PMAP_PFA_HISTOGRAM_BUCKETS];
+};
+
+/** Statistics on the behavior of the allocator, summed over all cores */
+struct pmap_pfa_stats {
+    /** The number of times a free block was split in half for an allocation */
+    uint64_t splits;
+    /** The number of times a freed block was merged with its buddy */
+    uint64_t merges;
+    /** 
+     * Blocks taken off the free lists by small and batch allocations, indexed
+     * by how many levels above the request they were found (and so how many
+     * times they were split)
+     */
+    uint64_t split_depth[PMAP_PFA_BUDDY_LEVELS];
+    /** Blocks returned to the free lists, indexed by how often they merged */
+    uint64_t merge_depth[PMAP_PFA_BUDDY_LEVELS];
+    /** The number of blocks inserted into or removed from the buddy lists */
+    uint64_t list_ops;
+    /** The number of buddy bitmap reads and writes made by the buddy lists */
+    uint64_t bitmap_ops;
+    /** The latency of the allocation entry points, including fast paths */
+    struct pmap_pfa_histogram alloc_ticks;
+    /** The latency of the free entry points, including fast paths */
+    struct pmap_pfa_histogram free_ticks;
+    /** Time spent waiting for an arena lock */
+    struct pmap_pfa_histogram lock_wait_ticks;
+    /** Time an arena lock was held for */
+    struct pmap_pfa_histogram lock_hold_ticks;
+};
+
 /**
  * Initialize the page-frame allocator with a managed range of [ram_base, 
  * ram_base + ram_size). 
@@ -51,13 +429,110 @@ pmap_pfa_init(phys_addr_t ram_base,
  * address at the start of the allocation is returned.
  * If no such allocation can be made, returns PHYS_ADDR_INVALID
  * 
- * If the allocation is small (SIZE < (PAGE_SIZE << (BUDDY_LEVELS - 1))), this
- * function is constant time. If the allocation is large, this function may take
- * linear time with respects to the size of system memory.
+ * If the allocation is small (SIZE <= (PAGE_SIZE << PMAP_PFA_MAX_ORDER)), this
+ * function is constant time. 
+ * 
+ * If the allocation is large, the allocator scans the top level buddy bitmap
+ * for a run of adjacent free top level blocks. The worst case cost is linear 
+ * with respect to the size of system memory but is very small in practice: one
+ * 64-bit bitmap word is read per 64 top level blocks (128MB of RAM with the
+ * default 2MB top level) plus one list removal per top level block of the
+ * allocation. Large allocations are aligned to the top level and may fail due
+ * to fragmentation even when enough memory is free.
+ * 
+ * Neither this nor any other PFA allocation or free (including batches, CMA
+ * claims and releases and their flags variants) may be called from an
+ * interrupt handler or with IRQs masked. The per-CPU magazines and the PFA's
+ * locks are not interrupt safe. Debug builds assert this at each entry point.
  */
 phys_addr_t
 pmap_pfa_alloc_contig(size_t size, pmap_page_metadata_s *metadata);
 
+/**
+ * Identical to pmap_pfa_alloc_contig but the behavior of the allocation may be
+ * modified by FLAGS.
+ * 
+ * With PMAP_PFA_ALLOC_ZERO, the allocation is zero filled. Single page requests
+ * are serviced from a pool of pages zeroed by idle cores when possible, so
+ * they cost no more than an unzeroed allocation. Other requests (and pool
+ * misses) are zeroed before returning.
+ * 
+ * With PMAP_PFA_ALLOC_DMA, the allocation is made from the DMA zone and so can
+ * be handed to the VideoCore or a DMA engine without a bounce buffer. These
+ * requests bypass the per-CPU magazines and the zero pool.
+ * 
+ * With PMAP_PFA_ALLOC_RECLAIMABLE or PMAP_PFA_ALLOC_MOVABLE, the allocation is
+ * grouped with other allocations of the same mobility class. These requests
+ * bypass the per-CPU magazines. Movable pages whose METADATA names a mover may
+ * later be migrated by compaction, and may borrow the CMA zone once their
+ * preferred zone is full.
+ */
+phys_addr_t
+pmap_pfa_alloc_contig_flags(size_t size, pmap_page_metadata_s *metadata,
+                            pmap_pfa_alloc_flags_t flags);
+
+/**
+ * Allocates a single block of PAGE_SIZE << ORDER bytes which is naturally
+ * aligned (i.e. its address is a multiple of its size) and applies METADATA.
+ * ORDER must not exceed PMAP_PFA_MAX_ORDER. This is intended for backing block
+ * mappings, such as a PMAP_PFA_ORDER_L2_BLOCK block for a 2MB L2 descriptor.
+ * Returns PHYS_ADDR_INVALID if no free block of ORDER or above exists.
+ * 
+ * The block is freed with pmap_pfa_free_contig(addr, PAGE_SIZE << ORDER).
+ */
+phys_addr_t
+pmap_pfa_alloc_order(unsigned int order, pmap_page_metadata_s *metadata);
+
+/**
+ * Allocates SIZE bytes of contiguous memory which begin on a multiple of ALIGN
+ * and applies METADATA. ALIGN must be a power of two and is independent of SIZE
+ * (alignments below PAGE_SIZE are treated as PAGE_SIZE). This is intended for
+ * page tables, contiguous hint mappings and DMA descriptors. Returns
+ * PHYS_ADDR_INVALID if no such allocation can be made.
+ * 
+ * Only SIZE bytes are taken. The rest of the block the allocation is carved
+ * from goes back to the free lists, so (for example) a 64K aligned 16K request
+ * leaves the 48K after it free. If no free block is large enough to guarantee
+ * the alignment, the buddy bitmap is scanned for a suitably aligned free block
+ * of the request's size. Requests bypass the per-CPU magazines and are freed
+ * with pmap_pfa_free_contig(addr, SIZE).
+ */
+phys_addr_t
+pmap_pfa_alloc_aligned(size_t size, size_t align, 
+                       pmap_page_metadata_s *metadata);
+
+/**
+ * Identical to pmap_pfa_alloc_aligned but the behavior of the allocation may be
+ * modified by FLAGS, as for pmap_pfa_alloc_contig_flags. An aligned request
+ * with PMAP_PFA_ALLOC_DMA is made from the DMA zone, so device buffers and
+ * descriptors with alignment requirements need no bounce buffer, and one with
+ * PMAP_PFA_ALLOC_ZERO is zeroed before returning.
+ */
+phys_addr_t
+pmap_pfa_alloc_aligned_flags(size_t size, size_t align, 
+                             pmap_page_metadata_s *metadata,
+                             pmap_pfa_alloc_flags_t flags);
+
+/** Get the cache color of the page at PA */
+static inline unsigned int
+pmap_pfa_page_color(phys_addr_t pa) {
+    return (pa >> PAGE_SHIFT) % PMAP_PFA_COLORS;
+}
+
+/**
+ * Allocates a single page of cache color COLOR and applies METADATA. If COLOR
+ * is PMAP_PFA_COLOR_NEXT, the calling core cycles through the colors. This is
+ * intended for hot kernel structures (page tables, per-CPU data, stacks) which
+ * should not compete for the same L2 sets.
+ * 
+ * Colored requests are serviced from free pages partitioned by color, which are
+ * refilled by splitting a block holding one page of each color. Colors are best
+ * effort: if coloring is disabled or no such block is free, a page of any color
+ * is returned. The page is freed with pmap_pfa_free_contig(addr, PAGE_SIZE).
+ */
+phys_addr_t
+pmap_pfa_alloc_colored(unsigned int color, pmap_page_metadata_s *metadata);
+
 /**
  * Frees physical pages starting at ADDR and ranging to ADDR + SIZE
  */
@@ -65,15 +540,388 @@ void
 pmap_pfa_free_contig(phys_addr_t addr, size_t size);
 
 /**
- * Get the metadata for a single page
+ * Allocates COUNT independent (not necessarily contiguous) pages and writes
+ * their addresses to PAGES. METADATA is applied to every allocated page. The
+ * pages are unmovable and come from the normal zone while it lasts (see
+ * pmap_pfa_alloc_batch_flags for other zones and classes). Returns the number
+ * of pages allocated, which is only less than COUNT if the system ran out of
+ * memory. In that case, the first N entries of PAGES are valid and must be
+ * freed by the caller.
+ * 
+ * The batch is serviced under a single hold of the home arena's lock (unless it
+ * runs dry) and higher order blocks are split directly into the batch, so this
+ * is much cheaper than COUNT calls to pmap_pfa_alloc_contig.
+ */
+size_t
+pmap_pfa_alloc_batch(phys_addr_t *pages, size_t count,
+                     pmap_page_metadata_s *metadata);
+
+/**
+ * Identical to pmap_pfa_alloc_batch but the behavior of the allocation may be
+ * modified by FLAGS, as for pmap_pfa_alloc_contig_flags. The pages are taken
+ * from the zone and pageblocks of the mobility class FLAGS select, and with
+ * PMAP_PFA_ALLOC_ZERO each page is zeroed before returning.
+ */
+size_t
+pmap_pfa_alloc_batch_flags(phys_addr_t *pages, size_t count,
+                           pmap_page_metadata_s *metadata,
+                           pmap_pfa_alloc_flags_t flags);
+
+/**
+ * Frees COUNT independent pages whose addresses are in PAGES, taking each arena
+ * lock once per run of pages from that arena
+ */
+void
+pmap_pfa_free_batch(phys_addr_t *pages, size_t count);
+
+/**
+ * Sets the watermarks for the per-CPU magazines caching blocks of 2^ORDER pages
+ * on all cores. ORDER must be 0 or 1.
+ * When a magazine is empty, it is refilled from the buddy allocator up to LOW
+ * blocks. When it holds more than HIGH blocks, it is drained back down to LOW.
+ * A LOW of zero disables caching allocations and a HIGH of zero disables
+ * caching frees for that order.
+ */
+void
+pmap_pfa_pcp_set_watermarks(unsigned int order, size_t low, size_t high);
+
+/**
+ * Sets the number of pre-zeroed pages background zeroing tries to keep in the
+ * zero pool. The pool does not shrink until it is drained or used.
+ */
+void
+pmap_pfa_zero_pool_set_target(size_t target);
+
+/** Get the statistics for the pool of pre-zeroed pages */
+void
+pmap_pfa_zero_pool_get_stats(struct pmap_pfa_zero_pool_stats *stats);
+
+/**
+ * Enables or disables colored allocation (enabled by default). While disabled,
+ * pmap_pfa_alloc_colored ignores the color and the free pages held for colored
+ * requests are returned to the buddy allocator.
+ */
+void
+pmap_pfa_color_set_enabled(bool enabled);
+
+/** Get the statistics for colored allocations */
+void
+pmap_pfa_color_get_stats(struct pmap_pfa_color_stats *stats);
+
+/**
+ * Enables or disables lazy coalescing (enabled by default). While enabled, a
+ * freed block is left on its own level without merging with its buddy as long
+ * as its zone holds fewer free blocks of that level than the level's slack, so
+ * that workloads which free and reallocate the same order don't merge blocks
+ * all the way up only to split them back down. Deferred merges are made when
+ * a request would otherwise fail. Disabling it makes every deferred merge.
+ */
+void
+pmap_pfa_lazy_set_enabled(bool enabled);
+
+/**
+ * Makes every merge lazy coalescing has deferred, so that the free lists look
+ * as they would had every free merged
+ */
+void
+pmap_pfa_coalesce(void);
+
+/**
+ * Sets the number of free blocks of 2^ORDER pages a zone may hold before frees
+ * of that order merge again. A slack of zero always merges.
+ */
+void
+pmap_pfa_lazy_set_slack(unsigned int order, size_t blocks);
+
+/** Get the statistics for lazy coalescing */
+void
+pmap_pfa_lazy_get_stats(struct pmap_pfa_lazy_stats *stats);
+
+/** Get the statistics for ZONE */
+void
+pmap_pfa_zone_get_stats(pmap_pfa_zone_e zone, 
+                        struct pmap_pfa_zone_stats *stats);
+
+/**
+ * Registers MOVER, which must remain valid forever, and returns its ID. Movable
+ * allocations whose metadata carries this ID may be migrated by compaction.
+ * Panics if more than PMAP_PFA_MOVER_MAX movers are registered.
+ * 
+ * Migration happens one page at a time, so a multi-page movable allocation may
+ * not remain physically contiguous.
+ */
+unsigned int
+pmap_pfa_register_mover(const struct pmap_pfa_mover *mover);
+
+/**
+ * Tries to create a free block of 2^ORDER pages in ZONE by migrating movable
+ * pages out of the way. Returns true if a block was created.
+ * 
+ * This happens automatically when an allocation of at least two pages fails.
+ * Compaction picks the naturally aligned window of 2^ORDER pages in a movable
+ * pageblock which needs the fewest migrations, so its cost is a scan of the
+ * zone plus a page copy per migrated page, all under an arena lock. Each arena
+ * holding a share of ZONE is tried in turn, starting from the calling core's.
+ */
+bool
+pmap_pfa_compact(pmap_pfa_zone_e zone, unsigned int order);
+
+/**
+ * Enables or disables background compaction. While enabled, idle cores compact
+ * any zone which has no free block of at least 2^ORDER pages. It is disabled
+ * by default.
+ */
+void
+pmap_pfa_compaction_set_background(bool enabled, unsigned int order);
+
+/** Get the statistics for compaction */
+void
+pmap_pfa_compaction_get_stats(struct pmap_pfa_compaction_stats *stats);
+
+/**
+ * Claims SIZE bytes of physically contiguous pages from the CMA zone and
+ * applies METADATA (as an unmovable allocation). The claim must be given back
+ * with pmap_pfa_cma_release. Returns PHYS_ADDR_INVALID if the reservation has
+ * no such range which can be emptied.
+ * 
+ * While unclaimed, the reservation services movable allocations with a mover so
+ * that it isn't wasted. A claim picks the range aligned to its size (or to the
+ * top level, if larger) which needs the fewest migrations, and migrates those
+ * pages to the normal and DMA zones. Its cost is therefore a scan of the
+ * reservation plus a page copy per migrated page. Claims never span arenas.
+ */
+phys_addr_t
+pmap_pfa_cma_claim(size_t size, pmap_page_metadata_s *metadata);
+
+/**
+ * Releases the SIZE bytes at ADDR, which must have been claimed with
+ * pmap_pfa_cma_claim, back to the CMA zone
+ */
+void
+pmap_pfa_cma_release(phys_addr_t addr, size_t size);
+
+/** Get the statistics for the contiguous memory reservation */
+void
+pmap_pfa_cma_get_stats(struct pmap_pfa_cma_stats *stats);
+
+/**
+ * Registers SHRINKER, which must remain valid forever. Once free memory falls
+ * below the low watermark, the allocation which crossed it asks the next
+ * shrinker for a batch of memory before returning, and idle cores then ask the
+ * shrinkers in turn until it is back above the high watermark. An allocation
+ * which finds free memory below the min watermark, or which would otherwise
+ * fail, asks every shrinker itself before going on. Panics if more than
+ * PMAP_PFA_SHRINKER_MAX shrinkers are registered.
+ */
+void
+pmap_pfa_register_shrinker(const struct pmap_pfa_shrinker *shrinker);
+
+/**
+ * Sets the free memory watermarks, in pages. MIN must not exceed LOW, which
+ * must not exceed HIGH. By default they are set relative to the amount of
+ * managed memory when the PFA is initialized.
+ */
+void
+pmap_pfa_pressure_set_watermarks(size_t min, size_t low, size_t high);
+
+/**
+ * Get the current pressure level without taking any lock. Caches may grow
+ * freely while this is PMAP_PFA_PRESSURE_NONE, since their shrinkers will be
+ * asked for the memory back before anyone runs out.
+ */
+pmap_pfa_pressure_e
+pmap_pfa_get_pressure(void);
+
+/** Get the statistics for memory pressure and reclaim */
+void
+pmap_pfa_pressure_get_stats(struct pmap_pfa_pressure_stats *stats);
+
+/**
+ * Summarizes free memory, with the fragmentation index taken for requests of
+ * 2^ORDER pages. The per-order counts are maintained as blocks enter and leave
+ * the free lists, so this reads a fixed number of counters however much is
+ * free and takes no lock. This makes it cheap enough to poll, at the cost of
+ * being slightly stale while other cores allocate.
+ */
+void
+pmap_pfa_get_free_summary(unsigned int order, 
+                          struct pmap_pfa_free_summary *summary);
+
+/**
+ * Get the allocator statistics. These are always collected and are kept per
+ * core, so they are summed here without stopping other cores and may be
+ * slightly inconsistent while the allocator is in use.
+ */
+void
+pmap_pfa_get_stats(struct pmap_pfa_stats *stats);
+
+/** Resets the allocator statistics to zero */
+void
+pmap_pfa_reset_stats(void);
+
+/**
+ * Prints the free block counts of each arena's zones, the free memory summary,
+ * the zone, zero pool, compaction and CMA statistics and the allocator
+ * statistics to the console
+ */
+void
+pmap_pfa_dump(void);
+
+#if (CONFIG_DEBUG || CONFIG_TESTING)
+/**
+ * Selects whether the next pmap_pfa_init builds its free lists in bulk (the
+ * default) or one block at a time, so that the two can be compared
+ */
+void
+pmap_pfa_set_bulk_init(bool enabled);
+#endif /* CONFIG_DEBUG || CONFIG_TESTING */
+
+/** Get the number of ticks pmap_pfa_init spent building the free lists */
+uint64_t
+pmap_pfa_get_init_ticks(void);
+
+#if (CONFIG_DEBUG || CONFIG_TESTING)
+/**
+ * Sets the number of arenas the next pmap_pfa_init splits memory into, between
+ * one and PMAP_PFA_ARENAS (the default). Arenas are a power of two number of
+ * top level blocks, so small memories may get fewer.
+ */
+void
+pmap_pfa_set_arena_count(unsigned int count);
+
+/**
+ * Sets the size of the contiguous memory reservation (the CMA zone) the next
+ * pmap_pfa_init sets aside, PMAP_PFA_CMA_SIZE by default. The size is rounded
+ * up to the top level and capped at half of the memory above the DMA zone, and
+ * zero disables the reservation.
+ */
+void
+pmap_pfa_set_cma_size(size_t size);
+#endif /* CONFIG_DEBUG || CONFIG_TESTING */
+
+/** Get the number of arenas memory was split into */
+unsigned int
+pmap_pfa_get_arena_count(void);
+
+/**
+ * Get the calling core's home arena, which its allocations try before falling
+ * back to the other arenas in turn
+ */
+unsigned int
+pmap_pfa_get_home_arena(void);
+
+/** Get the statistics for ARENA */
+void
+pmap_pfa_arena_get_stats(unsigned int arena, 
+                         struct pmap_pfa_arena_stats *stats);
+
+/**
+ * Performs a small, bounded amount of background maintenance (such as reclaim,
+ * zeroing free pages for the zero pool or compaction). This is intended to be
+ * called repeatedly by idle cores. Returns true if work was done and more may
+ * remain.
+ */
+bool
+pmap_pfa_idle(void);
+
+/**
+ * Returns all free pages cached by every core's magazines and all pre-zeroed
+ * pages back to the buddy allocator. Each core's magazines are locked in turn,
+ * so this is safe to call while other cores allocate.
+ */
+void
+pmap_pfa_drain_caches(void);
+
+/**
+ * Get the metadata for a single page. This does not take any lock.
  */
 void
 pmap_pfa_mds_get_metadata(page_id_t page, pmap_page_metadata_s *metadata);
 
+/**
+ * Begins a lockless read of the MDS entries in PAGE's top level block, waiting
+ * for any in flight writes to finish. Returns a sequence count which must be
+ * passed to pmap_pfa_mds_read_retry once the entries have been read:
+ *
+ *  do {
+ *      seq = pmap_pfa_mds_read_begin(page);
+ *      ...read the MDS...
+ *  } while (pmap_pfa_mds_read_retry(page, seq));
+ */
+uint32_t
+pmap_pfa_mds_read_begin(page_id_t page);
+
+/**
+ * Returns true if the MDS entries in PAGE's top level block may have changed
+ * since pmap_pfa_mds_read_begin returned SEQ, in which case the read must be
+ * retried
+ */
+bool
+pmap_pfa_mds_read_retry(page_id_t page, uint32_t seq);
+
+
+/*
+ * Extended page metadata. Each page has a reference count, a mapping count and
+ * an owner tag, stored separately from pmap_page_metadata. Every accessor is
+ * atomic and lock-free, and all fields are zero when a page is allocated. They
+ * are not interpreted by the PFA.
+ */
+
+/** Get the reference count of PAGE */
+uint16_t
+pmap_pfa_mds_refcount_get(page_id_t page);
+
+/** Increment the reference count of PAGE and return the new count */
+uint16_t
+pmap_pfa_mds_refcount_inc(page_id_t page);
+
+/** Decrement the reference count of PAGE and return the new count */
+uint16_t
+pmap_pfa_mds_refcount_dec(page_id_t page);
+
+/** Get the number of mappings of PAGE */
+uint16_t
+pmap_pfa_mds_mapcount_get(page_id_t page);
+
+/** Increment the mapping count of PAGE and return the new count */
+uint16_t
+pmap_pfa_mds_mapcount_inc(page_id_t page);
+
+/** Decrement the mapping count of PAGE and return the new count */
+uint16_t
+pmap_pfa_mds_mapcount_dec(page_id_t page);
+
+/** Get the owner tag of PAGE */
+uint32_t
+pmap_pfa_mds_owner_get(page_id_t page);
+
+/** Set the owner tag of PAGE to OWNER */
+void
+pmap_pfa_mds_owner_set(page_id_t page, uint32_t owner);
+
+/**
+ * Set the owner tag of PAGE to OWNER only if it is currently EXPECTED. Returns
+ * true if the tag was changed.
+ */
+bool
+pmap_pfa_mds_owner_cmpxchg(page_id_t page, uint32_t expected, uint32_t owner);
+
+/**
+ * Returns the first page in range [page, page + count) whose type is not TYPE,
+ * or PAGE_ID_INVALID if they all match.
+ * 
+ * This does not take any PFA lock, so it never serializes against allocation,
+ * and compares 32 pages per loop iteration. The caller must own the pages (i.e.
+ * they can't be allocated or freed concurrently) for the result to be stable.
+ */
+page_id_t
+pmap_pfa_mds_find_type_mismatch(page_id_t page, page_id_t count,
+                                pmap_page_type_e type);
 
 /**
  * Checks that all pages in range [page, page + count) are of type TYPE
- * If the check fails, the a panic is triggered.
+ * If the check fails, a panic is triggered which names the first offending
+ * page. See pmap_pfa_mds_find_type_mismatch.
  */
 void
 pmap_pfa_mds_require_range_type(page_id_t page, page_id_t count,
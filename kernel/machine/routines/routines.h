@@ -1,13 +1,72 @@
 #ifndef MACHINE_ROUTINES
 #define MACHINE_ROUTINES
 #include "lib/debug.h"
+#include "lib/types.h"
 
 /**
  * Infinite low-power loop
  */
 extern void routines_core_idle(void) NO_RETURN;
 
+/** Waits for an event (or interrupt) in a low-power state, then returns */
+extern void routines_wait_for_event(void);
+
 /** Signal to a hosting debugger that the OS is exiting */
 extern void routines_adp_application_exit(uint32_t exit_code) NO_RETURN;
 
+/**
+ * Moves the current CPU onto the kernel stack whose top is at KERNEL_SP and the
+ * exception stack whose top is at EXCEPTION_SP, then calls CONTINUATION.
+ * Nothing on the old stacks is used again, so they may be freed once running
+ * in CONTINUATION.
+ */
+extern void routines_switch_stacks(uint64_t kernel_sp, uint64_t exception_sp,
+                                   void (*continuation)(void)) NO_RETURN;
+
+/** Read the generic timer's virtual count (CNTVCT_EL0) */
+static inline uint64_t
+routines_read_cntvct(void) {
+    return __builtin_arm_rsr64("cntvct_el0");
+}
+
+/** Read the generic timer's frequency in Hz (CNTFRQ_EL0) */
+static inline uint64_t
+routines_read_cntfrq(void) {
+    return __builtin_arm_rsr64("cntfrq_el0");
+}
+
+/** The IRQ mask bit of DAIF (DAIFSet and DAIFClr take it as DAIF_IRQ) */
+#define ROUTINES_DAIF_IRQ_MASKED                (1 << 7)
+
+/**
+ * Returns true if IRQs are masked on the calling core. Taking an exception
+ * masks them, so this is always true inside an interrupt handler.
+ */
+static inline bool
+routines_irqs_masked(void) {
+    return __builtin_arm_rsr64("daif") & ROUTINES_DAIF_IRQ_MASKED;
+}
+
+/** The PMU event number for refills of the L2 data cache */
+#define ROUTINES_PMU_EVENT_L2D_CACHE_REFILL     (0x17)
+
+/**
+ * Resets and starts PMU event counter 0 counting EVENT (at EL1). There is only
+ * the one counter, so only one event can be counted at a time.
+ */
+static inline void
+routines_pmu_start(uint64_t event) {
+    /* Enable the PMU and reset its event counters */
+    __builtin_arm_wsr64("pmcr_el0", 0x3);
+    __builtin_arm_wsr64("pmevtyper0_el0", event);
+    __builtin_arm_wsr64("pmcntenset_el0", 0x1);
+    __builtin_arm_isb(0xF);
+}
+
+/** Read PMU event counter 0, see routines_pmu_start */
+static inline uint64_t
+routines_pmu_read(void) {
+    return __builtin_arm_rsr64("pmevcntr0_el0");
+}
+
 #endif /* MACHINE_ROUTINES */
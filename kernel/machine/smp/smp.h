@@ -1,4 +1,24 @@
 #ifndef SMP_H
 #define SMP_H
+#include "lib/types.h"
 
-#endif /* SMP_H */
\ No newline at end of file
+/** The maximum number of cores supported by the platform */
+#define SMP_MAX_CPUS            (4)
+
+/** The size of a cache line. Per-CPU data is padded to this to avoid sharing */
+#define SMP_CACHE_LINE_SIZE     (64)
+
+/** The size of the L2, which is shared by all cores and physically indexed */
+#define SMP_L2_CACHE_SIZE       (512 * 1024)
+
+/** The associativity of the L2 */
+#define SMP_L2_CACHE_WAYS       (16)
+
+/** Get the ID of the executing core, in range [0, SMP_MAX_CPUS) */
+static inline unsigned int
+smp_get_cpu_id(void) {
+    /* Aff0 is the core number within the (single) BCM2837 cluster */
+    return __builtin_arm_rsr64("mpidr_el1") & (SMP_MAX_CPUS - 1);
+}
+
+#endif /* SMP_H */
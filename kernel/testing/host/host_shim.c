@@ -0,0 +1,243 @@
+/*
+The host side of the host build, compiled against the host libc. See
+host_shim.h.
+*/
+#include "host_shim.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+/* A fake kernel image at the RPi3 load address, see host_pfa_init */
+#define HOST_KERNEL_TEXT_BASE   (0x80000)
+#define HOST_KERNEL_TEXT_SIZE   (0x40000)
+#define HOST_KERNEL_DATA_SIZE   (0x20000)
+/* The boot stacks and bootstrap tables reserved after the kernel by start.S */
+#define HOST_BOOTSTRAP_SIZE     (0x6000)
+
+#define HOST_MAX_THREADS        (64)
+
+/* Kernel functions the shim calls, declared with host types */
+void pmap_pfa_init(uint64_t ram_base, uint64_t ram_size,
+                   uint64_t kernel_text_base, uint64_t kernel_text_size,
+                   uint64_t kernel_data_base, uint64_t kernel_data_size,
+                   uint64_t bootstrap_pa_reserved);
+
+/** The host address of physical address zero */
+static uintptr_t host_physmap_base = 0;
+/** The size of the fake RAM */
+static uint64_t host_ram_size = 0;
+
+/** The simulated CPU ID of each thread, see host_set_cpu */
+static __thread unsigned int host_cpu_id = 0;
+
+uintptr_t
+pmap_pa_to_kva(uint64_t pa) {
+    if (pa >= host_ram_size) {
+        fprintf(
+            stderr, "PANIC: PA 0x%llx is not RAM\n", (unsigned long long)pa
+        );
+        abort();
+    }
+
+    return host_physmap_base + pa;
+}
+
+uint64_t
+pmap_physmap_kva_to_pa(uintptr_t kva) {
+    if (kva < host_physmap_base || kva - host_physmap_base >= host_ram_size) {
+        fprintf(stderr, "PANIC: KVA 0x%lx is not in the physmap\n", kva);
+        abort();
+    }
+
+    return kva - host_physmap_base;
+}
+
+void
+panic_simple(const char *message) {
+    fprintf(stderr, "PANIC: %s\n", message);
+    abort();
+}
+
+void
+panic_formatted(const char *message, ...) {
+    va_list args;
+
+    fprintf(stderr, "PANIC: ");
+    va_start(args, message);
+    vfprintf(stderr, message, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    abort();
+}
+
+void
+panic_macro(const char *file, int line, const char *function,
+            const char *message, ...) {
+    va_list args;
+
+    fprintf(stderr, "PANIC (%s:%d, %s): ", file, line, function);
+    va_start(args, message);
+    vfprintf(stderr, message, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    abort();
+}
+
+unsigned long long
+host_read_sysreg(const char *name) {
+    if (!strcmp(name, "cntvct_el0")) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    } else if (!strcmp(name, "cntfrq_el0")) {
+        return 1000000000ULL;
+    } else if (!strcmp(name, "mpidr_el1")) {
+        return host_cpu_id;
+    } else if (!strcmp(name, "pmevcntr0_el0")) {
+        return 0;
+    } else if (!strcmp(name, "daif")) {
+        /* Threads are never interrupted, as if IRQs were always unmasked */
+        return 0;
+    }
+
+    fprintf(stderr, "PANIC: unsupported system register %s\n", name);
+    abort();
+}
+
+/** There are no events to wait for on the host, so idle cores just yield */
+void
+routines_wait_for_event(void) {
+    sched_yield();
+}
+
+void
+host_set_cpu(unsigned int cpu) {
+    host_cpu_id = cpu;
+}
+
+void
+host_pfa_init(unsigned long long ram_size) {
+    uint64_t text_base = HOST_KERNEL_TEXT_BASE;
+    uint64_t data_base = text_base + HOST_KERNEL_TEXT_SIZE;
+    uint64_t reserved = data_base + HOST_KERNEL_DATA_SIZE + HOST_BOOTSTRAP_SIZE;
+    void *ram = (void *)host_physmap_base;
+
+    /* Reinitializing reuses the same RAM, as a reboot would */
+    if (ram && host_ram_size != ram_size) {
+        munmap(ram, host_ram_size);
+        ram = NULL;
+    }
+
+    /* Pages are only backed once the allocator touches them */
+    if (!ram) {
+        ram = mmap(
+            NULL, ram_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+        );
+    }
+    if (ram == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+
+    host_physmap_base = (uintptr_t)ram;
+    host_ram_size = ram_size;
+    pmap_pfa_init(
+        0, ram_size,
+        text_base, HOST_KERNEL_TEXT_SIZE,
+        data_base, HOST_KERNEL_DATA_SIZE,
+        reserved
+    );
+}
+
+char *
+host_read_file(const char *path, unsigned long long *size) {
+    FILE *file = fopen(path, "rb");
+    char *buffer = NULL;
+    long length = 0;
+
+    if (!file) {
+        return NULL;
+    }
+
+    if (fseek(file, 0, SEEK_END) || (length = ftell(file)) < 0
+            || fseek(file, 0, SEEK_SET)) {
+        fclose(file);
+        return NULL;
+    }
+
+    buffer = malloc(length + 1);
+    if (!buffer || fread(buffer, 1, length, file) != (size_t)length) {
+        free(buffer);
+        fclose(file);
+        return NULL;
+    }
+
+    fclose(file);
+    buffer[length] = '\0';
+    *size = length;
+    return buffer;
+}
+
+int
+host_parse_number(const char *string, unsigned long long *value) {
+    char *end = NULL;
+
+    if (!*string || *string == '-') {
+        return 0;
+    }
+
+    *value = strtoull(string, &end, 0);
+    return *end == '\0';
+}
+
+struct host_thread {
+    pthread_t thread;
+    unsigned int cpu;
+    void (*function)(unsigned int cpu, void *context);
+    void *context;
+};
+
+static void *
+host_thread_main(void *argument) {
+    struct host_thread *thread = argument;
+
+    host_set_cpu(thread->cpu);
+    thread->function(thread->cpu, thread->context);
+
+    return NULL;
+}
+
+void
+host_run_threads(unsigned int count,
+                 void (*function)(unsigned int cpu, void *context),
+                 void *context) {
+    struct host_thread threads[HOST_MAX_THREADS];
+
+    if (count > HOST_MAX_THREADS) {
+        fprintf(stderr, "PANIC: too many threads (%u)\n", count);
+        abort();
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        threads[i].cpu = i;
+        threads[i].function = function;
+        threads[i].context = context;
+        if (pthread_create(
+                &threads[i].thread, NULL, host_thread_main, &threads[i])) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef HOST_SHIM_H
+#define HOST_SHIM_H
+
+/*
+~* HOST SHIM *~
+The host build compiles the PFA and its libraries for the build machine so that
+allocator changes can be tested and profiled without booting a kernel. Kernel
+sources are still built freestanding against the kernel's own headers, while
+host_shim.c is built against the host libc and fills in what the kernel would
+otherwise provide:
+
+ - Physical memory is a single anonymous mmap, and the physmap is an offset into
+   it (pmap_pa_to_kva, pmap_physmap_kva_to_pa)
+ - printf and the panic family go to the host's stdio
+ - System register reads are redirected to host_read_sysreg. CNTVCT counts
+   nanoseconds (and CNTFRQ is 1GHz), and MPIDR holds the calling thread's
+   simulated CPU ID. There is no PMU, so its counters read as zero. DAIF reads
+   as zero (IRQs unmasked) and system register writes are ignored.
+ - Waiting for an event (routines_wait_for_event) just yields the thread
+
+This header is force-included into every kernel source in the host build, so it
+only uses builtin types.
+*/
+
+/** Reads the simulated system register NAME (e.g. "cntvct_el0") */
+unsigned long long host_read_sysreg(const char *name);
+#define __builtin_arm_rsr64(name) host_read_sysreg(name)
+#define __builtin_arm_wsr64(name, value) ((void)(name), (void)(value))
+#define __builtin_arm_isb(option) ((void)(option))
+
+/** Sets the simulated CPU ID of the calling thread */
+void host_set_cpu(unsigned int cpu);
+
+/**
+ * Maps RAM_SIZE bytes of fake RAM and initializes the PFA over it with a layout
+ * resembling a booted kernel's. Calling this again reinitializes the PFA,
+ * reusing the RAM if the size hasn't changed.
+ */
+void host_pfa_init(unsigned long long ram_size);
+
+/**
+ * Reads the entire file at PATH into a NUL terminated buffer which is never
+ * freed and writes its length to SIZE. Returns NULL if the file can't be read.
+ */
+char *host_read_file(const char *path, unsigned long long *size);
+
+/**
+ * Parses the unsigned number STRING (decimal, or hex with 0x) into VALUE.
+ * Returns zero if STRING isn't a number.
+ */
+int host_parse_number(const char *string, unsigned long long *value);
+
+/**
+ * Runs FUNCTION(cpu, CONTEXT) on COUNT threads at once, each with its own
+ * simulated CPU ID, and waits for all of them to return
+ */
+void host_run_threads(unsigned int count,
+                      void (*function)(unsigned int cpu, void *context),
+                      void *context);
+
+#endif /* HOST_SHIM_H */
@@ -0,0 +1,165 @@
+/*
+PFA tests which need real threads, and so only run in the host build. The
+kernel's own test runner only has the boot core to work with.
+*/
+#include "host_shim.h"
+#include "testing/tests/test_utils.h"
+#include "testing/tests/test_helpers.h"
+#include "machine/pmap/pmap_pfa.h"
+#include "machine/smp/smp.h"
+#include "lib/stdio.h"
+
+/** The pages in each run the seqlock writer publishes, all in one pageblock */
+#define SEQLOCK_RUN_PAGES   ((page_id_t)1 << MIN(6, PMAP_PFA_MAX_ORDER))
+/** The number of runs the seqlock writer allocates */
+#define SEQLOCK_WRITES      (100000)
+
+/** State shared by the seqlock writer and its readers */
+static struct {
+    /** The run readers check, or PHYS_ADDR_INVALID before the first */
+    phys_addr_t run;
+    /** Set by the writer once it is done */
+    bool done;
+    /** Set by the writer if it ran out of memory */
+    bool failed;
+    /** Set by a reader which accepted a snapshot mixing two runs */
+    bool torn;
+    /** The snapshots each reader accepted and retried */
+    size_t accepted[SMP_MAX_CPUS];
+    size_t retried[SMP_MAX_CPUS];
+} seqlock_threads;
+
+/**
+ * Replaces the published run SEQLOCK_WRITES times. Every MDS write in the runs'
+ * pageblocks covers a whole run (the allocation applying its type or the free
+ * clearing it), so a consistent snapshot of a run has a single type.
+ */
+static void
+seqlock_writer(void) {
+    pmap_page_metadata_s m;
+    phys_addr_t run = PHYS_ADDR_INVALID;
+    phys_addr_t old = PHYS_ADDR_INVALID;
+    size_t size = SEQLOCK_RUN_PAGES * PAGE_SIZE;
+
+    memset(&m, 0x00, sizeof(m));
+    for (size_t i = 0; i < SEQLOCK_WRITES; i++) {
+        m.page_type = i % 2
+            ? PMAP_PAGE_TYPE_KERNEL_TEXT : PMAP_PAGE_TYPE_PAGE_TABLE;
+        run = pmap_pfa_alloc_aligned(size, size, &m);
+        if (run == PHYS_ADDR_INVALID) {
+            seqlock_threads.failed = true;
+            break;
+        }
+
+        old = __atomic_exchange_n(&seqlock_threads.run, run, __ATOMIC_RELEASE);
+        if (old != PHYS_ADDR_INVALID) {
+            pmap_pfa_free_contig(old, size);
+        }
+    }
+
+    __atomic_store_n(&seqlock_threads.done, true, __ATOMIC_RELEASE);
+}
+
+/** Snapshots whichever run is published until the writer is done */
+static void
+seqlock_reader(unsigned int cpu) {
+    pmap_page_metadata_s m[SEQLOCK_RUN_PAGES];
+
+    while (!__atomic_load_n(&seqlock_threads.done, __ATOMIC_ACQUIRE)) {
+        phys_addr_t run = __atomic_load_n(
+            &seqlock_threads.run, __ATOMIC_ACQUIRE
+        );
+        page_id_t page = run >> PAGE_SHIFT;
+        uint32_t seq = 0;
+
+        if (run == PHYS_ADDR_INVALID) {
+            continue;
+        }
+
+        /* The run may be freed and reused under us, which is what we want */
+        while (true) {
+            seq = pmap_pfa_mds_read_begin(page);
+            for (page_id_t i = 0; i < SEQLOCK_RUN_PAGES; i++) {
+                pmap_pfa_mds_get_metadata(page + i, &m[i]);
+            }
+
+            if (!pmap_pfa_mds_read_retry(page, seq)) {
+                break;
+            }
+            seqlock_threads.retried[cpu]++;
+        }
+
+        for (page_id_t i = 1; i < SEQLOCK_RUN_PAGES; i++) {
+            if (memcmp(&m[i], &m[0], sizeof(m[0]))) {
+                __atomic_store_n(&seqlock_threads.torn, true, __ATOMIC_RELAXED);
+            }
+        }
+        seqlock_threads.accepted[cpu]++;
+    }
+}
+
+static void
+seqlock_thread(unsigned int cpu, void *context) {
+    (void)context;
+
+    if (cpu) {
+        seqlock_reader(cpu);
+    } else {
+        seqlock_writer();
+    }
+}
+
+static int mds_seqlock_threads(void) {
+    /*
+    Stresses the lockless MDS read protocol with real concurrency. One core
+    keeps replacing a run of pages with a run of another type while the others
+    read the run page by page under the seqlock, and no snapshot they accept
+    may mix the two.
+    */
+    size_t accepted = 0;
+    size_t retried = 0;
+    int result = 0;
+
+    memset(&seqlock_threads, 0x00, sizeof(seqlock_threads));
+    seqlock_threads.run = PHYS_ADDR_INVALID;
+    host_run_threads(SMP_MAX_CPUS, seqlock_thread, NULL);
+
+    if (seqlock_threads.run != PHYS_ADDR_INVALID) {
+        pmap_pfa_free_contig(
+            seqlock_threads.run, SEQLOCK_RUN_PAGES * PAGE_SIZE
+        );
+    }
+
+    for (unsigned int cpu = 1; cpu < SMP_MAX_CPUS; cpu++) {
+        accepted += seqlock_threads.accepted[cpu];
+        retried += seqlock_threads.retried[cpu];
+        if (!seqlock_threads.accepted[cpu]) {
+            result = -1;
+        }
+    }
+    printf("%zu snapshots accepted, %zu retried\n", accepted, retried);
+
+    if (seqlock_threads.failed) {
+        result = -2;
+    } else if (seqlock_threads.torn) {
+        result = -3;
+    }
+
+    if (!result && !test_vm_state_matches_original()) {
+        result = -4;
+    }
+
+    return result;
+}
+
+static struct test_case cases[] = {
+    TEST_CASE(mds_seqlock_threads),
+};
+
+struct test_suite host_test_pmap_pfa = {
+    .name = "pmap_pfa_threads",
+    .setup_function = test_vm_setup,
+    .teardown_function = NULL,
+    .cases = cases,
+    .cases_count = COUNT_OF(cases)
+};
@@ -0,0 +1,124 @@
+/*
+Runs the kernel test suites in the host build. This stands in for runner.c,
+which needs the real hardware (or QEMU) to report results and shut down.
+
+Usage: pfa_host_tests [ram MB] [suite name]...
+With no suite names, every test suite in tests.h is run, followed by the host
+only suites which need real threads. Benchmark suites only run when named.
+*/
+#include "host_shim.h"
+#include "testing/tests/tests.h"
+#include "core/vm/slab.h"
+#include "core/vm/kmalloc.h"
+#include "lib/stdio.h"
+#include "lib/string.h"
+
+#define TAG "[host runner] "
+/* Matches the RAM of a Raspberry Pi 3 */
+#define HOST_TESTS_DEFAULT_RAM_MB   (1024)
+
+extern struct test_suite host_test_pmap_pfa;
+
+/** Suites which need real threads, and so only run in the host build */
+static test_suite_t host_suites[] = {
+    &host_test_pmap_pfa,
+};
+
+/**
+ * Returns true if SUITE was requested on the command line. If no suite was
+ * named, returns BY_DEFAULT.
+ */
+static bool
+suite_selected(test_suite_t suite, int argc, char **argv, bool by_default) {
+    if (argc <= 2) {
+        return by_default;
+    }
+
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(argv[i], suite->name)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Runs every test in SUITE, adding to TEST_COUNT and TEST_PASS_COUNT. Returns
+ * false if the suite's setup or teardown failed.
+ */
+static bool
+run_suite(test_suite_t suite, size_t *test_count, size_t *test_pass_count) {
+    int result = 0;
+
+    printf(TAG "Running suite %s (%zu tests)\n",
+           suite->name, suite->cases_count);
+
+    if (suite->setup_function && (result = suite->setup_function()) < 0) {
+        printf(TAG "Suite setup failed (result=%d)\n", result);
+        return false;
+    }
+
+    for (size_t test_i = 0; test_i < suite->cases_count; test_i++) {
+        test_case_t test = &suite->cases[test_i];
+
+        (*test_count)++;
+        printf(TAG "\tRunning test %s\n", test->name);
+        if ((result = test->function()) < 0) {
+            printf(TAG "\tFAILED (result=%d)\n", result);
+        } else {
+            printf(TAG "\tPASSED\n");
+            (*test_pass_count)++;
+        }
+    }
+
+    if (suite->teardown_function
+            && (result = suite->teardown_function()) < 0) {
+        printf(TAG "Suite teardown failed (result=%d)\n", result);
+        return false;
+    }
+
+    return true;
+}
+
+int
+main(int argc, char **argv) {
+    unsigned long long ram_mb = HOST_TESTS_DEFAULT_RAM_MB;
+    size_t test_count = 0;
+    size_t test_pass_count = 0;
+
+    if (argc > 1 && (!host_parse_number(argv[1], &ram_mb) || !ram_mb)) {
+        printf("usage: %s [ram MB] [suite name]...\n", argv[0]);
+        return 2;
+    }
+
+    host_pfa_init(ram_mb << 20);
+    slab_init();
+    kmalloc_init();
+
+    for (size_t suite_i = 0; suite_i < COUNT_OF(suites); suite_i++) {
+        if (suite_selected(suites[suite_i], argc, argv, true)
+                && !run_suite(suites[suite_i], &test_count, &test_pass_count)) {
+            return 1;
+        }
+    }
+    for (size_t suite_i = 0; suite_i < COUNT_OF(host_suites); suite_i++) {
+        if (suite_selected(host_suites[suite_i], argc, argv, true)
+                && !run_suite(
+                    host_suites[suite_i], &test_count, &test_pass_count)) {
+            return 1;
+        }
+    }
+    for (size_t suite_i = 0; suite_i < COUNT_OF(bench_suites); suite_i++) {
+        if (suite_selected(bench_suites[suite_i], argc, argv, false)
+                && !run_suite(
+                    bench_suites[suite_i], &test_count, &test_pass_count)) {
+            return 1;
+        }
+    }
+
+    printf(TAG "Run complete: %zu/%zu passed\n", test_pass_count, test_count);
+
+    /* Running nothing (e.g. a misspelled suite) is a failure too */
+    return test_count && test_pass_count == test_count ? 0 : 1;
+}
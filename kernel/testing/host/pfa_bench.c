@@ -0,0 +1,586 @@
+/*
+~* PFA_BENCH *~
+Replays allocation workloads against the PFA in the host build so that allocator
+changes can be measured (and profiled with perf) on the build machine.
+
+Usage: pfa_bench <workload> [options]
+
+Workloads:
+    random  Allocates and frees blocks of random orders at random, keeping the
+            number of live blocks around half of --live.
+    bursty  Alternates between allocating a burst of up to --burst blocks and
+            freeing a random share of everything live, like a server handling
+            request spikes.
+    trace   Replays the trace file given by --trace. Each line is one of
+                a <slot> <bytes>    allocate into SLOT
+                f <slot>            free the allocation in SLOT
+            Blank lines and lines starting with # are ignored.
+    init    Initializes the PFA over --ram repeatedly, building the free lists
+            block by block and then in bulk, and reports the best time of each.
+            Fails if the two build different free lists.
+
+Options:
+    --ram <MB>          The size of the fake RAM (default 1024)
+    --ops <count>       Operations per thread for random and bursty
+    --threads <count>   Threads, each on its own simulated CPU (max 4)
+    --arenas <count>    Split memory into this many arenas (default one per CPU)
+    --max-order <n>     The largest order random and bursty allocate
+    --live <count>      The most blocks a thread may hold at once
+    --burst <count>     The largest burst for bursty
+    --seed <n>          The random seed. Each thread offsets it by its CPU ID.
+    --trace <path>      The trace for the trace workload
+    --eager             Disable lazy coalescing, so that every free merges
+    --dump              Print the allocator's statistics when done
+
+With more than one thread, each thread runs the whole workload (or replays the
+whole trace) with its own blocks, so they contend for the allocator. Each
+thread's allocations go to its home arena first, so comparing --arenas 1 with
+the default shows what per-core arenas save in lock contention.
+*/
+#include "host_shim.h"
+#include "machine/pmap/pmap_pfa.h"
+#include "testing/tests/test_helpers.h"
+#include "machine/smp/smp.h"
+#include "lib/stdio.h"
+#include "lib/string.h"
+#include "lib/ctype.h"
+
+#define BENCH_DEFAULT_RAM_MB    (1024)
+#define BENCH_DEFAULT_OPS       (1000000)
+#define BENCH_DEFAULT_MAX_ORDER (MIN(4, PMAP_PFA_MAX_ORDER))
+#define BENCH_DEFAULT_LIVE      (4096)
+#define BENCH_DEFAULT_BURST     (256)
+#define BENCH_DEFAULT_SEED      (0x9E3779B97F4A7C15ULL)
+/* The most blocks a thread may hold, which is also the number of trace slots */
+#define BENCH_LIVE_MAX          (65536)
+/* The number of times the init workload initializes the PFA each way */
+#define BENCH_INIT_ROUNDS       (16)
+/* Lock waits in this histogram bucket (2^10 ns) or above count as contended */
+#define BENCH_CONTENDED_BUCKET  (10)
+
+typedef enum {
+    BENCH_WORKLOAD_RANDOM,
+    BENCH_WORKLOAD_BURSTY,
+    BENCH_WORKLOAD_TRACE,
+    BENCH_WORKLOAD_INIT,
+} bench_workload_e;
+
+struct bench_config {
+    bench_workload_e workload;
+    unsigned long long ram_mb;
+    unsigned long long ops;
+    unsigned long long threads;
+    unsigned long long arenas;
+    unsigned long long max_order;
+    unsigned long long live;
+    unsigned long long burst;
+    unsigned long long seed;
+    const char *trace;
+    bool eager;
+    bool dump;
+};
+
+/** A block held by a thread */
+struct bench_block {
+    phys_addr_t addr;
+    size_t size;
+};
+
+/** The state of one benchmark thread */
+struct bench_thread {
+    uint64_t rng;
+    /** Held blocks. Dense for random and bursty, indexed by slot for traces */
+    struct bench_block blocks[BENCH_LIVE_MAX];
+    size_t block_count;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t failures;
+    uint64_t ticks;
+} __attribute__((aligned(SMP_CACHE_LINE_SIZE)));
+
+static struct bench_config config = {
+    .workload = BENCH_WORKLOAD_RANDOM,
+    .ram_mb = BENCH_DEFAULT_RAM_MB,
+    .ops = BENCH_DEFAULT_OPS,
+    .threads = 1,
+    .arenas = PMAP_PFA_ARENAS,
+    .max_order = BENCH_DEFAULT_MAX_ORDER,
+    .live = BENCH_DEFAULT_LIVE,
+    .burst = BENCH_DEFAULT_BURST,
+    .seed = BENCH_DEFAULT_SEED,
+    .trace = NULL,
+    .eager = false,
+    .dump = false,
+};
+
+static struct bench_thread bench_threads[SMP_MAX_CPUS];
+static pmap_page_metadata_s bench_metadata_m;
+
+/** The trace being replayed, see bench_trace */
+static const char *trace_text = NULL;
+
+/**
+ * Picks an order for a random allocation. Each order is half as likely as the
+ * one below it, which roughly matches what the kernel asks for.
+ */
+static unsigned int
+bench_rand_order(struct bench_thread *thread) {
+    uint64_t r = test_rand(&thread->rng);
+    unsigned int order = 0;
+
+    while (order < config.max_order && (r & 1)) {
+        order++;
+        r >>= 1;
+    }
+
+    return order;
+}
+
+/** Allocates SIZE bytes into BLOCK, returns false if we're out of memory */
+static bool
+bench_alloc(struct bench_thread *thread, struct bench_block *block,
+            size_t size) {
+    block->addr = pmap_pfa_alloc_contig(size, &bench_metadata_m);
+    block->size = size;
+    thread->allocs++;
+
+    if (block->addr == PHYS_ADDR_INVALID) {
+        thread->failures++;
+        return false;
+    }
+
+    return true;
+}
+
+/** Frees BLOCK */
+static void
+bench_free(struct bench_thread *thread, struct bench_block *block) {
+    pmap_pfa_free_contig(block->addr, block->size);
+    block->addr = PHYS_ADDR_INVALID;
+    thread->frees++;
+}
+
+/** Frees the block at INDEX of the thread's dense block array */
+static void
+bench_free_index(struct bench_thread *thread, size_t index) {
+    bench_free(thread, &thread->blocks[index]);
+    thread->blocks[index] = thread->blocks[--thread->block_count];
+}
+
+/** Allocates a block of a random order onto the thread's dense block array */
+static void
+bench_alloc_random(struct bench_thread *thread) {
+    struct bench_block *block = &thread->blocks[thread->block_count];
+
+    if (bench_alloc(thread, block, PAGE_SIZE << bench_rand_order(thread))) {
+        thread->block_count++;
+    }
+}
+
+static void
+bench_random(struct bench_thread *thread) {
+    for (uint64_t op_i = 0; op_i < config.ops; op_i++) {
+        /* Lean towards whichever side brings us back to half full */
+        bool alloc =
+            test_rand(&thread->rng) % config.live >= thread->block_count;
+
+        if (alloc && thread->block_count < config.live) {
+            bench_alloc_random(thread);
+        } else if (thread->block_count) {
+            bench_free_index(
+                thread, test_rand(&thread->rng) % thread->block_count
+            );
+        }
+    }
+}
+
+static void
+bench_bursty(struct bench_thread *thread) {
+    uint64_t op_i = 0;
+
+    while (op_i < config.ops) {
+        uint64_t burst = 1 + test_rand(&thread->rng) % config.burst;
+        uint64_t keep = 0;
+
+        for (uint64_t i = 0; i < burst && op_i < config.ops
+                && thread->block_count < config.live; i++, op_i++) {
+            bench_alloc_random(thread);
+        }
+
+        /* Let go of between none and all of what we're holding */
+        keep = test_rand(&thread->rng) % (thread->block_count + 1);
+        while (thread->block_count > keep && op_i < config.ops) {
+            bench_free_index(
+                thread, test_rand(&thread->rng) % thread->block_count
+            );
+            op_i++;
+        }
+    }
+}
+
+/** Skips spaces, then parses the number at *CURSOR and moves past it */
+static bool
+trace_parse_number(const char **cursor, unsigned long long *value) {
+    const char *c = *cursor;
+
+    while (*c == ' ' || *c == '\t') {
+        c++;
+    }
+
+    if (*c < '0' || *c > '9') {
+        return false;
+    }
+
+    for (*value = 0; *c >= '0' && *c <= '9'; c++) {
+        *value = *value * 10 + (*c - '0');
+    }
+
+    *cursor = c;
+    return true;
+}
+
+/**
+ * Checks the trace before any thread replays it. Returns the first bad line
+ * number or zero if the trace is valid.
+ */
+static size_t
+trace_validate(void) {
+    const char *c = trace_text;
+    size_t line = 1;
+
+    for (; *c; line++) {
+        char op = *c;
+        unsigned long long slot = 0;
+        unsigned long long bytes = 0;
+
+        if (op == 'a' || op == 'f') {
+            c++;
+            if (!trace_parse_number(&c, &slot) || slot >= BENCH_LIVE_MAX
+                    || (op == 'a'
+                        && (!trace_parse_number(&c, &bytes) || !bytes))) {
+                return line;
+            }
+        } else if (op != '#' && op != '\n') {
+            return line;
+        }
+
+        c = strchr(c, '\n');
+        if (!c) {
+            break;
+        }
+        c++;
+    }
+
+    return 0;
+}
+
+static void
+bench_trace(struct bench_thread *thread) {
+    const char *c = trace_text;
+
+    for (size_t slot = 0; slot < BENCH_LIVE_MAX; slot++) {
+        thread->blocks[slot].addr = PHYS_ADDR_INVALID;
+    }
+
+    while (*c) {
+        char op = *c;
+        unsigned long long slot = 0;
+        unsigned long long bytes = 0;
+
+        if (op == 'a' || op == 'f') {
+            c++;
+            trace_parse_number(&c, &slot);
+        }
+
+        if (op == 'a') {
+            trace_parse_number(&c, &bytes);
+
+            /* Reusing a slot implies freeing what was in it */
+            if (thread->blocks[slot].addr != PHYS_ADDR_INVALID) {
+                bench_free(thread, &thread->blocks[slot]);
+            }
+            bench_alloc(thread, &thread->blocks[slot], bytes);
+        } else if (op == 'f'
+                && thread->blocks[slot].addr != PHYS_ADDR_INVALID) {
+            bench_free(thread, &thread->blocks[slot]);
+        }
+
+        c = strchr(c, '\n');
+        if (!c) {
+            break;
+        }
+        c++;
+    }
+
+    /* Leave anything the trace leaked for bench_thread_main to clean up */
+    thread->block_count = 0;
+    for (size_t slot = 0; slot < BENCH_LIVE_MAX; slot++) {
+        if (thread->blocks[slot].addr != PHYS_ADDR_INVALID) {
+            thread->blocks[thread->block_count++] = thread->blocks[slot];
+        }
+    }
+}
+
+static void
+bench_thread_main(unsigned int cpu, void *context) {
+    struct bench_thread *thread = &bench_threads[cpu];
+    uint64_t start = 0;
+
+    (void)context;
+    thread->rng = config.seed + cpu;
+
+    start = host_read_sysreg("cntvct_el0");
+    switch (config.workload) {
+        case BENCH_WORKLOAD_RANDOM:
+            bench_random(thread);
+            break;
+        case BENCH_WORKLOAD_BURSTY:
+            bench_bursty(thread);
+            break;
+        case BENCH_WORKLOAD_TRACE:
+            bench_trace(thread);
+            break;
+        case BENCH_WORKLOAD_INIT:
+            /* Single threaded, see bench_init */
+            break;
+    }
+    thread->ticks = host_read_sysreg("cntvct_el0") - start;
+
+    /* Clean up untimed so that every run ends with the same free memory */
+    for (size_t i = 0; i < thread->block_count; i++) {
+        pmap_pfa_free_contig(thread->blocks[i].addr, thread->blocks[i].size);
+    }
+    thread->block_count = 0;
+}
+
+/**
+ * Allocates everything the PFA has free, largest blocks first, and returns a
+ * hash of the blocks in the order they were handed out. PFAs with identical
+ * free lists give identical hashes.
+ */
+static uint64_t
+bench_init_drain_hash(void) {
+    /* FNV-1a over the addresses, which carry the order in their low bits */
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for (unsigned int order = PMAP_PFA_MAX_ORDER + 1; order-- > 0;) {
+        phys_addr_t addr = PHYS_ADDR_INVALID;
+
+        while ((addr = pmap_pfa_alloc_order(order, &bench_metadata_m))
+                != PHYS_ADDR_INVALID) {
+            hash = (hash ^ (addr | order)) * 0x100000001B3ULL;
+        }
+    }
+
+    return hash;
+}
+
+/** Runs the init workload, returning the exit code */
+static int
+bench_init(void) {
+    uint64_t best[2] = { UINT64_MAX, UINT64_MAX };
+    uint64_t hash[2] = { 0, 0 };
+
+    /* Index 0 is block by block, index 1 is bulk */
+    for (unsigned int bulk = 0; bulk < 2; bulk++) {
+        pmap_pfa_set_bulk_init(bulk);
+        for (unsigned int round = 0; round < BENCH_INIT_ROUNDS; round++) {
+            host_pfa_init(config.ram_mb << 20);
+            best[bulk] = MIN(best[bulk], pmap_pfa_get_init_ticks());
+        }
+
+        hash[bulk] = bench_init_drain_hash();
+    }
+
+    printf(
+        "init: %llu MB, free lists built in %llu ns block by block, "
+        "%llu ns in bulk (best of %u)\n",
+        config.ram_mb, best[0], best[1], BENCH_INIT_ROUNDS
+    );
+
+    if (hash[0] != hash[1]) {
+        printf("init: bulk and block by block free lists differ\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/** Prints the usage and returns the exit code for bad arguments */
+static int
+usage(const char *name) {
+    printf(
+        "usage: %s random|bursty|trace|init [--ram MB] [--ops count] "
+        "[--threads count]\n"
+        "       [--arenas count] [--max-order n] [--live count] "
+        "[--burst count]\n"
+        "       [--seed n] [--trace path] [--eager] [--dump]\n",
+        name
+    );
+
+    return 2;
+}
+
+/** Parses the command line into CONFIG, returns false if it's invalid */
+static bool
+parse_arguments(int argc, char **argv) {
+    static const struct {
+        const char *name;
+        unsigned long long *value;
+    } numbers[] = {
+        { "--ram", &config.ram_mb },
+        { "--ops", &config.ops },
+        { "--threads", &config.threads },
+        { "--arenas", &config.arenas },
+        { "--max-order", &config.max_order },
+        { "--live", &config.live },
+        { "--burst", &config.burst },
+        { "--seed", &config.seed },
+    };
+
+    if (argc < 2) {
+        return false;
+    } else if (!strcmp(argv[1], "random")) {
+        config.workload = BENCH_WORKLOAD_RANDOM;
+    } else if (!strcmp(argv[1], "bursty")) {
+        config.workload = BENCH_WORKLOAD_BURSTY;
+    } else if (!strcmp(argv[1], "trace")) {
+        config.workload = BENCH_WORKLOAD_TRACE;
+    } else if (!strcmp(argv[1], "init")) {
+        config.workload = BENCH_WORKLOAD_INIT;
+    } else {
+        return false;
+    }
+
+    for (int arg_i = 2; arg_i < argc; arg_i++) {
+        const char *arg = argv[arg_i];
+        bool matched = false;
+
+        if (!strcmp(arg, "--dump")) {
+            config.dump = true;
+            continue;
+        } else if (!strcmp(arg, "--eager")) {
+            config.eager = true;
+            continue;
+        }
+
+        if (arg_i + 1 == argc) {
+            return false;
+        }
+
+        if (!strcmp(arg, "--trace")) {
+            config.trace = argv[++arg_i];
+            continue;
+        }
+
+        for (size_t i = 0; i < COUNT_OF(numbers); i++) {
+            if (!strcmp(arg, numbers[i].name)) {
+                matched = host_parse_number(argv[++arg_i], numbers[i].value);
+                break;
+            }
+        }
+
+        if (!matched) {
+            return false;
+        }
+    }
+
+    return config.ram_mb && config.threads
+        && config.threads <= SMP_MAX_CPUS
+        && config.arenas && config.arenas <= PMAP_PFA_ARENAS
+        && config.max_order <= PMAP_PFA_MAX_ORDER
+        && config.live && config.live <= BENCH_LIVE_MAX
+        && config.burst && config.seed
+        && (config.workload != BENCH_WORKLOAD_TRACE || config.trace);
+}
+
+int
+main(int argc, char **argv) {
+    static const char *workload_names[] = {
+        [BENCH_WORKLOAD_RANDOM] = "random",
+        [BENCH_WORKLOAD_BURSTY] = "bursty",
+        [BENCH_WORKLOAD_TRACE] = "trace",
+        [BENCH_WORKLOAD_INIT] = "init",
+    };
+    struct pmap_pfa_stats stats;
+    uint64_t ops = 0;
+    uint64_t failures = 0;
+    uint64_t ticks = 0;
+    uint64_t waits = 0;
+    uint64_t contended = 0;
+
+    if (!parse_arguments(argc, argv)) {
+        return usage(argv[0]);
+    }
+
+    memset(&bench_metadata_m, 0x00, sizeof(bench_metadata_m));
+    bench_metadata_m.page_type = PMAP_PAGE_TYPE_KERNEL_DATA;
+    pmap_pfa_set_arena_count(config.arenas);
+
+    if (config.workload == BENCH_WORKLOAD_INIT) {
+        return bench_init();
+    } else if (config.workload == BENCH_WORKLOAD_TRACE) {
+        unsigned long long size = 0;
+        size_t bad_line = 0;
+
+        trace_text = host_read_file(config.trace, &size);
+        if (!trace_text) {
+            printf("failed to read trace %s\n", config.trace);
+            return 1;
+        }
+
+        if ((bad_line = trace_validate())) {
+            printf("%s:%zu: malformed trace line\n", config.trace, bad_line);
+            return 1;
+        }
+    }
+
+    host_pfa_init(config.ram_mb << 20);
+    pmap_pfa_lazy_set_enabled(!config.eager);
+    pmap_pfa_reset_stats();
+
+    host_run_threads(config.threads, bench_thread_main, NULL);
+
+    for (unsigned int i = 0; i < config.threads; i++) {
+        struct bench_thread *thread = &bench_threads[i];
+
+        ops += thread->allocs + thread->frees;
+        failures += thread->failures;
+        ticks = MAX(ticks, thread->ticks);
+    }
+
+    printf(
+        "%s: %u threads, %u arenas, %llu ops (%llu failed allocations) in "
+        "%llu ms, %llu ns/op per thread\n",
+        workload_names[config.workload], (unsigned int)config.threads, 
+        pmap_pfa_get_arena_count(), ops, failures, ticks / 1000000, 
+        ops ? ticks * config.threads / ops : 0
+    );
+
+    /* An alloc/free pair is two ops */
+    pmap_pfa_get_stats(&stats);
+    printf(
+        "%s: %.2f list ops and %.2f bitmap ops per alloc/free pair (%s)\n",
+        workload_names[config.workload],
+        ops ? 2.0 * stats.list_ops / ops : 0.0,
+        ops ? 2.0 * stats.bitmap_ops / ops : 0.0,
+        config.eager ? "eager" : "lazy"
+    );
+
+    for (unsigned int i = 0; i < PMAP_PFA_HISTOGRAM_BUCKETS; i++) {
+        waits += stats.lock_wait_ticks.buckets[i];
+        if (i >= BENCH_CONTENDED_BUCKET) {
+            contended += stats.lock_wait_ticks.buckets[i];
+        }
+    }
+    printf(
+        "%s: %llu of %llu arena lock acquisitions waited over 1us\n",
+        workload_names[config.workload], contended, waits
+    );
+
+    if (config.dump) {
+        pmap_pfa_dump();
+    }
+
+    return 0;
+}
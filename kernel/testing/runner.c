@@ -7,6 +7,57 @@
 #define TAG "[runner] "
 
 
+/**
+ * Runs every test in SUITE, whose index in its list is SUITE_I, and adds to
+ * TEST_COUNT and TEST_PASS_COUNT
+ */
+static void
+run_suite(test_suite_t suite, size_t suite_i, size_t *test_count,
+          size_t *test_pass_count) {
+    int result = 0;
+
+    printf(
+        TAG "Running suite %s (sid=%zu, %zu tests)\n",
+        suite->name, suite_i, suite->cases_count
+    );
+
+    if (suite->setup_function) {
+        if ((result = suite->setup_function()) < 0) {
+            panic(
+                "Test suite setup failed (result=%d, suite=%s, sid=%zu)",
+                result, suite->name, suite_i
+            );
+        }
+    }
+
+    for (size_t test_i = 0; test_i < suite->cases_count; test_i++) {
+        test_case_t test = &suite->cases[test_i];
+
+        *test_count += 1;
+        
+        printf(
+            TAG "\tRunning test %s (tid=%zu)\n",
+            test->name, test_i
+        );
+        
+        if ((result = test->function()) < 0) {
+            printf(TAG "\tFAILED (result=%d)\n", result);
+        } else {
+            printf(TAG "\tPASSED\n");
+            *test_pass_count += 1;
+        }
+    }
+
+    if (suite->teardown_function) {
+        if ((result = suite->teardown_function()) < 0) {
+            panic(
+                "Test suite teardown failed (result=%d, suite=%s, sid=%zu)",
+                result, suite->name, suite_i
+            );
+        }
+    }
+}
+
 void
 test_runner_run(void) {
     size_t test_count = 0;
@@ -16,50 +67,18 @@ test_runner_run(void) {
     printf(TAG "Starting tests (%zu suites)...\n", suite_count);
 
     for (size_t suite_i = 0; suite_i < suite_count; suite_i++) {
-        int result = 0;
-        test_suite_t suite = suites[suite_i];
-        
-        printf(
-            TAG "Running suite %s (sid=%zu, %zu tests)\n",
-            suite->name, suite_i, suite->cases_count
-        );
-
-        if (suite->setup_function) {
-            if ((result = suite->setup_function()) < 0) {
-                panic(
-                    "Test suite setup failed (result=%d, suite=%s, sid=%zu)",
-                    result, suite->name, suite_i
-                );
-            }
-        }
+        run_suite(suites[suite_i], suite_i, &test_count, &test_pass_count);
+    }
 
-        for (size_t test_i = 0; test_i < suite->cases_count; test_i++) {
-            test_case_t test = &suite->cases[test_i];
+#ifdef CONFIG_TESTING_BENCHMARKS
+    printf(TAG "Starting benchmarks (%zu suites)...\n", COUNT_OF(bench_suites));
 
-            test_count += 1;
-            
-            printf(
-                TAG "\tRunning test %s (tid=%zu)\n",
-                test->name, test_i
-            );
-            
-            if ((result = test->function()) < 0) {
-                printf(TAG "\tFAILED (result=%d)\n", result);
-            } else {
-                printf(TAG "\tPASSED\n");
-                test_pass_count += 1;
-            }
-        }
-
-        if (suite->teardown_function) {
-            if ((result = suite->teardown_function()) < 0) {
-                panic(
-                    "Test suite teardown failed (result=%d, suite=%s, sid=%zu)",
-                    result, suite->name, suite_i
-                );
-            }
-        }
+    for (size_t suite_i = 0; suite_i < COUNT_OF(bench_suites); suite_i++) {
+        run_suite(
+            bench_suites[suite_i], suite_i, &test_count, &test_pass_count
+        );
     }
+#endif /* CONFIG_TESTING_BENCHMARKS */
 
     printf(TAG "Run complete: %zu/%zu passed\n", test_pass_count, test_count);
     if (test_pass_count == test_count) {
@@ -0,0 +1,135 @@
+#include "test_utils.h"
+#include "test_helpers.h"
+#include "core/vm/kmalloc.h"
+#include "core/vm/slab.h"
+#include "machine/pmap/pmap_pfa.h"
+#include "machine/routines/routines.h"
+#include "lib/stdio.h"
+
+/** The number of allocations each benchmark round holds at once */
+#define BENCH_BATCH             (256)
+/** The number of rounds each measurement is averaged over */
+#define BENCH_ROUNDS            (64)
+
+static pmap_page_metadata_s bench_metadata_m;
+static void *bench_ptrs[BENCH_BATCH];
+static phys_addr_t bench_addrs[BENCH_BATCH];
+
+static int setup(void) {
+    memset(&bench_metadata_m, 0x00, sizeof(bench_metadata_m));
+    bench_metadata_m.page_type = PMAP_PAGE_TYPE_KERNEL_DATA;
+
+    return 0;
+}
+
+static int teardown(void) {
+    /* Report how the caches behaved over the whole run */
+    slab_dump();
+
+    return 0;
+}
+
+/**
+ * Get the ticks taken by BENCH_ROUNDS rounds of BENCH_BATCH kmallocs of SIZE
+ * bytes followed by their kfrees, or 0 if memory ran out. If BATCHED is false,
+ * each allocation is freed immediately instead.
+ */
+static uint64_t
+bench_kmalloc_ticks(size_t size, bool batched) {
+    uint64_t start = routines_read_cntvct();
+
+    for (unsigned int round = 0; round < BENCH_ROUNDS; round++) {
+        for (unsigned int i = 0; i < BENCH_BATCH; i++) {
+            if (!(bench_ptrs[i] = kmalloc(size))) {
+                return 0;
+            }
+            if (!batched) {
+                kfree(bench_ptrs[i]);
+            }
+        }
+
+        for (unsigned int i = 0; batched && i < BENCH_BATCH; i++) {
+            kfree(bench_ptrs[i]);
+        }
+    }
+
+    return routines_read_cntvct() - start;
+}
+
+/** Identical to bench_kmalloc_ticks but allocates whole pages from the PFA */
+static uint64_t
+bench_pfa_ticks(size_t size, bool batched) {
+    uint64_t start = routines_read_cntvct();
+
+    size = ROUND_UP(size, PAGE_SIZE);
+    for (unsigned int round = 0; round < BENCH_ROUNDS; round++) {
+        for (unsigned int i = 0; i < BENCH_BATCH; i++) {
+            bench_addrs[i] = pmap_pfa_alloc_contig(size, &bench_metadata_m);
+            if (bench_addrs[i] == PHYS_ADDR_INVALID) {
+                return 0;
+            }
+            if (!batched) {
+                pmap_pfa_free_contig(bench_addrs[i], size);
+            }
+        }
+
+        for (unsigned int i = 0; batched && i < BENCH_BATCH; i++) {
+            pmap_pfa_free_contig(bench_addrs[i], size);
+        }
+    }
+
+    return routines_read_cntvct() - start;
+}
+
+/**
+ * Compares the throughput of kmalloc/kfree to that of the PFA (which is what
+ * callers without kmalloc would have to use) across sizes, both for an
+ * allocation freed immediately and for a batch held and then freed
+ */
+static int throughput(void) {
+    static const size_t sizes[] = {
+        16, 64, 100, 256, 1024, 3000, 4096, 3 * PAGE_SIZE,
+    };
+    const uint64_t ops = BENCH_ROUNDS * BENCH_BATCH;
+
+    printf(
+        "%10s %8s %12s %12s %10s\n",
+        "size", "pattern", "kmalloc ns", "pfa ns", "speedup"
+    );
+    for (unsigned int i = 0; i < COUNT_OF(sizes); i++) {
+        for (unsigned int batched = 0; batched < 2; batched++) {
+            /* Warm the caches so we measure the steady state */
+            uint64_t kmalloc_ticks = bench_kmalloc_ticks(sizes[i], batched)
+                ? bench_kmalloc_ticks(sizes[i], batched) : 0;
+            uint64_t pfa_ticks = bench_pfa_ticks(sizes[i], batched)
+                ? bench_pfa_ticks(sizes[i], batched) : 0;
+
+            if (!kmalloc_ticks || !pfa_ticks) {
+                return -1;
+            }
+
+            /* ns per alloc/free pair, speedup in hundredths */
+            printf(
+                "%10zu %8s %12llu %12llu %7llu.%02llu\n",
+                sizes[i], batched ? "batch" : "pair",
+                test_ticks_to_ns(kmalloc_ticks) / ops,
+                test_ticks_to_ns(pfa_ticks) / ops,
+                pfa_ticks / kmalloc_ticks, pfa_ticks * 100 / kmalloc_ticks % 100
+            );
+        }
+    }
+
+    return 0;
+}
+
+static struct test_case cases[] = {
+    TEST_CASE(throughput),
+};
+
+struct test_suite bench_kmalloc = {
+    .name = "bench_kmalloc",
+    .setup_function = setup,
+    .teardown_function = teardown,
+    .cases = cases,
+    .cases_count = COUNT_OF(cases)
+};
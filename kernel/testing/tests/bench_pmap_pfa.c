@@ -0,0 +1,583 @@
+#include "test_utils.h"
+#include "test_helpers.h"
+#include "machine/pmap/pmap_pfa.h"
+#include "machine/routines/routines.h"
+#include "lib/stdio.h"
+#include "lib/list.h"
+
+extern void pmap_pfa_set_mobility_grouping(bool enabled);
+
+#define BUDDY_LEVELS (PMAP_PFA_BUDDY_LEVELS)
+
+/** The maximum number of bytes a single benchmark round may hold at once */
+#define BENCH_BYTES_MAX (16 * 1024 * 1024)
+/** The maximum number of blocks a single benchmark round may hold at once */
+#define BENCH_BLOCKS_MAX (256)
+
+static pmap_page_metadata_s bench_metadata_m;
+static phys_addr_t bench_addrs[BENCH_BLOCKS_MAX];
+
+static int setup(void) {
+    memset(&bench_metadata_m, 0x00, sizeof(bench_metadata_m));
+    bench_metadata_m.page_type = PMAP_PAGE_TYPE_KERNEL_DATA;
+
+    /* Measure the buddy allocator itself rather than the per-CPU magazines */
+    pmap_pfa_pcp_set_watermarks(0, 0, 0);
+    pmap_pfa_pcp_set_watermarks(1, 0, 0);
+    pmap_pfa_drain_caches();
+    pmap_pfa_reset_stats();
+
+    return 0;
+}
+
+static int teardown(void) {
+    /* Report how the allocator behaved over the whole run */
+    pmap_pfa_dump();
+
+    /* Restore the defaults from pmap_pfa.c */
+    pmap_pfa_pcp_set_watermarks(0, 16, 64);
+    pmap_pfa_pcp_set_watermarks(1, 8, 32);
+
+    return 0;
+}
+
+static int free_latency(void) {
+    printf("%10s %8s %12s %10s\n", "size (K)", "blocks", "total ticks", "ns/free");
+
+    /* 
+    Sweep every buddy level plus a few large allocation sizes, up to the most
+    memory we're willing to hold at once
+    */
+    for (unsigned int order = 0; order < BUDDY_LEVELS + 3
+            && ((size_t)PAGE_SIZE << order) <= BENCH_BYTES_MAX; order++) {
+        size_t size = (size_t)PAGE_SIZE << order;
+        size_t count = 0;
+        size_t count_max = MIN(BENCH_BLOCKS_MAX, BENCH_BYTES_MAX / size);
+        uint64_t start = 0;
+        uint64_t ticks = 0;
+
+        while (count < count_max 
+                && (bench_addrs[count] = 
+                    pmap_pfa_alloc_contig(size, &bench_metadata_m))
+                    != PHYS_ADDR_INVALID) {
+            count++;
+        }
+
+        if (!count) {
+            return -1;
+        }
+
+        start = routines_read_cntvct();
+        for (size_t i = 0; i < count; i++) {
+            pmap_pfa_free_contig(bench_addrs[i], size);
+        }
+        ticks = routines_read_cntvct() - start;
+
+        printf(
+            "%10zu %8zu %12llu %10llu\n",
+            size >> 10, count, ticks, test_ticks_to_ns(ticks) / count
+        );
+    }
+
+    return 0;
+}
+
+/** The number of fill/free rounds in each soak */
+#define SOAK_ROUNDS (16)
+/** One in this many soak allocations is unmovable (pinned) */
+#define SOAK_PINNED_ONE_IN (8)
+/** Each round, one in this many pinned pages is released */
+#define SOAK_PINNED_FREE_ONE_IN (2)
+
+/** Soak pages are tracked on lists linked through the pages themselves */
+typedef struct soak_page {
+    struct list_elem elem;
+} * soak_page_t;
+
+/** The soak's random state, see test_rand */
+static uint64_t soak_rng_state;
+
+/** Frees each page on LIST with a one in ONE_IN chance */
+static size_t soak_release(struct list *list, unsigned int one_in) {
+    size_t freed = 0;
+
+    for (struct list_elem *e = list_begin(list); e != list_end(list);) {
+        struct list_elem *e_next = list_next(e);
+
+        if (test_rand(&soak_rng_state) % one_in == 0) {
+            list_remove(e);
+            pmap_pfa_free_contig(
+                pmap_physmap_kva_to_pa((vm_addr_t)e), PAGE_SIZE
+            );
+            freed++;
+        }
+
+        e = e_next;
+    }
+
+    return freed;
+}
+
+/** Get the number of pages free in the buddy allocator across all zones */
+static size_t soak_free_pages(void) {
+    struct pmap_pfa_zone_stats stats;
+    size_t free_pages = 0;
+
+    for (unsigned int zone_i = 0; zone_i < PMAP_PFA_ZONE_COUNT; zone_i++) {
+        pmap_pfa_zone_get_stats(zone_i, &stats);
+        free_pages += stats.free_pages;
+    }
+
+    return free_pages;
+}
+
+/** 
+ * Allocates as many top level blocks as possible (as a huge page user would),
+ * frees them, and returns how many there were
+ */
+static size_t soak_probe_top_blocks(void) {
+    const size_t size = (size_t)PAGE_SIZE << (BUDDY_LEVELS - 1);
+    struct list blocks;
+    size_t count = 0;
+    phys_addr_t addr;
+
+    list_init(&blocks);
+    while ((addr = pmap_pfa_alloc_contig_flags(
+                size, &bench_metadata_m, PMAP_PFA_ALLOC_MOVABLE))
+            != PHYS_ADDR_INVALID) {
+        list_push_back(&blocks, &((soak_page_t)pmap_pa_to_kva(addr))->elem);
+        count++;
+    }
+
+    while (!list_empty(&blocks)) {
+        struct list_elem *e = list_pop_front(&blocks);
+        pmap_pfa_free_contig(pmap_physmap_kva_to_pa((vm_addr_t)e), size);
+    }
+
+    return count;
+}
+
+/**
+ * Runs SOAK_ROUNDS rounds of filling memory with a mix of pinned and transient
+ * pages and then releasing all transient pages and some pinned ones. After each
+ * round, reports what fraction of free memory can still be allocated as top
+ * level blocks. Returns the average percentage.
+ */
+static size_t soak_run(bool grouping) {
+    const size_t top_pages = (size_t)1 << (BUDDY_LEVELS - 1);
+    struct list pinned;
+    struct list transient;
+    size_t pinned_count = 0;
+    size_t rate_sum = 0;
+
+    list_init(&pinned);
+    list_init(&transient);
+    soak_rng_state = 0x5eed5eed5eed5eedULL;
+    pmap_pfa_set_mobility_grouping(grouping);
+
+    printf("mobility grouping %s\n", grouping ? "enabled" : "disabled");
+    printf(
+        "%6s %10s %10s %10s %8s\n", 
+        "round", "pinned", "free", "top blocks", "rate"
+    );
+
+    for (unsigned int round = 0; round < SOAK_ROUNDS; round++) {
+        size_t free_pages = 0;
+        size_t top_blocks = 0;
+        size_t rate = 0;
+        phys_addr_t addr;
+
+        /* Fill memory completely */
+        while (true) {
+            bool pin = test_rand(&soak_rng_state) % SOAK_PINNED_ONE_IN == 0;
+            addr = pmap_pfa_alloc_contig_flags(
+                PAGE_SIZE, &bench_metadata_m, 
+                pin ? PMAP_PFA_ALLOC_NONE : PMAP_PFA_ALLOC_MOVABLE
+            );
+            if (addr == PHYS_ADDR_INVALID) {
+                break;
+            }
+
+            list_push_back(
+                pin ? &pinned : &transient, 
+                &((soak_page_t)pmap_pa_to_kva(addr))->elem
+            );
+            pinned_count += pin;
+        }
+
+        /* Release every transient page and some of the pinned ones */
+        soak_release(&transient, 1);
+        pinned_count -= soak_release(&pinned, SOAK_PINNED_FREE_ONE_IN);
+        pmap_pfa_drain_caches();
+
+        free_pages = soak_free_pages();
+        top_blocks = soak_probe_top_blocks();
+        rate = free_pages ? top_blocks * top_pages * 100 / free_pages : 0;
+        rate_sum += rate;
+
+        printf(
+            "%6u %10zu %10zu %10zu %7zu%%\n", 
+            round, pinned_count, free_pages, top_blocks, rate
+        );
+    }
+
+    soak_release(&pinned, 1);
+    pmap_pfa_set_mobility_grouping(true);
+
+    return rate_sum / SOAK_ROUNDS;
+}
+
+/**
+ * Measures how the fraction of free memory available as top level blocks
+ * evolves under a long running mix of pinned and transient allocations, with
+ * and without grouping by mobility
+ */
+static int mobility_soak(void) {
+    size_t grouped = soak_run(true);
+    size_t ungrouped = soak_run(false);
+
+    printf(
+        "average top level availability: %zu%% grouped, %zu%% ungrouped\n",
+        grouped, ungrouped
+    );
+
+    return 0;
+}
+
+/*
+Pages held by the color benchmark. Twice the ways of the L2 means a single color
+holds twice the pages its sets can, while spreading them over every color fits.
+*/
+#define COLOR_BENCH_PAGES   (2 * SMP_L2_CACHE_WAYS)
+/** The number of timed passes over the color benchmark's pages */
+#define COLOR_BENCH_PASSES  (64)
+
+typedef enum {
+    COLOR_BENCH_SAME,
+    COLOR_BENCH_UNCOLORED,
+    COLOR_BENCH_ROUND_ROBIN,
+
+    COLOR_BENCH_MODE_COUNT
+} color_bench_mode_e;
+
+/** Reads every cache line of the color benchmark's pages once */
+static uint64_t color_bench_pass(void) {
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < COLOR_BENCH_PAGES; i++) {
+        volatile uint64_t *page = (uint64_t *)pmap_pa_to_kva(bench_addrs[i]);
+
+        for (size_t offset = 0; offset < PAGE_SIZE / sizeof(*page); 
+                offset += SMP_CACHE_LINE_SIZE / sizeof(*page)) {
+            sum += page[offset];
+        }
+    }
+
+    return sum;
+}
+
+/**
+ * Measures the L2 refills (and time) taken by repeatedly reading a working set
+ * which fits in the L2 when it is allocated on a single color, without asking
+ * for colors, and on every color in turn
+ */
+static int color_conflicts(void) {
+    static const char *mode_names[COLOR_BENCH_MODE_COUNT] = {
+        [COLOR_BENCH_SAME] = "same color",
+        [COLOR_BENCH_UNCOLORED] = "uncolored",
+        [COLOR_BENCH_ROUND_ROBIN] = "round robin",
+    };
+
+    STATIC_ASSERT(COLOR_BENCH_PAGES <= BENCH_BLOCKS_MAX);
+    /* The colors seen by each mode are collected in a byte */
+    STATIC_ASSERT(PMAP_PFA_COLORS <= 8);
+    printf(
+        "%12s %8s %12s %12s\n", "mode", "colors", "total ticks", "L2 refills"
+    );
+
+    for (unsigned int mode = 0; mode < COLOR_BENCH_MODE_COUNT; mode++) {
+        uint8_t colors_used = 0;
+        unsigned int color_count = 0;
+        uint64_t start = 0;
+        uint64_t ticks = 0;
+        uint64_t refills = 0;
+
+        for (size_t i = 0; i < COLOR_BENCH_PAGES; i++) {
+            if (mode == COLOR_BENCH_SAME) {
+                bench_addrs[i] = pmap_pfa_alloc_colored(0, &bench_metadata_m);
+            } else if (mode == COLOR_BENCH_UNCOLORED) {
+                bench_addrs[i] = pmap_pfa_alloc_contig(
+                    PAGE_SIZE, &bench_metadata_m
+                );
+            } else {
+                bench_addrs[i] = pmap_pfa_alloc_colored(
+                    PMAP_PFA_COLOR_NEXT, &bench_metadata_m
+                );
+            }
+
+            if (bench_addrs[i] == PHYS_ADDR_INVALID) {
+                return -1;
+            }
+
+            colors_used |= 1 << pmap_pfa_page_color(bench_addrs[i]);
+        }
+
+        /* Warm up, so that only conflicts (not cold misses) are counted */
+        color_bench_pass();
+
+        routines_pmu_start(ROUTINES_PMU_EVENT_L2D_CACHE_REFILL);
+        start = routines_read_cntvct();
+        for (unsigned int pass = 0; pass < COLOR_BENCH_PASSES; pass++) {
+            color_bench_pass();
+        }
+        ticks = routines_read_cntvct() - start;
+        refills = routines_pmu_read();
+
+        for (size_t i = 0; i < COLOR_BENCH_PAGES; i++) {
+            pmap_pfa_free_contig(bench_addrs[i], PAGE_SIZE);
+        }
+
+        color_count = __builtin_popcount(colors_used);
+        printf(
+            "%12s %8u %12llu %12llu\n", 
+            mode_names[mode], color_count, ticks, refills
+        );
+    }
+
+    /* Give back the pages split off for colors */
+    pmap_pfa_drain_caches();
+
+    return 0;
+}
+
+/** The number of blocks the lazy coalescing benchmark frees and reallocates */
+#define LAZY_BENCH_BLOCKS   (16)
+/** The number of times the lazy coalescing benchmark cycles its blocks */
+#define LAZY_BENCH_ROUNDS   (256)
+/** The highest order the lazy coalescing benchmark tries */
+#define LAZY_BENCH_MAX_ORDER    (3)
+
+/**
+ * Measures the buddy list and bitmap operations (and time) per alloc/free pair
+ * of a workload which repeatedly frees and reallocates blocks of one order,
+ * with lazy coalescing disabled and enabled
+ */
+static int lazy_churn(void) {
+    STATIC_ASSERT(LAZY_BENCH_BLOCKS <= BENCH_BLOCKS_MAX);
+    printf(
+        "%6s %6s %10s %12s %10s\n", 
+        "order", "lazy", "list ops", "bitmap ops", "ns/pair"
+    );
+
+    for (unsigned int order = 0; 
+            order <= MIN(LAZY_BENCH_MAX_ORDER, BUDDY_LEVELS - 1); order++) {
+        for (unsigned int lazy = 0; lazy < 2; lazy++) {
+            size_t size = (size_t)PAGE_SIZE << order;
+            uint64_t pairs = (uint64_t)LAZY_BENCH_BLOCKS * LAZY_BENCH_ROUNDS;
+            struct pmap_pfa_stats stats;
+            uint64_t start = 0;
+            uint64_t ticks = 0;
+
+            pmap_pfa_lazy_set_enabled(lazy);
+            for (size_t i = 0; i < LAZY_BENCH_BLOCKS; i++) {
+                bench_addrs[i] = pmap_pfa_alloc_contig(size, &bench_metadata_m);
+                if (bench_addrs[i] == PHYS_ADDR_INVALID) {
+                    pmap_pfa_lazy_set_enabled(true);
+                    return -1;
+                }
+            }
+
+            pmap_pfa_reset_stats();
+            start = routines_read_cntvct();
+            for (unsigned int round = 0; round < LAZY_BENCH_ROUNDS; round++) {
+                for (size_t i = 0; i < LAZY_BENCH_BLOCKS; i++) {
+                    pmap_pfa_free_contig(bench_addrs[i], size);
+                }
+
+                for (size_t i = 0; i < LAZY_BENCH_BLOCKS; i++) {
+                    bench_addrs[i] = pmap_pfa_alloc_contig(
+                        size, &bench_metadata_m
+                    );
+                    if (bench_addrs[i] == PHYS_ADDR_INVALID) {
+                        pmap_pfa_lazy_set_enabled(true);
+                        return -2;
+                    }
+                }
+            }
+            ticks = routines_read_cntvct() - start;
+            pmap_pfa_get_stats(&stats);
+
+            for (size_t i = 0; i < LAZY_BENCH_BLOCKS; i++) {
+                pmap_pfa_free_contig(bench_addrs[i], size);
+            }
+
+            printf(
+                "%6u %6s %10llu %12llu %10llu\n", order, lazy ? "on" : "off",
+                stats.list_ops / pairs, stats.bitmap_ops / pairs,
+                test_ticks_to_ns(ticks) / pairs
+            );
+        }
+    }
+
+    /* Merge whatever the lazy rounds left behind */
+    pmap_pfa_drain_caches();
+
+    return 0;
+}
+
+/** The number of free summaries the query benchmark takes */
+#define SUMMARY_BENCH_QUERIES   (4096)
+
+/**
+ * Measures the cost of a free summary and prints the fragmentation index of
+ * free memory for each order
+ */
+static int free_summary_cost(void) {
+    struct pmap_pfa_free_summary summary;
+    uint64_t start = 0;
+    uint64_t ticks = 0;
+
+    start = routines_read_cntvct();
+    for (unsigned int i = 0; i < SUMMARY_BENCH_QUERIES; i++) {
+        pmap_pfa_get_free_summary(i % BUDDY_LEVELS, &summary);
+    }
+    ticks = routines_read_cntvct() - start;
+
+    printf(
+        "%llu ns/summary, %zu free pages, largest order %d\n",
+        test_ticks_to_ns(ticks) / SUMMARY_BENCH_QUERIES, summary.free_pages,
+        summary.largest_order
+    );
+
+    printf("%6s %12s %14s\n", "order", "free blocks", "fragmentation");
+    for (unsigned int order = 0; order < BUDDY_LEVELS; order++) {
+        pmap_pfa_get_free_summary(order, &summary);
+        printf(
+            "%6u %12zu %9u/%u\n", order, summary.free_blocks[order],
+            summary.fragmentation, PMAP_PFA_FRAGMENTATION_SCALE
+        );
+    }
+
+    return 0;
+}
+
+/** The largest claim the CMA bench makes */
+#define CMA_BENCH_BYTES_MAX     (8 * 1024 * 1024)
+/** The smallest claim the CMA bench makes */
+#define CMA_BENCH_BYTES_MIN     (64 * 1024)
+
+/** Movable pages borrowing the reservation are linked through their start */
+static bool cma_bench_migrate(phys_addr_t old_page, phys_addr_t new_page,
+                              void *context) {
+    struct list_elem *elem = (struct list_elem *)pmap_pa_to_kva(new_page);
+
+    elem->prev->next = elem;
+    elem->next->prev = elem;
+
+    return true;
+}
+
+static const struct pmap_pfa_mover cma_bench_mover = {
+    .migrate = cma_bench_migrate,
+    .context = NULL,
+};
+
+/**
+ * Measures claim and release latency across claim sizes, first with the
+ * reservation idle and then with movable pages borrowing all of it
+ */
+static int cma_claim_latency(void) {
+    static unsigned int mover_id = PMAP_PFA_MOVER_NONE;
+    pmap_page_metadata_s m = bench_metadata_m;
+    struct pmap_pfa_cma_stats before;
+    struct pmap_pfa_cma_stats after;
+    phys_addr_t addr = PHYS_ADDR_INVALID;
+    size_t size_max = 0;
+    struct list borrowed;
+    int result = 0;
+
+    pmap_pfa_cma_get_stats(&before);
+    if (!before.size) {
+        printf("No reservation\n");
+        return 0;
+    }
+    size_max = MIN(before.size / 2, CMA_BENCH_BYTES_MAX);
+
+    if (mover_id == PMAP_PFA_MOVER_NONE) {
+        mover_id = pmap_pfa_register_mover(&cma_bench_mover);
+    }
+    m.mover = mover_id;
+    list_init(&borrowed);
+
+    printf(
+        "%8s %10s %10s %12s %12s\n", 
+        "borrowed", "size (K)", "migrated", "claim ns", "release ns"
+    );
+    for (unsigned int pass = 0; pass < 2 && !result; pass++) {
+        if (pass == 1) {
+            /* 
+            Movable pages only borrow the reservation once everything else is
+            full, so fill memory and give back all but the borrowed pages
+            */
+            while ((addr = pmap_pfa_alloc_contig_flags(
+                        PAGE_SIZE, &m, PMAP_PFA_ALLOC_MOVABLE)) 
+                    != PHYS_ADDR_INVALID) {
+                list_push_back(
+                    &borrowed, (struct list_elem *)pmap_pa_to_kva(addr)
+                );
+            }
+            for (struct list_elem *e = list_begin(&borrowed); 
+                    e != list_end(&borrowed);) {
+                addr = pmap_physmap_kva_to_pa((vm_addr_t)e);
+                e = list_next(e);
+
+                if (addr < before.base || addr >= before.base + before.size) {
+                    list_remove((struct list_elem *)pmap_pa_to_kva(addr));
+                    pmap_pfa_free_contig(addr, PAGE_SIZE);
+                }
+            }
+        }
+
+        for (size_t size = CMA_BENCH_BYTES_MIN; size <= size_max; size <<= 1) {
+            pmap_pfa_cma_get_stats(&before);
+            addr = pmap_pfa_cma_claim(size, &bench_metadata_m);
+            if (addr == PHYS_ADDR_INVALID) {
+                result = -1;
+                break;
+            }
+            pmap_pfa_cma_release(addr, size);
+            pmap_pfa_cma_get_stats(&after);
+
+            printf(
+                "%8u %10zu %10llu %12llu %12llu\n", pass, size >> 10,
+                after.pages_migrated - before.pages_migrated,
+                test_ticks_to_ns(after.claim_ticks - before.claim_ticks),
+                test_ticks_to_ns(after.release_ticks - before.release_ticks)
+            );
+        }
+    }
+
+    while (!list_empty(&borrowed)) {
+        addr = pmap_physmap_kva_to_pa((vm_addr_t)list_pop_front(&borrowed));
+        pmap_pfa_free_contig(addr, PAGE_SIZE);
+    }
+
+    return result;
+}
+
+static struct test_case cases[] = {
+    TEST_CASE(free_latency),
+    TEST_CASE(mobility_soak),
+    TEST_CASE(color_conflicts),
+    TEST_CASE(lazy_churn),
+    TEST_CASE(free_summary_cost),
+    TEST_CASE(cma_claim_latency),
+};
+
+struct test_suite bench_pmap_pfa = {
+    .name = "bench_pmap_pfa",
+    .setup_function = setup,
+    .teardown_function = teardown,
+    .cases = cases,
+    .cases_count = COUNT_OF(cases)
+};
@@ -0,0 +1,44 @@
+#include "test_helpers.h"
+#include "core/vm/slab.h"
+#include "machine/pmap/pmap_pfa.h"
+#include "lib/string.h"
+
+extern void pmap_pfa_get_state(size_t *level_buffer, size_t count);
+
+static size_t pfa_original_state[PMAP_PFA_BUDDY_LEVELS];
+
+/**
+ * Returns every cached object and empty slab and every page cached by the PFA,
+ * then writes the PFA state to STATE
+ */
+static void
+settle_state(size_t *state) {
+    slab_drain_caches();
+    slab_shrink(SIZE_MAX);
+    pmap_pfa_drain_caches();
+    pmap_pfa_coalesce();
+    pmap_pfa_get_state(state, PMAP_PFA_BUDDY_LEVELS);
+}
+
+int
+test_vm_setup(void) {
+    /* The cache of caches holds a slab once the first cache is created */
+    slab_cache_destroy(slab_cache_create("setup", 8, 0));
+    settle_state(pfa_original_state);
+
+    return 0;
+}
+
+bool
+test_vm_state_matches_original(void) {
+    size_t temp_state[PMAP_PFA_BUDDY_LEVELS];
+
+    settle_state(temp_state);
+    if (memcmp(pfa_original_state, temp_state, sizeof(temp_state))) {
+        pmap_pfa_dump();
+        slab_dump();
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef TEST_HELPERS_H
+#define TEST_HELPERS_H
+#include "lib/types.h"
+#include "machine/routines/routines.h"
+
+/*
+Helpers shared by the test and benchmark suites. The VM fixture lets a suite
+check that it gave back everything it took from the slab allocator and the PFA.
+*/
+
+/**
+ * Captures the settled PFA state which test_vm_state_matches_original compares
+ * against. This is meant to be the setup function of suites which use the slab
+ * allocator or kmalloc.
+ */
+int
+test_vm_setup(void);
+
+/**
+ * Returns every cached slab object and empty slab and every page cached by the
+ * PFA, then checks that the PFA state matches the state captured by
+ * test_vm_setup. Both allocators are dumped if it doesn't.
+ */
+bool
+test_vm_state_matches_original(void);
+
+/**
+ * Advances the xorshift64 generator at STATE, which must not be zero, and
+ * returns the new value. We just need something cheap and repeatable.
+ */
+static inline uint64_t
+test_rand(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/** Converts generic timer ticks to nanoseconds */
+static inline uint64_t
+test_ticks_to_ns(uint64_t ticks) {
+    uint64_t frequency = routines_read_cntfrq();
+    return frequency ? ticks * 1000000000ULL / frequency : 0;
+}
+
+#endif /* TEST_HELPERS_H */
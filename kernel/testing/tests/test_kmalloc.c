@@ -0,0 +1,180 @@
+#include "test_utils.h"
+#include "test_helpers.h"
+#include "core/vm/kmalloc.h"
+#include "core/vm/slab.h"
+#include "machine/pmap/pmap_pfa.h"
+
+/** The largest size the sweep tests */
+#define SWEEP_SIZE_MAX          (4 * KMALLOC_SLAB_MAX)
+
+static int size_sweep(void) {
+    for (size_t size = 1; size <= SWEEP_SIZE_MAX; size++) {
+        uint8_t *ptr = kmalloc(size);
+        size_t usable = 0;
+
+        if (!ptr) {
+            return -1;
+        }
+
+        if ((vm_addr_t)ptr % KMALLOC_ALIGN) {
+            return -2;
+        }
+
+        /* Past the first two classes, at most a third of an object is waste */
+        usable = ksize(ptr);
+        if (usable < size
+                || (size <= KMALLOC_SLAB_MAX
+                    && usable > MAX(size + size / 2, 2 * KMALLOC_ALIGN))
+                || (size > KMALLOC_SLAB_MAX
+                    && usable != ROUND_UP(size, PAGE_SIZE))) {
+            return -3;
+        }
+
+        /* The whole of the usable size is ours */
+        memset(ptr, 0xA5, usable);
+        kfree(ptr);
+    }
+
+    if (!test_vm_state_matches_original()) {
+        return -4;
+    }
+
+    return 0;
+}
+
+static int large(void) {
+    size_t size = 3 * PAGE_SIZE + 1;
+    uint8_t *ptr = kmalloc(size);
+    page_id_t page = 0;
+    pmap_page_metadata_s m;
+
+    if (!ptr) {
+        return -1;
+    }
+
+    /* Large allocations are whole pages straight from the PFA */
+    if ((vm_addr_t)ptr % PAGE_SIZE || slab_cache_for_object(ptr)) {
+        return -2;
+    }
+
+    page = pmap_physmap_kva_to_pa((vm_addr_t)ptr) >> PAGE_SHIFT;
+    pmap_pfa_mds_get_metadata(page, &m);
+    if (m.page_type != PMAP_PAGE_TYPE_KERNEL_DATA) {
+        return -3;
+    }
+    pmap_pfa_mds_require_range_type(page, 4, PMAP_PAGE_TYPE_KERNEL_DATA);
+
+    memset(ptr, 0x5A, size);
+    kfree(ptr);
+
+    if (!test_vm_state_matches_original()) {
+        return -4;
+    }
+
+    return 0;
+}
+
+static int zeroed(void) {
+    static const size_t sizes[] = { 1, 40, 100, 4096, 5000, 3 * PAGE_SIZE };
+
+    for (unsigned int i = 0; i < COUNT_OF(sizes); i++) {
+        uint8_t *ptr = kmalloc(sizes[i]);
+
+        if (!ptr) {
+            return -1;
+        }
+
+        /* Dirty the memory so a reused allocation would show it */
+        memset(ptr, 0xFF, ksize(ptr));
+        kfree(ptr);
+
+        if (!(ptr = kzalloc(sizes[i]))) {
+            return -2;
+        }
+
+        for (size_t j = 0; j < sizes[i]; j++) {
+            if (ptr[j]) {
+                return -3;
+            }
+        }
+        kfree(ptr);
+    }
+
+    if (kmalloc(0) || kzalloc(0)) {
+        return -4;
+    }
+    kfree(NULL);
+
+    if (!test_vm_state_matches_original()) {
+        return -5;
+    }
+
+    return 0;
+}
+
+/** The number of allocations the churn test holds at once */
+#define CHURN_SLOTS             (512)
+/** The number of allocations the churn test replaces */
+#define CHURN_ROUNDS            (16384)
+
+static int churn(void) {
+    /*
+    Replaces random allocations of mixed sizes, each filled with a pattern
+    unique to its slot, and checks that no allocation ever overlaps another
+    */
+    static uint8_t *ptrs[CHURN_SLOTS];
+    static size_t sizes[CHURN_SLOTS];
+    uint64_t rng = 0x6B6D616C6C6F6321;
+    int result = 0;
+
+    memset(ptrs, 0x00, sizeof(ptrs));
+
+    for (unsigned int round = 0; round < CHURN_ROUNDS && !result; round++) {
+        unsigned int slot = test_rand(&rng) % CHURN_SLOTS;
+        uint64_t r = test_rand(&rng);
+        /* Mostly small, as kmalloc is used in practice */
+        size_t size = r % 8 ? 1 + r % 512 : 1 + r % (3 * KMALLOC_SLAB_MAX);
+
+        if (ptrs[slot]) {
+            for (size_t j = 0; j < sizes[slot]; j++) {
+                if (ptrs[slot][j] != (uint8_t)slot) {
+                    result = -1;
+                    break;
+                }
+            }
+            kfree(ptrs[slot]);
+        }
+
+        if (!(ptrs[slot] = kmalloc(size))) {
+            result = -2;
+            break;
+        }
+        sizes[slot] = size;
+        memset(ptrs[slot], (uint8_t)slot, size);
+    }
+
+    for (unsigned int slot = 0; slot < CHURN_SLOTS; slot++) {
+        kfree(ptrs[slot]);
+    }
+
+    if (!result && !test_vm_state_matches_original()) {
+        result = -3;
+    }
+
+    return result;
+}
+
+static struct test_case cases[] = {
+    TEST_CASE(size_sweep),
+    TEST_CASE(large),
+    TEST_CASE(zeroed),
+    TEST_CASE(churn),
+};
+
+struct test_suite test_kmalloc = {
+    .name = "kmalloc",
+    .setup_function = test_vm_setup,
+    .teardown_function = NULL,
+    .cases = cases,
+    .cases_count = COUNT_OF(cases)
+};
@@ -1,20 +1,28 @@
 #include "test_utils.h"
+#include "test_helpers.h"
 #include "machine/pmap/pmap_pfa.h"
+#include "machine/smp/smp.h"
+#include "core/idle/idle.h"
 #include "lib/list.h"
 
-extern void pmap_pfa_dump_state(void);
 extern void pmap_pfa_get_state(size_t *level_buffer, size_t count);
+extern size_t pmap_pfa_pcp_fill(unsigned int cpu, unsigned int order,
+                                size_t count);
 
-#define BUDDY_LEVELS (6)
+#define BUDDY_LEVELS (PMAP_PFA_BUDDY_LEVELS)
 static size_t pfa_original_state[BUDDY_LEVELS];
 static pmap_page_metadata_s pfa_metadata_m;
 
 
 static int setup(void) {
-    /* 
+    /*
     Capture the initial PFA state so that we can check that we got back to where
-    we expect later
+    we expect later. Pages cached by this core are not on the buddy lists, so
+    we return them first to get a stable picture. Lazy frees may also have left
+    blocks unmerged.
     */
+    pmap_pfa_drain_caches();
+    pmap_pfa_coalesce();
     pmap_pfa_get_state(pfa_original_state, COUNT_OF(pfa_original_state));
 
     memset(&pfa_metadata_m, 0x00, sizeof(pfa_metadata_m));
@@ -23,17 +31,29 @@ static int setup(void) {
     return 0;
 }
 
-static int simple_sweep(void) {
+/** Checks that the PFA state matches the state captured during setup */
+static bool state_matches_original(void) {
     size_t temp_state[BUDDY_LEVELS];
+
+    pmap_pfa_drain_caches();
+    pmap_pfa_coalesce();
+    pmap_pfa_get_state(temp_state, COUNT_OF(temp_state));
+    if (memcmp(pfa_original_state, temp_state, sizeof(temp_state))) {
+        pmap_pfa_dump();
+        return false;
+    }
+
+    return true;
+}
+
+static int simple_sweep(void) {
     phys_addr_t addr;
 
     for (unsigned int pg_count = 1; pg_count < 32; pg_count++) {
         addr = pmap_pfa_alloc_contig(PAGE_SIZE * pg_count, &pfa_metadata_m);
         pmap_pfa_free_contig(addr, PAGE_SIZE * pg_count);
 
-        pmap_pfa_get_state(temp_state, COUNT_OF(temp_state));
-        if (memcmp(pfa_original_state, temp_state, sizeof(temp_state))) {
-            pmap_pfa_dump_state();
+        if (!state_matches_original()) {
             return -1;
         }
     }
@@ -41,11 +61,10 @@ static int simple_sweep(void) {
 }
 
 static int multi_sweep(void) {
-    size_t temp_state[BUDDY_LEVELS];
     phys_addr_t addrs[32];
 
     for (unsigned int pg_count = 1; pg_count < 32; pg_count++) {
-        addrs[pg_count - 1] = 
+        addrs[pg_count - 1] =
             pmap_pfa_alloc_contig(PAGE_SIZE * pg_count, &pfa_metadata_m);
     }
 
@@ -54,7 +73,7 @@ static int multi_sweep(void) {
     }
 
     for (unsigned int pg_count = 1; pg_count < 32; pg_count++) {
-        addrs[pg_count - 1] = 
+        addrs[pg_count - 1] =
             pmap_pfa_alloc_contig(PAGE_SIZE * pg_count, &pfa_metadata_m);
     }
 
@@ -63,7 +82,7 @@ static int multi_sweep(void) {
     }
 
     for (unsigned int pg_count = 31; pg_count >= 1; pg_count--) {
-        addrs[pg_count - 1] = 
+        addrs[pg_count - 1] =
             pmap_pfa_alloc_contig(PAGE_SIZE * pg_count, &pfa_metadata_m);
     }
 
@@ -72,9 +91,7 @@ static int multi_sweep(void) {
     }
 
 
-    pmap_pfa_get_state(temp_state, COUNT_OF(temp_state));
-    if (memcmp(pfa_original_state, temp_state, sizeof(temp_state))) {
-        pmap_pfa_dump_state();
+    if (!state_matches_original()) {
         return -1;
     }
 
@@ -98,13 +115,12 @@ static int oom_sweep(void) {
     2. That we can allocate all memory and later free it correctly
     */
     phys_addr_t addr = PHYS_ADDR_INVALID;
-    size_t temp_state[BUDDY_LEVELS];
     struct list l;
-   
+
     list_init(&l);
     oom_sweep_run_cnt += 1;
 
-    while ((addr = pmap_pfa_alloc_contig(PAGE_SIZE, &pfa_metadata_m)) 
+    while ((addr = pmap_pfa_alloc_contig(PAGE_SIZE, &pfa_metadata_m))
             != PHYS_ADDR_INVALID) {
         oom_sweep_page_t osp = (oom_sweep_page_t)pmap_pa_to_kva(addr);
         if (osp->magic == OOM_SWEEP_MAGIC + oom_sweep_run_cnt) {
@@ -128,19 +144,2172 @@ static int oom_sweep(void) {
         e = e_next;
     }
 
-    pmap_pfa_get_state(temp_state, COUNT_OF(temp_state));
-    if (memcmp(pfa_original_state, temp_state, sizeof(temp_state))) {
-        pmap_pfa_dump_state();
+    if (!state_matches_original()) {
         return -1;
     }
 
    return 0;
 }
 
+/** The size of a single top level buddy block */
+#define TOP_BLOCK_SIZE  ((size_t)PAGE_SIZE << (BUDDY_LEVELS - 1))
+
+/** Stamps the first word of every page in [addr, addr + size) with TAG */
+static void stamp_pages(phys_addr_t addr, size_t size, uint64_t tag) {
+    for (size_t offset = 0; offset < size; offset += PAGE_SIZE) {
+        uint64_t *page = (uint64_t *)pmap_pa_to_kva(addr + offset);
+        *page = tag + offset;
+    }
+}
+
+/** Checks that every page in [addr, addr + size) still holds its TAG stamp */
+static bool check_stamps(phys_addr_t addr, size_t size, uint64_t tag) {
+    for (size_t offset = 0; offset < size; offset += PAGE_SIZE) {
+        uint64_t *page = (uint64_t *)pmap_pa_to_kva(addr + offset);
+        if (*page != tag + offset) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#if PMAP_PFA_MAX_ORDER <= PMAP_PFA_ORDER_L2_BLOCK
+/* These need several free top level blocks, which 1GB levels preclude */
+static int large_sweep(void) {
+    phys_addr_t addr;
+    pmap_page_metadata_s m;
+
+    /*
+    Sweep sizes from just over the top level up to several MB. The step is not
+    a multiple of the top level so that we exercise tail trimming.
+    */
+    for (size_t size = TOP_BLOCK_SIZE + PAGE_SIZE; size <= 4 * 1024 * 1024;
+            size += TOP_BLOCK_SIZE + 3 * PAGE_SIZE) {
+        addr = pmap_pfa_alloc_contig(size, &pfa_metadata_m);
+        if (addr == PHYS_ADDR_INVALID) {
+            return -1;
+        }
+
+        if (addr % TOP_BLOCK_SIZE) {
+            /* Large allocations must be top level aligned */
+            return -2;
+        }
+
+        /* Check that the metadata was applied to both ends */
+        pmap_pfa_mds_get_metadata(addr >> PAGE_SHIFT, &m);
+        if (m.page_type != pfa_metadata_m.page_type) {
+            return -3;
+        }
+        pmap_pfa_mds_get_metadata((addr + size - 1) >> PAGE_SHIFT, &m);
+        if (m.page_type != pfa_metadata_m.page_type) {
+            return -4;
+        }
+
+        pmap_pfa_free_contig(addr, size);
+
+        if (!state_matches_original()) {
+            return -5;
+        }
+    }
+
+    return 0;
+}
+
+static int large_multi(void) {
+    static const size_t sizes[] = {
+        TOP_BLOCK_SIZE + PAGE_SIZE,
+        TOP_BLOCK_SIZE * 2,
+        TOP_BLOCK_SIZE * 3 - PAGE_SIZE,
+        1024 * 1024,
+        1024 * 1024 + 5 * PAGE_SIZE,
+        TOP_BLOCK_SIZE * 5 + 7 * PAGE_SIZE,
+        2 * 1024 * 1024,
+        TOP_BLOCK_SIZE * 2 + 1,
+    };
+    phys_addr_t addrs[COUNT_OF(sizes)];
+
+    /* Interleave small and large allocations so the two paths share state */
+    for (size_t i = 0; i < COUNT_OF(sizes); i++) {
+        phys_addr_t small = pmap_pfa_alloc_contig(
+            PAGE_SIZE * (i + 1), &pfa_metadata_m
+        );
+
+        addrs[i] = pmap_pfa_alloc_contig(sizes[i], &pfa_metadata_m);
+        if (small == PHYS_ADDR_INVALID || addrs[i] == PHYS_ADDR_INVALID) {
+            return -1;
+        }
+
+        stamp_pages(addrs[i], sizes[i], OOM_SWEEP_MAGIC + (i << 32));
+        pmap_pfa_free_contig(small, PAGE_SIZE * (i + 1));
+    }
+
+    /* If any two allocations overlapped, one of them lost its stamps */
+    for (size_t i = 0; i < COUNT_OF(sizes); i++) {
+        if (!check_stamps(addrs[i], sizes[i], OOM_SWEEP_MAGIC + (i << 32))) {
+            return -2;
+        }
+    }
+
+    /* Free the even allocations first and then the odd ones */
+    for (size_t i = 0; i < COUNT_OF(sizes); i += 2) {
+        pmap_pfa_free_contig(addrs[i], sizes[i]);
+    }
+    for (size_t i = 1; i < COUNT_OF(sizes); i += 2) {
+        pmap_pfa_free_contig(addrs[i], sizes[i]);
+    }
+
+    if (!state_matches_original()) {
+        return -3;
+    }
+
+    return 0;
+}
+
+static int large_oom_sweep(void) {
+    static int large_oom_sweep_run_cnt = 0;
+    const size_t size = TOP_BLOCK_SIZE * 4 + PAGE_SIZE;
+    phys_addr_t addr = PHYS_ADDR_INVALID;
+    size_t allocation_count = 0;
+    struct list l;
+
+    list_init(&l);
+    large_oom_sweep_run_cnt += 1;
+
+    /*
+    Allocate large chunks until we run out of memory. Each allocation links the
+    list element in its first page so that we don't need any extra storage
+    */
+    while ((addr = pmap_pfa_alloc_contig(size, &pfa_metadata_m))
+            != PHYS_ADDR_INVALID) {
+        oom_sweep_page_t osp = (oom_sweep_page_t)pmap_pa_to_kva(addr);
+        if (osp->magic == OOM_SWEEP_MAGIC + large_oom_sweep_run_cnt) {
+            /* We got the same memory back?? */
+            return -1;
+        }
+        osp->magic = OOM_SWEEP_MAGIC + large_oom_sweep_run_cnt;
+        list_push_front(&l, &osp->elem);
+        allocation_count++;
+    }
+
+    if (!allocation_count) {
+        /* We should always have at least a few MB free */
+        return -2;
+    }
+
+    for (struct list_elem *e = list_begin(&l);  e != list_end (&l);) {
+        struct list_elem *e_next = list_next(e);
+        list_remove(e);
+
+        oom_sweep_page_t osp = list_entry(e, struct oom_sweep_page, elem);
+        addr = pmap_physmap_kva_to_pa((vm_addr_t)osp);
+        pmap_pfa_free_contig(addr, size);
+
+        e = e_next;
+    }
+
+    if (!state_matches_original()) {
+        return -3;
+    }
+
+    return 0;
+}
+
+static int large_fragmented(void) {
+    phys_addr_t addr = PHYS_ADDR_INVALID;
+    struct list odd;
+    struct list even;
+    int result = 0;
+
+    list_init(&odd);
+    list_init(&even);
+
+    /* Take every top level block on the system, sorted by address parity */
+    while ((addr = pmap_pfa_alloc_contig(TOP_BLOCK_SIZE, &pfa_metadata_m))
+            != PHYS_ADDR_INVALID) {
+        oom_sweep_page_t osp = (oom_sweep_page_t)pmap_pa_to_kva(addr);
+        if ((addr / TOP_BLOCK_SIZE) % 2) {
+            list_push_front(&odd, &osp->elem);
+        } else {
+            list_push_front(&even, &osp->elem);
+        }
+    }
+
+    /* Free the even blocks. No two free top level blocks are now adjacent. */
+    while (!list_empty(&even)) {
+        struct list_elem *e = list_pop_front(&even);
+        oom_sweep_page_t osp = list_entry(e, struct oom_sweep_page, elem);
+        addr = pmap_physmap_kva_to_pa((vm_addr_t)osp);
+        pmap_pfa_free_contig(addr, TOP_BLOCK_SIZE);
+    }
+
+    addr = pmap_pfa_alloc_contig(TOP_BLOCK_SIZE + PAGE_SIZE, &pfa_metadata_m);
+    if (addr != PHYS_ADDR_INVALID) {
+        /* There is no run of two free blocks, this should've failed */
+        pmap_pfa_free_contig(addr, TOP_BLOCK_SIZE + PAGE_SIZE);
+        result = -1;
+    }
+
+    while (!list_empty(&odd)) {
+        struct list_elem *e = list_pop_front(&odd);
+        oom_sweep_page_t osp = list_entry(e, struct oom_sweep_page, elem);
+        addr = pmap_physmap_kva_to_pa((vm_addr_t)osp);
+        pmap_pfa_free_contig(addr, TOP_BLOCK_SIZE);
+    }
+
+    if (result) {
+        return result;
+    }
+
+    /* Everything is free again, so the same request must now succeed */
+    addr = pmap_pfa_alloc_contig(TOP_BLOCK_SIZE + PAGE_SIZE, &pfa_metadata_m);
+    if (addr == PHYS_ADDR_INVALID) {
+        return -2;
+    }
+    pmap_pfa_free_contig(addr, TOP_BLOCK_SIZE + PAGE_SIZE);
+
+    if (!state_matches_original()) {
+        return -3;
+    }
+
+    return 0;
+}
+#endif
+
+/** Allocates and frees a mix of 4K and 8K blocks, checking for overlaps */
+static int pcp_mixed_pattern(void) {
+    phys_addr_t addrs[192];
+    size_t sizes[COUNT_OF(addrs)];
+
+    for (size_t i = 0; i < COUNT_OF(addrs); i++) {
+        sizes[i] = (i % 3 == 0) ? 2 * PAGE_SIZE : PAGE_SIZE;
+        addrs[i] = pmap_pfa_alloc_contig(sizes[i], &pfa_metadata_m);
+        if (addrs[i] == PHYS_ADDR_INVALID) {
+            return -1;
+        }
+        stamp_pages(addrs[i], sizes[i], OOM_SWEEP_MAGIC + (i << 32));
+
+        if (i % 5 == 4) {
+            /* Free some early so that blocks get recycled through the cache */
+            pmap_pfa_free_contig(addrs[i - 2], sizes[i - 2]);
+            addrs[i - 2] = PHYS_ADDR_INVALID;
+        }
+    }
+
+    for (size_t i = 0; i < COUNT_OF(addrs); i++) {
+        if (addrs[i] == PHYS_ADDR_INVALID) {
+            continue;
+        }
+
+        if (!check_stamps(addrs[i], sizes[i], OOM_SWEEP_MAGIC + (i << 32))) {
+            return -2;
+        }
+        pmap_pfa_free_contig(addrs[i], sizes[i]);
+    }
+
+    if (!state_matches_original()) {
+        return -3;
+    }
+
+    return 0;
+}
+
+static int pcp_watermarks(void) {
+    int result = 0;
+
+    /* Default watermarks */
+    if ((result = pcp_mixed_pattern()) < 0) {
+        return result;
+    }
+
+    /* Refill and drain on nearly every operation */
+    pmap_pfa_pcp_set_watermarks(0, 1, 1);
+    pmap_pfa_pcp_set_watermarks(1, 1, 1);
+    if ((result = pcp_mixed_pattern()) < 0) {
+        return result - 10;
+    }
+
+    /* Caching disabled, everything goes through the buddy allocator */
+    pmap_pfa_pcp_set_watermarks(0, 0, 0);
+    pmap_pfa_pcp_set_watermarks(1, 0, 0);
+    if ((result = pcp_mixed_pattern()) < 0) {
+        return result - 20;
+    }
+
+    /* Restore the defaults from pmap_pfa.c */
+    pmap_pfa_pcp_set_watermarks(0, 16, 64);
+    pmap_pfa_pcp_set_watermarks(1, 8, 32);
+
+    return 0;
+}
+
+/** The number of blocks pcp_remote caches on another core */
+#define PCP_REMOTE_BLOCKS       (64)
+
+/**
+ * Checks that a core which runs out of memory also gets back the blocks cached
+ * by another core's magazine
+ */
+static int pcp_remote(void) {
+    unsigned int other = (smp_get_cpu_id() + 1) % SMP_MAX_CPUS;
+    phys_addr_t addr = PHYS_ADDR_INVALID;
+    int result = 0;
+    struct list l;
+
+    list_init(&l);
+    if (pmap_pfa_pcp_fill(other, 0, PCP_REMOTE_BLOCKS) != PCP_REMOTE_BLOCKS) {
+        return -1;
+    }
+
+    /* A core with caching disabled still leaves other cores' caches alone */
+    pmap_pfa_pcp_set_watermarks(0, 0, 0);
+    addr = pmap_pfa_alloc_contig(PAGE_SIZE, &pfa_metadata_m);
+    if (addr != PHYS_ADDR_INVALID) {
+        pmap_pfa_free_contig(addr, PAGE_SIZE);
+    }
+    /* Restore the defaults, as pcp_watermarks does */
+    pmap_pfa_pcp_set_watermarks(0, 16, 64);
+    if (addr == PHYS_ADDR_INVALID
+            || pmap_pfa_pcp_fill(other, 0, 0) != PCP_REMOTE_BLOCKS) {
+        return -2;
+    }
+
+    while ((addr = pmap_pfa_alloc_contig(PAGE_SIZE, &pfa_metadata_m))
+            != PHYS_ADDR_INVALID) {
+        oom_sweep_page_t osp = (oom_sweep_page_t)pmap_pa_to_kva(addr);
+        list_push_front(&l, &osp->elem);
+    }
+
+    /* Running out must have emptied the other core's magazine */
+    if (pmap_pfa_pcp_fill(other, 0, 0)) {
+        result = -3;
+    }
+
+    while (!list_empty(&l)) {
+        oom_sweep_page_t osp = list_entry(
+            list_pop_front(&l), struct oom_sweep_page, elem
+        );
+        pmap_pfa_free_contig(pmap_physmap_kva_to_pa((vm_addr_t)osp), PAGE_SIZE);
+    }
+
+    if (!result && !state_matches_original()) {
+        result = -4;
+    }
+
+    return result;
+}
+
+static int batch_sweep(void) {
+    static const size_t counts[] = { 1, 2, 7, 33, 64, 100, 513 };
+    phys_addr_t pages[513];
+    pmap_page_metadata_s m;
+
+    for (size_t count_i = 0; count_i < COUNT_OF(counts); count_i++) {
+        size_t count = counts[count_i];
+
+        if (pmap_pfa_alloc_batch(pages, count, &pfa_metadata_m) != count) {
+            return -1;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            stamp_pages(pages[i], PAGE_SIZE, OOM_SWEEP_MAGIC + (i << 32));
+        }
+
+        /* Every page must be distinct and carry the metadata */
+        for (size_t i = 0; i < count; i++) {
+            if (!check_stamps(pages[i], PAGE_SIZE,
+                              OOM_SWEEP_MAGIC + (i << 32))) {
+                return -2;
+            }
+
+            pmap_pfa_mds_get_metadata(pages[i] >> PAGE_SHIFT, &m);
+            if (m.page_type != pfa_metadata_m.page_type) {
+                return -3;
+            }
+        }
+
+        pmap_pfa_free_batch(pages, count);
+
+        if (!state_matches_original()) {
+            return -4;
+        }
+    }
+
+    return 0;
+}
+
+static int batch_oom(void) {
+    struct pmap_pfa_zone_stats cma;
+    size_t free_pages = 0;
+    size_t request_count = 0;
+    size_t array_size = 0;
+    size_t allocated = 0;
+    phys_addr_t array_pa = PHYS_ADDR_INVALID;
+    phys_addr_t *pages = NULL;
+
+    /* Ask for more pages than exist */
+    for (unsigned int level_i = 0; level_i < BUDDY_LEVELS; level_i++) {
+        free_pages += pfa_original_state[level_i] << level_i;
+    }
+    request_count = free_pages + 16;
+    array_size = request_count * sizeof(phys_addr_t);
+
+    array_pa = pmap_pfa_alloc_contig(array_size, &pfa_metadata_m);
+    if (array_pa == PHYS_ADDR_INVALID) {
+        return -1;
+    }
+    pages = (phys_addr_t *)pmap_pa_to_kva(array_pa);
+
+    /* We should get everything except the array itself and the reservation */
+    pmap_pfa_zone_get_stats(PMAP_PFA_ZONE_CMA, &cma);
+    allocated = pmap_pfa_alloc_batch(pages, request_count, &pfa_metadata_m);
+    if (allocated != free_pages - cma.free_pages
+                        - (ROUND_UP(array_size, PAGE_SIZE) >> PAGE_SHIFT)
+            || pmap_pfa_alloc_contig(PAGE_SIZE, &pfa_metadata_m)
+                != PHYS_ADDR_INVALID) {
+        return -2;
+    }
+
+    pmap_pfa_free_batch(pages, allocated);
+    pmap_pfa_free_contig(array_pa, array_size);
+
+    if (!state_matches_original()) {
+        return -3;
+    }
+
+    return 0;
+}
+
+/** Checks that the page at ADDR is entirely zero */
+static bool page_is_zero(phys_addr_t addr) {
+    uint64_t *page = (uint64_t *)pmap_pa_to_kva(addr);
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        if (page[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int zero_pool(void) {
+    struct pmap_pfa_zero_pool_stats before;
+    struct pmap_pfa_zero_pool_stats after;
+    phys_addr_t addrs[8];
+    int result = 0;
+
+    pmap_pfa_zero_pool_set_target(COUNT_OF(addrs));
+
+    /* Fill the pool with the work an idle core does */
+    while (idle_step());
+
+    pmap_pfa_zero_pool_get_stats(&before);
+    if (before.count != COUNT_OF(addrs)) {
+        result = -1;
+        goto out;
+    }
+
+    /* Every request should now hit */
+    for (size_t i = 0; i < COUNT_OF(addrs); i++) {
+        addrs[i] = pmap_pfa_alloc_contig_flags(
+            PAGE_SIZE, &pfa_metadata_m, PMAP_PFA_ALLOC_ZERO
+        );
+
+        if (addrs[i] == PHYS_ADDR_INVALID || !page_is_zero(addrs[i])) {
+            result = -2;
+            goto out;
+        }
+
+        /* Dirty it so that we'd notice if it came back unzeroed */
+        memset((void *)pmap_pa_to_kva(addrs[i]), 0xAA, PAGE_SIZE);
+    }
+
+    pmap_pfa_zero_pool_get_stats(&after);
+    if (after.count != 0 || after.hits - before.hits != COUNT_OF(addrs)) {
+        result = -3;
+        goto out;
+    }
+
+    /* Return the dirty pages. The pool is empty, so the next requests miss. */
+    for (size_t i = 0; i < COUNT_OF(addrs); i++) {
+        pmap_pfa_free_contig(addrs[i], PAGE_SIZE);
+    }
+
+    for (size_t i = 0; i < COUNT_OF(addrs); i++) {
+        addrs[i] = pmap_pfa_alloc_contig_flags(
+            PAGE_SIZE, &pfa_metadata_m, PMAP_PFA_ALLOC_ZERO
+        );
+
+        if (addrs[i] == PHYS_ADDR_INVALID || !page_is_zero(addrs[i])) {
+            result = -4;
+            goto out;
+        }
+    }
+
+    pmap_pfa_zero_pool_get_stats(&before);
+    if (before.misses - after.misses != COUNT_OF(addrs)) {
+        result = -5;
+        goto out;
+    }
+
+    for (size_t i = 0; i < COUNT_OF(addrs); i++) {
+        pmap_pfa_free_contig(addrs[i], PAGE_SIZE);
+    }
+
+    /* Multi-page requests are zeroed on the critical path */
+    addrs[0] = pmap_pfa_alloc_contig(3 * PAGE_SIZE, &pfa_metadata_m);
+    if (addrs[0] == PHYS_ADDR_INVALID) {
+        result = -6;
+        goto out;
+    }
+    memset((void *)pmap_pa_to_kva(addrs[0]), 0xAA, 3 * PAGE_SIZE);
+    pmap_pfa_free_contig(addrs[0], 3 * PAGE_SIZE);
+    addrs[0] = pmap_pfa_alloc_contig_flags(
+        3 * PAGE_SIZE, &pfa_metadata_m, PMAP_PFA_ALLOC_ZERO
+    );
+    for (size_t i = 0; i < 3; i++) {
+        if (!page_is_zero(addrs[0] + i * PAGE_SIZE)) {
+            result = -7;
+        }
+    }
+    pmap_pfa_free_contig(addrs[0], 3 * PAGE_SIZE);
+
+    /* Idling again tops the pool back up */
+    while (idle_step());
+    pmap_pfa_zero_pool_get_stats(&after);
+    if (after.count != COUNT_OF(addrs)) {
+        result = -8;
+        goto out;
+    }
+
+out:
+    /* Restore the default from pmap_pfa.c */
+    pmap_pfa_zero_pool_set_target(64);
+
+    if (!result && !state_matches_original()) {
+        result = -9;
+    }
+
+    return result;
+}
+
+/*
+Orders above an L2 block are not tested since a 1GB block may not exist at all
+on a 1GB board
+*/
+#define ALIGNMENT_LEVELS (MIN(BUDDY_LEVELS, PMAP_PFA_ORDER_L2_BLOCK + 1))
+
+static int order_alignment(void) {
+    phys_addr_t blocks[ALIGNMENT_LEVELS];
+    phys_addr_t pad = PHYS_ADDR_INVALID;
+    pmap_page_metadata_s m;
+    int result = 0;
+
+    for (unsigned int order = 0; order < ALIGNMENT_LEVELS; order++) {
+        blocks[order] = PHYS_ADDR_INVALID;
+    }
+
+    /* Split a block first so that the free lists don't start out aligned */
+    pad = pmap_pfa_alloc_contig(PAGE_SIZE, &pfa_metadata_m);
+    if (pad == PHYS_ADDR_INVALID) {
+        return -1;
+    }
+
+    for (unsigned int order = 0; order < ALIGNMENT_LEVELS; order++) {
+        size_t size = PAGE_SIZE << order;
+
+        blocks[order] = pmap_pfa_alloc_order(order, &pfa_metadata_m);
+        if (blocks[order] == PHYS_ADDR_INVALID) {
+            result = -2;
+            goto out;
+        }
+
+        if (blocks[order] % size) {
+            /* Blocks must be naturally aligned */
+            result = -3;
+            goto out;
+        }
+
+        pmap_pfa_mds_get_metadata((blocks[order] + size - 1) >> PAGE_SHIFT, &m);
+        if (m.page_type != pfa_metadata_m.page_type) {
+            result = -4;
+            goto out;
+        }
+
+        stamp_pages(blocks[order], size, order << 24);
+    }
+
+    for (unsigned int order = 0; order < ALIGNMENT_LEVELS; order++) {
+        if (!check_stamps(blocks[order], PAGE_SIZE << order, order << 24)) {
+            result = -5;
+        }
+    }
+
+out:
+    for (unsigned int order = 0; order < ALIGNMENT_LEVELS; order++) {
+        if (blocks[order] != PHYS_ADDR_INVALID) {
+            pmap_pfa_free_contig(blocks[order], PAGE_SIZE << order);
+        }
+    }
+    pmap_pfa_free_contig(pad, PAGE_SIZE);
+
+    if (!result && !state_matches_original()) {
+        result = -6;
+    }
+
+    return result;
+}
+
+/** Checks if [addr, addr + size) lies entirely within the zone in STATS */
+static bool in_zone(phys_addr_t addr, size_t size,
+                    struct pmap_pfa_zone_stats *stats) {
+    return addr >= stats->base && addr + size <= stats->base + stats->size;
+}
+
+/** Get the zone which holds ADDR */
+static pmap_pfa_zone_e zone_of(phys_addr_t addr) {
+    struct pmap_pfa_zone_stats stats;
+
+    for (pmap_pfa_zone_e zone = 0; zone < PMAP_PFA_ZONE_COUNT; zone++) {
+        pmap_pfa_zone_get_stats(zone, &stats);
+        if (in_zone(addr, PAGE_SIZE, &stats)) {
+            return zone;
+        }
+    }
+
+    return PMAP_PFA_ZONE_COUNT;
+}
+
+/** Blocks used to exhaust the normal zone. Capped at 2MB for 1GB levels. */
+#define ZONE_BLOCK_SIZE ((size_t)PAGE_SIZE << (ALIGNMENT_LEVELS - 1))
+
+static int zones(void) {
+    struct pmap_pfa_zone_stats dma;
+    struct pmap_pfa_zone_stats cma;
+    struct pmap_pfa_zone_stats normal;
+    struct pmap_pfa_zone_stats after;
+    phys_addr_t addr = PHYS_ADDR_INVALID;
+    struct list taken;
+    bool fell_back = false;
+    int result = 0;
+
+    list_init(&taken);
+    pmap_pfa_zone_get_stats(PMAP_PFA_ZONE_DMA, &dma);
+    pmap_pfa_zone_get_stats(PMAP_PFA_ZONE_CMA, &cma);
+    pmap_pfa_zone_get_stats(PMAP_PFA_ZONE_NORMAL, &normal);
+
+    /* The DMA zone must be non-empty and the zones adjacent */
+    if (!dma.size || (cma.size && dma.base + dma.size != cma.base)
+            || dma.base + dma.size + cma.size != normal.base) {
+        return -1;
+    }
+
+    /* DMA requests must be serviced by the DMA zone */
+    for (size_t pages = 1; pages <= 64; pages *= 4) {
+        addr = pmap_pfa_alloc_contig_flags(
+            pages * PAGE_SIZE, &pfa_metadata_m, PMAP_PFA_ALLOC_DMA
+        );
+        if (addr == PHYS_ADDR_INVALID) {
+            return -2;
+        }
+
+        if (!in_zone(addr, pages * PAGE_SIZE, &dma)) {
+            pmap_pfa_free_contig(addr, pages * PAGE_SIZE);
+            return -3;
+        }
+        pmap_pfa_free_contig(addr, pages * PAGE_SIZE);
+    }
+
+    pmap_pfa_zone_get_stats(PMAP_PFA_ZONE_DMA, &after);
+    if (after.allocations < dma.allocations + 4) {
+        return -4;
+    }
+
+    if (!normal.size) {
+        /* Nothing to fall back from */
+        return state_matches_original() ? 0 : -5;
+    }
+
+    /* DMA blocks freed through the magazines must not serve normal requests */
+    for (size_t pages = 1; pages <= 2; pages++) {
+        addr = pmap_pfa_alloc_contig_flags(
+            pages * PAGE_SIZE, &pfa_metadata_m, PMAP_PFA_ALLOC_DMA
+        );
+        if (addr == PHYS_ADDR_INVALID) {
+            return -6;
+        }
+        pmap_pfa_free_contig(addr, pages * PAGE_SIZE);
+
+        addr = pmap_pfa_alloc_contig(pages * PAGE_SIZE, &pfa_metadata_m);
+        if (addr == PHYS_ADDR_INVALID) {
+            return -6;
+        }
+        pmap_pfa_free_contig(addr, pages * PAGE_SIZE);
+
+        if (in_zone(addr, pages * PAGE_SIZE, &dma)) {
+            return -7;
+        }
+    }
+
+    /*
+    Normal requests must exhaust the normal zone before touching the DMA zone.
+    Take large blocks until one comes from the DMA zone.
+    */
+    while ((addr = pmap_pfa_alloc_contig(ZONE_BLOCK_SIZE, &pfa_metadata_m))
+            != PHYS_ADDR_INVALID) {
+        oom_sweep_page_t osp = (oom_sweep_page_t)pmap_pa_to_kva(addr);
+        list_push_front(&taken, &osp->elem);
+
+        if (in_zone(addr, ZONE_BLOCK_SIZE, &dma)) {
+            fell_back = true;
+            break;
+        }
+    }
+
+    pmap_pfa_zone_get_stats(PMAP_PFA_ZONE_DMA, &after);
+    if (fell_back && after.fallbacks == dma.fallbacks) {
+        result = -8;
+    }
+
+    while (!list_empty(&taken)) {
+        struct list_elem *e = list_pop_front(&taken);
+        oom_sweep_page_t osp = list_entry(e, struct oom_sweep_page, elem);
+        addr = pmap_physmap_kva_to_pa((vm_addr_t)osp);
+        pmap_pfa_free_contig(addr, ZONE_BLOCK_SIZE);
+    }
+
+    if (!result && !fell_back) {
+        /* We never reached the DMA zone */
+        result = -9;
+    }
+
+    if (!result && !state_matches_original()) {
+        result = -10;
+    }
+
+    return result;
+}
+
+/** The number of pages each batch_flags batch asks for */
+#define BATCH_FLAGS_COUNT       (33)
+
+/** Checks that batches are made from the zone and class their flags select */
+static int batch_flags(void) {
+    static const pmap_pfa_alloc_flags_t flags[] = {
+        PMAP_PFA_ALLOC_DMA, 
+        PMAP_PFA_ALLOC_MOVABLE | PMAP_PFA_ALLOC_ZERO,
+        PMAP_PFA_ALLOC_RECLAIMABLE,
+    };
+    static const pmap_pfa_mobility_e mobilities[] = {
+        PMAP_PFA_MOBILITY_UNMOVABLE,
+        PMAP_PFA_MOBILITY_MOVABLE,
+        PMAP_PFA_MOBILITY_RECLAIMABLE,
+    };
+    struct pmap_pfa_zone_stats dma;
+    phys_addr_t pages[BATCH_FLAGS_COUNT];
+    pmap_page_metadata_s m;
+    int result = 0;
+
+    pmap_pfa_zone_get_stats(PMAP_PFA_ZONE_DMA, &dma);
+    for (unsigned int i = 0; i < COUNT_OF(flags) && !result; i++) {
+        size_t allocated = pmap_pfa_alloc_batch_flags(
+            pages, COUNT_OF(pages), &pfa_metadata_m, flags[i]
+        );
+
+        if (allocated != COUNT_OF(pages)) {
+            result = -1;
+        }
+
+        for (size_t page_i = 0; page_i < allocated && !result; page_i++) {
+            pmap_pfa_mds_get_metadata(pages[page_i] >> PAGE_SHIFT, &m);
+            if (m.mobility != mobilities[i]
+                    || m.page_type != pfa_metadata_m.page_type) {
+                result = -2;
+            } else if ((flags[i] & PMAP_PFA_ALLOC_DMA)
+                    && !in_zone(pages[page_i], PAGE_SIZE, &dma)) {
+                result = -3;
+            } else if ((flags[i] & PMAP_PFA_ALLOC_ZERO)
+                    && !page_is_zero(pages[page_i])) {
+                result = -4;
+            }
+        }
+        pmap_pfa_free_batch(pages, allocated);
+    }
+
+    if (!result && !state_matches_original()) {
+        result = -5;
+    }
+
+    return result;
+}
+
+/** Get the arena holding ADDR, or the arena count if there is none */
+static unsigned int arena_of(phys_addr_t addr) {
+    struct pmap_pfa_arena_stats stats;
+
+    for (unsigned int i = 0; i < pmap_pfa_get_arena_count(); i++) {
+        pmap_pfa_arena_get_stats(i, &stats);
+        if (addr >= stats.base && addr < stats.base + stats.size) {
+            return i;
+        }
+    }
+
+    return pmap_pfa_get_arena_count();
+}
+
+static int arenas(void) {
+    /*
+    Tests that the arenas tile memory, that allocations and frees are accounted
+    to the arena owning the pages, and that a core falls back to the other
+    arenas once its home runs out
+    */
+    struct pmap_pfa_arena_stats before[PMAP_PFA_ARENAS];
+    struct pmap_pfa_arena_stats after;
+    unsigned int count = pmap_pfa_get_arena_count();
+    unsigned int home = pmap_pfa_get_home_arena();
+    unsigned int owner = 0;
+    phys_addr_t addr = PHYS_ADDR_INVALID;
+    struct list taken;
+    bool used_remote = false;
+    bool remote_accounted = false;
+    int result = 0;
+
+    if (!count || count > PMAP_PFA_ARENAS || home >= count) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        pmap_pfa_arena_get_stats(i, &before[i]);
+        if (!before[i].size 
+                || (i && before[i - 1].base + before[i - 1].size 
+                            != before[i].base)) {
+            /* The arenas must be non-empty and adjacent */
+            return -2;
+        }
+    }
+
+    /* Aligned requests skip the magazines, so they hit an arena directly */
+    addr = pmap_pfa_alloc_aligned(2 * PAGE_SIZE, PAGE_SIZE, &pfa_metadata_m);
+    if (addr == PHYS_ADDR_INVALID) {
+        return -3;
+    }
+
+    owner = arena_of(addr);
+    if (owner == count || arena_of(addr + PAGE_SIZE) != owner) {
+        return -4;
+    }
+
+    pmap_pfa_arena_get_stats(owner, &after);
+    if (after.free_pages != before[owner].free_pages - 2
+            || after.allocations != before[owner].allocations + 1
+            || (owner != home && after.remote_allocations 
+                    != before[owner].remote_allocations + 1)) {
+        result = -5;
+    }
+
+    /* Once out of our magazines, the pages go back to the owning arena */
+    pmap_pfa_free_contig(addr, 2 * PAGE_SIZE);
+    pmap_pfa_drain_caches();
+    pmap_pfa_arena_get_stats(owner, &after);
+    if (after.free_pages != before[owner].free_pages) {
+        result = -6;
+    }
+
+    if (result || count == 1) {
+        return result ? result : (state_matches_original() ? 0 : -7);
+    }
+
+    /* Exhausting memory must take blocks from arenas other than our home */
+    list_init(&taken);
+    while ((addr = pmap_pfa_alloc_contig(ZONE_BLOCK_SIZE, &pfa_metadata_m))
+            != PHYS_ADDR_INVALID) {
+        oom_sweep_page_t osp = (oom_sweep_page_t)pmap_pa_to_kva(addr);
+        list_push_front(&taken, &osp->elem);
+
+        if (arena_of(addr) != home) {
+            used_remote = true;
+        }
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        pmap_pfa_arena_get_stats(i, &after);
+        if (i != home 
+                && after.remote_allocations > before[i].remote_allocations) {
+            remote_accounted = true;
+        }
+    }
+
+    if (used_remote && !remote_accounted) {
+        /* No other arena accounted for our allocations */
+        result = -8;
+    }
+
+    while (!list_empty(&taken)) {
+        struct list_elem *e = list_pop_front(&taken);
+        oom_sweep_page_t osp = list_entry(e, struct oom_sweep_page, elem);
+        addr = pmap_physmap_kva_to_pa((vm_addr_t)osp);
+        pmap_pfa_free_contig(addr, ZONE_BLOCK_SIZE);
+    }
+
+    if (!result && !used_remote) {
+        result = -9;
+    }
+
+    if (!result && !state_matches_original()) {
+        result = -10;
+    }
+
+    return result;
+}
+
+static int mobility(void) {
+    phys_addr_t movable = PHYS_ADDR_INVALID;
+    phys_addr_t unmovable = PHYS_ADDR_INVALID;
+    pmap_page_metadata_s m;
+    int result = 0;
+
+    movable = pmap_pfa_alloc_contig_flags(
+        PAGE_SIZE, &pfa_metadata_m, PMAP_PFA_ALLOC_MOVABLE
+    );
+    unmovable = pmap_pfa_alloc_contig(PAGE_SIZE, &pfa_metadata_m);
+    if (movable == PHYS_ADDR_INVALID || unmovable == PHYS_ADDR_INVALID) {
+        result = -1;
+        goto out;
+    }
+
+    if (BUDDY_LEVELS == ALIGNMENT_LEVELS
+            && movable / TOP_BLOCK_SIZE == unmovable / TOP_BLOCK_SIZE) {
+        /*
+        The two classes must not share a top level block. This only holds if
+        there are enough top level blocks to go around, which isn't the case
+        with 1GB blocks.
+        */
+        result = -2;
+        goto out;
+    }
+
+    /* The PFA records the class in the MDS */
+    pmap_pfa_mds_get_metadata(movable >> PAGE_SHIFT, &m);
+    if (m.mobility != PMAP_PFA_MOBILITY_MOVABLE
+            || m.page_type != pfa_metadata_m.page_type) {
+        result = -3;
+        goto out;
+    }
+    pmap_pfa_mds_get_metadata(unmovable >> PAGE_SHIFT, &m);
+    if (m.mobility != PMAP_PFA_MOBILITY_UNMOVABLE) {
+        result = -4;
+        goto out;
+    }
+
+out:
+    if (movable != PHYS_ADDR_INVALID) {
+        pmap_pfa_free_contig(movable, PAGE_SIZE);
+    }
+    if (unmovable != PHYS_ADDR_INVALID) {
+        pmap_pfa_free_contig(unmovable, PAGE_SIZE);
+    }
+
+    if (!result && !state_matches_original()) {
+        result = -5;
+    }
+
+    return result;
+}
+
+static int aligned(void) {
+    /*
+    Tests that aligned requests are aligned and only consume their own size,
+    and that they can still be met when memory is too fragmented for any block
+    to cover the alignment
+    */
+    static const size_t sizes[] = { PAGE_SIZE, 3 * PAGE_SIZE, 4 * PAGE_SIZE };
+    size_t align_pages = 16;
+    struct pmap_pfa_zone_stats before;
+    struct pmap_pfa_free_summary free_before;
+    struct pmap_pfa_free_summary free_after;
+    phys_addr_t addr = PHYS_ADDR_INVALID;
+    pmap_page_metadata_s m;
+    struct list l;
+    int result = 0;
+
+    /* Past the top level when there is room, exercising the large allocator */
+    for (size_t align = PAGE_SIZE; align <= ZONE_BLOCK_SIZE * 4;
+            align <<= 1) {
+        for (size_t i = 0; i < COUNT_OF(sizes); i++) {
+            pmap_pfa_drain_caches();
+            pmap_pfa_get_free_summary(0, &free_before);
+
+            addr = pmap_pfa_alloc_aligned(sizes[i], align, &pfa_metadata_m);
+            pmap_pfa_get_free_summary(0, &free_after);
+            if (addr == PHYS_ADDR_INVALID || addr % align) {
+                return -1;
+            }
+
+            /* 
+            The rest of the block must have gone back on the lists. This counts
+            every zone, since 1GB levels may leave the normal zone empty.
+            */
+            if (free_before.free_pages - free_after.free_pages
+                    != sizes[i] >> PAGE_SHIFT) {
+                pmap_pfa_free_contig(addr, sizes[i]);
+                return -2;
+            }
+
+            pmap_pfa_free_contig(addr, sizes[i]);
+        }
+    }
+
+    /* The zone and mobility come from the flags, as for unaligned requests */
+    pmap_pfa_zone_get_stats(PMAP_PFA_ZONE_DMA, &before);
+    for (unsigned int zeroed = 0; zeroed < 2; zeroed++) {
+        addr = pmap_pfa_alloc_aligned_flags(
+            3 * PAGE_SIZE, align_pages << PAGE_SHIFT, &pfa_metadata_m,
+            PMAP_PFA_ALLOC_DMA | PMAP_PFA_ALLOC_MOVABLE 
+                | (zeroed ? PMAP_PFA_ALLOC_ZERO : PMAP_PFA_ALLOC_NONE)
+        );
+        if (addr == PHYS_ADDR_INVALID || (addr >> PAGE_SHIFT) % align_pages
+                || !in_zone(addr, 3 * PAGE_SIZE, &before)) {
+            return -3;
+        }
+
+        pmap_pfa_mds_get_metadata(addr >> PAGE_SHIFT, &m);
+        for (size_t i = 0; i < 3 && zeroed && !result; i++) {
+            if (!page_is_zero(addr + i * PAGE_SIZE)) {
+                result = -4;
+            }
+        }
+        if (m.mobility != PMAP_PFA_MOBILITY_MOVABLE) {
+            result = -4;
+        }
+
+        /* Dirty it so that the zeroed pass would notice if it came back */
+        memset((void *)pmap_pa_to_kva(addr), 0xAA, 3 * PAGE_SIZE);
+        pmap_pfa_free_contig(addr, 3 * PAGE_SIZE);
+        if (result) {
+            return result;
+        }
+    }
+
+    /* Leave only single free pages which are each aligned to align_pages */
+    list_init(&l);
+    while ((addr = pmap_pfa_alloc_contig(PAGE_SIZE, &pfa_metadata_m))
+            != PHYS_ADDR_INVALID) {
+        oom_sweep_page_t osp = (oom_sweep_page_t)pmap_pa_to_kva(addr);
+        list_push_front(&l, &osp->elem);
+    }
+    for (struct list_elem *e = list_begin(&l); e != list_end(&l);) {
+        oom_sweep_page_t osp = list_entry(e, struct oom_sweep_page, elem);
+        e = list_next(e);
+
+        addr = pmap_physmap_kva_to_pa((vm_addr_t)osp);
+        if ((addr >> PAGE_SHIFT) % align_pages == 0) {
+            list_remove(&osp->elem);
+            pmap_pfa_free_contig(addr, PAGE_SIZE);
+        }
+    }
+    pmap_pfa_drain_caches();
+
+    addr = pmap_pfa_alloc_aligned(
+        PAGE_SIZE, align_pages << PAGE_SHIFT, &pfa_metadata_m
+    );
+    if (addr == PHYS_ADDR_INVALID || (addr >> PAGE_SHIFT) % align_pages) {
+        result = -5;
+    } else {
+        pmap_pfa_free_contig(addr, PAGE_SIZE);
+    }
+
+    /* No two adjacent pages are free */
+    addr = pmap_pfa_alloc_aligned(
+        2 * PAGE_SIZE, align_pages << PAGE_SHIFT, &pfa_metadata_m
+    );
+    if (!result && addr != PHYS_ADDR_INVALID) {
+        pmap_pfa_free_contig(addr, 2 * PAGE_SIZE);
+        result = -6;
+    }
+
+    /* 
+    Free the page after each aligned page too, so that the only aligned free
+    memory is in blocks above the size's level and below the alignment's
+    */
+    for (struct list_elem *e = list_begin(&l); e != list_end(&l);) {
+        oom_sweep_page_t osp = list_entry(e, struct oom_sweep_page, elem);
+        e = list_next(e);
+
+        addr = pmap_physmap_kva_to_pa((vm_addr_t)osp);
+        if ((addr >> PAGE_SHIFT) % align_pages == 1) {
+            list_remove(&osp->elem);
+            pmap_pfa_free_contig(addr, PAGE_SIZE);
+        }
+    }
+    pmap_pfa_drain_caches();
+    pmap_pfa_coalesce();
+
+    /* Only the page we asked for is taken, the rest of the block is freed */
+    pmap_pfa_get_free_summary(0, &free_before);
+    addr = pmap_pfa_alloc_aligned(
+        PAGE_SIZE, align_pages << PAGE_SHIFT, &pfa_metadata_m
+    );
+    pmap_pfa_get_free_summary(0, &free_after);
+    if (addr == PHYS_ADDR_INVALID) {
+        result = result ? result : -7;
+    } else {
+        if ((addr >> PAGE_SHIFT) % align_pages
+                || free_before.free_pages - free_after.free_pages != 1) {
+            result = result ? result : -8;
+        }
+        pmap_pfa_free_contig(addr, PAGE_SIZE);
+    }
+
+    while (!list_empty(&l)) {
+        oom_sweep_page_t osp = list_entry(
+            list_pop_front(&l), struct oom_sweep_page, elem
+        );
+        pmap_pfa_free_contig(pmap_physmap_kva_to_pa((vm_addr_t)osp), PAGE_SIZE);
+    }
+
+    if (!result && !state_matches_original()) {
+        result = -9;
+    }
+
+    return result;
+}
+
+/** A movable page in the compaction test, linked through its first bytes */
+typedef struct compaction_page {
+    struct list_elem elem;
+    uint64_t tag;
+} * compaction_page_t;
+
+static bool compaction_migrate(phys_addr_t old_page, phys_addr_t new_page,
+                               void *context) {
+    compaction_page_t cp = (compaction_page_t)pmap_pa_to_kva(new_page);
+
+    /* The list links are our only "mappings", point neighbors at the copy */
+    cp->elem.prev->next = &cp->elem;
+    cp->elem.next->prev = &cp->elem;
+    (*(size_t *)context)++;
+
+    return true;
+}
+
+static size_t compaction_migrated = 0;
+static const struct pmap_pfa_mover compaction_mover = {
+    .migrate = compaction_migrate,
+    .context = &compaction_migrated,
+};
+
+/** Get the ID of compaction_mover, registering it on first use */
+static unsigned int compaction_mover_id(void) {
+    static unsigned int mover_id = PMAP_PFA_MOVER_NONE;
+
+    if (mover_id == PMAP_PFA_MOVER_NONE) {
+        mover_id = pmap_pfa_register_mover(&compaction_mover);
+    }
+
+    return mover_id;
+}
+
+static int compaction(void) {
+    /*
+    Tests that a multi-page allocation succeeds when every free page is wedged
+    between movable pages, and that the moved pages are intact
+    */
+    unsigned int order = MIN(4, BUDDY_LEVELS - 1);
+    size_t size = (size_t)PAGE_SIZE << order;
+    struct pmap_pfa_compaction_stats before;
+    struct pmap_pfa_compaction_stats after;
+    pmap_page_metadata_s m = pfa_metadata_m;
+    phys_addr_t addr = PHYS_ADDR_INVALID;
+    phys_addr_t block = PHYS_ADDR_INVALID;
+    uint64_t tag = 0;
+    struct list l;
+    int result = 0;
+
+    m.mover = compaction_mover_id();
+    list_init(&l);
+
+    /* Fill memory with movable pages, then free every odd page */
+    while ((addr = pmap_pfa_alloc_contig_flags(
+                PAGE_SIZE, &m, PMAP_PFA_ALLOC_MOVABLE)) != PHYS_ADDR_INVALID) {
+        compaction_page_t cp = (compaction_page_t)pmap_pa_to_kva(addr);
+
+        list_push_back(&l, &cp->elem);
+    }
+    for (struct list_elem *e = list_begin(&l); e != list_end(&l);) {
+        compaction_page_t cp = list_entry(e, struct compaction_page, elem);
+        addr = pmap_physmap_kva_to_pa((vm_addr_t)cp);
+        e = list_next(e);
+
+        if ((addr >> PAGE_SHIFT) % 2) {
+            list_remove(&cp->elem);
+            pmap_pfa_free_contig(addr, PAGE_SIZE);
+        } else {
+            /* Migration must carry the extended metadata along */
+            pmap_pfa_mds_owner_set(addr >> PAGE_SHIFT, (uint32_t)tag);
+            cp->tag = tag++;
+        }
+    }
+    pmap_pfa_drain_caches();
+
+    compaction_migrated = 0;
+    pmap_pfa_compaction_get_stats(&before);
+    block = pmap_pfa_alloc_contig(size, &pfa_metadata_m);
+    pmap_pfa_compaction_get_stats(&after);
+    if (block == PHYS_ADDR_INVALID) {
+        /*
+        Compaction only empties movable pageblocks. With 1GB blocks, memory
+        may be a single pageblock which the kernel's own pages keep unmovable.
+        */
+        result = BUDDY_LEVELS == ALIGNMENT_LEVELS ? -1 : 0;
+        goto out;
+    }
+
+    if (after.successes != before.successes + 1 || !compaction_migrated
+            || after.pages_migrated - before.pages_migrated
+                != compaction_migrated) {
+        result = -2;
+        goto out;
+    }
+
+    /* 
+    Compacting explicitly works as well. Our pages may all be in the DMA zone,
+    which takes the first top level block whole.
+    */
+    if (!pmap_pfa_compact(zone_of(block), order)) {
+        result = -3;
+        goto out;
+    }
+
+    /* Every page must still be on the list, in order, and not in the block */
+    tag = 0;
+    for (struct list_elem *e = list_begin(&l); e != list_end(&l);
+            e = list_next(e)) {
+        compaction_page_t cp = list_entry(e, struct compaction_page, elem);
+        addr = pmap_physmap_kva_to_pa((vm_addr_t)cp);
+
+        if (cp->tag != tag || (addr >= block && addr < block + size)
+                || pmap_pfa_mds_owner_get(addr >> PAGE_SHIFT) != tag) {
+            result = -4;
+            goto out;
+        }
+        tag++;
+    }
+
+out:
+    if (block != PHYS_ADDR_INVALID) {
+        pmap_pfa_free_contig(block, size);
+    }
+    while (!list_empty(&l)) {
+        compaction_page_t cp = list_entry(
+            list_pop_front(&l), struct compaction_page, elem
+        );
+        pmap_pfa_free_contig(pmap_physmap_kva_to_pa((vm_addr_t)cp), PAGE_SIZE);
+    }
+
+    if (!result && !state_matches_original()) {
+        result = -5;
+    }
+
+    return result;
+}
+
+/** The largest claim the cma test makes */
+#define CMA_CLAIM_SIZE  ((size_t)4 * 1024 * 1024)
+
+static int cma(void) {
+    /*
+    Tests that only migratable pages borrow the CMA zone, and that a claim
+    migrates them out of its way intact and is given back by a release
+    */
+    struct pmap_pfa_cma_stats before;
+    struct pmap_pfa_cma_stats after;
+    struct pmap_pfa_zone_stats zone;
+    pmap_page_metadata_s m = pfa_metadata_m;
+    pmap_page_metadata_s claim_m;
+    phys_addr_t addr = PHYS_ADDR_INVALID;
+    phys_addr_t claim = PHYS_ADDR_INVALID;
+    size_t size = 0;
+    size_t borrowed = 0;
+    uint64_t tag = 0;
+    struct list l;
+    int result = 0;
+
+    pmap_pfa_zone_get_stats(PMAP_PFA_ZONE_CMA, &zone);
+    pmap_pfa_cma_get_stats(&before);
+    if (before.base != zone.base || before.size != zone.size 
+            || before.claimed_pages) {
+        return -1;
+    }
+
+    if (!zone.size) {
+        /* No room for a reservation */
+        return state_matches_original() ? 0 : -2;
+    }
+    size = MIN(zone.size / 2, CMA_CLAIM_SIZE);
+
+    /* Fill memory with movable pages, which borrow the reservation */
+    m.mover = compaction_mover_id();
+    list_init(&l);
+    while ((addr = pmap_pfa_alloc_contig_flags(
+                PAGE_SIZE, &m, PMAP_PFA_ALLOC_MOVABLE)) != PHYS_ADDR_INVALID) {
+        compaction_page_t cp = (compaction_page_t)pmap_pa_to_kva(addr);
+
+        list_push_back(&l, &cp->elem);
+        if (in_zone(addr, PAGE_SIZE, &zone)) {
+            borrowed++;
+        }
+    }
+    if (!borrowed) {
+        result = -3;
+        goto out;
+    }
+
+    /*
+    Free every odd page, leaving the claim half of its range to migrate. The
+    reservation goes first, since unmovable requests must not take its pages
+    even when nothing else is free.
+    */
+    for (unsigned int pass = 0; pass < 2; pass++) {
+        for (struct list_elem *e = list_begin(&l); e != list_end(&l);) {
+            compaction_page_t cp = list_entry(e, struct compaction_page, elem);
+            addr = pmap_physmap_kva_to_pa((vm_addr_t)cp);
+            e = list_next(e);
+
+            if ((addr >> PAGE_SHIFT) % 2 
+                    && in_zone(addr, PAGE_SIZE, &zone) == !pass) {
+                list_remove(&cp->elem);
+                pmap_pfa_free_contig(addr, PAGE_SIZE);
+            }
+        }
+        pmap_pfa_drain_caches();
+
+        if (pass == 0) {
+            addr = pmap_pfa_alloc_contig(PAGE_SIZE, &pfa_metadata_m);
+            if (addr != PHYS_ADDR_INVALID) {
+                pmap_pfa_free_contig(addr, PAGE_SIZE);
+                if (in_zone(addr, PAGE_SIZE, &zone)) {
+                    result = -4;
+                    goto out;
+                }
+            }
+        }
+    }
+    for (struct list_elem *e = list_begin(&l); e != list_end(&l);
+            e = list_next(e)) {
+        list_entry(e, struct compaction_page, elem)->tag = tag++;
+    }
+
+    claim = pmap_pfa_cma_claim(size, &pfa_metadata_m);
+    pmap_pfa_cma_get_stats(&after);
+    if (claim == PHYS_ADDR_INVALID || !in_zone(claim, size, &zone)) {
+        result = -5;
+        goto out;
+    }
+
+    if (after.claims != before.claims + 1 
+            || after.claimed_pages != size >> PAGE_SHIFT
+            || after.pages_migrated == before.pages_migrated) {
+        result = -6;
+        goto out;
+    }
+
+    /* The claim carries the caller's type but is pinned */
+    for (phys_addr_t page_i = claim; page_i < claim + size; 
+            page_i += PAGE_SIZE) {
+        pmap_pfa_mds_get_metadata(page_i >> PAGE_SHIFT, &claim_m);
+        if (claim_m.page_type != pfa_metadata_m.page_type
+                || claim_m.mobility != PMAP_PFA_MOBILITY_UNMOVABLE
+                || claim_m.mover != PMAP_PFA_MOVER_NONE) {
+            result = -7;
+            goto out;
+        }
+    }
+
+    /* Every page must still be on the list, in order, and not in the claim */
+    tag = 0;
+    for (struct list_elem *e = list_begin(&l); e != list_end(&l);
+            e = list_next(e)) {
+        compaction_page_t cp = list_entry(e, struct compaction_page, elem);
+        addr = pmap_physmap_kva_to_pa((vm_addr_t)cp);
+
+        if (cp->tag != tag || (addr >= claim && addr < claim + size)) {
+            result = -8;
+            goto out;
+        }
+        tag++;
+    }
+
+    pmap_pfa_cma_release(claim, size);
+    claim = PHYS_ADDR_INVALID;
+    pmap_pfa_cma_get_stats(&after);
+    if (after.releases != before.releases + 1 || after.claimed_pages) {
+        result = -9;
+        goto out;
+    }
+
+out:
+    if (claim != PHYS_ADDR_INVALID) {
+        pmap_pfa_cma_release(claim, size);
+    }
+    while (!list_empty(&l)) {
+        compaction_page_t cp = list_entry(
+            list_pop_front(&l), struct compaction_page, elem
+        );
+        pmap_pfa_free_contig(pmap_physmap_kva_to_pa((vm_addr_t)cp), PAGE_SIZE);
+    }
+
+    if (!result && !state_matches_original()) {
+        result = -10;
+    }
+
+    return result;
+}
+
+static int mds_type_check(void) {
+    /*
+    Tests that the MDS type checker finds the first mismatched page wherever it
+    lies relative to the checker's vector chunks
+    */
+    static const page_id_t offsets[] = {
+        99, 64, 63, 33, 32, 31, 17, 16, 15, 1, 0
+    };
+    page_id_t count = 100;
+    pmap_page_metadata_s m = pfa_metadata_m;
+    bool freed[100] = { false };
+    phys_addr_t addr = PHYS_ADDR_INVALID;
+    page_id_t base = 0;
+    int result = 0;
+
+    m.page_type = PMAP_PAGE_TYPE_PAGE_TABLE;
+    addr = pmap_pfa_alloc_contig((size_t)count << PAGE_SHIFT, &m);
+    if (addr == PHYS_ADDR_INVALID) {
+        return -1;
+    }
+    base = addr >> PAGE_SHIFT;
+
+    /* Every length from every starting point matches */
+    for (page_id_t start = 0; start < 40; start++) {
+        for (page_id_t length = 0; start + length <= count; length += 7) {
+            if (pmap_pfa_mds_find_type_mismatch(base + start, length,
+                    PMAP_PAGE_TYPE_PAGE_TABLE) != PAGE_ID_INVALID) {
+                result = -2;
+                goto out;
+            }
+        }
+    }
+    pmap_pfa_mds_require_range_type(base, count, PMAP_PAGE_TYPE_PAGE_TABLE);
+
+    if (pmap_pfa_mds_find_type_mismatch(base, count,
+            PMAP_PAGE_TYPE_KERNEL_TEXT) != base) {
+        result = -3;
+        goto out;
+    }
+
+    /*
+    Freeing a page changes its type, so free pages from the back and check that
+    each one is now the first mismatch
+    */
+    for (size_t i = 0; i < COUNT_OF(offsets); i++) {
+        page_id_t page = base + offsets[i];
+        /* The previously freed page is the first mismatch after this one */
+        page_id_t next = i ? base + offsets[i - 1] : PAGE_ID_INVALID;
+
+        pmap_pfa_free_contig(addr + ((size_t)offsets[i] << PAGE_SHIFT),
+                             PAGE_SIZE);
+        freed[offsets[i]] = true;
+
+        if (pmap_pfa_mds_find_type_mismatch(base, count,
+                PMAP_PAGE_TYPE_PAGE_TABLE) != page
+            || pmap_pfa_mds_find_type_mismatch(page + 1,
+                base + count - page - 1, PMAP_PAGE_TYPE_PAGE_TABLE) != next) {
+            result = -4;
+            goto out;
+        }
+    }
+
+out:
+    for (page_id_t i = 0; i < count; i++) {
+        if (!freed[i]) {
+            pmap_pfa_free_contig(addr + ((size_t)i << PAGE_SHIFT), PAGE_SIZE);
+        }
+    }
+
+    if (!result && !state_matches_original()) {
+        result = -5;
+    }
+
+    return result;
+}
+
+static int mds_extended(void) {
+    /*
+    Tests the extended metadata accessors and that freed pages come back with
+    zeroed fields
+    */
+    phys_addr_t addr = PHYS_ADDR_INVALID;
+    page_id_t page = 0;
+    int result = 0;
+
+    addr = pmap_pfa_alloc_contig(4 * PAGE_SIZE, &pfa_metadata_m);
+    if (addr == PHYS_ADDR_INVALID) {
+        return -1;
+    }
+    page = (addr >> PAGE_SHIFT) + 2;
+
+    if (pmap_pfa_mds_refcount_get(page) || pmap_pfa_mds_mapcount_get(page)
+            || pmap_pfa_mds_owner_get(page)) {
+        result = -2;
+        goto out;
+    }
+
+    if (pmap_pfa_mds_refcount_inc(page) != 1
+            || pmap_pfa_mds_refcount_inc(page) != 2
+            || pmap_pfa_mds_refcount_dec(page) != 1
+            || pmap_pfa_mds_mapcount_inc(page) != 1
+            || pmap_pfa_mds_refcount_get(page) != 1
+            || pmap_pfa_mds_mapcount_get(page) != 1) {
+        result = -3;
+        goto out;
+    }
+
+    /* Fields are per page */
+    if (pmap_pfa_mds_refcount_get(page - 1)
+            || pmap_pfa_mds_refcount_get(page + 1)) {
+        result = -4;
+        goto out;
+    }
+
+    pmap_pfa_mds_owner_set(page, 0xCAFE);
+    if (pmap_pfa_mds_owner_cmpxchg(page, 0xBEEF, 0xF00D)
+            || !pmap_pfa_mds_owner_cmpxchg(page, 0xCAFE, 0xF00D)
+            || pmap_pfa_mds_owner_get(page) != 0xF00D) {
+        result = -5;
+        goto out;
+    }
+
+out:
+    pmap_pfa_free_contig(addr, 4 * PAGE_SIZE);
+
+    if (!result && (pmap_pfa_mds_refcount_get(page)
+            || pmap_pfa_mds_mapcount_get(page)
+            || pmap_pfa_mds_owner_get(page))) {
+        result = -6;
+    }
+
+    if (!result && !state_matches_original()) {
+        result = -7;
+    }
+
+    return result;
+}
+
+/** The number of interleaved readers and the number of steps they take */
+#define SEQLOCK_READERS     (16)
+#define SEQLOCK_STEPS       (20000)
+
+/** A simulated lockless MDS reader */
+struct seqlock_reader {
+    /** The page this reader owns and reads */
+    phys_addr_t addr;
+    /** True while a snapshot is in flight */
+    bool reading;
+    /** True if a write hit the snapshot's pageblock while it was in flight */
+    bool written;
+    page_id_t page;
+    uint32_t seq;
+    pmap_page_metadata_s m;
+};
+
+/** Returns true if A and B are in the same top level block */
+static bool same_pageblock(page_id_t a, page_id_t b) {
+    return (a >> (BUDDY_LEVELS - 1)) == (b >> (BUDDY_LEVELS - 1));
+}
+
+static int mds_seqlock(void) {
+    /*
+    Stresses the lockless MDS read protocol. Tests run on a single core, so we
+    interleave many readers with writers by hand: each step either starts a
+    reader's snapshot, finishes one, or replaces a page with one of another
+    type. A reader must retry if a write hit its pageblock while it was reading
+    and may only accept a snapshot which still matches the MDS.
+    */
+    struct seqlock_reader readers[SEQLOCK_READERS];
+    pmap_page_metadata_s m = pfa_metadata_m;
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    size_t accepted = 0;
+    size_t retried = 0;
+    int result = 0;
+
+    memset(readers, 0x00, sizeof(readers));
+    for (size_t i = 0; i < SEQLOCK_READERS; i++) {
+        readers[i].addr = PHYS_ADDR_INVALID;
+    }
+
+    for (size_t i = 0; i < SEQLOCK_READERS; i++) {
+        m.page_type = i % 3;
+        readers[i].addr = pmap_pfa_alloc_contig(PAGE_SIZE, &m);
+        if (readers[i].addr == PHYS_ADDR_INVALID) {
+            result = -1;
+            goto out;
+        }
+    }
+
+    for (size_t step_i = 0; step_i < SEQLOCK_STEPS; step_i++) {
+        uint64_t r = test_rand(&rng);
+        size_t reader_i = (r >> 8) % SEQLOCK_READERS;
+        struct seqlock_reader *reader = &readers[reader_i];
+
+        switch (r % 3) {
+            case 0:
+                if (reader->reading) {
+                    break;
+                }
+
+                reader->reading = true;
+                reader->written = false;
+                reader->page = reader->addr >> PAGE_SHIFT;
+                reader->seq = pmap_pfa_mds_read_begin(reader->page);
+                pmap_pfa_mds_get_metadata(reader->page, &reader->m);
+                break;
+
+            case 1: {
+                pmap_page_metadata_s current;
+
+                if (!reader->reading) {
+                    break;
+                }
+
+                reader->reading = false;
+                if (pmap_pfa_mds_read_retry(reader->page, reader->seq)) {
+                    retried++;
+                    break;
+                }
+
+                pmap_pfa_mds_get_metadata(reader->page, &current);
+                if (reader->written
+                        || memcmp(&current, &reader->m, sizeof(current))) {
+                    result = -2;
+                    goto out;
+                }
+                accepted++;
+                break;
+            }
+
+            case 2: {
+                page_id_t old_page = reader->addr >> PAGE_SHIFT;
+                page_id_t new_page = 0;
+
+                /* Both the free and the allocation write the MDS */
+                pmap_pfa_free_contig(reader->addr, PAGE_SIZE);
+                m.page_type = (r >> 32) % 3;
+                reader->addr = pmap_pfa_alloc_contig(PAGE_SIZE, &m);
+                if (reader->addr == PHYS_ADDR_INVALID) {
+                    result = -3;
+                    goto out;
+                }
+                new_page = reader->addr >> PAGE_SHIFT;
+
+                for (size_t i = 0; i < SEQLOCK_READERS; i++) {
+                    if (readers[i].reading 
+                            && (same_pageblock(readers[i].page, old_page)
+                            || same_pageblock(readers[i].page, new_page))) {
+                        readers[i].written = true;
+                    }
+                }
+                break;
+            }
+        }
+    }
+
+    /* Make sure both outcomes were actually exercised */
+    if (!accepted || !retried) {
+        result = -4;
+    }
+
+out:
+    for (size_t i = 0; i < SEQLOCK_READERS; i++) {
+        if (readers[i].addr != PHYS_ADDR_INVALID) {
+            pmap_pfa_free_contig(readers[i].addr, PAGE_SIZE);
+        }
+    }
+
+    if (!result && !state_matches_original()) {
+        result = -5;
+    }
+
+    return result;
+}
+
+/** Returns the number of samples in HISTOGRAM */
+static uint64_t histogram_total(const struct pmap_pfa_histogram *histogram) {
+    uint64_t total = 0;
+
+    for (unsigned int i = 0; i < PMAP_PFA_HISTOGRAM_BUCKETS; i++) {
+        total += histogram->buckets[i];
+    }
+
+    return total;
+}
+
+static int stats(void) {
+    /*
+    Tests that a single allocation and free are counted once in each histogram
+    and that the split and merge counters agree with their depth histograms
+    */
+    struct pmap_pfa_stats stats;
+    phys_addr_t addr = PHYS_ADDR_INVALID;
+    uint64_t splits = 0;
+    uint64_t split_blocks = 0;
+    uint64_t merges = 0;
+    uint64_t merge_blocks = 0;
+
+    /* 
+    Three pages are never cached by the magazines. Lazy frees don't merge, so
+    merge eagerly to have something to count.
+    */
+    pmap_pfa_lazy_set_enabled(false);
+    pmap_pfa_reset_stats();
+    addr = pmap_pfa_alloc_contig(3 * PAGE_SIZE, &pfa_metadata_m);
+    if (addr == PHYS_ADDR_INVALID) {
+        pmap_pfa_lazy_set_enabled(true);
+        return -1;
+    }
+    pmap_pfa_free_contig(addr, 3 * PAGE_SIZE);
+    pmap_pfa_get_stats(&stats);
+    pmap_pfa_lazy_set_enabled(true);
+
+    if (histogram_total(&stats.alloc_ticks) != 1
+            || histogram_total(&stats.free_ticks) != 1
+            || !histogram_total(&stats.lock_wait_ticks)
+            || histogram_total(&stats.lock_wait_ticks) 
+                != histogram_total(&stats.lock_hold_ticks)) {
+        return -2;
+    }
+
+    for (unsigned int level_i = 0; level_i < BUDDY_LEVELS; level_i++) {
+        splits += level_i * stats.split_depth[level_i];
+        split_blocks += stats.split_depth[level_i];
+        merges += level_i * stats.merge_depth[level_i];
+        merge_blocks += stats.merge_depth[level_i];
+    }
+
+    /* 
+    One block is taken for the allocation. The free is decomposed into a block
+    of two and a block of one, and the latter merges at least with the fourth
+    page which was trimmed off the allocation.
+    */
+    if (split_blocks != 1 || merge_blocks != 2 || merges < 1
+            || splits != stats.splits || merges != stats.merges) {
+        return -3;
+    }
+
+    if (!state_matches_original()) {
+        return -4;
+    }
+
+    return 0;
+}
+
+/** The order of the block the free summary test fragments */
+#define SUMMARY_ORDER   (MIN(4, PMAP_PFA_MAX_ORDER))
+
+/** Checks that SUMMARY is consistent with its own per-order counts */
+static bool summary_consistent(const struct pmap_pfa_free_summary *summary,
+                               unsigned int order) {
+    size_t free_pages = 0;
+    size_t usable = 0;
+    int largest_order = -1;
+
+    for (unsigned int level_i = 0; level_i < BUDDY_LEVELS; level_i++) {
+        size_t pages = summary->free_blocks[level_i] << level_i;
+
+        free_pages += pages;
+        if (level_i >= order) {
+            usable += pages;
+        }
+        if (summary->free_blocks[level_i]) {
+            largest_order = level_i;
+        }
+    }
+
+    if (summary->free_pages != free_pages
+            || summary->largest_order != largest_order) {
+        return false;
+    }
+
+    return free_pages 
+        ? summary->fragmentation == (free_pages - usable) 
+            * PMAP_PFA_FRAGMENTATION_SCALE / free_pages
+        : summary->fragmentation == 0;
+}
+
+static int free_summary(void) {
+    /*
+    Tests that the free summary agrees with the free lists and the zone
+    statistics, and that freeing every other page of a block shows up as
+    order zero blocks which are useless to larger requests
+    */
+    const size_t pages = (size_t)1 << SUMMARY_ORDER;
+    struct pmap_pfa_free_summary before;
+    struct pmap_pfa_free_summary after;
+    struct pmap_pfa_zone_stats zone;
+    size_t state[BUDDY_LEVELS];
+    size_t zone_free = 0;
+    phys_addr_t addr = PHYS_ADDR_INVALID;
+    int result = 0;
+
+    pmap_pfa_drain_caches();
+    pmap_pfa_get_free_summary(0, &before);
+    pmap_pfa_get_state(state, COUNT_OF(state));
+    for (unsigned int zone_i = 0; zone_i < PMAP_PFA_ZONE_COUNT; zone_i++) {
+        pmap_pfa_zone_get_stats(zone_i, &zone);
+        zone_free += zone.free_pages;
+    }
+
+    if (memcmp(before.free_blocks, state, sizeof(state))
+            || before.free_pages != zone_free 
+            || before.largest_order < 0
+            || before.fragmentation
+            || !summary_consistent(&before, 0)) {
+        return -1;
+    }
+
+    /* Aligned requests skip the magazines, so the block comes off the lists */
+    addr = pmap_pfa_alloc_aligned(
+        pages * PAGE_SIZE, pages * PAGE_SIZE, &pfa_metadata_m
+    );
+    if (addr == PHYS_ADDR_INVALID) {
+        return -2;
+    }
+
+    pmap_pfa_get_free_summary(SUMMARY_ORDER, &before);
+    if (!summary_consistent(&before, SUMMARY_ORDER)) {
+        result = -3;
+    }
+
+    /* The odd pages' buddies are still allocated, so none of them can merge */
+    for (size_t i = 1; i < pages; i += 2) {
+        pmap_pfa_free_contig(addr + i * PAGE_SIZE, PAGE_SIZE);
+    }
+    pmap_pfa_drain_caches();
+
+    pmap_pfa_get_free_summary(SUMMARY_ORDER, &after);
+    if (after.free_blocks[0] != before.free_blocks[0] + pages / 2
+            || after.free_pages != before.free_pages + pages / 2
+            || after.fragmentation < before.fragmentation
+            || !summary_consistent(&after, SUMMARY_ORDER)) {
+        result = -4;
+    }
+
+    for (size_t i = 0; i < pages; i += 2) {
+        pmap_pfa_free_contig(addr + i * PAGE_SIZE, PAGE_SIZE);
+    }
+
+    if (!result && !state_matches_original()) {
+        result = -5;
+    }
+
+    return result;
+}
+
+/** The number of pages the color test takes of each color */
+#define COLORED_PAGES_PER_COLOR (4)
+
+static int colored(void) {
+    /*
+    Tests that colored requests get their color (or each color in turn) with
+    their metadata applied, and that the pages held for them are given back
+    */
+    phys_addr_t addrs[PMAP_PFA_COLORS * COLORED_PAGES_PER_COLOR];
+    struct pmap_pfa_color_stats stats;
+    pmap_page_metadata_s m;
+    uint32_t colors_seen = 0;
+    int result = 0;
+
+    STATIC_ASSERT(PMAP_PFA_COLORS <= 32);
+    for (size_t i = 0; i < COUNT_OF(addrs); i++) {
+        unsigned int color = i % PMAP_PFA_COLORS;
+
+        addrs[i] = pmap_pfa_alloc_colored(color, &pfa_metadata_m);
+        if (addrs[i] == PHYS_ADDR_INVALID) {
+            return -1;
+        }
+
+        pmap_pfa_mds_get_metadata(addrs[i] >> PAGE_SHIFT, &m);
+        if (pmap_pfa_page_color(addrs[i]) != color
+                || m.page_type != pfa_metadata_m.page_type) {
+            result = -2;
+        }
+    }
+
+    pmap_pfa_color_get_stats(&stats);
+    if (!stats.enabled || !stats.refills || !stats.hits || stats.misses) {
+        result = -3;
+    }
+
+    for (size_t i = 0; i < COUNT_OF(addrs); i++) {
+        pmap_pfa_free_contig(addrs[i], PAGE_SIZE);
+    }
+
+    /* Consecutive round robin requests on one core cover every color */
+    for (size_t i = 0; i < PMAP_PFA_COLORS; i++) {
+        addrs[i] = pmap_pfa_alloc_colored(
+            PMAP_PFA_COLOR_NEXT, &pfa_metadata_m
+        );
+        if (addrs[i] == PHYS_ADDR_INVALID) {
+            return -4;
+        }
+
+        colors_seen |= 1U << pmap_pfa_page_color(addrs[i]);
+    }
+
+    if (colors_seen != (1ULL << PMAP_PFA_COLORS) - 1) {
+        result = -5;
+    }
+
+    for (size_t i = 0; i < PMAP_PFA_COLORS; i++) {
+        pmap_pfa_free_contig(addrs[i], PAGE_SIZE);
+    }
+
+    /* Disabling coloring gives back every held page but still allocates */
+    pmap_pfa_color_set_enabled(false);
+    pmap_pfa_color_get_stats(&stats);
+    for (size_t i = 0; i < PMAP_PFA_COLORS; i++) {
+        if (stats.cached[i]) {
+            result = -6;
+        }
+    }
+
+    addrs[0] = pmap_pfa_alloc_colored(0, &pfa_metadata_m);
+    if (addrs[0] == PHYS_ADDR_INVALID) {
+        result = -7;
+    } else {
+        pmap_pfa_free_contig(addrs[0], PAGE_SIZE);
+    }
+    pmap_pfa_color_set_enabled(true);
+
+    if (!result && !state_matches_original()) {
+        result = -8;
+    }
+
+    return result;
+}
+
+/** The number of pages the pressure test's cache holds when full */
+#define PRESSURE_CACHE_PAGES    (64)
+
+/** A cache of pages for the pressure test's shrinker to give back */
+static struct {
+    phys_addr_t pages[PRESSURE_CACHE_PAGES];
+    size_t count;
+} pressure_cache;
+
+static size_t pressure_shrink(size_t pages, void *context) {
+    size_t freed = 0;
+
+    (void)context;
+    while (freed < pages && pressure_cache.count) {
+        pmap_pfa_free_contig(
+            pressure_cache.pages[--pressure_cache.count], PAGE_SIZE
+        );
+        freed++;
+    }
+
+    return freed;
+}
+
+static const struct pmap_pfa_shrinker pressure_shrinker = {
+    .shrink = pressure_shrink,
+    .context = NULL,
+};
+
+/** Fills the pressure test's cache. Returns false if memory ran out. */
+static bool pressure_cache_fill(void) {
+    while (pressure_cache.count < PRESSURE_CACHE_PAGES) {
+        phys_addr_t addr = pmap_pfa_alloc_contig(PAGE_SIZE, &pfa_metadata_m);
+
+        if (addr == PHYS_ADDR_INVALID) {
+            return false;
+        }
+        pressure_cache.pages[pressure_cache.count++] = addr;
+    }
+
+    /* Only pages on the buddy lists count as free */
+    pmap_pfa_drain_caches();
+    return true;
+}
+
+static int pressure(void) {
+    /*
+    Tests that falling below the low watermark has the allocation which crossed
+    it and then idle cores shrink caches back up to the high watermark, and that
+    allocating below the min watermark or running out of memory has the
+    allocation shrink them itself
+    */
+    static bool registered = false;
+    struct pmap_pfa_pressure_stats original;
+    struct pmap_pfa_pressure_stats before;
+    struct pmap_pfa_pressure_stats stats;
+    struct pmap_pfa_zero_pool_stats zero_pool;
+    unsigned int other = (smp_get_cpu_id() + 1) % SMP_MAX_CPUS;
+    phys_addr_t addr = PHYS_ADDR_INVALID;
+    struct list l;
+    int result = 0;
+
+    if (!registered) {
+        pmap_pfa_register_shrinker(&pressure_shrinker);
+        registered = true;
+    }
+
+    /* Idle cores would otherwise take free pages for the zero pool */
+    pmap_pfa_zero_pool_get_stats(&zero_pool);
+    pmap_pfa_zero_pool_set_target(0);
+    pmap_pfa_pressure_get_stats(&original);
+
+    /* Let any reclaim left over from earlier tests finish */
+    pmap_pfa_pressure_set_watermarks(0, 0, 0);
+    while (idle_step());
+    pmap_pfa_pressure_get_stats(&before);
+
+    if (!pressure_cache_fill()) {
+        result = -1;
+        goto out;
+    }
+
+    /* Reclaim must leave what other cores have cached alone */
+    if (pmap_pfa_pcp_fill(other, 0, 1) != 1) {
+        result = -1;
+        goto out;
+    }
+
+    /* Ask for half the cache back once the next allocation crosses low */
+    pmap_pfa_pressure_get_stats(&stats);
+    pmap_pfa_pressure_set_watermarks(
+        0, stats.free_pages, stats.free_pages + PRESSURE_CACHE_PAGES / 2
+    );
+    if (pmap_pfa_get_pressure() != PMAP_PFA_PRESSURE_NONE) {
+        result = -2;
+        goto out;
+    }
+
+    /* The allocation which crosses starts reclaim before it returns */
+    addr = pmap_pfa_alloc_contig(3 * PAGE_SIZE, &pfa_metadata_m);
+    pmap_pfa_pressure_get_stats(&stats);
+    if (addr == PHYS_ADDR_INVALID
+            || stats.low_crossings != before.low_crossings + 1
+            || stats.async_runs == before.async_runs
+            || stats.pages_reclaimed == before.pages_reclaimed) {
+        result = -3;
+        goto out;
+    }
+    pmap_pfa_free_contig(addr, 3 * PAGE_SIZE);
+
+    /* Idle cores take it from there */
+    while (idle_step());
+    pmap_pfa_pressure_get_stats(&stats);
+    if (pressure_cache.count != PRESSURE_CACHE_PAGES / 2
+            || stats.level != PMAP_PFA_PRESSURE_NONE
+            || stats.low_crossings != before.low_crossings + 1
+            || stats.async_runs == before.async_runs
+            || stats.pages_reclaimed 
+                != before.pages_reclaimed + PRESSURE_CACHE_PAGES / 2) {
+        result = -4;
+        goto out;
+    }
+
+    if (pmap_pfa_pcp_fill(other, 0, 0) != 1) {
+        result = -5;
+        goto out;
+    }
+
+    /* Below the min watermark, allocations don't wait for idle cores */
+    pmap_pfa_pressure_set_watermarks(
+        stats.free_pages + 1, stats.free_pages + 1, stats.free_pages + 1
+    );
+    addr = pmap_pfa_alloc_contig(3 * PAGE_SIZE, &pfa_metadata_m);
+    if (addr == PHYS_ADDR_INVALID) {
+        result = -6;
+        goto out;
+    }
+    pmap_pfa_free_contig(addr, 3 * PAGE_SIZE);
+
+    pmap_pfa_pressure_get_stats(&stats);
+    if (pressure_cache.count || stats.direct_runs == before.direct_runs) {
+        result = -7;
+        goto out;
+    }
+
+    /* Running out of memory empties the cache before anything fails */
+    if (!pressure_cache_fill()) {
+        result = -8;
+        goto out;
+    }
+    pmap_pfa_pressure_set_watermarks(0, 0, 0);
+
+    list_init(&l);
+    while ((addr = pmap_pfa_alloc_contig(PAGE_SIZE, &pfa_metadata_m))
+            != PHYS_ADDR_INVALID) {
+        struct list_elem *elem = (struct list_elem *)pmap_pa_to_kva(addr);
+
+        list_push_front(&l, elem);
+    }
+
+    if (pressure_cache.count) {
+        result = -9;
+    }
+
+    while (!list_empty(&l)) {
+        struct list_elem *elem = list_pop_front(&l);
+
+        pmap_pfa_free_contig(
+            pmap_physmap_kva_to_pa((vm_addr_t)elem), PAGE_SIZE
+        );
+    }
+
+out:
+    pressure_shrink(PRESSURE_CACHE_PAGES, NULL);
+    pmap_pfa_pressure_set_watermarks(
+        original.min, original.low, original.high
+    );
+    pmap_pfa_zero_pool_set_target(zero_pool.target);
+
+    if (!result && !state_matches_original()) {
+        result = -10;
+    }
+
+    return result;
+}
+
 static struct test_case cases[] = {
     TEST_CASE(simple_sweep),
     TEST_CASE(multi_sweep),
     TEST_CASE(oom_sweep),
+#if PMAP_PFA_MAX_ORDER <= PMAP_PFA_ORDER_L2_BLOCK
+    TEST_CASE(large_sweep),
+    TEST_CASE(large_multi),
+    TEST_CASE(large_oom_sweep),
+    TEST_CASE(large_fragmented),
+#endif
+    TEST_CASE(pcp_watermarks),
+    TEST_CASE(pcp_remote),
+    TEST_CASE(batch_sweep),
+    TEST_CASE(batch_oom),
+    TEST_CASE(zero_pool),
+    TEST_CASE(order_alignment),
+    TEST_CASE(zones),
+    TEST_CASE(batch_flags),
+    TEST_CASE(arenas),
+    TEST_CASE(mobility),
+    TEST_CASE(compaction),
+    TEST_CASE(cma),
+    TEST_CASE(aligned),
+    TEST_CASE(mds_type_check),
+    TEST_CASE(mds_extended),
+    TEST_CASE(mds_seqlock),
+    TEST_CASE(stats),
+    TEST_CASE(free_summary),
+    TEST_CASE(colored),
+    TEST_CASE(pressure),
 };
 
 struct test_suite test_pmap_pfa = {
@@ -0,0 +1,349 @@
+#include "test_utils.h"
+#include "test_helpers.h"
+#include "core/vm/slab.h"
+#include "machine/pmap/pmap_pfa.h"
+#include "machine/smp/smp.h"
+#include "lib/list.h"
+
+/** Checks that OBJECT lies in a slab of CACHE */
+static bool
+object_in_cache(struct slab_cache *cache, void *object) {
+    page_id_t page = pmap_physmap_kva_to_pa((vm_addr_t)object) >> PAGE_SHIFT;
+    pmap_page_metadata_s m;
+
+    pmap_pfa_mds_get_metadata(page, &m);
+    return m.page_type == PMAP_PAGE_TYPE_SLAB
+        && slab_cache_for_object(object) == cache;
+}
+
+static int simple(void) {
+    struct slab_cache *cache = slab_cache_create("simple", 40, 0);
+    uint64_t *objects[100];
+
+    if (!cache) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < COUNT_OF(objects); i++) {
+        if (!(objects[i] = slab_alloc(cache))) {
+            return -2;
+        }
+
+        if (!object_in_cache(cache, objects[i])) {
+            return -3;
+        }
+
+        /* Objects must not overlap, so each can hold a distinct pattern */
+        memset(objects[i], i, 40);
+    }
+
+    for (unsigned int i = 0; i < COUNT_OF(objects); i++) {
+        uint8_t *bytes = (uint8_t *)objects[i];
+
+        for (unsigned int j = 0; j < 40; j++) {
+            if (bytes[j] != (uint8_t)i) {
+                return -4;
+            }
+        }
+        slab_free(cache, objects[i]);
+    }
+
+    slab_cache_destroy(cache);
+
+    if (!test_vm_state_matches_original()) {
+        return -5;
+    }
+
+    return 0;
+}
+
+static int packing(void) {
+    static const struct {
+        size_t size;
+        size_t align;
+        size_t object_size;
+    } expected[] = {
+        { 1, 0, 8 },
+        { 8, 0, 8 },
+        { 24, 0, 32 },
+        { 33, 0, SMP_CACHE_LINE_SIZE },
+        { SMP_CACHE_LINE_SIZE + 1, 0, SMP_CACHE_LINE_SIZE * 2 },
+        { 24, 16, 32 },
+        { 24, 256, 256 },
+        { SLAB_OBJECT_MAX, 0, SLAB_OBJECT_MAX },
+    };
+
+    for (unsigned int i = 0; i < COUNT_OF(expected); i++) {
+        struct slab_cache *cache = slab_cache_create(
+            "packing", expected[i].size, expected[i].align
+        );
+        struct slab_cache_stats stats;
+        void *objects[2 * SLAB_MAGAZINE_SIZE];
+        size_t line_mask = SMP_CACHE_LINE_SIZE - 1;
+
+        if (!cache) {
+            return -1;
+        }
+
+        slab_cache_get_stats(cache, &stats);
+        if (stats.object_size != expected[i].object_size) {
+            return -2;
+        }
+
+        /* At most an eighth of the slab goes to waste once it is big enough */
+        if (stats.order < SLAB_MAX_ORDER
+                && (PAGE_SIZE << stats.order)
+                    - stats.objects_per_slab * stats.object_size
+                    > (PAGE_SIZE << stats.order) / 8) {
+            return -3;
+        }
+
+        for (unsigned int j = 0; j < COUNT_OF(objects); j++) {
+            vm_addr_t addr = 0;
+
+            if (!(objects[j] = slab_alloc(cache))) {
+                return -4;
+            }
+
+            addr = (vm_addr_t)objects[j];
+            if (expected[i].align && addr % expected[i].align) {
+                return -5;
+            }
+
+            /* Packed small objects never straddle a cache line */
+            if (!expected[i].align
+                    && stats.object_size <= SMP_CACHE_LINE_SIZE
+                    && (addr & ~line_mask)
+                        != ((addr + expected[i].size - 1) & ~line_mask)) {
+                return -6;
+            }
+        }
+
+        for (unsigned int j = 0; j < COUNT_OF(objects); j++) {
+            slab_free(cache, objects[j]);
+        }
+        slab_cache_destroy(cache);
+    }
+
+    if (!test_vm_state_matches_original()) {
+        return -7;
+    }
+
+    return 0;
+}
+
+static int slab_lists(void) {
+    struct slab_cache *cache = slab_cache_create("slab_lists", 128, 0);
+    struct slab_cache_stats stats;
+    void *objects[256];
+    size_t per_slab = 0;
+    uint64_t destroyed = 0;
+
+    if (!cache) {
+        return -1;
+    }
+
+    slab_cache_get_stats(cache, &stats);
+    per_slab = stats.objects_per_slab;
+    if (per_slab * 3 > COUNT_OF(objects)) {
+        return -2;
+    }
+
+    /*
+    Three full slabs, once the magazine is back in the slabs. The last refill
+    may have spilled into a fourth slab, which is empty again after the drain.
+    */
+    for (unsigned int i = 0; i < per_slab * 3; i++) {
+        if (!(objects[i] = slab_alloc(cache))) {
+            return -3;
+        }
+    }
+    slab_drain_caches();
+    slab_shrink(SIZE_MAX);
+    slab_cache_get_stats(cache, &stats);
+    if (stats.slab_objects != per_slab * 3 || stats.magazine_objects
+            || stats.full_slabs != 3 || stats.partial_slabs
+            || stats.empty_slabs
+            || stats.slabs_created - stats.slabs_destroyed != 3) {
+        slab_dump();
+        return -4;
+    }
+    destroyed = stats.slabs_destroyed;
+
+    /* Freeing one object of each slab leaves them all partial */
+    for (unsigned int i = 0; i < 3; i++) {
+        slab_free(cache, objects[i * per_slab]);
+    }
+    slab_drain_caches();
+    slab_cache_get_stats(cache, &stats);
+    if (stats.full_slabs || stats.partial_slabs != 3 || stats.empty_slabs) {
+        slab_dump();
+        return -5;
+    }
+
+    /* Emptying every slab keeps SLAB_EMPTY_MAX of them */
+    for (unsigned int i = 0; i < per_slab * 3; i++) {
+        if (i % per_slab) {
+            slab_free(cache, objects[i]);
+        }
+    }
+    slab_drain_caches();
+    slab_cache_get_stats(cache, &stats);
+    if (stats.slab_objects || stats.full_slabs || stats.partial_slabs
+            || stats.empty_slabs != MIN(3, SLAB_EMPTY_MAX)
+            || stats.slabs_destroyed != destroyed + 3 - stats.empty_slabs) {
+        slab_dump();
+        return -6;
+    }
+
+    /* The shrinker gives the rest back */
+    if (slab_shrink(SIZE_MAX) < stats.empty_slabs << stats.order) {
+        return -7;
+    }
+    slab_cache_get_stats(cache, &stats);
+    if (stats.empty_slabs || stats.slabs_destroyed != destroyed + 3) {
+        return -8;
+    }
+
+    slab_cache_destroy(cache);
+
+    if (!test_vm_state_matches_original()) {
+        return -9;
+    }
+
+    return 0;
+}
+
+static int magazines(void) {
+    struct slab_cache *cache = slab_cache_create("magazines", 64, 0);
+    struct slab_cache_stats stats;
+    void *objects[SLAB_MAGAZINE_SIZE / 2];
+
+    if (!cache) {
+        return -1;
+    }
+
+    /* Churn within half a magazine never goes back to the slabs */
+    for (unsigned int round = 0; round < 1000; round++) {
+        for (unsigned int i = 0; i < COUNT_OF(objects); i++) {
+            if (!(objects[i] = slab_alloc(cache))) {
+                return -2;
+            }
+        }
+        for (unsigned int i = 0; i < COUNT_OF(objects); i++) {
+            slab_free(cache, objects[i]);
+        }
+    }
+
+    slab_cache_get_stats(cache, &stats);
+    if (stats.refills != 1 || stats.drains
+            || stats.allocs != 1000 * COUNT_OF(objects)
+            || stats.frees != stats.allocs
+            || stats.magazine_objects != COUNT_OF(objects)) {
+        slab_dump();
+        return -3;
+    }
+
+    /* The most recently freed object is handed out first */
+    objects[0] = slab_alloc(cache);
+    slab_free(cache, objects[0]);
+    if (slab_alloc(cache) != objects[0]) {
+        return -4;
+    }
+    slab_free(cache, objects[0]);
+
+    slab_cache_destroy(cache);
+
+    if (!test_vm_state_matches_original()) {
+        return -5;
+    }
+
+    return 0;
+}
+
+/**
+ * An object of the oom test, linked to the others it allocated. Objects are
+ * OOM_OBJECT_SIZE bytes so that filling memory takes a reasonable time.
+ */
+#define OOM_OBJECT_SIZE (512)
+struct oom_object {
+    struct list_elem elem;
+    uint64_t magic;
+};
+#define OOM_MAGIC (0x51AB51AB51AB51AB)
+
+static int oom(void) {
+    struct slab_cache *cache =
+        slab_cache_create("oom", OOM_OBJECT_SIZE, 0);
+    struct oom_object *object = NULL;
+    struct list l;
+    size_t count = 0;
+
+    if (!cache) {
+        return -1;
+    }
+
+    list_init(&l);
+    while ((object = slab_alloc(cache))) {
+        if (object->magic == OOM_MAGIC + count) {
+            /* Handed out twice?? */
+            return -2;
+        }
+        object->magic = OOM_MAGIC + count;
+        list_push_back(&l, &object->elem);
+        count++;
+    }
+
+    if (!count || slab_cache_for_object(list_entry(
+            list_front(&l), struct oom_object, elem)) != cache) {
+        return -3;
+    }
+
+    while (!list_empty(&l)) {
+        object = list_entry(list_pop_front(&l), struct oom_object, elem);
+        slab_free(cache, object);
+    }
+
+    slab_cache_destroy(cache);
+
+    if (!test_vm_state_matches_original()) {
+        return -4;
+    }
+
+    return 0;
+}
+
+static int not_slab(void) {
+    pmap_page_metadata_s m;
+    phys_addr_t pa = PHYS_ADDR_INVALID;
+
+    memset(&m, 0x00, sizeof(m));
+    m.page_type = PMAP_PAGE_TYPE_KERNEL_DATA;
+    if ((pa = pmap_pfa_alloc_contig(PAGE_SIZE, &m)) == PHYS_ADDR_INVALID) {
+        return -1;
+    }
+
+    if (slab_cache_for_object((void *)pmap_pa_to_kva(pa + 64))) {
+        return -2;
+    }
+    pmap_pfa_free_contig(pa, PAGE_SIZE);
+
+    return 0;
+}
+
+static struct test_case cases[] = {
+    TEST_CASE(simple),
+    TEST_CASE(packing),
+    TEST_CASE(slab_lists),
+    TEST_CASE(magazines),
+    TEST_CASE(oom),
+    TEST_CASE(not_slab),
+};
+
+struct test_suite test_slab = {
+    .name = "slab",
+    .setup_function = test_vm_setup,
+    .teardown_function = NULL,
+    .cases = cases,
+    .cases_count = COUNT_OF(cases)
+};
@@ -3,9 +3,24 @@
 #include "test_utils.h"
 
 extern struct test_suite test_pmap_pfa;
+extern struct test_suite bench_pmap_pfa;
+extern struct test_suite test_slab;
+extern struct test_suite test_kmalloc;
+extern struct test_suite bench_kmalloc;
 
 test_suite_t suites[] = {
     &test_pmap_pfa,
+    &test_slab,
+    &test_kmalloc,
+};
+
+/**
+ * Benchmarks take a while and check little, so they only run when asked for:
+ * see the TESTING_BENCHMARKS CMake option. pfa_host_tests runs them by name.
+ */
+test_suite_t bench_suites[] = {
+    &bench_pmap_pfa,
+    &bench_kmalloc,
 };
 
 